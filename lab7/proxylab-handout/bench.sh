@@ -0,0 +1,429 @@
+#!/bin/bash
+#
+# bench.sh - load benchmarks for the proxy, with tiny as the origin.
+#
+#     Concurrency: for each concurrency model of the proxy, warms the
+#     cache with one fetch and drives it with loadgen at increasing
+#     numbers of concurrent clients, printing connections/sec and
+#     latency percentiles.
+#
+#     Workers: sweeps the worker pool size of thread mode (-T -w) at a
+#     fixed number of clients, against one thread per connection (-w 0).
+#
+#     Throughput: fetches a godzilla.jpg sized object and multi-MB files
+#     through the proxy, relaying responses too big to cache with splice
+#     and with plain copies (-C), printing MB/s.
+#
+#     Resolver: fetches a file too big to cache, so every request makes a
+#     new connection to tiny and resolves its name, with the resolver
+#     cache and with a blocking getaddrinfo per connection (-R), printing
+#     connections/sec and the proxy's resolver counters (SIGUSR1).
+#
+#     Disk: fetches DISK_FILES files, far more than the memory cache holds,
+#     through a proxy with a new disk tier (-D), restarts it and fetches
+#     them again from the warm tier, printing connections/sec, how long
+#     the restart took to scan the tier, how many fetches still went to
+#     tiny (flight leaders) and how many reads of the tier an event loop
+#     handed to a reader thread. Then crashes the proxy (kill -9)
+#     in the middle of a run, tears the end of a segment and damages a
+#     record in another, restarts it and checks every file it serves
+#     against the original.
+#
+#     Coalescing: has a client fetch a COALESCE_MB MB file slowly through
+#     the proxy, so COALESCE_CONNS others asking for it meanwhile follow
+#     its fetch, then kills that first client mid-response. Then has
+#     as many others ask for one MB-aligned byte range each of a slow
+#     fetch in progress. Prints how many of the followers still got the
+#     file, and the range, intact and the flight counters.
+#
+#     Tunnel: serves tiny's files over TLS with openssl s_server, a local
+#     stand-in for an HTTPS origin with a throwaway certificate, and has
+#     TUNNEL_CONNS curls fetch the 32 MB file through CONNECT tunnels of
+#     the proxy in each concurrency model, and straight from the server,
+#     printing MB/s and how many of the files came through intact.
+#
+#     Compression: fetches COMPRESS_FILES text files, cut from the sources
+#     of the proxy, with Zipf popularity through a cache that holds a part
+#     of them as received: stored as received (-Z 0), stored gzip and
+#     inflated for clients without gzip, and sent coded to clients taking
+#     it (loadgen -g). Prints requests/sec, the hits, what the cache takes
+#     against what it would take uncompressed, and the mean time spent
+#     compressing a response and inflating a hit.
+#
+#     usage: ./bench.sh [requests]
+#
+
+REQUESTS=${1:-20000}
+CONNS_LIST="10 100 1000 4000"
+FETCH_FILE="home.html"
+
+# Proxy command lines to compare for concurrency
+MODELS=("-T" "")
+MODEL_NAMES=("thread-per-connection" "event loops")
+
+# Worker pool sizes to sweep, and the clients driving them
+WORKERS_LIST="0 4 16 64 256"
+WORKERS_CONNS=256
+
+# Files and request counts for throughput, sizes in MB (0: godzilla.jpg)
+SIZES=(0 1 8 32)
+SIZE_REQS=(2000 400 50 12)
+RELAYS=("" "-C")
+RELAY_NAMES=("splice" "copy")
+
+# Proxy command lines to compare for name resolution
+RESOLVERS=("" "-R")
+RESOLVER_NAMES=("resolver cache" "getaddrinfo")
+RESOLVE_REQS=400
+
+# Files of DISK_KB KB for the disk tier, and the clients fetching them
+DISK_FILES=200
+DISK_KB=48
+DISK_CONNS=8
+
+# File of COALESCE_MB MB fetched by a slow client at COALESCE_RATE and
+# the clients following its fetch, through a cache that takes it
+COALESCE_MB=64
+COALESCE_RATE=4M
+COALESCE_CONNS=8
+
+# Proxy command lines to compare for tunnels, and the fetches over each
+TUNNELS=("" "-T")
+TUNNEL_NAMES=("event loops" "thread mode")
+TUNNEL_CONNS=4
+TUNNEL_REQS=4
+
+# Text files of COMPRESS_KB KB and the cache they go through, the proxy and
+# loadgen arguments to compare and the requests of each
+COMPRESS_FILES=400
+COMPRESS_KB=24
+COMPRESS_CACHE=4m
+COMPRESSIONS=("-Z 0" "" "")
+COMPRESS_CLIENTS=("" "" "-g")
+COMPRESS_NAMES=("as received" "gzip, identity clients" "gzip, gzip clients")
+COMPRESS_REQS=20000
+
+HOME_DIR=`pwd`
+PROXY_LOG=`mktemp`
+DISK_DIR=`mktemp -d`
+TLS_DIR=`mktemp -d`
+
+#
+# wait_for_port - spins until something listens on TCP port $1
+#
+function wait_for_port {
+    for i in `seq 1 50`
+    do
+        netstat --numeric-ports --numeric-hosts -ln --protocol=inet \
+            | grep -q ":${1} " && return
+        sleep 0.1
+    done
+    echo "Error: nothing listens on port ${1}"
+    exit 1
+}
+
+#
+# start_proxy - starts the proxy with arguments $@ on a free port, which is
+#     left in proxy_port, its output goes to PROXY_LOG
+#
+function start_proxy {
+    proxy_port=`bash ./free-port.sh`
+    ./proxy "$@" ${proxy_port} &> ${PROXY_LOG} &
+    proxy_pid=$!
+    wait_for_port ${proxy_port}
+}
+
+#
+# stop_proxy - kills the proxy started last
+#
+function stop_proxy {
+    kill ${proxy_pid}
+    wait ${proxy_pid} 2> /dev/null
+}
+
+#
+# cleanup - kills tiny and removes the generated files
+#
+function cleanup {
+    kill ${tiny_pid} ${tls_pid} 2> /dev/null
+    rm -f ${PROXY_LOG}
+    rm -rf ${DISK_DIR} ${TLS_DIR} ./tiny/bench-disk ./tiny/bench-text
+    for size in ${SIZES[@]}
+    do
+        rm -f ./tiny/bench-${size}m.bin
+    done
+    rm -f ./tiny/bench-coalesce.bin
+}
+
+#
+# tunnel_fetch - TUNNEL_CONNS curls fetching the 32 MB file from the TLS
+#     server TUNNEL_REQS times each, with the curl arguments $@, and the
+#     MB/s of all of them together
+#
+function tunnel_fetch {
+    local pids="" start=`date +%s.%N` secs intact
+    for c in `seq 1 ${TUNNEL_CONNS}`
+    do
+        for r in `seq 1 ${TUNNEL_REQS}`
+        do
+            curl -sk --max-time 60 "$@" \
+                https://localhost:${tls_port}/bench-32m.bin \
+                | cmp -s - ./tiny/bench-32m.bin && echo intact
+        done > ${TLS_DIR}/fetched.${c} &
+        pids="${pids} $!"
+    done
+    wait ${pids}
+    secs=`awk "BEGIN { print \`date +%s.%N\` - ${start} }"`
+    intact=`cat ${TLS_DIR}/fetched.* | wc -l`
+    awk "BEGIN { printf \"    %d of %d intact, secs %.2f MB/s %.1f\\n\", \
+        ${intact}, ${TUNNEL_CONNS} * ${TUNNEL_REQS}, ${secs}, \
+        ${TUNNEL_CONNS} * ${TUNNEL_REQS} * 32 / ${secs} }"
+}
+
+ulimit -n 65536 2> /dev/null
+make -s proxy loadgen || exit 1
+
+for size in ${SIZES[@]}
+do
+    [ ${size} != 0 ] && head -c $((size * 1048576)) /dev/urandom \
+        > ./tiny/bench-${size}m.bin
+done
+mkdir -p ./tiny/bench-disk
+for i in `seq 1 ${DISK_FILES}`
+do
+    head -c $((DISK_KB * 1024)) /dev/urandom > ./tiny/bench-disk/${i}.bin
+done
+
+tiny_port=`bash ./free-port.sh`
+cd ./tiny
+./tiny ${tiny_port} &> /dev/null &
+tiny_pid=$!
+cd ${HOME_DIR}
+wait_for_port ${tiny_port}
+trap cleanup EXIT
+
+echo "****** Concurrency ******"
+for m in ${!MODELS[@]}
+do
+    start_proxy ${MODELS[$m]}
+    url="http://localhost:${tiny_port}/${FETCH_FILE}"
+
+    echo "*** ${MODEL_NAMES[$m]} (proxy ${MODELS[$m]}) ***"
+    ./loadgen -c 1 -n 1 localhost ${proxy_port} ${url} > /dev/null
+    for conns in ${CONNS_LIST}
+    do
+        echo "${conns} clients:"
+        ./loadgen -c ${conns} -n ${REQUESTS} localhost ${proxy_port} ${url} \
+            | sed 's/^/    /'
+    done
+
+    stop_proxy
+done
+
+echo "****** Workers ******"
+for workers in ${WORKERS_LIST}
+do
+    start_proxy -T -w ${workers}
+    url="http://localhost:${tiny_port}/${FETCH_FILE}"
+
+    echo "*** ${workers} workers (proxy -T -w ${workers}) ***"
+    ./loadgen -c 1 -n 1 localhost ${proxy_port} ${url} > /dev/null
+    ./loadgen -c ${WORKERS_CONNS} -n ${REQUESTS} localhost ${proxy_port} \
+        ${url} | sed 's/^/    /'
+
+    stop_proxy
+done
+
+echo "****** Throughput ******"
+for r in ${!RELAYS[@]}
+do
+    start_proxy ${RELAYS[$r]}
+
+    echo "*** ${RELAY_NAMES[$r]} relay (proxy ${RELAYS[$r]}) ***"
+    for s in ${!SIZES[@]}
+    do
+        if [ ${SIZES[$s]} == 0 ]; then
+            file="godzilla.jpg"
+        else
+            file="bench-${SIZES[$s]}m.bin"
+        fi
+        echo "${file}:"
+        ./loadgen -c 4 -n ${SIZE_REQS[$s]} localhost ${proxy_port} \
+            "http://localhost:${tiny_port}/${file}" | sed 's/^/    /'
+    done
+
+    stop_proxy
+done
+
+echo "****** Resolver ******"
+for r in ${!RESOLVERS[@]}
+do
+    start_proxy ${RESOLVERS[$r]}
+
+    echo "*** ${RESOLVER_NAMES[$r]} (proxy ${RESOLVERS[$r]}) ***"
+    ./loadgen -c 4 -n ${RESOLVE_REQS} localhost ${proxy_port} \
+        "http://localhost:${tiny_port}/bench-1m.bin" | sed 's/^/    /'
+    kill -USR1 ${proxy_pid}
+    sleep 0.2
+    grep '^dns' ${PROXY_LOG} | sed 's/^/    /'
+
+    stop_proxy
+done
+
+echo "****** Disk ******"
+for i in `seq 1 ${DISK_FILES}`
+do
+    echo "http://localhost:${tiny_port}/bench-disk/${i}.bin"
+done > ${DISK_DIR}/urls
+for run in "cold" "warm"
+do
+    start_proxy -D ${DISK_DIR}/tier
+
+    echo "*** ${run} start (proxy -D) ***"
+    grep '^disk:' ${PROXY_LOG} | sed 's/^/    /'
+    ./loadgen -c ${DISK_CONNS} -n ${DISK_FILES} localhost ${proxy_port} \
+        @${DISK_DIR}/urls | sed 's/^/    /'
+    kill -USR1 ${proxy_pid}
+    sleep 0.2
+    grep -E '^(flight_leaders|disk_(hits|parked)) ' ${PROXY_LOG} \
+        | sed 's/^/    /'
+
+    stop_proxy #SIGTERM, the cache is saved to the tier
+done
+
+echo "*** crash (proxy -D, kill -9) ***"
+start_proxy -D ${DISK_DIR}/tier
+./loadgen -c ${DISK_CONNS} -n $((DISK_FILES * 5)) localhost ${proxy_port} \
+    @${DISK_DIR}/urls > /dev/null &
+loadgen_pid=$!
+sleep 0.5
+kill -9 ${proxy_pid}
+wait ${proxy_pid} ${loadgen_pid} 2> /dev/null
+segs=(`ls ${DISK_DIR}/tier`)
+truncate -s -1000 ${DISK_DIR}/tier/${segs[${#segs[@]}-1]}
+printf 'XXXX' | dd of=${DISK_DIR}/tier/${segs[0]} bs=1 seek=100000 \
+    conv=notrunc 2> /dev/null
+start_proxy -D ${DISK_DIR}/tier
+grep '^disk' ${PROXY_LOG} | sed 's/^/    /'
+intact=0
+for i in `seq 1 ${DISK_FILES}`
+do
+    curl -s --max-time 5 --proxy http://localhost:${proxy_port} \
+        http://localhost:${tiny_port}/bench-disk/${i}.bin \
+        | cmp -s - ./tiny/bench-disk/${i}.bin && intact=$((intact + 1))
+done
+kill -USR1 ${proxy_pid}
+sleep 0.2
+grep '^disk_hits ' ${PROXY_LOG} | sed 's/^/    /'
+echo "    ${intact} of ${DISK_FILES} responses intact"
+stop_proxy
+
+echo "****** Coalescing ******"
+head -c $((COALESCE_MB * 1048576)) /dev/urandom > ./tiny/bench-coalesce.bin
+start_proxy -S $((COALESCE_MB * 2))m -O $((COALESCE_MB * 2))m
+url="http://localhost:${tiny_port}/bench-coalesce.bin"
+
+echo "*** leader client killed mid-response ***"
+curl -s --limit-rate ${COALESCE_RATE} --proxy http://localhost:${proxy_port} \
+    ${url} > /dev/null &
+leader_pid=$!
+sleep 0.5
+pids=""
+for c in `seq 1 ${COALESCE_CONNS}`
+do
+    { curl -s --max-time 30 --proxy http://localhost:${proxy_port} ${url} \
+        | cmp -s - ./tiny/bench-coalesce.bin && echo intact; } \
+        > ${DISK_DIR}/followed.${c} &
+    pids="${pids} $!"
+done
+sleep 0.5
+kill ${leader_pid}
+wait ${pids}
+intact=`cat ${DISK_DIR}/followed.* | wc -l`
+echo "    ${intact} of ${COALESCE_CONNS} followers intact"
+kill -USR1 ${proxy_pid}
+sleep 0.2
+grep '^flight_' ${PROXY_LOG} | sed 's/^/    /'
+stop_proxy
+
+echo "*** followers asking for byte ranges ***"
+start_proxy -S $((COALESCE_MB * 2))m -O $((COALESCE_MB * 2))m
+curl -s --limit-rate ${COALESCE_RATE} --proxy http://localhost:${proxy_port} \
+    ${url} > /dev/null &
+leader_pid=$!
+sleep 0.5
+pids=""
+for c in `seq 1 ${COALESCE_CONNS}`
+do
+    first=$((c * 1048576))
+    { curl -s --max-time 30 -r ${first}-$((first + 65535)) \
+        --proxy http://localhost:${proxy_port} ${url} \
+        | cmp -s - <(tail -c +$((first + 1)) ./tiny/bench-coalesce.bin \
+                     | head -c 65536) && echo intact; } \
+        > ${DISK_DIR}/ranged.${c} &
+    pids="${pids} $!"
+done
+wait ${pids}
+kill ${leader_pid}
+intact=`cat ${DISK_DIR}/ranged.* | wc -l`
+echo "    ${intact} of ${COALESCE_CONNS} ranges intact"
+kill -USR1 ${proxy_pid}
+sleep 0.2
+grep -E '^(flight_followers|range_hits) ' ${PROXY_LOG} | sed 's/^/    /'
+stop_proxy
+
+echo "****** Tunnel ******"
+openssl req -x509 -newkey rsa:2048 -nodes -subj /CN=localhost -days 1 \
+    -keyout ${TLS_DIR}/key.pem -out ${TLS_DIR}/cert.pem &> /dev/null
+tls_port=`bash ./free-port.sh`
+cd ./tiny
+openssl s_server -4 -quiet -WWW -accept ${tls_port} -cert ${TLS_DIR}/cert.pem \
+    -key ${TLS_DIR}/key.pem &> /dev/null &
+tls_pid=$!
+cd ${HOME_DIR}
+wait_for_port ${tls_port}
+
+echo "*** direct ***"
+tunnel_fetch
+for t in ${!TUNNELS[@]}
+do
+    start_proxy ${TUNNELS[$t]}
+
+    echo "*** ${TUNNEL_NAMES[$t]} (proxy ${TUNNELS[$t]}) ***"
+    tunnel_fetch --proxy http://localhost:${proxy_port}
+    kill -USR1 ${proxy_pid}
+    sleep 0.2
+    grep -E '^(tunnels|bytes_tunneled)' ${PROXY_LOG} | sed 's/^/    /'
+
+    stop_proxy
+done
+
+echo "****** Compression ******"
+mkdir -p ./tiny/bench-text
+cat ./*.c ./tiny/*.c > ${DISK_DIR}/corpus
+corpus=`stat -c %s ${DISK_DIR}/corpus`
+for i in `seq 1 ${COMPRESS_FILES}`
+do
+    off=$(( i * 7919 % (corpus - COMPRESS_KB * 1024) ))
+    tail -c +$((off + 1)) ${DISK_DIR}/corpus | head -c $((COMPRESS_KB * 1024)) \
+        > ./tiny/bench-text/${i}.txt
+    echo "http://localhost:${tiny_port}/bench-text/${i}.txt"
+done > ${DISK_DIR}/text-urls
+for c in ${!COMPRESSIONS[@]}
+do
+    start_proxy -S ${COMPRESS_CACHE} ${COMPRESSIONS[$c]}
+
+    echo "*** ${COMPRESS_NAMES[$c]} (proxy -S ${COMPRESS_CACHE}" \
+         "${COMPRESSIONS[$c]}, loadgen ${COMPRESS_CLIENTS[$c]}) ***"
+    ./loadgen -k -c 16 -n ${COMPRESS_FILES} localhost ${proxy_port} \
+        @${DISK_DIR}/text-urls > /dev/null
+    ./loadgen -k ${COMPRESS_CLIENTS[$c]} -c 64 -n ${COMPRESS_REQS} -z 0.9 \
+        localhost ${proxy_port} @${DISK_DIR}/text-urls | sed 's/^/    /'
+    kill -USR1 ${proxy_pid}
+    sleep 0.2
+    grep -E -e '^cache_(hits|misses|bytes|plain_bytes) ' \
+        -e '^(gzip_(stored|skipped)|latency_(gzip|gunzip)_mean_us) ' \
+        ${PROXY_LOG} | sed 's/^/    /'
+
+    stop_proxy
+done
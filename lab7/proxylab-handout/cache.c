@@ -1,156 +1,893 @@
-/****************************************************************************** 
- * 
+/******************************************************************************
+ *
  * Proxy lab
  * Min Xu
  * andrewID: minxu
  *
  * This is an LRU cache for caching web contents forwarded back from servers
- * to clients. It is implementd by a FIFO queue using doubly linked list. Total
- * cache size is 1 MB and single web data size is 1 KB. Anything larger than 
- * 1 KB will not be cached. If cache size exceeds 1 MB, the leaset recently 
- * used content will be replaced. 
- * 
+ * to clients. It is split into CACHE_SHARDS shards by a 64 bit FNV-1a hash
+ * of the URL. Each shard has a chained hash table for O(1) lookups and a
+ * FIFO queue using doubly linked list for its LRU order, both protected by
+ * the shard's own readers-writers locks. Total cache size (1 MB unless
+ * given) and the largest object cached (100 KB) are set by initCache.
+ * The total size is shared by all shards: if it exceeds the total, the 
+ * least recently used content of the inserting shard is replaced, then 
+ * that of the other shards in turn. Objects are reference counted: a 
+ * replaced object leaves the cache at once, but is only freed after the
+ * last hit that returned it has been released with releaseObj. Payloads
+ * are lists of chunks of a memfd slab twice the cache size, leaving room
+ * for objects still being received and evicted objects still being sent,
+ * and the cache size counts whole chunks, the memory objects really take.
+ * A miss takes chunks one at a time with growCache as the response comes
+ * in, the proxy reads it straight into them, then commitCache inserts 
+ * the object.
+ * The order of each shard is kept by the eviction policy (policy.c), and
+ * with TinyLFU admission a full cache only takes an object that has been
+ * asked for more often than the victim it would replace.
+ *
+ * Hits do not take the write lock of their shard to move the object to
+ * the head. Each thread notes the hashes of its hits in a buffer of 
+ * PROMOTE_BATCH and applies them in order once it is full, or before it 
+ * inserts and so evicts, taking a shard's write lock once for a run of
+ * hits on it. Only the hashes are kept, so nothing is pinned while 
+ * waiting: an object that left meanwhile is simply not found, and one of
+ * another URL with the same 64 bit hash gets a promotion it did not earn.
+ *
+ * With a disk tier (disk.c) evicted objects are queued to be written to
+ * it instead of just dropped, and a miss looks there before giving up,
+ * reading the object back into a reservation and caching it again.
+ *
+ * Split per node (splitCache), every node has a slab whose pages come 
+ * from its own memory and CACHE_SHARDS / nnodes of the shards. A response
+ * is received into the slab of the node its thread runs on and stored in
+ * that node's shard of its URL, so a thread on the same node finds it 
+ * without touching another node's memory. Lookups try the own node first,
+ * then the others: a URL stored elsewhere is still a hit, only remote.
+ * Storing a URL removes its copies on other nodes, one shard locked at a
+ * time, so two nodes storing it at once may briefly both have it. The 
+ * total size is still shared, eviction goes across nodes. Each slab has
+ * twice the cache size, like the only one: an address range, its pages
+ * are only taken as they are written.
+ *
  * ***************************************************************************/
 
 #include "csapp.h"
 #include "cache.h"
+#include "policy.h"
+#include "disk.h"
+
+#define PROMOTE_BATCH 32 //hits buffered per thread before promoting
+#define INIT_BUCKETS 16 //initial hash buckets per shard, power of 2
 
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
-#define APPROX_LRU 1 //for enabling approximate LRU cache
+/* function prototypes */
+static unsigned long hashUrl(char *url);
+static void readLock(shard *sh);
+static void readUnlock(shard *sh);
+static object *findObj(shard *sh, char *inurl, unsigned long hash);
+static void unlinkObj(shard *sh, object *obj);
+static void freeObj(object *obj);
+static object *holdObj(object *obj);
+static void makeRoom(queue *cacheQueue, shard *sh, size_t want);
+static size_t popCache(queue *cacheQueue, shard *sh);
+static int admitObj(queue *cacheQueue, shard *sh, unsigned long hash);
+static void notePromote(queue *cacheQueue, shard *sh, unsigned long hash);
+static object *lookShard(queue *cacheQueue, shard *sh, char *inurl, \
+                                                       unsigned long hash);
+static void dropOld(queue *cacheQueue, shard *sh, char *inurl, \
+                                                  unsigned long hash);
+static void drainPromote();
+static object *loadDisk(queue *cacheQueue, char *inurl);
+static int imageObj(int fd, object *obj);
 
-/* initCache - initialize the cache in the heap */
-queue *initCache() {
+/* promoteBuf is struct for the hits of one thread not promoted yet. It
+ * has the cache they belong to, their hashes in order and the shard of
+ * each */
+typedef struct promoteBuf {
+	queue *cache;
+	int n;
+	unsigned long hashes[PROMOTE_BATCH];
+	unsigned char shards[PROMOTE_BATCH];
+} promoteBuf;
+
+static __thread promoteBuf promotes;
+
+/* initCache - initialize the cache of maxSize bytes in the heap, caching
+ * objects of up to maxObject bytes, evicting by policy (LRU if NULL) and 
+ * filtering new objects with TinyLFU if admit is set */
+queue *initCache(policyOps *policy, int admit, size_t maxSize, \
+                                                      size_t maxObject) {
 
 	queue *init = (queue *)Calloc(1, sizeof(queue));
+	int i;
 
-	init->head = 0;
-	init->tail = 0;
+	for(i = 0; i < CACHE_SHARDS; i++) {
+		shard *sh = &init->shards[i];
+		sh->head = 0;
+		sh->tail = 0;
+		sh->nbuckets = INIT_BUCKETS;
+		sh->buckets = (object **)Calloc(INIT_BUCKETS, sizeof(object *));
+		sh->nobjs = 0;
+		sh->readcnt = 0;
+		Sem_init(&(sh->readSem), 0, 1);
+		Sem_init(&(sh->writeSem), 0, 1);
+	}
+	if(maxObject > maxSize) //could never be cached
+		maxObject = maxSize;
+	if((init->payloads[0] = initSlab(2 * maxSize)) == NULL) {
+		Free(init);
+		return NULL;
+	}
+	init->nnodes = 1;
+	init->nodeShards = CACHE_SHARDS;
 	init->cacheSize = 0;
-	init->readcnt = 0;
-	Sem_init(&(init->readSem), 0, 1);
-	Sem_init(&(init->writeSem), 0, 1);
+	init->maxSize = maxSize;
+	init->maxObject = maxObject;
+	init->evictCursor = 0;
+	init->policy = policy ? policy : &lruPolicy;
+	init->admit = admit ? initSketch() : NULL;
+	init->recency = RECENCY_BATCHED;
 
 	return init;
 }
 
-/* pushCache - based on given indata and inurl, allocate a new cache object 
- * store it in the cache as the new head, remove LRU object if neccessary
- * in order to have enough cache space */
+/* splitCache - split the cache of initCache over nnodes nodes (up to 
+ * TOPO_MAX_NODES and CACHE_SHARDS), right after initCache: a slab bound
+ * to each node's memory and a group of the shards each. return -1 if a
+ * slab cannot be made, the cache stays whole then */
+int splitCache(queue *cacheQueue, int nnodes) {
+	int i;
+
+	if(nnodes < 2)
+		return 0;
+	if(nnodes > TOPO_MAX_NODES)
+		nnodes = TOPO_MAX_NODES;
+	for(i = 1; i < nnodes; i++) {
+		cacheQueue->payloads[i] = initSlab(2 * cacheQueue->maxSize);
+		if(cacheQueue->payloads[i] == NULL)
+			return -1;
+	}
+	for(i = 0; i < nnodes; i++) {
+		slab *sl = cacheQueue->payloads[i];
+		if(topoBind(sl->base, sl->size, i) < 0)
+			fprintf(stderr, "cannot bind the cache slab of node %d\n", i);
+	}
+	cacheQueue->nnodes = nnodes;
+	cacheQueue->nodeShards = CACHE_SHARDS / nnodes;
+	return 0;
+}
+
+/* chunkNode - the node whose slab chunk c is of */
+static inline int chunkNode(queue *cacheQueue, chunk *c) {
+	int i;
+
+	for(i = 1; i < cacheQueue->nnodes; i++) {
+		if(slabOwns(cacheQueue->payloads[i], c))
+			return i;
+	}
+	return 0;
+}
+
+/* chunkSlab - the slab chunk c is of, for sendChunks */
+slab *chunkSlab(queue *cacheQueue, chunk *c) {
+	return cacheQueue->payloads[chunkNode(cacheQueue, c)];
+}
+
+/* homeNode - the node of the calling thread, 0 if the cache is whole */
+static inline int homeNode(queue *cacheQueue) {
+	return cacheQueue->nnodes > 1 ? topoNode() % cacheQueue->nnodes : 0;
+}
+
+/* shardOf - the shard of hash among those of node */
+static inline shard *shardOf(queue *cacheQueue, unsigned long hash, \
+                                                         int node) {
+	return &cacheQueue->shards[node * cacheQueue->nodeShards + 
+	                           hash % cacheQueue->nodeShards];
+}
+
+/* hashUrl - 64 bit FNV-1a hash of the url string. low bits pick the shard,
+ * the bits above them the bucket */
+static unsigned long hashUrl(char *url) {
+	unsigned long hash = 14695981039346656037UL;
+
+	while(*url) {
+		hash ^= (unsigned char)*url++;
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+/* bucketOf - index of the bucket of hash in shard sh */
+static inline size_t bucketOf(shard *sh, unsigned long hash) {
+	return (hash / CACHE_SHARDS) & (sh->nbuckets - 1);
+}
+
+/* growBuckets - double the hash buckets of shard sh and rehash,
+ * called with the shard write locked */
+static void growBuckets(shard *sh) {
+	size_t oldn = sh->nbuckets, i;
+	object **old = sh->buckets, *curr, *next;
+
+	sh->nbuckets = oldn * 2;
+	sh->buckets = (object **)Calloc(sh->nbuckets, sizeof(object *));
+	for(i = 0; i < oldn; i++) {
+		for(curr = old[i]; curr != NULL; curr = next) {
+			next = curr->hnext;
+			curr->hnext = sh->buckets[bucketOf(sh, curr->hash)];
+			sh->buckets[bucketOf(sh, curr->hash)] = curr;
+		}
+	}
+	Free(old);
+}
+
+/* makeRoom - pop objects until the cache size is at most want: the
+ * own shard sh first, then the others in turn. only one shard is locked
+ * at a time, so callers on different shards cannot deadlock */
+static void makeRoom(queue *cacheQueue, shard *sh, size_t want) {
+	shard *victim = sh;
+	size_t freed;
+	int empty = 0;
+
+	while(cacheQueue->cacheSize > want && empty < CACHE_SHARDS) {
+		P(&victim->writeSem);
+		freed = popCache(cacheQueue, victim);
+		V(&victim->writeSem);
+		if(freed) {
+			__sync_sub_and_fetch(&cacheQueue->cacheSize, freed);
+			empty = 0;
+			continue;
+		}
+		empty++; //nothing left in victim, move on to the next shard
+		victim = &cacheQueue->shards[__sync_fetch_and_add(
+		                 &cacheQueue->evictCursor, 1) % CACHE_SHARDS];
+	}
+}
+
+/* pushCache - based on given indata and inurl, copy the data into the slab
+ * and store it as a new cache object, see commitCache. without headers
+ * there is nothing to tell its freshness, it is stale from the start */
 void pushCache(char *indata, size_t dataSize, char *inurl, size_t urlSize, \
                                                            queue *cacheQueue) {
+	chunkList cl = { NULL, NULL, 0 };
+	object *obj;
 
-	P(&cacheQueue->writeSem); //lock writers
+	if(appendCache(&cl, indata, dataSize, cacheQueue) < 0) {
+		cancelCache(&cl, cacheQueue);
+		return;
+	}
+	obj = commitCache(&cl, inurl, urlSize, 0, 0, 0, 0, cacheQueue);
+	if(obj != NULL)
+		releaseObj(obj);
+	else
+		cancelCache(&cl, cacheQueue);
+}
+
+/* takeChunk - take a chunk of the slab sl, evicting LRU objects if the
+ * slab is full. return NULL if there is no room anyway */
+static chunk *takeChunk(queue *cacheQueue, slab *sl) {
+	chunk *c;
+	int tries;
 
-	while(dataSize + cacheQueue->cacheSize > MAX_CACHE_SIZE) {
-		popCache(cacheQueue); //pop cached objects until cache is big enough
+	for(tries = 0; tries < CACHE_SHARDS; tries++) {
+		if((c = slabAlloc(sl)) != NULL)
+			return c;
+		if(cacheQueue->cacheSize == 0)
+			break;
+		//free the slab by shrinking the cache, pinned objects stay
+		makeRoom(cacheQueue, &cacheQueue->shards[tries],
+		         cacheQueue->cacheSize - cacheQueue->cacheSize / 8);
 	}
+	return NULL;
+}
+
+/* growCache - where the next bytes of the response received into cl go,
+ * with room for *room bytes there: the rest of its last chunk or a new 
+ * one. return NULL if it would grow past the largest object or there is
+ * no room in the slab, then the response is just not cached. all chunks
+ * of cl are of one slab, that of the node of the thread taking the first */
+char *growCache(chunkList *cl, size_t *room, queue *cacheQueue) {
+	size_t used = cl->size % CHUNK_SIZE;
+	slab *sl;
+	chunk *c;
+
+	if(cl->size >= cacheQueue->maxObject)
+		return NULL;
+	if(cl->tail == NULL || (used == 0 && cl->size > 0)) { //full, add one
+		sl = cl->head != NULL ? chunkSlab(cacheQueue, cl->head) :
+		                        cacheQueue->payloads[homeNode(cacheQueue)];
+		if((c = takeChunk(cacheQueue, sl)) == NULL)
+			return NULL;
+		if(cl->tail != NULL)
+			cl->tail->next = c;
+		else
+			cl->head = c;
+		cl->tail = c;
+		used = 0;
+	}
+	*room = CHUNK_SIZE - used;
+	if(*room > cacheQueue->maxObject - cl->size)
+		*room = cacheQueue->maxObject - cl->size;
+	return cl->tail->data + used;
+}
+
+/* appendCache - copy n bytes of buf to the end of cl. return -1 if they
+ * do not fit, 0 otherwise */
+int appendCache(chunkList *cl, char *buf, size_t n, queue *cacheQueue) {
+	size_t room, part;
+	char *ptr;
+
+	while(n > 0) {
+		if((ptr = growCache(cl, &room, cacheQueue)) == NULL)
+			return -1;
+		part = n < room ? n : room;
+		memcpy(ptr, buf, part);
+		cl->size += part;
+		buf += part;
+		n -= part;
+	}
+	return 0;
+}
+
+/* fillCache - give cl the chunks for size more bytes, to be filled by the
+ * caller. return -1 if they do not fit, 0 otherwise */
+int fillCache(chunkList *cl, size_t size, queue *cacheQueue) {
+	size_t room;
+
+	while(size > 0) {
+		if(growCache(cl, &room, cacheQueue) == NULL)
+			return -1;
+		if(room > size)
+			room = size;
+		cl->size += room;
+		size -= room;
+	}
+	return 0;
+}
+
+/* cancelCache - give back the chunks of a response that will not be
+ * cached */
+void cancelCache(chunkList *cl, queue *cacheQueue) {
+	if(cl->head != NULL)
+		slabFree(chunkSlab(cacheQueue, cl->head), cl->head);
+	cl->head = cl->tail = NULL;
+	cl->size = 0;
+}
+
+/* commitCache - based on given data received into the chunks of cl,
+ * inurl, the size of its headers, its framing, the size of its body
+ * before it was compressed (0 if it is not) and until when it is fresh,
+ * store a new cache object as the new head of its shard, remove LRU
+ * objects if neccessary in order to have enough cache space. an older
+ * object of the same url is replaced, on any node. the object lives on
+ * the node of its chunks. return the new object held for the caller, see
+ * releaseObj, which owns the chunks now, or NULL if the admission filter
+ * keeps it out. the chunks are still the caller's then */
+object *commitCache(chunkList *cl, char *inurl, size_t urlSize, \
+                    size_t hdrSize, int framing, size_t plainSize, \
+                    time_t expires, queue *cacheQueue) {
+
+	unsigned long hash = hashUrl(inurl);
+	int node = cl->head != NULL ? chunkNode(cacheQueue, cl->head) : 0, i;
+	shard *sh = shardOf(cacheQueue, hash, node);
+	size_t bytes = chunkBytes(cl->size); //what it takes of the cache
+
+	/* our own hits count before we evict anything */
+	if(promotes.cache == cacheQueue)
+		drainPromote();
+
+	/* a full cache only takes it if it is worth its victim */
+	if(cacheQueue->admit != NULL && 
+	   cacheQueue->cacheSize + bytes > cacheQueue->maxSize &&
+	   !admitObj(cacheQueue, sh, hash))
+		return NULL;
+
+	/* reserve the space first, then pop objects until the cache is small
+	 * enough */
+	__sync_add_and_fetch(&cacheQueue->cacheSize, bytes);
+	makeRoom(cacheQueue, sh, cacheQueue->maxSize);
 
 	/* allocate memory for new object pointer */
 	object *newObj = (object *)Calloc(1, sizeof(object));
 
-	/* allocate memory for data and url and copy them */
-	newObj->data = (char *)Calloc(1, dataSize); 
+	/* data is already in the slab, allocate memory for url and copy it */
+	newObj->chunks = cl->head;
+	newObj->dslab = cacheQueue->payloads[node];
+	newObj->node = node;
 	newObj->durl = (char *)Calloc(1, urlSize);
-	memcpy(newObj->data, indata, dataSize);
-	memcpy(newObj->durl, inurl, urlSize); 
-	newObj->dsize = dataSize; 
-	
-	//increment cache size
-	cacheQueue->cacheSize += newObj->dsize;
-
-	/* insert as the new head */
-	newObj->prev = NULL;
-	newObj->next = cacheQueue->head;
-
-	/* configure the head and tail of the queue */
-	if(cacheQueue->head == NULL) { // if this is the first object
-		cacheQueue->head = newObj;
-		cacheQueue->tail = newObj;
-	}
-	else { //already a head object
-		cacheQueue->head->prev = newObj;
-		cacheQueue->head = newObj;
-	}
-	
-	V(&cacheQueue->writeSem); //unlock writers
-}
-
-/* popCache - remove the tail object of the cache
- * popCache does not need mutex lock since it is only called
- * during pushCache and lock is already in place */
-void popCache(queue *cacheQueue) {
-	object *temp = cacheQueue->tail;
-	
-	//decrement cache size
-	cacheQueue->cacheSize -= temp->dsize;
-	
-	//set the new tail, free the old tail
-	cacheQueue->tail = cacheQueue->tail->prev;
-	cacheQueue->tail->next = NULL;
-	Free(temp->data);
-	Free(temp->durl);
-	Free(temp);
+	memcpy(newObj->durl, inurl, urlSize);
+	newObj->dsize = cl->size;
+	newObj->hsize = hdrSize;
+	newObj->framing = framing;
+	newObj->plainSize = plainSize;
+	newObj->expires = expires;
+	newObj->hash = hash;
+	newObj->refcnt = 2; //reference of the cache itself and the caller
+	__sync_add_and_fetch(&cacheQueue->plainBytes, objPlainBytes(newObj));
+
+	/* copies of the url on the other nodes are older */
+	for(i = 1; i < cacheQueue->nnodes; i++) {
+		shard *other = shardOf(cacheQueue, hash, (node + i) % 
+		                                         cacheQueue->nnodes);
+		P(&other->writeSem);
+		dropOld(cacheQueue, other, inurl, hash);
+		V(&other->writeSem);
+	}
+
+	P(&sh->writeSem); //lock writers
+
+	/* replace an older copy of the same url */
+	dropOld(cacheQueue, sh, inurl, hash);
+
+	if(sh->nobjs >= sh->nbuckets) //keep chains short
+		growBuckets(sh);
+
+	/* insert in its bucket */
+	size_t b = bucketOf(sh, hash);
+	newObj->hnext = sh->buckets[b];
+	sh->buckets[b] = newObj;
+	sh->nobjs++;
+
+	/* the policy puts it in order, as the new head for LRU */
+	cacheQueue->policy->insert(sh, newObj);
+
+	V(&sh->writeSem); //unlock writers
+	return newObj;
+}
+
+/* dropOld - remove the object of inurl from shard sh if there is one, an
+ * older copy being replaced. called with the shard write locked */
+static void dropOld(queue *cacheQueue, shard *sh, char *inurl, \
+                                                  unsigned long hash) {
+	object *old = findObj(sh, inurl, hash);
+
+	if(old == NULL)
+		return;
+	unlinkObj(sh, old);
+	cacheQueue->policy->remove(sh, old);
+	__sync_sub_and_fetch(&cacheQueue->cacheSize, chunkBytes(old->dsize));
+	__sync_sub_and_fetch(&cacheQueue->plainBytes, objPlainBytes(old));
+	releaseObj(old);
+}
+
+/* unlinkObj - remove obj from the hash bucket of shard sh, the policy
+ * takes it out of its order. called with the shard write locked */
+static void unlinkObj(shard *sh, object *obj) {
+	object **pp = &sh->buckets[bucketOf(sh, obj->hash)];
+
+	while(*pp != obj)
+		pp = &(*pp)->hnext;
+	*pp = obj->hnext;
+	sh->nobjs--;
+}
+
+/* admitObj - TinyLFU, whether the object of hash has been looked up more
+ * often than the next victim of shard sh. an empty shard evicts from the
+ * others, then it is admitted */
+static int admitObj(queue *cacheQueue, shard *sh, unsigned long hash) {
+	object *victim;
+	int admit = 1;
+
+	P(&sh->writeSem);
+	if((victim = cacheQueue->policy->victim(sh)) != NULL)
+		admit = sketchEstimate(cacheQueue->admit, hash) >
+		        sketchEstimate(cacheQueue->admit, victim->hash);
+	V(&sh->writeSem);
+	return admit;
+}
+
+/* freeObj - free an object and give its chunks back to the slab */
+static void freeObj(object *obj) {
+	slabFree(obj->dslab, obj->chunks);
+	Free(obj->durl);
+	Free(obj);
+}
+
+/* holdObj - take a reference on obj if not null, called with the shard
+ * locked so obj cannot be released by the cache meanwhile */
+static object *holdObj(object *obj) {
+	if(obj != NULL)
+		__sync_add_and_fetch(&obj->refcnt, 1);
+	return obj;
+}
+
+/* retainObj - take another reference on an object already held */
+object *retainObj(object *obj) {
+	__sync_add_and_fetch(&obj->refcnt, 1);
+	return obj;
+}
+
+/* refreshObj - a held object was revalidated, it is fresh until expires.
+ * readers see the old time or the new one, both are whole */
+void refreshObj(object *obj, time_t expires) {
+	__atomic_store_n(&obj->expires, expires, __ATOMIC_RELAXED);
+}
+
+/* releaseObj - drop a reference on obj taken by searchCache, free the
+ * object once it has been evicted and no hit is using it anymore */
+void releaseObj(object *obj) {
+	if(__sync_sub_and_fetch(&obj->refcnt, 1) == 0)
+		freeObj(obj);
+}
+
+/* sendObj - send n bytes of the data of a held object from offset off to
+ * fd straight from the slab, see sendChunks. return the bytes sent or -1
+ * on error */
+ssize_t sendObj(int fd, object *obj, size_t off, size_t n) {
+	return sendChunks(fd, obj->dslab, obj->chunks, off, n);
+}
+
+/* sendChunks - send n bytes from offset off of the data in the chunks
+ * starting at c to fd with sendfile, one call for each run of chunks that
+ * follow each other in the slab, or with writes from the mapping if the
+ * slab cannot punch out freed chunks. return the bytes sent or -1 on
+ * error */
+ssize_t sendChunks(int fd, slab *sl, chunk *c, size_t off, size_t n) {
+	size_t sent = 0, start, len;
+	chunk *last;
+
+	for(; off >= CHUNK_SIZE; off -= CHUNK_SIZE) //skip to the first one
+		c = c->next;
+	while(sent < n) {
+		/* the run of adjacent chunks from c */
+		start = slabOffset(sl, c) + off;
+		len = CHUNK_SIZE - off;
+		for(last = c; len < n - sent && last->next != NULL &&
+		    last->next->data == last->data + CHUNK_SIZE; last = last->next)
+			len += CHUNK_SIZE;
+		if(len > n - sent)
+			len = n - sent;
+		if(!slabPunches(sl)) {
+			if(Rio_writen(fd, sl->base + start, len) != len)
+				return -1;
+		}
+		else if(Rio_sendfile(fd, sl->fd, start, len) != len) {
+			return -1;
+		}
+		sent += len;
+		c = last->next;
+		off = 0;
+	}
+	return sent;
+}
+
+/* copyChunks - copy n bytes from offset off of the data in the chunks
+ * starting at c to buf, return n */
+size_t copyChunks(chunk *c, size_t off, char *buf, size_t n) {
+	size_t done = 0, part;
+
+	for(; off >= CHUNK_SIZE; off -= CHUNK_SIZE)
+		c = c->next;
+	while(done < n) {
+		part = CHUNK_SIZE - off < n - done ? CHUNK_SIZE - off : n - done;
+		memcpy(buf + done, c->data + off, part);
+		done += part;
+		c = c->next;
+		off = 0;
+	}
+	return n;
+}
+
+/* popCache - remove the victim of the policy from shard sh (the tail for
+ * LRU) and drop the cache's reference, or spill it to the disk tier. 
+ * return the cache size it took or 0 if the shard is empty. popCache does
+ * not take the lock, makeRoom holds the shard's write lock around it */
+static size_t popCache(queue *cacheQueue, shard *sh) {
+	object *temp = cacheQueue->policy->victim(sh);
+	size_t size;
+
+	if(temp == NULL)
+		return 0;
+
+	size = chunkBytes(temp->dsize);
+	__sync_sub_and_fetch(&cacheQueue->plainBytes, objPlainBytes(temp));
+	sh->evictions++;
+	unlinkObj(sh, temp);
+	cacheQueue->policy->evict(sh, temp);
+	if(cacheQueue->disk != NULL) //the cache's reference goes to the tier
+		diskSpill(cacheQueue->disk, temp, 0);
+	else
+		releaseObj(temp);
+	return size;
+}
+
+/* findObj - look for object with the same url string in shard sh,
+ * comparing hashes before strings. called with the shard locked */
+static object *findObj(shard *sh, char *inurl, unsigned long hash) {
+	object *curr = sh->buckets[bucketOf(sh, hash)];
+
+	while(curr != NULL) { //go through the bucket
+		if(curr->hash == hash && !strcmp(curr->durl, inurl))
+			break;
+		curr = curr->hnext;
+	}
+	return curr;
+}
+
+/* readLock - first readers-writers, lock shard sh for read only */
+static void readLock(shard *sh) {
+	P(&sh->readSem);
+	sh->readcnt++;
+	if(sh->readcnt == 1) //first in
+		P(&sh->writeSem);
+	V(&sh->readSem);
+}
+
+/* readUnlock - first readers-writers, unlock shard sh */
+static void readUnlock(shard *sh) {
+	P(&sh->readSem);
+	sh->readcnt--;
+	if(sh->readcnt == 0) //last out
+		V(&sh->writeSem);
+	V(&sh->readSem);
 }
 
 /* searchCache - look for object with the same url string, return the
- * object if found, return null otherwise. this object will be the MRU 
- * object, which will be set as the new head */
+ * object if found, return null otherwise. the hit is told to the policy,
+ * for LRU this object will be the MRU object, which will be set as the 
+ * new head of its shard, right away or with the next batch of promotions
+ * of this thread. every lookup is counted for admission. split per node,
+ * the shard of the url on the node of the calling thread is looked in
+ * first. a miss is looked up in the disk tier if there is one */
 object *searchCache(char *inurl, queue *cacheQueue) {
-	
-	/* first readers-writers, lock for read only */
-	P(&cacheQueue->readSem);
-	cacheQueue->readcnt++;
-	if(cacheQueue->readcnt == 1) //first in  
-		P(&cacheQueue->writeSem);
-	V(&cacheQueue->readSem);
-	
-	object *curr = cacheQueue->head; //start from the head
-
-	while(curr != NULL) { //go through the queue
-		if(!strcmp(curr->durl, inurl)) //if found url, break
-			break;
-		curr = curr->next;
-	}
-	
-	/* first readers-writers, unlock */
-	P(&cacheQueue->readSem);
-	cacheQueue->readcnt--;
-	if(cacheQueue->readcnt == 0) //last out 
-		V(&cacheQueue->writeSem);
-	V(&cacheQueue->readSem);
-	
-	/* if APPROX_LRU enabled, this will be approximately LRU
-	 * but enbale true concorrent reading in this function */
-	if(APPROX_LRU) { 
+	unsigned long hash = hashUrl(inurl);
+	int home = homeNode(cacheQueue), i;
+	object *curr = NULL;
+
+	if(cacheQueue->admit != NULL)
+		sketchAdd(cacheQueue->admit, hash);
+
+	for(i = 0; i < cacheQueue->nnodes && curr == NULL; i++)
+		curr = lookShard(cacheQueue, shardOf(cacheQueue, hash,
+		                 (home + i) % cacheQueue->nnodes), inurl, hash);
+	if(curr == NULL && cacheQueue->disk != NULL)
+		curr = loadDisk(cacheQueue, inurl);
+	return curr;
+}
+
+/* lookShard - look for the object of inurl in shard sh for searchCache,
+ * return it held or null */
+static object *lookShard(queue *cacheQueue, shard *sh, char *inurl, \
+                                                       unsigned long hash) {
+	object *curr;
+
+	/* exact order the old way, lock for writers, need to modify the 
+	 * queue. this serializes all readers of the shard */
+	if(cacheQueue->recency == RECENCY_LOCKED) {
+		P(&sh->writeSem);
+		if((curr = holdObj(findObj(sh, inurl, hash))) != NULL)
+			cacheQueue->policy->touch(sh, curr);
+		V(&sh->writeSem);
 		return curr;
 	}
-	else { //if APPROX_LRU not enabled, this will be the true LRU cache 
-		/* lock for writers, need to modify the queue */
-		P(&cacheQueue->writeSem);
 
-		if(curr == NULL) { //path not found, return null
-			V(&cacheQueue->writeSem);
-			return NULL;
+	/* otherwise concurrent reading, the hit is only noted. counted hits
+	 * are credited by the policies when the object is a victim */
+	readLock(sh);
+	if((curr = holdObj(findObj(sh, inurl, hash))) != NULL &&
+	   cacheQueue->recency == RECENCY_COUNT)
+		__sync_fetch_and_add(&curr->hits, 1);
+	readUnlock(sh);
+
+	if(curr != NULL && cacheQueue->recency == RECENCY_BATCHED)
+		notePromote(cacheQueue, sh, hash);
+	return curr;
+}
+
+/* notePromote - note a hit on the object of hash in shard sh for 
+ * promotion, and promote the batch if it is full */
+static void notePromote(queue *cacheQueue, shard *sh, unsigned long hash) {
+	if(promotes.cache != cacheQueue) { //another cache, finish with that one
+		drainPromote();
+		promotes.cache = cacheQueue;
+	}
+	promotes.shards[promotes.n] = sh - cacheQueue->shards;
+	promotes.hashes[promotes.n++] = hash;
+	if(promotes.n == PROMOTE_BATCH)
+		drainPromote();
+}
+
+/* drainPromote - promote the noted hits of this thread in order, taking
+ * the write lock of a shard once for a run of hits on it */
+static void drainPromote() {
+	queue *cacheQueue = promotes.cache;
+	unsigned long hash;
+	object *obj;
+	shard *sh;
+	int i = 0;
+
+	while(i < promotes.n) {
+		sh = &cacheQueue->shards[promotes.shards[i]];
+		P(&sh->writeSem);
+		do {
+			hash = promotes.hashes[i++];
+			for(obj = sh->buckets[bucketOf(sh, hash)];
+			    obj != NULL && obj->hash != hash; obj = obj->hnext)
+				;
+			if(obj != NULL)
+				cacheQueue->policy->touch(sh, obj);
+		} while(i < promotes.n && 
+		        &cacheQueue->shards[promotes.shards[i]] == sh);
+		V(&sh->writeSem);
+	}
+	promotes.n = 0;
+}
+
+/* loadDisk - read the object of inurl back from the disk tier into the
+ * slab and cache it again, return it held like a hit or NULL if it is not
+ * on disk, there is no room or it is damaged */
+static object *loadDisk(queue *cacheQueue, char *inurl) {
+	chunkList cl = { NULL, NULL, 0 };
+	diskHit hit;
+	object *obj;
+
+	if(diskFind(cacheQueue->disk, inurl, &hit) < 0)
+		return NULL;
+	if(fillCache(&cl, hit.rec.dataSize, cacheQueue) < 0) {
+		diskRelease(cacheQueue->disk, &hit);
+		cancelCache(&cl, cacheQueue);
+		return NULL;
+	}
+	if(diskRead(cacheQueue->disk, &hit, cl.head) < 0) {
+		cancelCache(&cl, cacheQueue);
+		return NULL;
+	}
+
+	obj = commitCache(&cl, inurl, strlen(inurl) + 1, hit.rec.hdrSize,
+	                  hit.rec.framing, hit.rec.plainSize, hit.rec.expires,
+	                  cacheQueue);
+	if(obj == NULL)
+		cancelCache(&cl, cacheQueue);
+	else
+		obj->fromDisk = 1; //its record is still there, not written again
+	return obj;
+}
+
+/* spillCache - write every cached object to the disk tier and wait until
+ * it is durable, so a restart finds all of the cache. objects stay cached,
+ * those read back from disk are only written if their record is gone */
+void spillCache(queue *cacheQueue) {
+	shard *sh;
+	object *obj;
+	size_t b;
+	int i;
+
+	if(cacheQueue->disk == NULL)
+		return;
+	for(i = 0; i < CACHE_SHARDS; i++) {
+		sh = &cacheQueue->shards[i];
+		readLock(sh);
+		for(b = 0; b < sh->nbuckets; b++) {
+			for(obj = sh->buckets[b]; obj != NULL; obj = obj->hnext)
+				diskSpill(cacheQueue->disk, holdObj(obj), 1);
 		}
+		readUnlock(sh);
+	}
+	diskSync(cacheQueue->disk);
+}
 
-		if(curr != cacheQueue->head) { //if not the head, bring it to head
-			//configure the neighbours of curr
-			if(curr->next != NULL)
-				curr->next->prev = curr->prev;
-			//curr's prev has to be non-null since it is not the head
-			curr->prev->next = curr->next;
-		
-			//bring it as the new head
-			curr->prev = NULL;
-			curr->next = cacheQueue->head;
-			cacheQueue->head->prev = curr;
-			cacheQueue->head = curr;
-		} 
-
-		/* unlock for writers */
-		V(&cacheQueue->writeSem);
-
-		return cacheQueue->head; 
+/* saveCache - write every cached object to fd as an image for loadCache,
+ * those of each shard from the next to be evicted on, so loading them in
+ * turn rebuilds their order for LRU (SLRU's protected segment after its
+ * probation segment, GDSF in heap order). a record is the diskRecord 
+ * header of the disk tier without checksums, the image never leaves 
+ * memory, the URL and the response. return the number of objects, or -1
+ * on write error */
+long saveCache(queue *cacheQueue, int fd) {
+	shard *sh;
+	object *obj;
+	size_t h;
+	long n = 0;
+	int i, rc = 0;
+
+	for(i = 0; i < CACHE_SHARDS && rc == 0; i++) {
+		sh = &cacheQueue->shards[i];
+		readLock(sh);
+		for(obj = sh->tail; obj != NULL && rc == 0; obj = obj->prev, n++)
+			rc = imageObj(fd, obj);
+		for(obj = sh->ptail; obj != NULL && rc == 0; obj = obj->prev, n++)
+			rc = imageObj(fd, obj);
+		for(h = 0; h < sh->heapLen && rc == 0; h++, n++)
+			rc = imageObj(fd, sh->heap[h]);
+		readUnlock(sh);
+	}
+	return rc < 0 ? -1 : n;
+}
+
+/* imageObj - write the record of obj to the image on fd. return -1 on
+ * write error, 0 otherwise */
+static int imageObj(int fd, object *obj) {
+	diskRecord rec;
+	chunk *c;
+	size_t left, part;
+
+	memset(&rec, 0, sizeof(diskRecord));
+	rec.magic = DISK_MAGIC;
+	rec.urlSize = strlen(obj->durl) + 1;
+	rec.dataSize = obj->dsize;
+	rec.hdrSize = obj->hsize;
+	rec.framing = obj->framing;
+	rec.plainSize = obj->plainSize;
+	rec.expires = obj->expires;
+	if(rio_writen(fd, &rec, sizeof(diskRecord)) != sizeof(diskRecord) ||
+	   rio_writen(fd, obj->durl, rec.urlSize) != rec.urlSize)
+		return -1;
+	for(c = obj->chunks, left = obj->dsize; left > 0; c = c->next) {
+		part = left < CHUNK_SIZE ? left : CHUNK_SIZE;
+		if(rio_writen(fd, c->data, part) != part)
+			return -1;
+		left -= part;
+	}
+	return 0;
+}
+
+/* loadCache - cache the objects of the image saveCache wrote to fd, in 
+ * its order. it is read up to a record of another layout (a proxy built
+ * with another DISK_MAGIC wrote it) or cut short. objects that do not fit
+ * are skipped. return the number of objects cached */
+long loadCache(queue *cacheQueue, int fd) {
+	char url[MAXLINE];
+	chunkList cl;
+	diskRecord rec;
+	object *obj;
+	chunk *c;
+	size_t left, part;
+	long n = 0;
+
+	while(rio_readn(fd, &rec, sizeof(diskRecord)) == sizeof(diskRecord) &&
+	      rec.magic == DISK_MAGIC && rec.urlSize > 0 &&
+	      rec.urlSize <= MAXLINE &&
+	      rio_readn(fd, url, rec.urlSize) == rec.urlSize) {
+		url[rec.urlSize - 1] = '\0';
+		cl.head = cl.tail = NULL;
+		cl.size = 0;
+		if(fillCache(&cl, rec.dataSize, cacheQueue) < 0) {
+			cancelCache(&cl, cacheQueue);
+			if(lseek(fd, rec.dataSize, SEEK_CUR) < 0)
+				break;
+			continue;
+		}
+		for(c = cl.head, left = rec.dataSize; left > 0; c = c->next) {
+			part = left < CHUNK_SIZE ? left : CHUNK_SIZE;
+			if(rio_readn(fd, c->data, part) != part)
+				break;
+			left -= part;
+		}
+		if(left > 0) { //cut short
+			cancelCache(&cl, cacheQueue);
+			break;
+		}
+		obj = commitCache(&cl, url, rec.urlSize, rec.hdrSize, rec.framing,
+		                  rec.plainSize, rec.expires, cacheQueue);
+		if(obj == NULL) {
+			cancelCache(&cl, cacheQueue);
+			continue;
+		}
+		releaseObj(obj);
+		n++;
 	}
+	return n;
+}
+
+/* cacheEvictions - objects evicted from all shards so far, for the stats.
+ * each shard's count only changes under its write lock, a scrape reads
+ * them without taking it */
+unsigned long cacheEvictions(queue *cacheQueue) {
+	unsigned long n = 0;
+	int i;
+
+	for(i = 0; i < CACHE_SHARDS; i++)
+		n += __atomic_load_n(&cacheQueue->shards[i].evictions,
+		                     __ATOMIC_RELAXED);
+	return n;
+}
+
+/* cacheLostChunks - chunks of the slabs of all nodes kept off their free
+ * lists after a failed hole punch, for the stats */
+unsigned long cacheLostChunks(queue *cacheQueue) {
+	unsigned long n = 0;
+	int i;
+
+	for(i = 0; i < cacheQueue->nnodes; i++)
+		n += __atomic_load_n(&cacheQueue->payloads[i]->nlost,
+		                     __ATOMIC_RELAXED);
+	return n;
 }
@@ -4,45 +4,218 @@
  * andrewID: minxu
  *
  * This is an LRU cache for caching web contents forwarded back from servers
- * to clients. It is implementd by a FIFO queue using doubly linked list. Total
- * cache size is 1 MB and single web data size is 1 KB. Anything larger than 
- * 1 KB will not be cached. If cache size exceeds 1 MB, the leaset recently 
- * used content will be replaced. 
+ * to clients. It is split into CACHE_SHARDS shards by a hash of the URL, 
+ * each with its own hash table, LRU queue (doubly linked list) and 
+ * readers-writers locks, so lookups are O(1) and threads working on 
+ * different URLs rarely meet on a lock. Total cache size is 1 MB and single
+ * web data size is 100 KB by default, both set when the cache is created.
+ * Anything larger will not be cached. If cache size exceeds the total, 
+ * least recently used contents of the shards are replaced. Payloads are
+ * lists of fixed size chunks of a memfd backed slab (slab.c), so hits are
+ * sent with sendfile and misses are received straight into their chunks,
+ * and the size of the cache counts the chunks it really takes.
+ * Which object leaves first is up to the eviction policy chosen at 
+ * startup (policy.c): LRU, segmented LRU or GDSF, optionally behind a 
+ * TinyLFU admission filter that keeps rarely asked for objects out.
+ * Bodies may be stored gzip compressed (gzip.c), then the cache also 
+ * counts what its objects would take as they were received.
+ * On a NUMA machine the cache can be split per node (splitCache): each 
+ * node gets a slab of its own memory and a group of the shards, and an
+ * object lives on the node of the thread that stored it.
  * 
  * ***************************************************************************/
 
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
 #include "csapp.h"
+#include "slab.h"
+#include "topo.h"
+
+#define CACHE_SHARDS 64 //number of shards, power of 2
+#define DEFAULT_CACHE_SIZE 1049000 //total size of the cache
+#define DEFAULT_OBJECT_SIZE 102400 //largest object cached
+
+/* how hits reach the eviction order, see searchCache */
+#define RECENCY_COUNT 0 //only counted, credited when evicting (FIFO for lru)
+#define RECENCY_LOCKED 1 //promoted at once under the shard write lock
+#define RECENCY_BATCHED 2 //buffered per thread, promoted in batches
 
 /* object is struct for indivisual web content marked by URL. It has web 
- * content data, url, data size and its next and prvious objects in the 
- * FIFO queue */
+ * content data in chunks of the slab, the slab, url, data size, size of
+ * the response headers before their empty line (0 if not known), how the
+ * body is framed (opaque to the cache), the size of the body before it
+ * was compressed (0 if stored as received), until when it is fresh (seconds
+ * of the wall clock, see fresh.h), hash of the url, a reference count, its 
+ * next and prvious objects in the queue (or SLRU segment) of its shard and
+ * the next object in the same hash bucket, whether it was read back
+ * from the disk tier and the node it lives on. The policy also keeps the hits
+ * it has not seen yet, the SLRU segment, and the GDSF frequency, priority
+ * and heap index. The cache holds one reference while the
+ * object is cached and every searchCache hit holds one until releaseObj,
+ * so eviction never frees data that is still being sent */
 typedef struct object {
-	char *data;
+	chunk *chunks;
+	slab *dslab;
 	char *durl;
 	size_t dsize;
+	size_t hsize;
+	int framing;
+	size_t plainSize;
+	time_t expires;
+	unsigned long hash;
+	int refcnt;
 	struct object *next;
 	struct object *prev;
+	struct object *hnext;
+	unsigned int hits;
+	int seg;
+	unsigned int freq;
+	double prio;
+	size_t hidx;
+	int fromDisk;
+	int node;
 } object;
 
-/* queue is struct for holding global information about the cache. It has
- * the head object of the queue, tail object of the queue, total cache size,
- * read and write semaphores(mutexes) and a reader's counter for implementing
- * first readers-writers problem */
-typedef struct queue {
+/* shard is struct for one part of the cache. It has the head and tail 
+ * object of its queue (the probation segment for SLRU) and of the SLRU 
+ * protected segment, its bytes in all and in the protected segment, the
+ * GDSF heap with its length, room and inflation value, its hash buckets,
+ * the objects it evicted, read and write semaphores(mutexes) and a
+ * reader's counter for implementing first readers-writers problem.
+ * Shards are cache line aligned so their locks do not share lines */
+typedef struct shard {
 	object *head;
 	object *tail;
-	size_t cacheSize;
+	object *phead;
+	object *ptail;
+	size_t bytes;
+	size_t protBytes;
+	object **heap;
+	size_t heapLen;
+	size_t heapCap;
+	double inflation;
+	object **buckets;
+	size_t nbuckets;
+	size_t nobjs;
+	unsigned long evictions;
 	sem_t readSem;
 	sem_t writeSem;
 	unsigned int readcnt;
+} __attribute__((aligned(64))) shard;
+
+/* policyOps is struct for an eviction policy, see policy.c. All are 
+ * called with the shard write locked: insert adds a new object, remove
+ * takes out a replaced one and evict the victim, touch records a hit, and
+ * victim picks the object to evict next (NULL if the shard is empty) after
+ * crediting the hits counted in obj->hits meanwhile */
+typedef struct policyOps {
+	char *name;
+	void (*insert)(shard *sh, object *obj);
+	void (*remove)(shard *sh, object *obj);
+	void (*evict)(shard *sh, object *obj);
+	void (*touch)(shard *sh, object *obj);
+	object *(*victim)(shard *sh);
+} policyOps;
+
+/* chunkList is struct for a response being received into the cache. It
+ * has its first and last chunk and its size */
+typedef struct chunkList {
+	chunk *head;
+	chunk *tail;
+	size_t size;
+} chunkList;
+
+/* queue is struct for holding global information about the cache. It has 
+ * the shards, the slab of payloads of each node, the number of nodes and
+ * the shards of each (the first group of them is node 0's), total cache
+ * size (updated atomically, in whole chunks) and the most it may be, what
+ * the cached objects would take uncompressed (likewise, see 
+ * objPlainBytes), the largest object cached, the shard where eviction
+ * continues when the inserting shard has nothing left to evict, the
+ * eviction policy, the TinyLFU frequency sketch (NULL to admit
+ * everything), how hits are promoted, RECENCY_BATCHED unless changed
+ * right after initCache, and the disk tier evicted objects go to (NULL if
+ * none, set right after initCache too) */
+typedef struct queue {
+	shard shards[CACHE_SHARDS];
+	slab *payloads[TOPO_MAX_NODES];
+	int nnodes;
+	unsigned int nodeShards;
+	size_t cacheSize;
+	size_t maxSize;
+	size_t plainBytes;
+	size_t maxObject;
+	unsigned int evictCursor;
+	policyOps *policy;
+	struct sketch *admit;
+	int recency;
+	struct disk *disk;
 } queue;
 
 /* function prototypes for cache.c */
-queue *initCache();
+queue *initCache(policyOps *policy, int admit, size_t maxSize, \
+                                                      size_t maxObject);
+
+int splitCache(queue *cacheQueue, int nnodes);
+
+slab *chunkSlab(queue *cacheQueue, chunk *c);
 
 void pushCache(char *indata, size_t dataSize, char *inurl, size_t urlSize, \
                                                            queue *cacheQueue);
 
-void popCache(queue *cacheQueue);
+char *growCache(chunkList *cl, size_t *room, queue *cacheQueue);
+
+int appendCache(chunkList *cl, char *buf, size_t n, queue *cacheQueue);
+
+int fillCache(chunkList *cl, size_t size, queue *cacheQueue);
+
+object *commitCache(chunkList *cl, char *inurl, size_t urlSize, \
+                    size_t hdrSize, int framing, size_t plainSize, \
+                    time_t expires, queue *cacheQueue);
+
+void cancelCache(chunkList *cl, queue *cacheQueue);
 
 object *searchCache(char *inpath, queue *cacheQueue);
+
+void spillCache(queue *cacheQueue);
+
+long saveCache(queue *cacheQueue, int fd);
+
+long loadCache(queue *cacheQueue, int fd);
+
+unsigned long cacheEvictions(queue *cacheQueue);
+
+unsigned long cacheLostChunks(queue *cacheQueue);
+
+object *retainObj(object *obj);
+
+void refreshObj(object *obj, time_t expires);
+
+void releaseObj(object *obj);
+
+ssize_t sendObj(int fd, object *obj, size_t off, size_t n);
+
+ssize_t sendChunks(int fd, slab *sl, chunk *c, size_t off, size_t n);
+
+size_t copyChunks(chunk *c, size_t off, char *buf, size_t n);
+
+/* objFresh - whether a held object is still fresh at now, see refreshObj */
+static inline int objFresh(object *obj, time_t now) {
+	return now < __atomic_load_n(&obj->expires, __ATOMIC_RELAXED);
+}
+
+/* chunkBytes - memory taken by size bytes of data, in whole chunks */
+static inline size_t chunkBytes(size_t size) {
+	return (size + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE;
+}
+
+/* objPlainBytes - memory obj would take stored as received, in whole
+ * chunks. a compressed body is all that follows the empty line */
+static inline size_t objPlainBytes(object *obj) {
+	if(obj->plainSize == 0)
+		return chunkBytes(obj->dsize);
+	return chunkBytes(obj->hsize + 2 + obj->plainSize);
+}
+
+#endif /* __CACHE_H__ */
@@ -0,0 +1,205 @@
+/****************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * cachesim - trace driven simulator of the proxy cache. Replays a trace of
+ * requests against the cache of cache.c once for every eviction policy,
+ * with and without TinyLFU admission, and reports the hit ratio and the
+ * byte hit ratio of each. A request that misses is "fetched": chunks for
+ * its size are taken from the slab and committed like the proxy does, 
+ * objects larger than the largest object size are never cached. -S and
+ * -O set the cache size and the largest object size, in KB.
+ *
+ * The trace is read from a file (or - for stdin), one request per line,
+ * either "url size" or a line of a web server's common log format, whose
+ * request line and size fields are used. Without a trace, -z generates
+ * one: requests to objects with Zipf distributed popularity of exponent
+ * -a and sizes spread over 1 KB to 64 KB, mixed with one hit wonders,
+ * URLs that are asked for once, in the ratio given with -o.
+ *
+ * usage: cachesim [-a alpha] [-n requests] [-o onehit] [-O kb] [-S kb]
+ *                 [-z objects] [trace]
+ *
+ *****************************************************************************/
+
+#include <math.h>
+#include "csapp.h"
+#include "cache.h"
+#include "policy.h"
+
+/* request is struct for one request of the trace. It has the url and the
+ * size of the response */
+typedef struct request {
+	char *url;
+	size_t size;
+} request;
+
+static request *trace; //the requests to replay
+static size_t ntrace, traceCap;
+static size_t cacheSize = DEFAULT_CACHE_SIZE, objectSize = DEFAULT_OBJECT_SIZE;
+
+/* addRequest - append a request for url of size bytes to the trace */
+static void addRequest(char *url, size_t size) {
+	if(ntrace == traceCap) {
+		traceCap = traceCap ? traceCap * 2 : 4096;
+		trace = (request *)Realloc(trace, traceCap * sizeof(request));
+	}
+	trace[ntrace].url = strdup(url);
+	trace[ntrace].size = size;
+	ntrace++;
+}
+
+/* parseLine - take the url and size out of a trace line, in common log
+ * format if it has a quoted request line. return 0 if there are none */
+static int parseLine(char *line, char *url, size_t *size) {
+	char *q, *end;
+	long status, n;
+
+	if((q = strchr(line, '"')) == NULL)
+		return sscanf(line, "%s %zu", url, size) == 2;
+
+	/* host ident user [date] "METHOD url VERSION" status size */
+	if((end = strchr(q + 1, '"')) == NULL)
+		return 0;
+	*end = '\0';
+	if(sscanf(q + 1, "%*s %s", url) != 1)
+		return 0;
+	if(sscanf(end + 1, "%ld %ld", &status, &n) != 2 || status != 200)
+		return 0; //no size ("-") or nothing a proxy would cache
+	*size = n;
+	return 1;
+}
+
+/* readTrace - read the trace from file, - for stdin */
+static void readTrace(char *file) {
+	FILE *fp = strcmp(file, "-") ? fopen(file, "r") : stdin;
+	char line[MAXLINE], url[MAXLINE];
+	size_t size;
+
+	if(fp == NULL)
+		unix_error("cannot open trace");
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		if(parseLine(line, url, &size))
+			addRequest(url, size);
+	}
+	if(fp != stdin)
+		fclose(fp);
+}
+
+/* makeTrace - generate n requests, onehit of them to URLs asked for only
+ * once, the others to nobjs objects with Zipf(alpha) popularity */
+static void makeTrace(long n, long nobjs, double alpha, double onehit) {
+	double *cdf = (double *)Malloc(nobjs * sizeof(double)), sum = 0, u;
+	size_t *sizes = (size_t *)Malloc(nobjs * sizeof(size_t));
+	char url[MAXLINE];
+	long i, lo, hi, once = 0;
+
+	srand48(1); //the same trace every run
+	for(i = 0; i < nobjs; i++) {
+		sum += 1.0 / pow(i + 1, alpha);
+		cdf[i] = sum;
+		sizes[i] = 1024 << (lrand48() % 7); //1 KB to 64 KB
+	}
+	for(i = 0; i < n; i++) {
+		if(drand48() < onehit) {
+			sprintf(url, "http://sim/once/%ld", once++);
+			addRequest(url, 1024 << (lrand48() % 7));
+			continue;
+		}
+		u = drand48() * sum;
+		for(lo = 0, hi = nobjs - 1; lo < hi; ) { //first cdf >= u
+			if(cdf[(lo + hi) / 2] < u)
+				lo = (lo + hi) / 2 + 1;
+			else
+				hi = (lo + hi) / 2;
+		}
+		sprintf(url, "http://sim/obj/%ld", lo);
+		addRequest(url, sizes[lo]);
+	}
+	Free(cdf);
+	Free(sizes);
+}
+
+/* replay - run the trace through a new cache, print its hit ratios */
+static void replay(policyOps *policy, int admit) {
+	queue *cache = initCache(policy, admit, cacheSize, objectSize);
+	size_t i, hits = 0, hitBytes = 0, allBytes = 0;
+	object *obj;
+	chunkList cl;
+
+	if(cache == NULL)
+		exit(1);
+	for(i = 0; i < ntrace; i++) {
+		allBytes += trace[i].size;
+		if((obj = searchCache(trace[i].url, cache)) != NULL) {
+			hits++;
+			hitBytes += trace[i].size;
+			releaseObj(obj);
+			continue;
+		}
+		if(trace[i].size == 0 || trace[i].size > cache->maxObject)
+			continue;
+		cl.head = cl.tail = NULL;
+		cl.size = 0;
+		if(fillCache(&cl, trace[i].size, cache) < 0) {
+			cancelCache(&cl, cache);
+			continue;
+		}
+		obj = commitCache(&cl, trace[i].url, strlen(trace[i].url) + 1, 0, 0,
+		                  0, 0, cache);
+		if(obj != NULL)
+			releaseObj(obj);
+		else
+			cancelCache(&cl, cache);
+	}
+	printf("%-6s %-8s %8.2f%% %8.2f%%\n", policy->name,
+	       admit ? "tinylfu" : "-", 100.0 * hits / ntrace,
+	       allBytes ? 100.0 * hitBytes / allBytes : 0.0);
+}
+
+static void usage(char *prog) {
+	fprintf(stderr, "usage: %s [-a alpha] [-n requests] [-o onehit] "
+	        "[-O kb] [-S kb] [-z objects] [trace]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	policyOps *policies[] = { &lruPolicy, &slruPolicy, &gdsfPolicy };
+	long n = 200000, nobjs = 0;
+	double alpha = 0.8, onehit = 0.3;
+	int opt, i;
+
+	while((opt = getopt(argc, argv, "a:n:o:O:S:z:")) != -1) {
+		switch(opt) {
+		case 'a': alpha = atof(optarg); break;
+		case 'n': n = atol(optarg); break;
+		case 'o': onehit = atof(optarg); break;
+		case 'O': objectSize = strtoul(optarg, NULL, 10) << 10; break;
+		case 'S': cacheSize = strtoul(optarg, NULL, 10) << 10; break;
+		case 'z': nobjs = atol(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if(cacheSize == 0 || objectSize == 0)
+		usage(argv[0]);
+	if(argc - optind == 1 && nobjs == 0)
+		readTrace(argv[optind]);
+	else if(argc - optind == 0 && nobjs > 0 && n > 0)
+		makeTrace(n, nobjs, alpha, onehit);
+	else
+		usage(argv[0]);
+	if(ntrace == 0) {
+		fprintf(stderr, "empty trace\n");
+		exit(1);
+	}
+
+	printf("%zu requests\n", ntrace);
+	printf("%-6s %-8s %9s %9s\n", "policy", "admit", "hits", "bytes");
+	for(i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+		replay(policies[i], 0);
+		replay(policies[i], 1);
+	}
+	return 0;
+}
@@ -23,10 +23,46 @@
  *    error handling
  *   -rio_read & rio_readn: retry on ECONNRESET and EINTR errors
  *   -rio_writen: retry on EPIPE and EINTR errors
+ *   -io_hooks: Rio routines, open_clientfd and Close cooperate with the
+ *    proxy's event loops when the calling thread installed hooks
+ *   -rio_readnb: reads straight into the user buffer when the internal
+ *    buffer is empty and at least a buffer full is wanted
+ *   -rio_sendfile: robust sendfile for serving cached objects
+ *   -rio_splice: robust relay between sockets through a pipe with splice
+ *   -open_clientfd: resolves through resolve_hooks when installed, and 
+ *    returns -1 instead of using an unset list when resolution fails
+ *   -wakeups: eventfd based wait and wake between threads and tasks, 
+ *    wait_wakeup_for gives up after a timeout
+ *   -rio_fillb: reads more into the internal buffer, keeping what is unread
+ *   -rio_writev: robust writev of a list of pieces in one system call
+ *   -set_io_timeout: bounds the waits of loop tasks and the connects of
+ *    open_clientfd, which keeps errno of the failed connect
+ *   -wait_either: waits for the first of two descriptors to be ready
  */
 /* $begin csapp.c */
+#include <sys/sendfile.h>
+#include <sys/eventfd.h>
 #include "csapp.h"
 
+/* splice and pipe2 are only declared with _GNU_SOURCE, which clashes with
+ * the gai_error in csapp.h */
+ssize_t splice(int fdin, loff_t *offin, int fdout, loff_t *offout,
+               size_t len, unsigned int flags);
+int pipe2(int pipefd[2], int flags);
+#ifndef SPLICE_F_MOVE
+#define SPLICE_F_MOVE 1
+#define SPLICE_F_MORE 4
+#endif
+
+/* Per-thread cooperative I/O hooks, NULL for ordinary blocking threads */
+__thread io_hooks_t *io_hooks = NULL;
+
+/* Name resolution hooks, NULL to call getaddrinfo directly */
+resolve_hooks_t *resolve_hooks = NULL;
+
+/* I/O timeout of a blocking thread in ms, 0 for none */
+static __thread long io_timeout = 0;
+
 /************************** 
  * Error-handling functions
  **************************/
@@ -348,6 +384,8 @@ void Close(int fd)
 {
     int rc;
 
+    if (io_hooks)
+	io_hooks->close(fd);
     if ((rc = close(fd)) < 0)
 	unix_error("Close error");
 }
@@ -749,6 +787,9 @@ ssize_t rio_readn(int fd, void *usrbuf, size_t n)
 		 /* ignore ECONNRESET error */
 	    else if(errno == ECONNRESET)
 			nread = 0;  
+	    /* non-blocking descriptor, park until it is readable */
+	    else if(errno == EAGAIN && io_hooks && !io_hooks->wait(fd, POLLIN))
+			nread = 0;
 	    else
 			return -1;      /* errno set by read() */ 
 	} 
@@ -778,6 +819,9 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 	    /* ignore EPIPE and ECONNRESET error */
 	    else if(errno == EPIPE) // || errno == ECONNRESET)
 			nwritten = 0;
+	    /* non-blocking descriptor, park until it is writable */
+	    else if(errno == EAGAIN && io_hooks && !io_hooks->wait(fd, POLLOUT))
+			nwritten = 0;
 	    else
 			return -1;       /* errno set by write() */
 	}
@@ -788,6 +832,42 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 }
 /* $end rio_writen */
 
+/*
+ * rio_writev - Robustly write the iovcnt pieces of iov, as one writev
+ *    unless the descriptor takes less. iov is advanced past what was
+ *    written, so it is left consumed.
+ */
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    size_t n = 0;
+    ssize_t nwritten;
+    int i;
+
+    for (i = 0; i < iovcnt; i++)
+	n += iov[i].iov_len;
+    while (iovcnt > 0) {
+	if ((nwritten = writev(fd, iov, iovcnt)) < 0) {
+	    if (errno == EINTR)
+			nwritten = 0;
+	    else if (errno == EAGAIN && io_hooks && !io_hooks->wait(fd, POLLOUT))
+			nwritten = 0;
+	    else
+			return -1;       /* errno set by writev() */
+	}
+	/* skip the pieces written, and the written part of the next */
+	while (iovcnt > 0 && (size_t)nwritten >= iov->iov_len) {
+	    nwritten -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	if (iovcnt > 0) {
+	    iov->iov_base = (char *)iov->iov_base + nwritten;
+	    iov->iov_len -= nwritten;
+	}
+    }
+    return n;
+}
+
 
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
@@ -808,7 +888,12 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 	if (rp->rio_cnt < 0) {
 		/* ignore EPIPE, ECONNRESET error, 
 		 * or not Interrupted by sig handler return*/
-	    if(errno != ECONNRESET && errno != EINTR)
+	    if(errno == EAGAIN && io_hooks) {
+			/* non-blocking descriptor, park until it is readable */
+			if(io_hooks->wait(rp->rio_fd, POLLIN) < 0)
+				return -1;
+	    }
+	    else if(errno != ECONNRESET && errno != EINTR)
 			return -1;
 	}
 	else if (rp->rio_cnt == 0)  /* EOF */
@@ -840,6 +925,27 @@ void rio_readinitb(rio_t *rp, int fd)
 }
 /* $end rio_readinitb */
 
+/*
+ * rio_readdirect - read() straight into the user buffer, with the same
+ *    error handling as rio_read. Only used while the internal buffer
+ *    is empty, so no buffered bytes are skipped.
+ */
+static ssize_t rio_readdirect(rio_t *rp, char *usrbuf, size_t n)
+{
+    ssize_t nread;
+
+    while ((nread = read(rp->rio_fd, usrbuf, n)) < 0) {
+	if (errno == EAGAIN && io_hooks) {
+	    /* non-blocking descriptor, park until it is readable */
+	    if (io_hooks->wait(rp->rio_fd, POLLIN) < 0)
+		return -1;
+	}
+	else if (errno != ECONNRESET && errno != EINTR)
+	    return -1;
+    }
+    return nread;
+}
+
 /*
  * rio_readnb - Robustly read n bytes (buffered)
  */
@@ -851,7 +957,12 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
     char *bufp = usrbuf;
     
     while (nleft > 0) {
-	if ((nread = rio_read(rp, bufp, nleft)) < 0) 
+	/* large reads skip the extra copy through the internal buffer */
+	if (rp->rio_cnt <= 0 && nleft >= sizeof(rp->rio_buf))
+	    nread = rio_readdirect(rp, bufp, nleft);
+	else
+	    nread = rio_read(rp, bufp, nleft);
+	if (nread < 0) 
             return -1;          /* errno set by read() */ 
 	else if (nread == 0)
 	    break;              /* EOF */
@@ -891,6 +1002,132 @@ ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
 }
 /* $end rio_readlineb */
 
+/*
+ * rio_sendfile - Robustly send n bytes of file infd starting at offset
+ *    to outfd, without copying them through user space
+ */
+ssize_t rio_sendfile(int outfd, int infd, off_t offset, size_t n)
+{
+    size_t nleft = n;
+    ssize_t nsent;
+
+    while (nleft > 0) {
+	if ((nsent = sendfile(outfd, infd, &offset, nleft)) <= 0) {
+	    if (nsent < 0 && errno == EINTR) /* Interrupted by sig handler */
+		nsent = 0;                   /* and call sendfile() again */
+	    /* non-blocking descriptor, park until it is writable */
+	    else if (nsent < 0 && errno == EAGAIN && io_hooks && 
+	             !io_hooks->wait(outfd, POLLOUT))
+		nsent = 0;
+	    else
+		return -1;      /* errno set by sendfile(), or short file */
+	}
+	nleft -= nsent;
+    }
+    return n;
+}
+
+/*
+ * rio_splice - Robustly move up to n bytes from the descriptor of rp to 
+ *    outfd, or until EOF, without copying them through user space. Bytes
+ *    already in rp's internal buffer are written first, the rest is
+ *    spliced through a pipe of its own. Returns the bytes moved.
+ */
+ssize_t rio_splice(rio_t *rp, int outfd, size_t n)
+{
+    int pipefd[2];
+    size_t nleft = n, inpipe = 0, cnt;
+    ssize_t nin, nout, moved = 0;
+
+    /* first the bytes rp has already read */
+    if (rp->rio_cnt > 0) {
+	cnt = (rp->rio_cnt < nleft) ? rp->rio_cnt : nleft;
+	if (rio_writen(outfd, rp->rio_bufptr, cnt) != cnt)
+	    return -1;
+	rp->rio_bufptr += cnt;
+	rp->rio_cnt -= cnt;
+	nleft -= cnt;
+	moved += cnt;
+    }
+
+    if (pipe2(pipefd, O_CLOEXEC) < 0)
+	return -1;
+
+    /* the pipe is always drained before it is filled again, so only the 
+     * sockets can make splice wait */
+    while (nleft > 0 || inpipe > 0) {
+	if (inpipe == 0) {
+	    cnt = (nleft < RIO_SPLICESIZE) ? nleft : RIO_SPLICESIZE;
+	    nin = splice(rp->rio_fd, NULL, pipefd[1], NULL, cnt,
+	                 SPLICE_F_MOVE | SPLICE_F_MORE);
+	    if (nin < 0) {
+		if (errno == EINTR)
+		    continue;
+		/* non-blocking descriptor, park until it is readable */
+		if (errno == EAGAIN && io_hooks && 
+		    !io_hooks->wait(rp->rio_fd, POLLIN))
+		    continue;
+		if (errno == ECONNRESET) /* peer is gone, same as EOF */
+		    break;
+		moved = -1;
+		break;
+	    }
+	    if (nin == 0) /* EOF */
+		break;
+	    inpipe = nin;
+	    nleft -= nin;
+	}
+	nout = splice(pipefd[0], NULL, outfd, NULL, inpipe,
+	              SPLICE_F_MOVE | SPLICE_F_MORE);
+	if (nout < 0) {
+	    if (errno == EINTR)
+		continue;
+	    /* non-blocking descriptor, park until it is writable */
+	    if (errno == EAGAIN && io_hooks && !io_hooks->wait(outfd, POLLOUT))
+		continue;
+	    moved = -1;
+	    break;
+	}
+	inpipe -= nout;
+	moved += nout;
+    }
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return moved;
+}
+
+/*
+ * rio_fillb - Robustly read more bytes into rp's internal buffer without
+ *    consuming any, after moving the unread ones to its start so they 
+ *    stay contiguous for a parser. Returns the bytes read, 0 on EOF or if
+ *    the buffer is already full.
+ */
+ssize_t rio_fillb(rio_t *rp)
+{
+    ssize_t nread;
+
+    if (rp->rio_cnt > 0 && rp->rio_bufptr != rp->rio_buf)
+	memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+    rp->rio_bufptr = rp->rio_buf;
+    if (rp->rio_cnt == sizeof(rp->rio_buf))
+	return 0;
+
+    while ((nread = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt,
+                         sizeof(rp->rio_buf) - rp->rio_cnt)) < 0) {
+	if (errno == EINTR) /* Interrupted by sig handler return */
+	    continue;
+	/* non-blocking descriptor, park until it is readable */
+	if (errno == EAGAIN && io_hooks && !io_hooks->wait(rp->rio_fd, POLLIN))
+	    continue;
+	if (errno == ECONNRESET) /* peer is gone, same as EOF */
+	    return 0;
+	return -1;
+    }
+    rp->rio_cnt += nread;
+    return nread;
+}
+
 /**********************************
  * Wrappers for robust I/O routines
  **********************************/
@@ -912,6 +1149,42 @@ ssize_t Rio_writen(int fd, void *usrbuf, size_t n)
 	return wc;
 }
 
+ssize_t Rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t wc;
+
+    if ((wc = rio_writev(fd, iov, iovcnt)) < 0)
+	unix_error("Rio_writev error");
+    return wc;
+}
+
+ssize_t Rio_sendfile(int outfd, int infd, off_t offset, size_t n)
+{
+    ssize_t sc;
+
+    if ((sc = rio_sendfile(outfd, infd, offset, n)) != n)
+	unix_error("Rio_sendfile error");
+    return sc;
+}
+
+ssize_t Rio_splice(rio_t *rp, int outfd, size_t n)
+{
+    ssize_t sc;
+
+    if ((sc = rio_splice(rp, outfd, n)) < 0)
+	unix_error("Rio_splice error");
+    return sc;
+}
+
+ssize_t Rio_fillb(rio_t *rp)
+{
+    ssize_t rc;
+
+    if ((rc = rio_fillb(rp)) < 0)
+	unix_error("Rio_fillb error");
+    return rc;
+}
+
 void Rio_readinitb(rio_t *rp, int fd)
 {
     rio_readinitb(rp, fd);
@@ -947,8 +1220,9 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
  */
 /* $begin open_clientfd */
 int open_clientfd(char *hostname, char *port) {
-    int clientfd;
+    int clientfd, err = 0;
     struct addrinfo hints, *listp, *p;
+    struct timeval tv = { io_timeout / 1000, io_timeout % 1000 * 1000 };
 
     /* Get a list of potential server addresses */
     memset(&hints, 0, sizeof(struct addrinfo));
@@ -956,29 +1230,101 @@ int open_clientfd(char *hostname, char *port) {
     hints.ai_flags = AI_NUMERICSERV;  /* ... using a numeric port arg. */
     hints.ai_flags |= AI_ADDRCONFIG;  /* Recommended for connections */
 
-    Getaddrinfo(hostname, port, &hints, &listp);
+    if (resolve_hooks) {
+        if (resolve_hooks->lookup(hostname, port, &listp) < 0)
+            return -1;
+    }
+    else {
+        int rc;
+        if ((rc = getaddrinfo(hostname, port, &hints, &listp)) != 0) {
+            gai_error(rc, "Getaddrinfo error");
+            return -1;
+        }
+    }
  
     /* Walk the list for one that we can successfully connect to */
     for (p = listp; p; p = p->ai_next) {
         /* Create a socket descriptor */
-        if ((clientfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) 
+        if ((clientfd = socket(p->ai_family, p->ai_socktype | 
+                               (io_hooks ? SOCK_NONBLOCK : 0),
+                               p->ai_protocol)) < 0) 
             continue; /* Socket failed, try the next */
 
+        /* Blocking connect: bounded by the send timeout, if any */
+        if (!io_hooks && io_timeout > 0)
+            setsockopt(clientfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
         /* Connect to the server */
         if (connect(clientfd, p->ai_addr, p->ai_addrlen) != -1) 
             break; /* Success */
+        err = errno;
+        /* Non-blocking connect: park until writable, then check result */
+        if (io_hooks && errno == EINPROGRESS) {
+            if (!io_hooks->wait(clientfd, POLLOUT)) {
+                socklen_t errlen = sizeof(err);
+                if (getsockopt(clientfd, SOL_SOCKET, SO_ERROR, &err, &errlen))
+                    err = errno;
+                else if (!err)
+                    break; /* Success */
+            }
+            else
+                err = errno;
+        }
         Close(clientfd); /* Connect failed, try another */  //line:netp:openclientfd:closefd
     } 
 
     /* Clean up */
-    Freeaddrinfo(listp);
-    if (!p) /* All connects failed */
+    if (resolve_hooks)
+        resolve_hooks->release(listp);
+    else
+        Freeaddrinfo(listp);
+    if (!p) { /* All connects failed, errno of the last one */
+        errno = err;
         return -1;
+    }
     else    /* The last connect succeeded */
         return clientfd;
 }
 /* $end open_clientfd */
 
+/*
+ * set_io_timeout - Limit the I/O of the caller to ms, 0 for no limit: each
+ *     later wait of a loop task through io_hooks, or each later connect of
+ *     open_clientfd and wait_either from a blocking thread. Timed out 
+ *     waits fail with ETIMEDOUT, timed out blocking connects with 
+ *     EINPROGRESS.
+ */
+void set_io_timeout(long ms)
+{
+    if (io_hooks)
+        io_hooks->timeout(ms);
+    else
+        io_timeout = ms;
+}
+
+/*
+ * wait_either - Wait until fd1 is ready for events1 or fd2 for events2,
+ *     POLLIN and/or POLLOUT, 0 for a descriptor not waited on. Parks the
+ *     task through io_hooks or polls. Returns 0 once one may be ready, -1
+ *     on error or after the I/O timeout, with errno ETIMEDOUT.
+ */
+int wait_either(int fd1, int events1, int fd2, int events2)
+{
+    /* no events, not even errors and hangups */
+    struct pollfd pfds[2] = { { events1 ? fd1 : -1, events1, 0 },
+                              { events2 ? fd2 : -1, events2, 0 } };
+    int rc;
+
+    if (io_hooks)
+        return io_hooks->waitEither(fd1, events1, fd2, events2);
+    while ((rc = poll(pfds, 2, io_timeout > 0 ? io_timeout : -1)) < 0 &&
+           errno == EINTR)
+        ;
+    if (rc == 0)
+        errno = ETIMEDOUT;
+    return rc > 0 ? 0 : -1;
+}
+
 /*  
  * open_listenfd - Open and return a listening socket on port. This
  *     function is reentrant and protocol-independent.
@@ -1049,6 +1395,88 @@ int Open_listenfd(char *port)
     return rc;
 }
 
+/******************************************
+ * Wakeups between threads and loop tasks
+ ******************************************/
+
+/*
+ * open_wakeupfd - Open an eventfd for wait_wakeup, non-blocking when the
+ *     calling thread has io_hooks so that waiting parks the task instead.
+ *     Returns -1 on error.
+ */
+int open_wakeupfd(void) 
+{
+    return eventfd(0, EFD_CLOEXEC | (io_hooks ? EFD_NONBLOCK : 0));
+}
+
+/*
+ * wait_wakeup - Wait until send_wakeup is called on fd, parking the task
+ *     through io_hooks or blocking the thread. Never returns early: the 
+ *     waker may still write fd, so the waiter must not go away before.
+ */
+void wait_wakeup(int fd) 
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    uint64_t count;
+
+    while (read(fd, &count, sizeof(count)) < 0) {
+	if (errno == EAGAIN && io_hooks && !io_hooks->wait(fd, POLLIN))
+	    continue;
+	if (errno == EAGAIN) /* cannot park, block instead */
+	    poll(&pfd, 1, -1);
+    }
+}
+
+/*
+ * wait_wakeup_for - Same as wait_wakeup, but give up after about ms, 
+ *     clearing the I/O timeout of the task. Returns 0 if woken, -1 if the
+ *     time ran out first: the waker may then still write fd.
+ */
+int wait_wakeup_for(int fd, long ms) 
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    uint64_t count;
+    int rc = 0;
+
+    if (!io_hooks) { /* blocking fd, read once it is readable */
+	while ((rc = poll(&pfd, 1, ms)) < 0 && errno == EINTR)
+	    ;
+	if (rc <= 0)
+	    return -1;
+	rc = 0;
+    }
+    else
+	io_hooks->timeout(ms);
+    while (rc == 0 && read(fd, &count, sizeof(count)) < 0) {
+	if (errno == EAGAIN && io_hooks)
+	    rc = io_hooks->wait(fd, POLLIN);
+	else if (errno != EINTR)
+	    rc = -1;
+    }
+    if (io_hooks)
+	io_hooks->timeout(0);
+    return rc;
+}
+
+/*
+ * send_wakeup - Wake the waiter on fd. Wakeups before the wait are kept.
+ */
+void send_wakeup(int fd) 
+{
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) < 0)
+	unix_error("send_wakeup error");
+}
+
+int Open_wakeupfd(void) 
+{
+    int rc;
+
+    if ((rc = open_wakeupfd()) < 0)
+	unix_error("Open_wakeupfd error");
+    return rc;
+}
 /* $end csapp.c */
 
 
@@ -25,9 +25,11 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <poll.h>
 
 /* Default file permissions are DEF_MODE & ~DEF_UMASK */
 /* $begin createmasks */
@@ -51,6 +53,31 @@ typedef struct {
 } rio_t;
 /* $end rio_t */
 
+/* Cooperative I/O hooks, installed per thread by the proxy's event loops
+ * (event.c). While set, sockets are non-blocking: the Rio routines and
+ * open_clientfd park the calling task in wait() on EAGAIN/EINPROGRESS 
+ * instead of failing, and Close tells the loop the descriptor is gone.
+ * timeout() limits every later wait of the calling task to ms, 0 for no
+ * limit, a wait past it fails with ETIMEDOUT. waitEither() parks until 
+ * one of two descriptors is ready, for relaying both ways at once */
+typedef struct {
+    int (*wait)(int fd, int events); /* events is POLLIN or POLLOUT */
+    void (*close)(int fd);
+    void (*timeout)(long ms);
+    int (*waitEither)(int fd1, int events1, int fd2, int events2);
+} io_hooks_t;
+extern __thread io_hooks_t *io_hooks;
+
+/* Name resolution hooks, installed once by the proxy's resolver cache 
+ * (dns.c). While set, open_clientfd gets its addresses from lookup (0 on
+ * success, -1 on error) and gives them back with release, instead of 
+ * calling getaddrinfo itself */
+typedef struct {
+    int (*lookup)(char *host, char *port, struct addrinfo **res);
+    void (*release)(struct addrinfo *res);
+} resolve_hooks_t;
+extern resolve_hooks_t *resolve_hooks;
+
 /* External variables */
 extern int h_errno;    /* Defined by BIND for DNS errors */ 
 extern char **environ; /* Defined by libc */
@@ -59,6 +86,7 @@ extern char **environ; /* Defined by libc */
 #define	MAXLINE	 8192  /* Max text line length */
 #define MAXBUF   8192  /* Max I/O buffer size */
 #define LISTENQ  1024  /* Second argument to listen() */
+#define RIO_SPLICESIZE 65536 /* Max bytes per splice, default pipe size */
 
 /* Our own error-handling functions */
 void unix_error(char *msg);
@@ -175,25 +203,48 @@ void V(sem_t *sem);
 /* Rio (Robust I/O) package */
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, void *usrbuf, size_t n);
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt);
 void rio_readinitb(rio_t *rp, int fd); 
 ssize_t	rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t	rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t rio_sendfile(int outfd, int infd, off_t offset, size_t n);
+ssize_t rio_splice(rio_t *rp, int outfd, size_t n);
+ssize_t rio_fillb(rio_t *rp);
 
 /* Wrappers for Rio package */
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t Rio_writen(int fd, void *usrbuf, size_t n);
+ssize_t Rio_writev(int fd, struct iovec *iov, int iovcnt);
 void Rio_readinitb(rio_t *rp, int fd); 
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t Rio_sendfile(int outfd, int infd, off_t offset, size_t n);
+ssize_t Rio_splice(rio_t *rp, int outfd, size_t n);
+ssize_t Rio_fillb(rio_t *rp);
 
 /* Reentrant protocol-independent client/server helpers */
 int open_clientfd(char *hostname, char *port);
 int open_listenfd(char *port);
 
+/* I/O timeouts: of every wait of the calling task with io_hooks, or of
+ * the connects of open_clientfd and wait_either from a blocking thread */
+void set_io_timeout(long ms);
+int wait_either(int fd1, int events1, int fd2, int events2);
+
 /* Wrappers for reentrant protocol-independent client/server helpers */
 int Open_clientfd(char *hostname, char *port);
 int Open_listenfd(char *port);
 
+/* Wakeups: an eventfd a thread or task parks on until another one wakes 
+ * it, which works the same from event loop tasks and plain threads */
+int open_wakeupfd(void);
+void wait_wakeup(int fd);
+int wait_wakeup_for(int fd, long ms);
+void send_wakeup(int fd);
+
+/* Wrappers for wakeups */
+int Open_wakeupfd(void);
+
 
 #endif /* __CSAPP_H__ */
 /* $end csapp.h */
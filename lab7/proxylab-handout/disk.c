@@ -0,0 +1,587 @@
+/******************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the disk tier of the cache, see disk.h. One mutex covers the
+ * segment list, the index and the queue; no file is read or written with
+ * it held. Only the writer thread appends, to the newest segment, so the
+ * size of a segment is where its next record goes. Readers hold the
+ * segment they read from, so deleting it only closes its file once they
+ * are done. Reads run on the thread that missed in memory, or for an
+ * event loop on a reader thread while the task waits for it.
+ *
+ * ***************************************************************************/
+
+#include <stddef.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/uio.h>
+#include "csapp.h"
+#include "disk.h"
+
+#define DISK_IOV 64 //iovecs of one pwritev or preadv
+
+static unsigned int crcTable[256]; //CRC-32 of every byte value
+
+/* function prototypes */
+static void *diskReader(void *vargp);
+
+/* initCrc - fill the table of the reflected CRC-32 polynomial */
+static void initCrc() {
+	unsigned int c, n, k;
+
+	for(n = 0; n < 256; n++) {
+		for(c = n, k = 0; k < 8; k++)
+			c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+		crcTable[n] = c;
+	}
+}
+
+/* crc32 - continue the CRC-32 crc over n bytes at buf, start with 0 */
+static unsigned int crc32(unsigned int crc, char *buf, size_t n) {
+	crc = ~crc;
+	while(n-- > 0)
+		crc = crcTable[(crc ^ (unsigned char)*buf++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+/* headerCheck - checksum of the header fields after hcheck */
+static unsigned int headerCheck(diskRecord *rec) {
+	return crc32(0, (char *)&rec->check,
+	             sizeof(diskRecord) - offsetof(diskRecord, check));
+}
+
+/* hashUrl - 64 bit FNV-1a hash of the url */
+static unsigned long hashUrl(char *url) {
+	unsigned long hash = 14695981039346656037UL;
+
+	while(*url) {
+		hash ^= (unsigned char)*url++;
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+/* findEntry - the link to the index entry of url, pointing to NULL if
+ * there is none. called with the mutex held */
+static diskEntry **findEntry(disk *dk, char *url, unsigned long hash) {
+	diskEntry **pp = &dk->buckets[hash & (DISK_BUCKETS - 1)];
+
+	while(*pp != NULL && ((*pp)->hash != hash || strcmp((*pp)->url, url)))
+		pp = &(*pp)->next;
+	return pp;
+}
+
+/* indexPut - point the entry of url to the record rec at off in seg, the
+ * newest record of a URL wins. called with the mutex held */
+static void indexPut(disk *dk, char *url, diskSegment *seg, size_t off, \
+                                                         diskRecord *rec) {
+	unsigned long hash = hashUrl(url);
+	diskEntry **pp = findEntry(dk, url, hash), *e = *pp;
+
+	if(e == NULL) {
+		e = (diskEntry *)Calloc(1, sizeof(diskEntry));
+		e->hash = hash;
+		e->url = strdup(url);
+		*pp = e;
+		dk->stats.objects++;
+	}
+	e->seg = seg;
+	e->off = off;
+	e->rec = *rec;
+}
+
+/* unlinkEntry - take the entry at *pp out of the index and free it.
+ * called with the mutex held */
+static void unlinkEntry(disk *dk, diskEntry **pp) {
+	diskEntry *e = *pp;
+
+	*pp = e->next;
+	Free(e->url);
+	Free(e);
+	dk->stats.objects--;
+}
+
+/* openSegment - open the file of segment id, emptied if create is set.
+ * return NULL on error */
+static diskSegment *openSegment(disk *dk, unsigned int id, int create) {
+	char path[MAXLINE];
+	diskSegment *seg;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/seg-%08u.log", dk->dir, id);
+	if((fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_TRUNC : 0),
+	              0644)) < 0) {
+		fprintf(stderr, "disk: cannot open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	seg = (diskSegment *)Calloc(1, sizeof(diskSegment));
+	seg->id = id;
+	seg->fd = fd;
+	return seg;
+}
+
+/* addSegment - append seg as the newest segment. called with the mutex
+ * held */
+static void addSegment(disk *dk, diskSegment *seg) {
+	if(dk->newest != NULL)
+		dk->newest->next = seg;
+	else
+		dk->oldest = seg;
+	dk->newest = seg;
+	dk->stats.segments++;
+	dk->stats.bytes += seg->size;
+}
+
+/* removeSegment - delete the file of segment id */
+static void removeSegment(disk *dk, unsigned int id) {
+	char path[MAXLINE];
+
+	snprintf(path, sizeof(path), "%s/seg-%08u.log", dk->dir, id);
+	unlink(path);
+}
+
+/* dropOldest - delete the oldest segment and the entries of its records.
+ * called with the mutex held */
+static void dropOldest(disk *dk) {
+	diskSegment *seg = dk->oldest;
+	diskEntry **pp;
+	int b;
+
+	for(b = 0; b < DISK_BUCKETS; b++) {
+		for(pp = &dk->buckets[b]; *pp != NULL; ) {
+			if((*pp)->seg == seg)
+				unlinkEntry(dk, pp);
+			else
+				pp = &(*pp)->next;
+		}
+	}
+	dk->oldest = seg->next;
+	dk->stats.segments--;
+	dk->stats.bytes -= seg->size;
+
+	removeSegment(dk, seg->id);
+	seg->dead = 1;
+	if(seg->readers == 0) {
+		close(seg->fd);
+		Free(seg);
+	}
+}
+
+/* scanSegment - index the records of seg by their headers. a record whose
+ * header is damaged or that runs past the end of the file was torn by a
+ * crash, the segment is cut off there */
+static void scanSegment(disk *dk, diskSegment *seg) {
+	struct stat st;
+	diskRecord rec;
+	char url[MAXLINE];
+	size_t off = 0, len;
+
+	if(fstat(seg->fd, &st) < 0)
+		st.st_size = 0;
+	while(pread(seg->fd, &rec, sizeof(rec), off) == sizeof(rec)) {
+		if(rec.magic != DISK_MAGIC || rec.hcheck != headerCheck(&rec) ||
+		   rec.urlSize < 1 || rec.urlSize > MAXLINE)
+			break;
+		len = sizeof(rec) + rec.urlSize + rec.dataSize;
+		if(off + len > st.st_size ||
+		   pread(seg->fd, url, rec.urlSize, off + sizeof(rec)) !=
+		                                           rec.urlSize ||
+		   url[rec.urlSize - 1] != '\0')
+			break;
+		indexPut(dk, url, seg, off, &rec);
+		off += len;
+	}
+
+	if(off < st.st_size) {
+		fprintf(stderr, "disk: segment %u cut at %zu of %zu bytes\n",
+		        seg->id, off, (size_t)st.st_size);
+		if(ftruncate(seg->fd, off) < 0)
+			unix_error("ftruncate error");
+	}
+	seg->size = off;
+}
+
+/* crcChunks - continue the CRC-32 crc over n bytes in the chunks from c */
+static unsigned int crcChunks(unsigned int crc, chunk *c, size_t n) {
+	for(; n > 0; c = c->next) {
+		crc = crc32(crc, c->data, n < CHUNK_SIZE ? n : CHUNK_SIZE);
+		n -= n < CHUNK_SIZE ? n : CHUNK_SIZE;
+	}
+	return crc;
+}
+
+/* chunkIo - write (or read if reading is set) the cnt buffers of iov and
+ * then n bytes in the chunks from c at offset off of fd, as few pwritev
+ * or preadv as DISK_IOV iovecs take. return 0 if all were, -1 otherwise */
+static int chunkIo(int fd, int reading, struct iovec *iov, int cnt, \
+                   chunk *c, size_t n, off_t off) {
+	size_t len = 0;
+	ssize_t rc;
+	int i;
+
+	for(i = 0; i < cnt; i++)
+		len += iov[i].iov_len;
+	while(cnt > 0 || n > 0) {
+		for(; cnt < DISK_IOV && n > 0; cnt++, c = c->next) {
+			iov[cnt].iov_base = c->data;
+			iov[cnt].iov_len = n < CHUNK_SIZE ? n : CHUNK_SIZE;
+			len += iov[cnt].iov_len;
+			n -= iov[cnt].iov_len;
+		}
+		rc = reading ? preadv(fd, iov, cnt, off) : pwritev(fd, iov, cnt, off);
+		if(rc != len)
+			return -1;
+		off += len;
+		len = cnt = 0;
+	}
+	return 0;
+}
+
+/* cmpId - qsort comparator for segment ids */
+static int cmpId(const void *a, const void *b) {
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+	return (x > y) - (x < y);
+}
+
+/* writeRecord - append obj to the newest segment and index it, starting
+ * a new segment first if it would not fit. called by the writer only */
+static void writeRecord(disk *dk, object *obj) {
+	diskRecord rec;
+	struct iovec iov[DISK_IOV];
+	diskSegment *seg = dk->newest, *next;
+	size_t len;
+
+	rec.magic = DISK_MAGIC;
+	rec.urlSize = strlen(obj->durl) + 1;
+	rec.dataSize = obj->dsize;
+	rec.hdrSize = obj->hsize;
+	rec.framing = obj->framing;
+	rec.plainSize = obj->plainSize;
+	rec.expires = obj->expires > UINT_MAX ? UINT_MAX : obj->expires;
+	rec.check = crcChunks(crc32(0, obj->durl, rec.urlSize), obj->chunks,
+	                      obj->dsize);
+	rec.hcheck = headerCheck(&rec);
+	len = sizeof(rec) + rec.urlSize + rec.dataSize;
+
+	/* the full segment is made durable before the next one is started */
+	if(seg->size > 0 && seg->size + len > DISK_SEGMENT_SIZE) {
+		fdatasync(seg->fd);
+		if((next = openSegment(dk, seg->id + 1, 1)) == NULL)
+			return;
+		P(&dk->mutex);
+		addSegment(dk, next);
+		while(dk->stats.bytes > DISK_MAX_SIZE && dk->oldest != next)
+			dropOldest(dk);
+		V(&dk->mutex);
+		seg = next;
+	}
+
+	iov[0].iov_base = &rec;
+	iov[0].iov_len = sizeof(rec);
+	iov[1].iov_base = obj->durl;
+	iov[1].iov_len = rec.urlSize;
+	if(chunkIo(seg->fd, 0, iov, 2, obj->chunks, rec.dataSize, 
+	           seg->size) < 0) {
+		//disk full or failing, leave no partial record behind
+		if(ftruncate(seg->fd, seg->size) < 0)
+			unix_error("ftruncate error");
+		return;
+	}
+
+	P(&dk->mutex);
+	indexPut(dk, obj->durl, seg, seg->size, &rec);
+	seg->size += len;
+	dk->stats.bytes += len;
+	dk->stats.spills++;
+	V(&dk->mutex);
+}
+
+/* diskWriter - thread appending the queued objects. an object read back
+ * from disk is not written again while its record is still indexed */
+static void *diskWriter(void *vargp) {
+	disk *dk = (disk *)vargp;
+	spill *s;
+	int skip;
+
+	Pthread_detach(pthread_self());
+	while(1) {
+		P(&dk->items);
+		P(&dk->mutex);
+		s = dk->qhead;
+		if((dk->qhead = s->next) == NULL)
+			dk->qtail = NULL;
+		dk->qbytes -= s->obj->dsize;
+		dk->writing = 1;
+		skip = s->obj->fromDisk &&
+		       *findEntry(dk, s->obj->durl, hashUrl(s->obj->durl)) != NULL;
+		if(skip)
+			dk->stats.skipped++;
+		V(&dk->mutex);
+
+		if(!skip)
+			writeRecord(dk, s->obj);
+		releaseObj(s->obj);
+		Free(s);
+
+		P(&dk->mutex);
+		dk->writing = 0;
+		V(&dk->mutex);
+	}
+	return NULL;
+}
+
+/* openDisk - open the tier in dir, creating it if needed, and rebuild the
+ * index from its segments. appends go to a new segment, never after what
+ * may be a torn record. return NULL on error */
+disk *openDisk(char *dir) {
+	disk *dk;
+	DIR *dp;
+	struct dirent *de;
+	unsigned int *ids = NULL, id, next = 0;
+	size_t nids = 0, i;
+	diskSegment *seg;
+	struct timeval start, end;
+	pthread_t tid;
+
+	if(mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "disk: cannot create %s: %s\n", dir, strerror(errno));
+		return NULL;
+	}
+	if((dp = opendir(dir)) == NULL) {
+		fprintf(stderr, "disk: cannot open %s: %s\n", dir, strerror(errno));
+		return NULL;
+	}
+
+	initCrc();
+	dk = (disk *)Calloc(1, sizeof(disk));
+	dk->dir = strdup(dir);
+	Sem_init(&dk->mutex, 0, 1);
+	Sem_init(&dk->items, 0, 0);
+	Sem_init(&dk->jobs, 0, 0);
+
+	gettimeofday(&start, NULL);
+	while((de = readdir(dp)) != NULL) {
+		if(sscanf(de->d_name, "seg-%u.log", &id) != 1)
+			continue;
+		ids = (unsigned int *)Realloc(ids, (nids + 1) * sizeof(*ids));
+		ids[nids++] = id;
+	}
+	closedir(dp);
+	qsort(ids, nids, sizeof(*ids), cmpId);
+	for(i = 0; i < nids; i++) {
+		if((seg = openSegment(dk, ids[i], 0)) == NULL)
+			continue;
+		next = ids[i] + 1;
+		scanSegment(dk, seg);
+		if(seg->size == 0) { //nothing was ever appended, or all was torn
+			close(seg->fd);
+			Free(seg);
+			removeSegment(dk, ids[i]);
+			continue;
+		}
+		addSegment(dk, seg);
+	}
+	Free(ids);
+	gettimeofday(&end, NULL);
+	fprintf(stderr, "disk: %lu objects in %lu segments of %s, "
+	        "scanned in %.1f ms\n", dk->stats.objects, dk->stats.segments,
+	        dir, (end.tv_sec - start.tv_sec) * 1000.0 +
+	        (end.tv_usec - start.tv_usec) / 1000.0);
+
+	if((seg = openSegment(dk, next, 1)) == NULL)
+		return NULL;
+	addSegment(dk, seg);
+	Pthread_create(&tid, NULL, diskWriter, dk);
+	for(i = 0; i < DISK_READERS; i++)
+		Pthread_create(&tid, NULL, diskReader, dk);
+	return dk;
+}
+
+/* diskSpill - queue an evicted object to be written, its reference taken
+ * over by the tier. if the queue is full the object is dropped, or if
+ * wait is set, the caller waits for room. paused, it is always dropped.
+ * the queue is bounded in bytes, a slow disk must not hold the slab space
+ * new responses need */
+void diskSpill(disk *dk, object *obj, int wait) {
+	spill *s;
+
+	P(&dk->mutex);
+	if(dk->paused) {
+		dk->stats.dropped++;
+		V(&dk->mutex);
+		releaseObj(obj);
+		return;
+	}
+	while(dk->qbytes > 0 && dk->qbytes + obj->dsize > DISK_QUEUE_BYTES) {
+		if(!wait) {
+			dk->stats.dropped++;
+			V(&dk->mutex);
+			releaseObj(obj);
+			return;
+		}
+		V(&dk->mutex);
+		usleep(1000);
+		P(&dk->mutex);
+	}
+	s = (spill *)Malloc(sizeof(spill));
+	s->obj = obj;
+	s->next = NULL;
+	if(dk->qtail != NULL)
+		dk->qtail->next = s;
+	else
+		dk->qhead = s;
+	dk->qtail = s;
+	dk->qbytes += obj->dsize;
+	V(&dk->mutex);
+	V(&dk->items);
+}
+
+/* diskFind - look up url in the index, filling hit and holding its
+ * segment if found. return 0 if found, -1 otherwise */
+int diskFind(disk *dk, char *url, diskHit *hit) {
+	diskEntry *e;
+
+	P(&dk->mutex);
+	if((e = *findEntry(dk, url, hashUrl(url))) == NULL) {
+		dk->stats.misses++;
+		V(&dk->mutex);
+		return -1;
+	}
+	e->seg->readers++;
+	hit->hash = e->hash;
+	hit->seg = e->seg;
+	hit->off = e->off;
+	hit->rec = e->rec;
+	dk->stats.hits++;
+	V(&dk->mutex);
+	return 0;
+}
+
+/* readRecord - read the response of hit into the chunks from head, see
+ * diskRead. return 0 if intact, -1 otherwise */
+static int readRecord(disk *dk, diskHit *hit, chunk *head) {
+	char *url = (char *)Malloc(hit->rec.urlSize);
+	struct iovec iov[DISK_IOV];
+	diskEntry **pp;
+	int rc = 0;
+
+	iov[0].iov_base = url;
+	iov[0].iov_len = hit->rec.urlSize;
+	if(chunkIo(hit->seg->fd, 1, iov, 1, head, hit->rec.dataSize,
+	           hit->off + sizeof(diskRecord)) < 0 ||
+	   crcChunks(crc32(0, url, hit->rec.urlSize), head, hit->rec.dataSize) !=
+	                                                        hit->rec.check)
+		rc = -1;
+
+	if(rc < 0) { //unless the URL was written again meanwhile
+		P(&dk->mutex);
+		pp = &dk->buckets[hit->hash & (DISK_BUCKETS - 1)];
+		while(*pp != NULL && ((*pp)->seg != hit->seg || (*pp)->off != hit->off))
+			pp = &(*pp)->next;
+		if(*pp != NULL)
+			unlinkEntry(dk, pp);
+		dk->stats.corrupt++;
+		V(&dk->mutex);
+	}
+	Free(url);
+	return rc;
+}
+
+/* diskReader - thread doing the queued reads one at a time and waking
+ * the task waiting for each */
+static void *diskReader(void *vargp) {
+	disk *dk = (disk *)vargp;
+	diskJob *job;
+
+	Pthread_detach(pthread_self());
+	while(1) {
+		P(&dk->jobs);
+		P(&dk->mutex);
+		job = dk->jobHead;
+		if((dk->jobHead = job->next) == NULL)
+			dk->jobTail = NULL;
+		V(&dk->mutex);
+
+		/* the waiter returns as soon as it is woken, the job with it */
+		job->rc = readRecord(dk, job->hit, job->head);
+		send_wakeup(job->fd);
+	}
+	return NULL;
+}
+
+/* diskRead - read the response of hit into the chunks from head,
+ * hit->rec.dataSize bytes, and release its segment. a record that does
+ * not match its checksum is dropped from the index. a thread reads it
+ * itself, an event loop task parks until a reader thread has. return 0
+ * if intact, -1 otherwise */
+int diskRead(disk *dk, diskHit *hit, chunk *head) {
+	diskJob job;
+
+	if(io_hooks == NULL || (job.fd = Open_wakeupfd()) < 0) {
+		job.rc = readRecord(dk, hit, head);
+	}
+	else {
+		job.hit = hit;
+		job.head = head;
+		job.next = NULL;
+		P(&dk->mutex);
+		if(dk->jobTail != NULL)
+			dk->jobTail->next = &job;
+		else
+			dk->jobHead = &job;
+		dk->jobTail = &job;
+		dk->stats.parked++;
+		V(&dk->mutex);
+		V(&dk->jobs);
+
+		wait_wakeup(job.fd);
+		Close(job.fd);
+	}
+	diskRelease(dk, hit);
+	return job.rc;
+}
+
+/* diskRelease - done with the segment of hit, closing it if it was
+ * deleted meanwhile and this was its last reader */
+void diskRelease(disk *dk, diskHit *hit) {
+	diskSegment *seg = hit->seg;
+
+	P(&dk->mutex);
+	if(--seg->readers == 0 && seg->dead) {
+		close(seg->fd);
+		Free(seg);
+	}
+	V(&dk->mutex);
+}
+
+/* diskSync - wait until every queued object is written and make the
+ * newest segment durable */
+void diskSync(disk *dk) {
+	P(&dk->mutex);
+	while(dk->qhead != NULL || dk->writing) {
+		V(&dk->mutex);
+		usleep(1000);
+		P(&dk->mutex);
+	}
+	fdatasync(dk->newest->fd);
+	V(&dk->mutex);
+}
+
+/* diskPause - while paused is set, drop the objects spilled instead of
+ * writing them, the log belongs to a new process taking over (see 
+ * reload in proxy.c), which appends to segments of its own. lookups go on */
+void diskPause(disk *dk, int paused) {
+	P(&dk->mutex);
+	dk->paused = paused;
+	V(&dk->mutex);
+}
+
+/* diskGetStats - copy the counters into out */
+void diskGetStats(disk *dk, diskStats *out) {
+	P(&dk->mutex);
+	*out = dk->stats;
+	V(&dk->mutex);
+}
@@ -0,0 +1,169 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the disk tier of the cache. Objects evicted from memory are
+ * appended by a writer thread to a log of segment files in a directory,
+ * seg-<id>.log, each up to DISK_SEGMENT_SIZE. An index in memory maps
+ * URLs to the newest record of each, and a miss in memory that is in the
+ * index is read back into the slab and cached again. When the log grows
+ * past DISK_MAX_SIZE the oldest segment is deleted with its entries.
+ * Reads for an event loop are done by DISK_READERS reader threads while
+ * the task parks on an eventfd, like lookups of the resolver (dns.c), so
+ * a cold page cache stalls the request and not the whole loop.
+ *
+ * A record is a diskRecord header, the URL and the response. The header
+ * has a checksum of its own and one of the URL and response, so on start
+ * the index is rebuilt by scanning the headers of every segment, and a
+ * torn write at the end of a segment (a crash in the middle of an append)
+ * is cut off there. A damaged response is found when it is read back and
+ * dropped from the index, so it is fetched again instead of served.
+ *
+ * ***************************************************************************/
+
+#ifndef __DISK_H__
+#define __DISK_H__
+
+#include "csapp.h"
+#include "cache.h"
+
+#define DISK_SEGMENT_SIZE (8 << 20) //segments are closed at this size
+#define DISK_MAX_SIZE (256 << 20) //oldest segments go beyond this
+#define DISK_BUCKETS 4096 //hash buckets of the index, power of 2
+#define DISK_QUEUE_BYTES (512 << 10) //evicted bytes waiting at most
+#define DISK_MAGIC 0x50525833 //"PRX3", starts every record
+#define DISK_READERS 2 //reader threads for the event loops
+
+/* diskRecord is struct for the header of a record in a segment. It has
+ * the magic number, the checksum of the rest of the header and the one of
+ * the URL and response, the sizes of the URL (with its null), response
+ * and response headers, the framing of the response, the size of its body
+ * before compression (0 if stored as received) and until when it is
+ * fresh (seconds of the wall clock) */
+typedef struct diskRecord {
+	unsigned int magic;
+	unsigned int hcheck;
+	unsigned int check;
+	unsigned int urlSize;
+	unsigned int dataSize;
+	unsigned int hdrSize;
+	int framing;
+	unsigned int plainSize;
+	unsigned int expires;
+} diskRecord;
+
+/* diskSegment is struct for one segment file. It has its id, its open
+ * file, its size, the readers reading from it, whether it was deleted
+ * (closed when the last reader is done) and the next newer segment */
+typedef struct diskSegment {
+	unsigned int id;
+	int fd;
+	size_t size;
+	int readers;
+	int dead;
+	struct diskSegment *next;
+} diskSegment;
+
+/* diskEntry is struct for one URL in the index. It has the hash and URL,
+ * the segment and offset of its record, the sizes and framing of the
+ * record and the next entry in the same bucket */
+typedef struct diskEntry {
+	unsigned long hash;
+	char *url;
+	diskSegment *seg;
+	size_t off;
+	diskRecord rec;
+	struct diskEntry *next;
+} diskEntry;
+
+/* diskHit is struct for a record found in the index. It has the hash of
+ * its URL, its segment, held for reading until diskRead or diskRelease,
+ * and its offset and header */
+typedef struct diskHit {
+	unsigned long hash;
+	diskSegment *seg;
+	size_t off;
+	diskRecord rec;
+} diskHit;
+
+/* diskJob is struct for one read handed to the reader threads. It has
+ * the record, the chunks to read it into, the eventfd the caller parks
+ * on, the result and the next read in the queue */
+typedef struct diskJob {
+	diskHit *hit;
+	chunk *head;
+	int fd;
+	int rc;
+	struct diskJob *next;
+} diskJob;
+
+/* diskStats is struct for the counters of the disk tier. hits and misses
+ * count index lookups, corrupt the records dropped when read back.
+ * parked counts the reads done by a reader thread for an event loop.
+ * spills are objects written, skipped ones already on disk and dropped
+ * ones evicted while the queue was full. objects, bytes and segments are
+ * what the log holds now */
+typedef struct diskStats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long corrupt;
+	unsigned long spills;
+	unsigned long skipped;
+	unsigned long dropped;
+	unsigned long parked;
+	unsigned long objects;
+	unsigned long bytes;
+	unsigned long segments;
+} diskStats;
+
+/* spill is struct for an evicted object waiting to be written. It has
+ * the object, held until written, and the next one in the queue */
+typedef struct spill {
+	object *obj;
+	struct spill *next;
+} spill;
+
+/* disk is struct for the whole tier. It has the directory, the segments
+ * from oldest to newest (the newest is appended to), the index, the queue
+ * of objects to write and their bytes, which stay pinned in the slab
+ * until written, whether the writer is busy, whether spills are dropped
+ * (diskPause), the queue of reads for the reader threads, a mutex for all
+ * of that, counting semaphores of queued objects and reads and the
+ * counters */
+typedef struct disk {
+	char *dir;
+	diskSegment *oldest;
+	diskSegment *newest;
+	diskEntry *buckets[DISK_BUCKETS];
+	spill *qhead;
+	spill *qtail;
+	size_t qbytes;
+	int writing;
+	diskJob *jobHead;
+	diskJob *jobTail;
+	int paused;
+	sem_t mutex;
+	sem_t items;
+	sem_t jobs;
+	diskStats stats;
+} disk;
+
+/* function prototypes for disk.c */
+disk *openDisk(char *dir);
+
+void diskSpill(disk *dk, object *obj, int wait);
+
+int diskFind(disk *dk, char *url, diskHit *hit);
+
+int diskRead(disk *dk, diskHit *hit, chunk *head);
+
+void diskRelease(disk *dk, diskHit *hit);
+
+void diskSync(disk *dk);
+
+void diskPause(disk *dk, int paused);
+
+void diskGetStats(disk *dk, diskStats *out);
+
+#endif /* __DISK_H__ */
@@ -0,0 +1,315 @@
+/******************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the resolver cache for server names, see dns.h. Every caller
+ * gets its own copy of the addresses, one malloc'd block, so an answer
+ * can be refreshed while connections are still being made from the old
+ * one. Entries past their stale time are dropped from their bucket when a
+ * new name is added to it, which keeps the table bounded by the names in
+ * use.
+ *
+ * ***************************************************************************/
+
+#include "csapp.h"
+#include "dns.h"
+
+static resolver *hookResolver; //resolver installed as resolve_hooks
+
+/* monoNs - CLOCK_MONOTONIC in nanoseconds */
+static unsigned long monoNs() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* hashName - 64 bit FNV-1a hash of host and port */
+static unsigned long hashName(char *host, char *port) {
+	unsigned long hash = 14695981039346656037UL;
+
+	while(*host) {
+		hash ^= (unsigned char)*host++;
+		hash *= 1099511628211UL;
+	}
+	hash ^= ':';
+	hash *= 1099511628211UL;
+	while(*port) {
+		hash ^= (unsigned char)*port++;
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+/* copyAddrs - copy the addrinfo list into one malloc'd block that
+ * dnsRelease frees, canonical names left out. return NULL if empty */
+static struct addrinfo *copyAddrs(struct addrinfo *list) {
+	struct addrinfo *p, *copy, *ai;
+	size_t n = 0, addrSize = 0;
+	char *addr;
+
+	for(p = list; p != NULL; p = p->ai_next) {
+		n++;
+		addrSize += p->ai_addrlen;
+	}
+	if(n == 0)
+		return NULL;
+
+	copy = (struct addrinfo *)Malloc(n * sizeof(struct addrinfo) + addrSize);
+	addr = (char *)(copy + n);
+	for(p = list, ai = copy; p != NULL; p = p->ai_next, ai++) {
+		*ai = *p;
+		ai->ai_canonname = NULL;
+		ai->ai_addr = (struct sockaddr *)addr;
+		memcpy(addr, p->ai_addr, p->ai_addrlen);
+		addr += p->ai_addrlen;
+		ai->ai_next = p->ai_next ? ai + 1 : NULL;
+	}
+	return copy;
+}
+
+/* staleEntry - whether e is of no use anymore and can be dropped.
+ * called with the resolver locked */
+static int staleEntry(dnsEntry *e, long now) {
+	return !e->resolving && e->waiters == NULL && e->nwaiting == 0 &&
+	       now >= e->expires && now >= e->staleUntil;
+}
+
+/* findEntry - look for host:port, adding it if not there after dropping
+ * the stale entries of its bucket. called with the resolver locked */
+static dnsEntry *findEntry(resolver *rs, char *host, char *port, long now) {
+	unsigned long hash = hashName(host, port);
+	dnsEntry **pp = &rs->buckets[hash & (DNS_BUCKETS - 1)];
+	dnsEntry *curr;
+
+	for(curr = *pp; curr != NULL; curr = curr->next) {
+		if(curr->hash == hash && !strcmp(curr->host, host) &&
+		   !strcmp(curr->port, port))
+			return curr;
+	}
+
+	while((curr = *pp) != NULL) {
+		if(staleEntry(curr, now)) {
+			*pp = curr->next;
+			rs->nentries--;
+			Free(curr->host);
+			Free(curr->port);
+			if(curr->addrs != NULL)
+				Free(curr->addrs);
+			Free(curr);
+		}
+		else {
+			pp = &curr->next;
+		}
+	}
+
+	curr = (dnsEntry *)Calloc(1, sizeof(dnsEntry));
+	curr->host = strdup(host);
+	curr->port = strdup(port);
+	curr->hash = hash;
+	curr->next = rs->buckets[hash & (DNS_BUCKETS - 1)];
+	rs->buckets[hash & (DNS_BUCKETS - 1)] = curr;
+	rs->nentries++;
+	return curr;
+}
+
+/* queueLookup - hand e to the resolver threads. called with the resolver
+ * locked */
+static void queueLookup(resolver *rs, dnsEntry *e) {
+	e->resolving = 1;
+	e->qnext = NULL;
+	if(rs->jobTail != NULL)
+		rs->jobTail->qnext = e;
+	else
+		rs->jobHead = e;
+	rs->jobTail = e;
+	V(&rs->jobs);
+}
+
+/* resolveThread - take queued entries one at a time, look them up with
+ * getaddrinfo, store the answer and wake everyone waiting for it */
+static void *resolveThread(void *vargp) {
+	resolver *rs = (resolver *)vargp;
+	struct addrinfo hints, *list, *addrs;
+	unsigned long start, ns;
+	dnsWaiter *w, *next;
+	dnsEntry *e;
+	long now;
+	int rc;
+
+	Pthread_detach(pthread_self());
+
+	/* same hints as open_clientfd */
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+
+	while(1) {
+		P(&rs->jobs);
+		P(&rs->mutex);
+		e = rs->jobHead;
+		rs->jobHead = e->qnext;
+		if(rs->jobHead == NULL)
+			rs->jobTail = NULL;
+		V(&rs->mutex);
+
+		/* host and port never change while the entry is resolving */
+		start = monoNs();
+		rc = getaddrinfo(e->host, e->port, &hints, &list);
+		ns = monoNs() - start;
+		addrs = NULL;
+		if(rc == 0) {
+			addrs = copyAddrs(list);
+			freeaddrinfo(list);
+			if(addrs == NULL)
+				rc = EAI_NONAME;
+		}
+
+		P(&rs->mutex);
+		now = (start + ns) / 1000000000UL;
+		if(rc == 0) {
+			if(e->addrs != NULL)
+				Free(e->addrs);
+			e->addrs = addrs;
+			e->err = 0;
+			e->expires = now + DNS_TTL_SECS;
+			e->staleUntil = e->expires + DNS_STALE_SECS;
+		}
+		else {
+			/* a stale answer beats none, until it is too old */
+			if(e->addrs != NULL && now >= e->staleUntil) {
+				Free(e->addrs);
+				e->addrs = NULL;
+			}
+			e->err = rc;
+			e->expires = now + DNS_NEG_TTL_SECS;
+			rs->stats.failures++;
+		}
+		rs->stats.resolves++;
+		rs->stats.resolveNsTotal += ns;
+		if(ns > rs->stats.resolveNsMax)
+			rs->stats.resolveNsMax = ns;
+		e->resolving = 0;
+		w = e->waiters;
+		e->waiters = NULL;
+		V(&rs->mutex);
+
+		/* a waiter returns as soon as it is woken, its struct with it */
+		for(; w != NULL; w = next) {
+			next = w->next;
+			send_wakeup(w->fd);
+		}
+	}
+	return NULL;
+}
+
+/* initResolver - initialize an empty resolver cache in the heap and start
+ * nthreads resolver threads */
+resolver *initResolver(int nthreads) {
+	resolver *init = (resolver *)Calloc(1, sizeof(resolver));
+	pthread_t tid;
+	int i;
+
+	Sem_init(&init->mutex, 0, 1);
+	Sem_init(&init->jobs, 0, 0);
+	for(i = 0; i < nthreads; i++)
+		Pthread_create(&tid, NULL, resolveThread, init);
+	return init;
+}
+
+/* dnsHookLookup, dnsHookRelease - resolve_hooks for open_clientfd */
+static int dnsHookLookup(char *host, char *port, struct addrinfo **res) {
+	return dnsLookup(hookResolver, host, port, res);
+}
+
+static void dnsHookRelease(struct addrinfo *res) {
+	dnsRelease(res);
+}
+
+static resolve_hooks_t dnsHooks = { dnsHookLookup, dnsHookRelease };
+
+/* dnsInstall - make open_clientfd resolve names through rs */
+void dnsInstall(resolver *rs) {
+	hookResolver = rs;
+	resolve_hooks = &dnsHooks;
+}
+
+/* dnsLookup - find the addresses of host:port, from the cache if fresh or
+ * not too stale, otherwise waiting for a resolver thread to look them up.
+ * on success *res is the caller's copy for dnsRelease. return 0 on
+ * success, -1 if the name cannot be resolved */
+int dnsLookup(resolver *rs, char *host, char *port, struct addrinfo **res) {
+	long now = monoNs() / 1000000000UL;
+	dnsWaiter self;
+	dnsEntry *e;
+	int err;
+
+	P(&rs->mutex);
+	rs->stats.lookups++;
+	e = findEntry(rs, host, port, now);
+
+	/* fresh answer, or fresh failure */
+	if(!e->resolving && now < e->expires) {
+		rs->stats.hits++;
+		*res = e->addrs ? copyAddrs(e->addrs) : NULL;
+		V(&rs->mutex);
+		return *res ? 0 : -1;
+	}
+
+	/* expired but not too old, use it and refresh it meanwhile */
+	if(e->addrs != NULL && now < e->staleUntil) {
+		rs->stats.staleHits++;
+		if(!e->resolving)
+			queueLookup(rs, e);
+		*res = copyAddrs(e->addrs);
+		V(&rs->mutex);
+		return 0;
+	}
+
+	/* nothing usable, wait for a lookup, starting one if none runs */
+	if(e->resolving) {
+		rs->stats.joined++;
+	}
+	else {
+		rs->stats.misses++;
+		queueLookup(rs, e);
+	}
+	if((self.fd = Open_wakeupfd()) < 0) {
+		V(&rs->mutex);
+		return -1;
+	}
+	self.next = e->waiters;
+	e->waiters = &self;
+	e->nwaiting++;
+	V(&rs->mutex);
+
+	wait_wakeup(self.fd);
+	Close(self.fd);
+
+	P(&rs->mutex);
+	e->nwaiting--;
+	err = e->err;
+	*res = e->addrs ? copyAddrs(e->addrs) : NULL;
+	V(&rs->mutex);
+
+	if(*res == NULL) {
+		if(err)
+			gai_error(err, "dnsLookup error");
+		return -1;
+	}
+	return 0;
+}
+
+/* dnsRelease - free the copy of addresses returned by dnsLookup */
+void dnsRelease(struct addrinfo *res) {
+	Free(res);
+}
+
+/* dnsGetStats - copy the counters into out */
+void dnsGetStats(resolver *rs, dnsStats *out) {
+	P(&rs->mutex);
+	*out = rs->stats;
+	V(&rs->mutex);
+}
@@ -0,0 +1,100 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the resolver cache for server names. getaddrinfo blocks, which
+ * costs a whole thread in thread per connection mode and would stall a
+ * whole event loop, so lookups are done by a few resolver threads and the
+ * caller parks on an eventfd until its answer is in (a task parks through
+ * io_hooks, a thread just blocks in read). Answers are cached by host and
+ * port for DNS_TTL_SECS, since getaddrinfo does not tell the real TTL,
+ * and failures for DNS_NEG_TTL_SECS. An expired answer is still handed out
+ * for up to DNS_STALE_SECS while it is refreshed in the background, and
+ * callers asking for a name already being resolved wait for that lookup
+ * instead of starting another one.
+ *
+ * ***************************************************************************/
+
+#ifndef __DNS_H__
+#define __DNS_H__
+
+#include "csapp.h"
+
+#define DNS_BUCKETS 256 //hash buckets for names, power of 2
+#define DNS_THREADS 4 //resolver threads
+#define DNS_TTL_SECS 60 //answers are fresh this long
+#define DNS_STALE_SECS 300 //then still served this long while refreshed
+#define DNS_NEG_TTL_SECS 5 //failed lookups are remembered this long
+
+/* dnsWaiter is struct for one caller waiting for a lookup. It has the
+ * eventfd the caller parks on and the next waiter of the same lookup */
+typedef struct dnsWaiter {
+	int fd;
+	struct dnsWaiter *next;
+} dnsWaiter;
+
+/* dnsEntry is struct for one host and port in the cache. It has the host
+ * and port strings, hash of both, the addresses as one block (NULL if not
+ * resolved or failed), the getaddrinfo error of the last lookup, until
+ * when the answer is fresh and until when it may be served stale (seconds
+ * of CLOCK_MONOTONIC), whether a lookup is queued or running, its waiters,
+ * the callers still copying the answer, the next entry in the same bucket
+ * and the next entry in the lookup queue */
+typedef struct dnsEntry {
+	char *host;
+	char *port;
+	unsigned long hash;
+	struct addrinfo *addrs;
+	int err;
+	long expires;
+	long staleUntil;
+	int resolving;
+	dnsWaiter *waiters;
+	int nwaiting;
+	struct dnsEntry *next;
+	struct dnsEntry *qnext;
+} dnsEntry;
+
+/* dnsStats is struct for the resolver counters. lookups is every call,
+ * answered from the cache fresh (hits), stale (staleHits) or by waiting
+ * for a lookup started by the call (misses) or already running (joined).
+ * resolves counts getaddrinfo calls, of which failures failed, and the
+ * time they took in total and at most */
+typedef struct dnsStats {
+	unsigned long lookups;
+	unsigned long hits;
+	unsigned long staleHits;
+	unsigned long misses;
+	unsigned long joined;
+	unsigned long resolves;
+	unsigned long failures;
+	unsigned long resolveNsTotal;
+	unsigned long resolveNsMax;
+} dnsStats;
+
+/* resolver is struct for the whole cache. It has the hash buckets of
+ * entries and their count, the queue of entries to look up, a mutex for
+ * all of it, a counting semaphore of queued lookups and the counters */
+typedef struct resolver {
+	dnsEntry *buckets[DNS_BUCKETS];
+	size_t nentries;
+	dnsEntry *jobHead;
+	dnsEntry *jobTail;
+	sem_t mutex;
+	sem_t jobs;
+	dnsStats stats;
+} resolver;
+
+/* function prototypes for dns.c */
+resolver *initResolver(int nthreads);
+
+void dnsInstall(resolver *rs);
+
+int dnsLookup(resolver *rs, char *host, char *port, struct addrinfo **res);
+
+void dnsRelease(struct addrinfo *res);
+
+void dnsGetStats(resolver *rs, dnsStats *out);
+
+#endif /* __DNS_H__ */
@@ -0,0 +1,648 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * Event loop engine for the proxy, see event.h. Each loop thread waits in
+ * epoll_wait for edges on its listening socket and on descriptors its tasks
+ * are parked on. Descriptors are added to epoll lazily, edge-triggered for
+ * both directions, the first time a task waits on them, and forgotten when
+ * they are closed through Close. A task only parks after its read, write or
+ * connect returned EAGAIN/EINPROGRESS, so edges can never be missed.
+ *
+ * Out of descriptors, accept fails and the clients already in the backlog
+ * would get no new edge. Each loop keeps a spare descriptor for that: it
+ * is closed to accept the next client and close it at once, then opened
+ * again, so the backlog drains by turning clients away instead of leaving
+ * them waiting. On any other error the listener is armed again.
+ *
+ * A task with a timeout (set_io_timeout) is also put on the loop's timer
+ * wheel while it is parked: a hashed wheel of WHEEL_SLOTS lists, one per
+ * WHEEL_TICK_MS tick, a task going into the list of the tick it expires
+ * in. Adding and removing a timer is O(1), and the loop wakes once a tick
+ * while there are timers to run the tasks whose time is up, their waits
+ * failing with ETIMEDOUT. Timers further out than one turn of the wheel
+ * stay in their list until their turn comes round.
+ *
+ * A loop may take over a listening socket handed over by the process it
+ * replaces (evListen) instead of opening one. When the proxy drains, 
+ * evDrain wakes every loop through an eventfd of its own: the loop closes
+ * its listener, and ends the waits of tasks parked on their client alone
+ * as if they timed out, so idle keep-alive clients are let go at once. 
+ * The tasks busy with a request finish it.
+ *
+ * Pinned (evStart with pin), loop i runs on the i-th CPU the proxy may
+ * use, so the memory it touches first, its tasks and their stacks above
+ * all, is on the NUMA node it runs on.
+ *
+ * ***************************************************************************/
+
+#include <sys/epoll.h>
+#include <ucontext.h>
+#include "csapp.h"
+#include "event.h"
+#include "topo.h"
+
+/* accept4 is only declared with _GNU_SOURCE, which clashes with the
+ * gai_error in csapp.h */
+int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+
+#define TASK_STACK_SIZE (512*1024) //task stacks, touched pages only
+#define MAX_FREE_TASKS 256 //finished tasks kept per loop for reuse
+#define MAX_EVENTS 256 //events taken from epoll_wait at once
+#define WHEEL_SLOTS 1024 //lists of the timer wheel, power of 2
+#define WHEEL_TICK_MS 10 //time a list of the wheel covers
+
+/* task is struct for one client connection running as a coroutine. It has
+ * the saved context and stack, the client file descriptor, the descriptors
+ * and events it is parked on (-1 for none, a tunnel waits on both of its
+ * sockets), whether it is done, the next task in the loop's free list, the
+ * timeout of its waits, and while parked with one the tick of its wheel
+ * list (-1 if in none), when it expires, its neighbours in the list and
+ * whether it timed out */
+typedef struct task {
+	ucontext_t ctx;
+	char *stack;
+	int clientfd;
+	int waitfds[2];
+	unsigned int waitEvents[2];
+	int done;
+	struct task *next;
+	long timeout;
+	long tick;
+	long expires;
+	struct task *wheelPrev;
+	struct task *wheelNext;
+	int timedOut;
+} task;
+
+/* fdState is per loop state of one file descriptor: whether it has been
+ * added to the loop's epoll and the task currently parked on it */
+typedef struct fdState {
+	int registered;
+	task *waiter;
+} fdState;
+
+/* loop is struct for one event loop thread. It has the epoll instance, the
+ * listening socket (-1 once drained), the spare descriptor (-1 if none),
+ * the eventfd evDrain wakes it with, the CPU it is pinned to (-1 if none),
+ * the loop's own context, the running task, the free task list, a table
+ * of descriptor states indexed by file descriptor, the timer wheel with
+ * the next tick to run and how many tasks are on it, and when the sweep
+ * of evSweep is due next */
+typedef struct loop {
+	int epfd;
+	int listenfd;
+	int sparefd;
+	int wakefd;
+	int cpu;
+	ucontext_t main;
+	task *curr;
+	task *freeTasks;
+	int nfree;
+	fdState *fds;
+	int nfds;
+	handler_fn *handler;
+	task *wheel[WHEEL_SLOTS];
+	long tick;
+	int ntimers;
+	long sweepAt;
+} loop;
+
+static __thread loop *currLoop; //loop owned by this thread
+static sweep_fn *sweeper; //run by every loop, see evSweep
+static long sweepMs;
+static loop **loops; //every loop, see evListen
+static int nloops;
+
+/* function prototypes */
+static int evWait(int fd, int events);
+static void evClose(int fd);
+static void evTimeout(long ms);
+static void stopListening(loop *lp);
+static int evWaitEither(int fd1, int events1, int fd2, int events2);
+static io_hooks_t evHooks = { evWait, evClose, evTimeout, evWaitEither };
+
+/* nowMs - milliseconds of CLOCK_MONOTONIC */
+static long nowMs() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/* openReuseportfd - same as open_listenfd, but with SO_REUSEPORT so each
+ * loop can bind its own non-blocking listening socket to the same port */
+static int openReuseportfd(char *port) {
+	struct addrinfo hints, *listp, *p;
+	int listenfd, optval = 1;
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG | AI_NUMERICSERV;
+	if(getaddrinfo(NULL, port, &hints, &listp) != 0)
+		return -1;
+
+	for(p = listp; p; p = p->ai_next) {
+		if((listenfd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK,
+		                      p->ai_protocol)) < 0)
+			continue;
+		setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(int));
+		setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(int));
+		if(bind(listenfd, p->ai_addr, p->ai_addrlen) == 0)
+			break;
+		close(listenfd);
+	}
+
+	freeaddrinfo(listp);
+	if(!p)
+		return -1;
+
+	if(listen(listenfd, LISTENQ) < 0) {
+		close(listenfd);
+		return -1;
+	}
+	return listenfd;
+}
+
+/* getFdState - return the state of fd in loop lp, growing the table
+ * if fd is beyond it, NULL if out of memory */
+static fdState *getFdState(loop *lp, int fd) {
+	if(fd >= lp->nfds) {
+		int n = lp->nfds ? lp->nfds : 1024;
+		while(n <= fd)
+			n *= 2;
+		fdState *fds = realloc(lp->fds, n * sizeof(fdState));
+		if(fds == NULL)
+			return NULL;
+		memset(fds + lp->nfds, 0, (n - lp->nfds) * sizeof(fdState));
+		lp->fds = fds;
+		lp->nfds = n;
+	}
+	return &lp->fds[fd];
+}
+
+/* taskMain - entry of every task, run the handler on the client, mark
+ * the task done and fall back to the loop through uc_link */
+static void taskMain(void) {
+	task *t = currLoop->curr;
+	currLoop->handler(t->clientfd);
+	t->done = 1;
+}
+
+/* newTask - take a task from the free list or allocate one with a guarded
+ * stack, and prepare it to run the handler on clientfd */
+static task *newTask(loop *lp, int clientfd) {
+	task *t;
+
+	if((t = lp->freeTasks) != NULL) {
+		lp->freeTasks = t->next;
+		lp->nfree--;
+	}
+	else {
+		if((t = calloc(1, sizeof(task))) == NULL)
+			return NULL;
+		t->stack = mmap(NULL, TASK_STACK_SIZE, PROT_READ | PROT_WRITE,
+		                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(t->stack == MAP_FAILED) {
+			free(t);
+			return NULL;
+		}
+		//lowest page is the guard against stack overflow
+		mprotect(t->stack, getpagesize(), PROT_NONE);
+	}
+
+	t->clientfd = clientfd;
+	t->waitfds[0] = t->waitfds[1] = -1;
+	t->done = 0;
+	t->timeout = 0;
+	t->tick = -1;
+	getcontext(&t->ctx);
+	t->ctx.uc_stack.ss_sp = t->stack;
+	t->ctx.uc_stack.ss_size = TASK_STACK_SIZE;
+	t->ctx.uc_link = &lp->main;
+	makecontext(&t->ctx, taskMain, 0);
+	return t;
+}
+
+/* freeTask - put a finished task back in the free list, or release it if
+ * the free list is already full */
+static void freeTask(loop *lp, task *t) {
+	if(lp->nfree < MAX_FREE_TASKS) {
+		t->next = lp->freeTasks;
+		lp->freeTasks = t;
+		lp->nfree++;
+		return;
+	}
+	munmap(t->stack, TASK_STACK_SIZE);
+	free(t);
+}
+
+/* unparkTask - forget the descriptors task t is parked on in loop lp */
+static void unparkTask(loop *lp, task *t) {
+	int i, fd;
+
+	for(i = 0; i < 2; i++) {
+		fd = t->waitfds[i];
+		if(fd >= 0 && fd < lp->nfds && lp->fds[fd].waiter == t)
+			lp->fds[fd].waiter = NULL;
+		t->waitfds[i] = -1;
+	}
+}
+
+/* runTask - switch to task t until it parks or finishes */
+static void runTask(loop *lp, task *t) {
+	lp->curr = t;
+	swapcontext(&lp->main, &t->ctx);
+	lp->curr = NULL;
+	if(t->done)
+		freeTask(lp, t);
+}
+
+/* wheelAdd - put parked task t on the wheel of lp, in the list of the first
+ * tick at or after it expires, or of the next tick to run if that one has
+ * gone by */
+static void wheelAdd(loop *lp, task *t) {
+	task **slot;
+
+	t->tick = (t->expires + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+	if(t->tick < lp->tick)
+		t->tick = lp->tick;
+	slot = &lp->wheel[t->tick & (WHEEL_SLOTS - 1)];
+	t->wheelPrev = NULL;
+	t->wheelNext = *slot;
+	if(*slot != NULL)
+		(*slot)->wheelPrev = t;
+	*slot = t;
+	lp->ntimers++;
+}
+
+/* wheelRemove - take task t off the wheel of lp */
+static void wheelRemove(loop *lp, task *t) {
+	if(t->wheelPrev != NULL)
+		t->wheelPrev->wheelNext = t->wheelNext;
+	else
+		lp->wheel[t->tick & (WHEEL_SLOTS - 1)] = t->wheelNext;
+	if(t->wheelNext != NULL)
+		t->wheelNext->wheelPrev = t->wheelPrev;
+	t->tick = -1;
+	lp->ntimers--;
+}
+
+/* wheelRun - run every tick of the wheel of lp up to now, resuming the
+ * tasks whose time is up with their wait timed out. the expired ones are
+ * taken off first, a resumed task may go back on the same list */
+static void wheelRun(loop *lp) {
+	long now = nowMs(), last = now / WHEEL_TICK_MS;
+	task *t, *next, *expired;
+	int slot;
+
+	if(last - lp->tick >= WHEEL_SLOTS) //every list is due
+		lp->tick = last - WHEEL_SLOTS + 1;
+	while(lp->tick <= last) {
+		slot = lp->tick++ & (WHEEL_SLOTS - 1);
+		expired = NULL;
+		for(t = lp->wheel[slot]; t != NULL; t = next) {
+			next = t->wheelNext;
+			if(t->expires > now)
+				continue;
+			wheelRemove(lp, t);
+			t->next = expired;
+			expired = t;
+		}
+		for(t = expired; t != NULL; t = next) {
+			next = t->next;
+			unparkTask(lp, t);
+			t->timedOut = 1;
+			runTask(lp, t);
+		}
+	}
+}
+
+/* parkOn - make the running task t of lp the waiter of fd for events,
+ * the i-th of its descriptors. return -1 if fd cannot be watched */
+static int parkOn(loop *lp, task *t, int i, int fd, int events) {
+	fdState *st;
+
+	if((st = getFdState(lp, fd)) == NULL)
+		return -1;
+
+	/* first wait on fd in this loop, watch both directions edge-triggered.
+	 * readiness at this point is reported by epoll right away */
+	if(!st->registered) {
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.fd = fd;
+		if(epoll_ctl(lp->epfd, EPOLL_CTL_ADD, fd, &ev) < 0 && errno != EEXIST)
+			return -1;
+		st->registered = 1;
+	}
+
+	t->waitfds[i] = fd;
+	t->waitEvents[i] = EPOLLERR | EPOLLHUP;
+	if(events & POLLIN)
+		t->waitEvents[i] |= EPOLLIN | EPOLLRDHUP;
+	if(events & POLLOUT)
+		t->waitEvents[i] |= EPOLLOUT;
+	st->waiter = t;
+	return 0;
+}
+
+/* evWait - io_hooks wait, park the running task until fd is ready for
+ * events or its timeout. return -1 if not called from a task or fd cannot
+ * be watched, and with errno ETIMEDOUT if the timeout came first */
+static int evWait(int fd, int events) {
+	return evWaitEither(fd, events, -1, 0);
+}
+
+/* evWaitEither - io_hooks waitEither, same as evWait but until fd1 is
+ * ready for events1 or fd2 for events2. a descriptor with no events, or
+ * fd2 -1, is not waited on */
+static int evWaitEither(int fd1, int events1, int fd2, int events2) {
+	loop *lp = currLoop;
+	task *t;
+
+	if(lp == NULL || (t = lp->curr) == NULL) {
+		errno = EAGAIN;
+		return -1;
+	}
+	if((fd1 >= 0 && events1 && parkOn(lp, t, 0, fd1, events1) < 0) ||
+	   (fd2 >= 0 && events2 && parkOn(lp, t, 1, fd2, events2) < 0)) {
+		unparkTask(lp, t);
+		return -1;
+	}
+	t->timedOut = 0;
+	if(t->timeout > 0) {
+		t->expires = nowMs() + t->timeout;
+		wheelAdd(lp, t);
+	}
+
+	swapcontext(&t->ctx, &lp->main); //back to the loop until woken
+
+	if(t->tick >= 0) //woken before its time
+		wheelRemove(lp, t);
+	if(t->timedOut) {
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	return 0;
+}
+
+/* evTimeout - io_hooks timeout, limit the waits of the running task */
+static void evTimeout(long ms) {
+	if(currLoop != NULL && currLoop->curr != NULL)
+		currLoop->curr->timeout = ms;
+}
+
+/* evClose - io_hooks close, closing fd removes it from epoll, forget it */
+static void evClose(int fd) {
+	loop *lp = currLoop;
+
+	if(lp != NULL && fd >= 0 && fd < lp->nfds) {
+		lp->fds[fd].registered = 0;
+		lp->fds[fd].waiter = NULL;
+	}
+}
+
+/* turnAway - out of descriptors, accept the next client with the spare
+ * one and close it, then take the spare back if there is one again */
+static void turnAway(loop *lp) {
+	int clientfd;
+
+	close(lp->sparefd);
+	if((clientfd = accept(lp->listenfd, NULL, NULL)) >= 0)
+		close(clientfd);
+	lp->sparefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+/* rearmListener - have epoll report the listener of lp again if clients
+ * are still waiting, accept failed before the backlog was empty */
+static void rearmListener(loop *lp) {
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.fd = lp->listenfd;
+	epoll_ctl(lp->epfd, EPOLL_CTL_MOD, lp->listenfd, &ev);
+}
+
+/* acceptAll - accept every pending client and run each one as a task until
+ * it first parks. edge-triggered, so keep going until EAGAIN */
+static void acceptAll(loop *lp) {
+	int clientfd;
+	task *t;
+
+	while(1) {
+		clientfd = accept4(lp->listenfd, NULL, NULL, SOCK_NONBLOCK);
+		if(clientfd < 0) {
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			if((errno == EMFILE || errno == ENFILE) && lp->sparefd >= 0) {
+				turnAway(lp);
+				continue;
+			}
+			unix_error("accept error");
+			rearmListener(lp);
+			return;
+		}
+		if((t = newTask(lp, clientfd)) == NULL) {
+			close(clientfd);
+			continue;
+		}
+		runTask(lp, t);
+	}
+}
+
+/* stopListening - the proxy drains: close the listener of lp, another
+ * process serves it now, and resume the tasks parked on their client
+ * alone for reading with their wait timed out. those are between requests
+ * or, rarely, in the middle of sending one, and are closed. tasks busy
+ * answering a request wait on anything else and finish it */
+static void stopListening(loop *lp) {
+	uint64_t count;
+	task *t;
+	int fd;
+
+	if(read(lp->wakefd, &count, sizeof(count)) < 0 || lp->listenfd < 0)
+		return;
+	epoll_ctl(lp->epfd, EPOLL_CTL_DEL, lp->listenfd, NULL);
+	close(lp->listenfd);
+	lp->listenfd = -1;
+
+	for(fd = 0; fd < lp->nfds; fd++) {
+		if((t = lp->fds[fd].waiter) == NULL || fd != t->clientfd ||
+		   t->waitfds[0] != fd || t->waitfds[1] >= 0 ||
+		   !(t->waitEvents[0] & EPOLLIN))
+			continue;
+		unparkTask(lp, t);
+		t->timedOut = 1;
+		runTask(lp, t);
+	}
+}
+
+/* loopThread - body of an event loop thread, never returns */
+static void *loopThread(void *vargp) {
+	loop *lp = (loop *)vargp;
+	struct epoll_event evs[MAX_EVENTS];
+	int i, n, fd, wait;
+	long due;
+	task *t;
+
+	/* pinned first, so its tasks and buffers are in its node's memory */
+	if(lp->cpu >= 0 && topoPin(lp->cpu) < 0)
+		unix_error("cannot pin event loop");
+	currLoop = lp;
+	io_hooks = &evHooks;
+	lp->tick = nowMs() / WHEEL_TICK_MS;
+	lp->sweepAt = nowMs() + sweepMs;
+
+	while(1) {
+		/* with timers, wake up no later than the next tick is due, and
+		 * with a sweeper no later than its next sweep */
+		wait = -1;
+		if(lp->ntimers > 0) {
+			wait = (int)(lp->tick * WHEEL_TICK_MS - nowMs());
+			if(wait < 0)
+				wait = 0;
+		}
+		if(sweeper != NULL) {
+			due = lp->sweepAt - nowMs();
+			if(due < 0)
+				due = 0;
+			if(wait < 0 || due < wait)
+				wait = (int)due;
+		}
+		if((n = epoll_wait(lp->epfd, evs, MAX_EVENTS, wait)) < 0) {
+			if(errno != EINTR)
+				unix_error("epoll_wait error");
+			continue;
+		}
+		for(i = 0; i < n; i++) {
+			fd = evs[i].data.fd;
+			if(fd == lp->listenfd) {
+				acceptAll(lp);
+				continue;
+			}
+			if(fd == lp->wakefd) {
+				stopListening(lp);
+				continue;
+			}
+			/* wake the task parked on fd if this is the edge it waits for */
+			if(fd < lp->nfds && (t = lp->fds[fd].waiter) != NULL &&
+			   ((t->waitfds[0] == fd && (evs[i].events & t->waitEvents[0])) ||
+			    (t->waitfds[1] == fd && (evs[i].events & t->waitEvents[1])))) {
+				unparkTask(lp, t);
+				runTask(lp, t);
+			}
+		}
+		if(lp->ntimers > 0)
+			wheelRun(lp);
+		if(sweeper != NULL && nowMs() >= lp->sweepAt) {
+			sweeper();
+			lp->sweepAt = nowMs() + sweepMs;
+		}
+	}
+	return NULL;
+}
+
+/* initLoop - create the epoll instance, listening socket and eventfd of a
+ * loop. the listener is listenfd if it is not -1, one handed over */
+static loop *initLoop(char *port, int listenfd) {
+	struct epoll_event ev;
+	loop *lp = (loop *)Calloc(1, sizeof(loop));
+
+	if(listenfd >= 0)
+		fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+	else if((listenfd = openReuseportfd(port)) < 0) {
+		Free(lp);
+		return NULL;
+	}
+	lp->listenfd = listenfd;
+	lp->wakefd = -1;
+	if((lp->epfd = epoll_create1(0)) < 0)
+		goto fail;
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.fd = lp->listenfd;
+	if(epoll_ctl(lp->epfd, EPOLL_CTL_ADD, lp->listenfd, &ev) < 0 ||
+	   (lp->wakefd = Open_wakeupfd()) < 0)
+		goto fail;
+	ev.data.fd = lp->wakefd;
+	if(epoll_ctl(lp->epfd, EPOLL_CTL_ADD, lp->wakefd, &ev) < 0)
+		goto fail;
+	lp->sparefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	return lp;
+
+fail:
+	if(lp->wakefd >= 0)
+		close(lp->wakefd);
+	if(lp->epfd >= 0)
+		close(lp->epfd);
+	close(lp->listenfd);
+	Free(lp);
+	return NULL;
+}
+
+/* evSweep - have every loop run sweep every ms milliseconds, for state
+ * of its own such as idle connections. called before evStart */
+void evSweep(sweep_fn *sweep, long ms) {
+	sweeper = sweep;
+	sweepMs = ms;
+}
+
+/* evListen - set up n event loops listening on port, each taking one of
+ * the nfds listening sockets in fds handed over, if any, before opening
+ * one of its own. those left over are closed. every listener is open 
+ * before serving so a bad port fails up front. return -1 on error */
+int evListen(char *port, int n, int *fds, int nfds) {
+	int i;
+
+	if(n < 1)
+		n = 1;
+	loops = (loop **)Calloc(n, sizeof(loop *));
+	for(i = 0; i < n; i++) {
+		if((loops[i] = initLoop(port, i < nfds ? fds[i] : -1)) == NULL) {
+			unix_error("evListen error");
+			return -1;
+		}
+	}
+	for(; i < nfds; i++)
+		close(fds[i]);
+	nloops = n;
+	return 0;
+}
+
+/* evStart - serve the loops of evListen with handler, each pinned to a
+ * CPU of its own in turn if pin is set. the calling thread becomes the 
+ * first loop, so this never returns */
+void evStart(handler_fn *handler, int pin) {
+	pthread_t tid;
+	int i;
+
+	for(i = 0; i < nloops; i++) {
+		loops[i]->handler = handler;
+		loops[i]->cpu = pin ? i : -1;
+	}
+	for(i = 1; i < nloops; i++)
+		Pthread_create(&tid, NULL, loopThread, loops[i]);
+	loopThread(loops[0]);
+}
+
+/* evListeners - put the listening sockets of the loops in fds, at most
+ * most of them, to hand them over. return how many */
+int evListeners(int *fds, int most) {
+	int i;
+
+	for(i = 0; i < nloops && i < most; i++)
+		fds[i] = loops[i]->listenfd;
+	return i;
+}
+
+/* evDrain - stop accepting: wake every loop to close its listener and let
+ * its idle clients go, see stopListening. any thread may call it once */
+void evDrain() {
+	int i;
+
+	for(i = 0; i < nloops; i++)
+		send_wakeup(loops[i]->wakefd);
+}
@@ -0,0 +1,45 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * Event loop engine for the proxy. N loop threads each own an edge-triggered
+ * epoll instance and a SO_REUSEPORT listening socket on the same port, so
+ * the kernel spreads new connections across loops. Every accepted client
+ * runs as a task (a small coroutine) on its loop: the task executes the
+ * ordinary request code, and whenever a non-blocking socket returns EAGAIN
+ * the csapp I/O hooks park the task on that descriptor and switch back to
+ * the loop. The task's saved context is the per-connection state machine
+ * (reading request, connecting upstream, relaying), without a kernel thread
+ * or an 8 MB stack per connection.
+ *
+ * On a hot reload the listening sockets pass to the new process, and the
+ * loops of the old one stop accepting and finish their clients.
+ *
+ * ***************************************************************************/
+
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#include "csapp.h"
+
+/* handler_fn is run once per accepted client on a task, and must close
+ * the client file descriptor before returning */
+typedef void handler_fn(int clientfd);
+
+/* sweep_fn is run by every loop on its own thread, outside of any task,
+ * every few seconds, see evSweep */
+typedef void sweep_fn(void);
+
+/* function prototypes for event.c */
+int evListen(char *port, int nloops, int *fds, int nfds);
+
+void evSweep(sweep_fn *sweep, long ms);
+
+void evStart(handler_fn *handler, int pin);
+
+int evListeners(int *fds, int most);
+
+void evDrain();
+
+#endif /* __EVENT_H__ */
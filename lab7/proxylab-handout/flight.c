@@ -0,0 +1,202 @@
+/******************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the table of responses in flight, see flight.h. One mutex
+ * covers the table and the state of all flights: only misses come here,
+ * and the leader takes it once per read from the server. Followers park
+ * on their own eventfd, and the leader wakes the parked ones whenever
+ * there is something new for them.
+ *
+ * ***************************************************************************/
+
+#include "csapp.h"
+#include "flight.h"
+
+/* hashUrl - 64 bit FNV-1a hash of the url */
+static unsigned long hashUrl(char *url) {
+	unsigned long hash = 14695981039346656037UL;
+
+	while(*url) {
+		hash ^= (unsigned char)*url++;
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+/* wakeAll - wake every parked follower of f. called with the table locked,
+ * a follower cannot leave before it is woken */
+static void wakeAll(flight *f) {
+	flightWaiter *w, *next;
+
+	for(w = f->waiters; w != NULL; w = next) {
+		next = w->next;
+		send_wakeup(w->fd);
+	}
+	f->waiters = NULL;
+}
+
+/* unlinkFlight - take f out of the table, later misses lead a new fetch
+ * or find the object in the cache. called with the table locked */
+static void unlinkFlight(flightTable *ft, flight *f) {
+	flight **pp = &ft->buckets[f->hash & (FLIGHT_BUCKETS - 1)];
+
+	if(!f->inTable)
+		return;
+	while(*pp != f)
+		pp = &(*pp)->next;
+	*pp = f->next;
+	f->inTable = 0;
+}
+
+/* initFlights - initialize an empty table in the heap */
+flightTable *initFlights() {
+	flightTable *init = (flightTable *)Calloc(1, sizeof(flightTable));
+
+	Sem_init(&init->mutex, 0, 1);
+	return init;
+}
+
+/* flightStart - join the flight of url, or start one if there is none.
+ * *leader tells which. the flight is held until flightRelease */
+flight *flightStart(flightTable *ft, char *url, int *leader) {
+	unsigned long hash = hashUrl(url);
+	flight **bucket = &ft->buckets[hash & (FLIGHT_BUCKETS - 1)];
+	flight *f;
+
+	P(&ft->mutex);
+	for(f = *bucket; f != NULL; f = f->next) {
+		if(f->hash == hash && !strcmp(f->url, url)) {
+			f->refcnt++;
+			ft->stats.followers++;
+			V(&ft->mutex);
+			*leader = 0;
+			return f;
+		}
+	}
+
+	f = (flight *)Calloc(1, sizeof(flight));
+	f->url = strdup(url);
+	f->hash = hash;
+	f->state = FLIGHT_HEADERS;
+	f->refcnt = 1;
+	f->inTable = 1;
+	f->next = *bucket;
+	*bucket = f;
+	ft->stats.leaders++;
+	V(&ft->mutex);
+	*leader = 1;
+	return f;
+}
+
+/* flightShare - the leader has received the headers into the chunks of
+ * cl, cl->size bytes so far of which hdrSize are headers before the empty
+ * line. the followers stream it if total, the size of the whole response,
+ * is known, or wait for it all if total is 0. the chunks are the flight's
+ * from now on */
+void flightShare(flightTable *ft, flight *f, chunkList *cl, size_t hdrSize, \
+                                                size_t total, queue *cache) {
+	P(&ft->mutex);
+	f->chunks = *cl;
+	f->hdrSize = hdrSize;
+	f->total = total;
+	f->cache = cache;
+	f->state = total ? FLIGHT_STREAM : FLIGHT_BUFFER;
+	wakeAll(f);
+	V(&ft->mutex);
+}
+
+/* flightProgress - the leader has received more of a shared response into
+ * the chunks of cl, wake the followers streaming it */
+void flightProgress(flightTable *ft, flight *f, chunkList *cl) {
+	P(&ft->mutex);
+	f->chunks = *cl;
+	if(f->state == FLIGHT_STREAM)
+		wakeAll(f);
+	V(&ft->mutex);
+}
+
+/* flightDone - the shared response is complete and cached as obj, which
+ * the leader held for the flight. an object compressed into chunks of its
+ * own leaves the received ones to the followers still streaming them */
+void flightDone(flightTable *ft, flight *f, object *obj) {
+	P(&ft->mutex);
+	f->obj = obj;
+	if(obj->chunks == f->chunks.head)
+		f->chunks.size = obj->dsize;
+	f->state = FLIGHT_DONE;
+	unlinkFlight(ft, f);
+	wakeAll(f);
+	V(&ft->mutex);
+}
+
+/* flightFail - the response will not be complete in the cache, if it
+ * ever was shared. nothing if the flight is already over */
+void flightFail(flightTable *ft, flight *f) {
+	P(&ft->mutex);
+	if(f->state != FLIGHT_DONE && f->state != FLIGHT_FAILED) {
+		f->state = FLIGHT_FAILED;
+		unlinkFlight(ft, f);
+		wakeAll(f);
+	}
+	V(&ft->mutex);
+}
+
+/* flightWait - a follower that has seen have bytes parks on wakefd until
+ * the headers are shared and then, while streaming, until more bytes
+ * came, and otherwise until the flight is over. *state is the state it
+ * found, return the bytes received so far */
+size_t flightWait(flightTable *ft, flight *f, size_t have, int *state, \
+                                                             int wakefd) {
+	flightWaiter self;
+	size_t dataSize;
+
+	self.fd = wakefd;
+	P(&ft->mutex);
+	while(f->state == FLIGHT_HEADERS || f->state == FLIGHT_BUFFER ||
+	      (f->state == FLIGHT_STREAM && f->chunks.size <= have)) {
+		self.next = f->waiters;
+		f->waiters = &self;
+		V(&ft->mutex);
+		wait_wakeup(wakefd);
+		P(&ft->mutex);
+	}
+	*state = f->state;
+	dataSize = f->chunks.size;
+	if(f->state == FLIGHT_FAILED && have == 0)
+		ft->stats.fallbacks++;
+	V(&ft->mutex);
+	return dataSize;
+}
+
+/* flightRelease - drop the reference of a leader or follower, freeing the
+ * flight with the last one: the object is released, and chunks that were
+ * shared but not cached as they are are given back */
+void flightRelease(flightTable *ft, flight *f) {
+	int last, own;
+
+	P(&ft->mutex);
+	last = (--f->refcnt == 0);
+	if(last)
+		unlinkFlight(ft, f);
+	V(&ft->mutex);
+	if(!last)
+		return;
+
+	own = f->obj == NULL || f->obj->chunks != f->chunks.head;
+	if(f->obj != NULL)
+		releaseObj(f->obj);
+	if(own && f->chunks.head != NULL)
+		cancelCache(&f->chunks, f->cache);
+	Free(f->url);
+	Free(f);
+}
+
+/* flightGetStats - copy the counters into out */
+void flightGetStats(flightTable *ft, flightStats *out) {
+	P(&ft->mutex);
+	*out = ft->stats;
+	V(&ft->mutex);
+}
@@ -0,0 +1,101 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the table of responses in flight, keyed by URL. The first miss
+ * on a URL leads: it fetches the response into its cache reservation as
+ * usual. Misses on the same URL while it is in flight follow instead of
+ * opening their own server connection. Once the leader has the response
+ * headers it shares its cache chunks: with a known length the followers
+ * stream the body out of them as it arrives, otherwise they wait for the
+ * complete object. A response that cannot be cached is not shared, and
+ * its followers fetch it on their own. Shared chunks belong to the 
+ * flight, and are given back (or the object released) when the last
+ * leader or follower releases it, both if the object was cached
+ * compressed into chunks of its own.
+ *
+ * ***************************************************************************/
+
+#ifndef __FLIGHT_H__
+#define __FLIGHT_H__
+
+#include "csapp.h"
+#include "cache.h"
+
+#define FLIGHT_BUCKETS 256 //hash buckets for URLs, power of 2
+
+/* states of a flight */
+#define FLIGHT_HEADERS 0 //leader waits for the response headers
+#define FLIGHT_STREAM 1 //followers stream the body while it comes
+#define FLIGHT_BUFFER 2 //followers wait for the complete response
+#define FLIGHT_DONE 3 //response complete and cached
+#define FLIGHT_FAILED 4 //not shared, followers fetch on their own
+
+/* flightWaiter is struct for one follower waiting for progress. It has
+ * the eventfd the follower parks on and the next waiter */
+typedef struct flightWaiter {
+	int fd;
+	struct flightWaiter *next;
+} flightWaiter;
+
+/* flight is struct for one response in flight. It has the url and its
+ * hash, the state, the shared chunks with the size of the response 
+ * received so far, the size of its headers before the empty line and of
+ * the whole response if known (0 if not), the cached object once done,
+ * the cache, a reference count, the parked followers, whether it is
+ * still in the table and the next flight in the same bucket */
+typedef struct flight {
+	char *url;
+	unsigned long hash;
+	int state;
+	chunkList chunks;
+	size_t hdrSize;
+	size_t total;
+	object *obj;
+	queue *cache;
+	int refcnt;
+	flightWaiter *waiters;
+	int inTable;
+	struct flight *next;
+} flight;
+
+/* flightStats is struct for the counters of the table: misses that led a
+ * fetch, misses that followed one, and followers that had to fetch on
+ * their own since the response was not shared */
+typedef struct flightStats {
+	unsigned long leaders;
+	unsigned long followers;
+	unsigned long fallbacks;
+} flightStats;
+
+/* flightTable is struct for the whole table. It has the hash buckets,
+ * a mutex for them and for the state of every flight, and the counters */
+typedef struct flightTable {
+	flight *buckets[FLIGHT_BUCKETS];
+	sem_t mutex;
+	flightStats stats;
+} flightTable;
+
+/* function prototypes for flight.c */
+flightTable *initFlights();
+
+flight *flightStart(flightTable *ft, char *url, int *leader);
+
+void flightShare(flightTable *ft, flight *f, chunkList *cl, size_t hdrSize, \
+                                                size_t total, queue *cache);
+
+void flightProgress(flightTable *ft, flight *f, chunkList *cl);
+
+void flightDone(flightTable *ft, flight *f, object *obj);
+
+void flightFail(flightTable *ft, flight *f);
+
+size_t flightWait(flightTable *ft, flight *f, size_t have, int *state, \
+                                                             int wakefd);
+
+void flightRelease(flightTable *ft, flight *f);
+
+void flightGetStats(flightTable *ft, flightStats *out);
+
+#endif /* __FLIGHT_H__ */
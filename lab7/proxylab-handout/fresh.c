@@ -0,0 +1,313 @@
+/******************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the freshness model of cached responses, see fresh.h. The
+ * proxy hands every response header line to freshHeader while relaying
+ * it, then decides with freshStorable and freshUntil whether and until
+ * when the response is cached. Times are seconds of the wall clock, the
+ * one Date and Expires are in.
+ *
+ * ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "fresh.h"
+
+#define DELTA_MAX 2147483648L //delta-seconds larger than this are this
+
+/* request headers the proxy always sends its own value of, so a response
+ * varying on them is the same for every client */
+static const char *fixedHeaders[] = { "user-agent", "accept",
+                                      "accept-encoding" };
+
+static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+/* headerValue - the value of the header line if it is a name header, its
+ * whitespace skipped, NULL if it is another header */
+static const char *headerValue(const char *line, const char *name) {
+	size_t len = strlen(name);
+
+	if(strncasecmp(line, name, len) || line[len] != ':')
+		return NULL;
+	for(line += len + 1; *line == ' ' || *line == '\t'; line++)
+		;
+	return line;
+}
+
+/* tokenLen - length of the token at p, up to a separator */
+static size_t tokenLen(const char *p) {
+	size_t n = 0;
+
+	while(p[n] && !strchr(" \t,;=\"\r\n", p[n]))
+		n++;
+	return n;
+}
+
+/* isToken - whether the n bytes at p are the token tok, ignoring case */
+static int isToken(const char *p, size_t n, const char *tok) {
+	return n == strlen(tok) && !strncasecmp(p, tok, n);
+}
+
+/* deltaSeconds - the delta-seconds at p, quoted or not. anything else is
+ * 0, so a garbled max-age makes the response stale, not fresh forever */
+static long deltaSeconds(const char *p) {
+	long n;
+
+	if(*p == '"')
+		p++;
+	if(!isdigit((unsigned char)*p))
+		return 0;
+	n = strtol(p, NULL, 10);
+	return (n < 0 || n > DELTA_MAX) ? DELTA_MAX : n;
+}
+
+/* cacheControl - note the Cache-Control directives in the value at p */
+static void cacheControl(freshInfo *f, const char *p) {
+	const char *arg;
+	size_t n;
+
+	while(*p && *p != '\r' && *p != '\n') {
+		n = tokenLen(p);
+		arg = p[n] == '=' ? p + n + 1 : NULL;
+		if(isToken(p, n, "no-store") || isToken(p, n, "private"))
+			f->noStore = 1;
+		else if(isToken(p, n, "no-cache"))
+			f->noCache = 1;
+		else if(isToken(p, n, "max-age") && arg != NULL)
+			f->maxAge = deltaSeconds(arg);
+		else if(isToken(p, n, "s-maxage") && arg != NULL)
+			f->sMaxAge = deltaSeconds(arg);
+
+		/* past the argument, which may be a quoted string with commas */
+		p += n;
+		if(arg != NULL && *arg == '"') {
+			for(p = arg + 1; *p && *p != '"'; p++)
+				;
+		}
+		while(*p && *p != ',' && *p != '\r' && *p != '\n')
+			p++;
+		while(*p == ',' || *p == ' ' || *p == '\t')
+			p++;
+	}
+}
+
+/* vary - the response is not stored if it varies on a request header
+ * other than the ones the proxy fixes, its cache key is only the URL */
+static void vary(freshInfo *f, const char *p) {
+	size_t n, i;
+	int fixed;
+
+	while(*p && *p != '\r' && *p != '\n') {
+		if(*p == '*') {
+			f->noStore = 1;
+			return;
+		}
+		n = tokenLen(p);
+		for(fixed = 0, i = 0; i < 3 && !fixed; i++)
+			fixed = isToken(p, n, fixedHeaders[i]);
+		if(n > 0 && !fixed)
+			f->noStore = 1;
+		p += n;
+		while(*p && *p != ',' && *p != '\r' && *p != '\n')
+			p++;
+		while(*p == ',' || *p == ' ' || *p == '\t')
+			p++;
+	}
+}
+
+/* freshInit - nothing known about a response yet */
+void freshInit(freshInfo *f) {
+	f->cacheControl = 0;
+	f->validator = 0;
+	f->noStore = 0;
+	f->noCache = 0;
+	f->sMaxAge = -1;
+	f->maxAge = -1;
+	f->date = -1;
+	f->expires = -1;
+	f->lastModified = -1;
+	f->age = 0;
+}
+
+/* freshHeader - note what the header line of a response tells about
+ * caching it, other headers are ignored */
+void freshHeader(freshInfo *f, const char *line) {
+	const char *v;
+
+	switch(tolower((unsigned char)line[0])) {
+	case 'a':
+		if((v = headerValue(line, "age")) != NULL)
+			f->age = deltaSeconds(v);
+		break;
+	case 'c':
+		if((v = headerValue(line, "cache-control")) != NULL) {
+			f->cacheControl = 1;
+			cacheControl(f, v);
+		}
+		else if(headerValue(line, "content-range") != NULL) {
+			f->noStore = 1; //part of the body, whatever the status says
+		}
+		break;
+	case 'd':
+		if((v = headerValue(line, "date")) != NULL)
+			f->date = freshParseDate(v);
+		break;
+	case 'e':
+		if(headerValue(line, "etag") != NULL)
+			f->validator = 1;
+		else if((v = headerValue(line, "expires")) != NULL &&
+		   (f->expires = freshParseDate(v)) < 0)
+			f->expires = 0; //invalid, already expired
+		break;
+	case 'l':
+		if((v = headerValue(line, "last-modified")) != NULL) {
+			f->lastModified = freshParseDate(v);
+			f->validator = 1;
+		}
+		break;
+	case 'v':
+		if((v = headerValue(line, "vary")) != NULL)
+			vary(f, v);
+		break;
+	}
+}
+
+/* freshHeaders - note the header lines of the string hdrs, a stored
+ * response head, the status line is skipped like any other header */
+void freshHeaders(freshInfo *f, const char *hdrs) {
+	const char *line;
+
+	for(line = hdrs; *line; line += strcspn(line, "\n")) {
+		if(*line == '\n')
+			line++;
+		freshHeader(f, line);
+	}
+}
+
+/* freshUpdate - a 304 with the headers in update revalidated the stored
+ * response with the headers in f. what the 304 carries replaces what was
+ * stored, its Date and Age are the only ones that count now */
+void freshUpdate(freshInfo *f, freshInfo *update) {
+	if(update->cacheControl) {
+		f->noStore = update->noStore;
+		f->noCache = update->noCache;
+		f->sMaxAge = update->sMaxAge;
+		f->maxAge = update->maxAge;
+	}
+	if(update->expires >= 0)
+		f->expires = update->expires;
+	if(update->lastModified >= 0)
+		f->lastModified = update->lastModified;
+	f->date = update->date;
+	f->age = update->age;
+}
+
+/* freshStorable - whether a response of status with these headers, fresh
+ * until expires, is worth caching at now. only the statuses cacheable by
+ * default are, never a partial 206, an error that may pass or a redirect
+ * of the moment. one already stale is only of use with a validator */
+int freshStorable(freshInfo *f, int status, time_t expires, time_t now) {
+	switch(status) {
+	case 200: case 203: case 204: case 300: case 301: case 308:
+	case 404: case 405: case 410: case 414: case 501:
+		return !f->noStore && (expires > now || f->validator);
+	}
+	return 0;
+}
+
+/* freshUntil - the time a response received at now stops being fresh,
+ * dflt seconds after now if its headers tell nothing. 0 if it must be
+ * revalidated every time */
+time_t freshUntil(freshInfo *f, time_t now, long dflt) {
+	time_t date = f->date >= 0 ? f->date : now;
+	long lifetime, age;
+
+	if(f->noCache)
+		return 0;
+	if(f->sMaxAge >= 0) //for shared caches like this one
+		lifetime = f->sMaxAge;
+	else if(f->maxAge >= 0)
+		lifetime = f->maxAge;
+	else if(f->expires >= 0)
+		lifetime = f->expires > date ? f->expires - date : 0;
+	else if(f->lastModified >= 0 && f->lastModified < date)
+		lifetime = (date - f->lastModified) / 10 < FRESH_HEURISTIC_MAX ?
+		           (date - f->lastModified) / 10 : FRESH_HEURISTIC_MAX;
+	else
+		lifetime = dflt;
+
+	/* how old it already was when it arrived */
+	age = now > date ? now - date : 0;
+	if(f->age > age)
+		age = f->age;
+	return lifetime > age ? now + lifetime - age : 0;
+}
+
+/* freshParseDate - the time of the HTTP date at s, in the preferred
+ * format or one of the two obsolete ones. return -1 if it is none */
+time_t freshParseDate(const char *s) {
+	char mon[4];
+	struct tm tm;
+	int i;
+
+	memset(&tm, 0, sizeof(tm));
+	/* Sun, 06 Nov 1994 08:49:37 GMT, Sunday, 06-Nov-94 08:49:37 GMT and
+	 * Sun Nov  6 08:49:37 1994 */
+	if(sscanf(s, "%*[A-Za-z], %d %3s %d %d:%d:%d GMT", &tm.tm_mday, mon,
+	          &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6 &&
+	   sscanf(s, "%*[A-Za-z], %d-%3s-%d %d:%d:%d GMT", &tm.tm_mday, mon,
+	          &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6 &&
+	   sscanf(s, "%*[A-Za-z] %3s %d %d:%d:%d %d", mon, &tm.tm_mday,
+	          &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &tm.tm_year) != 6)
+		return -1;
+
+	for(i = 0; i < 12 && strcasecmp(mon, months[i]); i++)
+		;
+	if(i == 12 || tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_hour > 23 ||
+	   tm.tm_min > 59 || tm.tm_sec > 60 || tm.tm_year < 0)
+		return -1;
+	tm.tm_mon = i;
+	if(tm.tm_year < 70) //two digit years of the obsolete format
+		tm.tm_year += 100;
+	else if(tm.tm_year >= 1900)
+		tm.tm_year -= 1900;
+	return timegm(&tm);
+}
+
+/* freshValidators - the conditional headers revalidating a response with
+ * the stored headers hdrs, a string: If-None-Match from its ETag and
+ * If-Modified-Since from its Last-Modified. write them to out of size
+ * bytes and return their length, 0 if it has no validator or they do not
+ * fit */
+size_t freshValidators(const char *hdrs, char *out, size_t size) {
+	const char *line, *next, *v;
+	size_t len = 0, n;
+	int rc;
+
+	for(line = hdrs; *line; line = next + 1) {
+		if(*(next = line + strcspn(line, "\n")) == '\0')
+			break; //the last line is cut short
+		if((v = headerValue(line, "etag")) != NULL)
+			rc = snprintf(out + len, size - len, "If-None-Match: ");
+		else if((v = headerValue(line, "last-modified")) != NULL)
+			rc = snprintf(out + len, size - len, "If-Modified-Since: ");
+		else
+			continue;
+		n = strcspn(v, "\r\n");
+		if(rc < 0 || len + rc + n + 2 >= size)
+			return 0;
+		len += rc;
+		memcpy(out + len, v, n);
+		len += n;
+		memcpy(out + len, "\r\n", 3);
+		len += 2;
+	}
+	return len;
+}
@@ -0,0 +1,65 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the freshness model of cached responses, after RFC 9111. The
+ * headers of a response tell whether it may be stored at all (its status,
+ * never a partial 206, Cache-Control no-store and private, Vary) and for
+ * how long it is fresh: s-maxage or max-age, else Expires less Date, else
+ * a tenth of the time since Last-Modified up to FRESH_HEURISTIC_MAX, else
+ * a default lifetime for responses that tell nothing. Its age at arrival,
+ * from Age and Date, is taken off. A stale response is revalidated with
+ * the server using the validators in its stored headers, ETag as
+ * If-None-Match and Last-Modified as If-Modified-Since.
+ *
+ * ***************************************************************************/
+
+#ifndef __FRESH_H__
+#define __FRESH_H__
+
+#include <time.h>
+#include <stddef.h>
+
+#define DEFAULT_FRESH_SECS 300 //lifetime of responses telling nothing
+#define FRESH_HEURISTIC_MAX 86400 //longest lifetime from Last-Modified
+
+/* freshInfo is struct for what the headers of a response tell about
+ * caching it. It has whether it had a Cache-Control header, whether it
+ * has a validator (ETag or Last-Modified), whether it must not be stored
+ * (no-store, private, a Vary on a header the proxy does not fix or a
+ * Content-Range, only part of the body), whether it must be revalidated
+ * before every use (no-cache), s-maxage and max-age (-1 if absent), the
+ * Date, Expires and Last-Modified times (-1 if absent, Expires is 0 if
+ * invalid, so in the past) and the Age */
+typedef struct freshInfo {
+	int cacheControl;
+	int validator;
+	int noStore;
+	int noCache;
+	long sMaxAge;
+	long maxAge;
+	time_t date;
+	time_t expires;
+	time_t lastModified;
+	long age;
+} freshInfo;
+
+/* function prototypes for fresh.c */
+void freshInit(freshInfo *f);
+
+void freshHeader(freshInfo *f, const char *line);
+
+void freshHeaders(freshInfo *f, const char *hdrs);
+
+void freshUpdate(freshInfo *f, freshInfo *update);
+
+int freshStorable(freshInfo *f, int status, time_t expires, time_t now);
+
+time_t freshUntil(freshInfo *f, time_t now, long dflt);
+
+time_t freshParseDate(const char *s);
+
+size_t freshValidators(const char *hdrs, char *out, size_t size);
+
+#endif /* __FRESH_H__ */
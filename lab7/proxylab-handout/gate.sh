@@ -0,0 +1,179 @@
+#!/bin/bash
+#
+# gate.sh - performance regression gate for the proxy, with tiny as the
+#     origin. Where driver.sh checks with serial curl fetches that the
+#     proxy works, this checks that a change did not make it slower.
+#
+#     Fills tiny with GATE_FILES files of 1 to 32 KB, warms the proxy with
+#     one fetch of each, then drives it with loadgen: GATE_CONNS keep-alive
+#     connections sending GATE_REQS requests with Zipf(GATE_ALPHA)
+#     popularity over the files. The run is repeated RUNS times and the
+#     median requests/sec and p99 latency are compared with a baseline
+#     saved by an earlier run on the same machine, with the hit ratio the
+#     proxy reports on its admin port (-M). The gate fails if throughput
+#     dropped or p99 rose by more than the tolerances, the hit ratio fell,
+#     or any request failed or stalled.
+#
+#     usage: ./gate.sh [-s] [baseline]   (or "make gate")
+#         -s        save the results as the new baseline
+#         baseline  file of the baseline, ./gate.baseline by default
+#
+
+# Load of every run
+GATE_FILES=2000
+GATE_CONNS=2000
+GATE_REQS=200000
+GATE_ALPHA=0.9
+RUNS=3
+
+# Proxy command line, the cache holds part of the files only
+PROXY_ARGS="-S 16m"
+
+# Tolerances against the baseline
+THROUGHPUT_DROP=10 #percent
+P99_RISE=30 #percent
+HIT_RATIO_DROP=0.02
+
+HOME_DIR=`pwd`
+PROXY_LOG=`mktemp`
+URLS=`mktemp`
+
+save=0
+if [ "$1" == "-s" ]; then
+    save=1
+    shift
+fi
+BASELINE=${1:-./gate.baseline}
+
+#
+# wait_for_port - spins until something listens on TCP port $1
+#
+function wait_for_port {
+    for i in `seq 1 50`
+    do
+        netstat --numeric-ports --numeric-hosts -ln --protocol=inet \
+            | grep -q ":${1} " && return
+        sleep 0.1
+    done
+    echo "Error: nothing listens on port ${1}"
+    exit 1
+}
+
+#
+# cleanup - kills tiny and the proxy and removes the generated files
+#
+function cleanup {
+    kill ${proxy_pid} ${tiny_pid} 2> /dev/null
+    rm -f ${PROXY_LOG} ${URLS}
+    rm -rf ./tiny/gate
+}
+
+#
+# field - the value after the name $1 in the loadgen output $2
+#
+function field {
+    echo "$2" | tr ' ' '\n' | grep -A1 -x -- "$1" | tail -1
+}
+
+#
+# median - the median of the numbers given
+#
+function median {
+    printf '%s\n' "$@" | sort -g | sed -n "$(( ($# + 1) / 2 ))p"
+}
+
+ulimit -n 65536 2> /dev/null
+make -s proxy loadgen || exit 1
+
+mkdir -p ./tiny/gate
+for i in `seq 1 ${GATE_FILES}`
+do
+    head -c $(( (i * 7919 % 32 + 1) * 1024 )) /dev/urandom \
+        > ./tiny/gate/${i}.bin
+done
+
+tiny_port=`bash ./free-port.sh`
+cd ./tiny
+./tiny ${tiny_port} &> /dev/null &
+tiny_pid=$!
+cd ${HOME_DIR}
+wait_for_port ${tiny_port}
+trap cleanup EXIT
+
+proxy_port=`bash ./free-port.sh`
+admin_port=`bash ./free-port.sh`
+[ ${admin_port} == ${proxy_port} ] && admin_port=$((proxy_port + 1))
+./proxy ${PROXY_ARGS} -M ${admin_port} ${proxy_port} &> ${PROXY_LOG} &
+proxy_pid=$!
+wait_for_port ${proxy_port}
+
+for i in `seq 1 ${GATE_FILES}`
+do
+    echo "http://localhost:${tiny_port}/gate/${i}.bin"
+done > ${URLS}
+
+echo "*** warm up: ${GATE_FILES} files ***"
+./loadgen -k -c 64 -n ${GATE_FILES} localhost ${proxy_port} @${URLS} \
+    | sed 's/^/    /'
+
+rates=()
+p99s=()
+hits=()
+failed=0
+for run in `seq 1 ${RUNS}`
+do
+    echo "*** run ${run}: ${GATE_CONNS} keep-alive clients, ${GATE_REQS}" \
+         "requests, zipf ${GATE_ALPHA} ***"
+    out=`./loadgen -k -c ${GATE_CONNS} -n ${GATE_REQS} -z ${GATE_ALPHA} \
+         -s ${run} -m ${admin_port} localhost ${proxy_port} @${URLS}`
+    echo "${out}" | sed 's/^/    /'
+    rates+=(`field req/s "${out}"`)
+    p99s+=(`field p99 "${out}"`)
+    hits+=(`field hit_ratio "${out}"`)
+    bad=$(( `field errors "${out}"` + `field bad_status "${out}"` + \
+            `field stalled "${out}"` ))
+    [ ${bad} != 0 ] && failed=1
+done
+
+rate=`median ${rates[@]}`
+p99=`median ${p99s[@]}`
+hit=`median ${hits[@]}`
+echo "*** median: req/s ${rate} p99_us ${p99} hit_ratio ${hit} ***"
+
+if [ ${failed} == 1 ]; then
+    echo "FAIL: requests failed or stalled"
+    exit 1
+fi
+
+if [ ${save} == 1 ] || [ ! -f ${BASELINE} ]; then
+    echo "req/s ${rate} p99_us ${p99} hit_ratio ${hit}" > ${BASELINE}
+    echo "baseline saved to ${BASELINE}"
+    exit 0
+fi
+
+base=`cat ${BASELINE}`
+base_rate=`field req/s "${base}"`
+base_p99=`field p99_us "${base}"`
+base_hit=`field hit_ratio "${base}"`
+echo "*** baseline: req/s ${base_rate} p99_us ${base_p99}" \
+     "hit_ratio ${base_hit} ***"
+
+status=0
+if awk "BEGIN { exit !(${rate} < \
+    ${base_rate} * (1 - ${THROUGHPUT_DROP} / 100)) }"
+then
+    echo "FAIL: req/s dropped more than ${THROUGHPUT_DROP}%"
+    status=1
+fi
+if awk "BEGIN { exit !(${p99} > ${base_p99} * (1 + ${P99_RISE} / 100)) }"
+then
+    echo "FAIL: p99 latency rose more than ${P99_RISE}%"
+    status=1
+fi
+if awk "BEGIN { exit !(${hit} < ${base_hit} - ${HIT_RATIO_DROP}) }"
+then
+    echo "FAIL: hit ratio fell more than ${HIT_RATIO_DROP}"
+    status=1
+fi
+[ ${status} == 0 ] && echo "PASS"
+exit ${status}
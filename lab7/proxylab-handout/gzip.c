@@ -0,0 +1,250 @@
+/******************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the gzip coding of cached responses, see gzip.h. Compressing
+ * never waits on a socket, so each thread keeps one deflate stream, about
+ * 256 KB of zlib state, and resets it for the next response. Inflating
+ * writes to the client and may park an event loop task in the middle, so
+ * every inflate has a stream of its own on its task's stack.
+ *
+ * Coded or random data would cost a miss the time to compress it for
+ * nothing, so it is told apart cheaply first. Its first GZIP_SAMPLE bytes
+ * have nearly every byte value, text and markup a small set of them: more
+ * than GZIP_BYTE_SET values and the body is left alone. Otherwise it is 
+ * compressed GZIP_PROBE bytes far and flushed, and if that saved less than
+ * 1/GZIP_PROBE_GAIN of it, given up on as well.
+ *
+ * ***************************************************************************/
+
+#include "csapp.h"
+#include "gzip.h"
+#include <zlib.h>
+
+#define GZIP_WINDOW (15 + 16) //largest window, with a gzip wrapper
+#define GZIP_OUT (8 * CHUNK_SIZE) //bytes inflated per write to the client
+
+static __thread z_stream *deflater; //stream of the calling thread
+static __thread int deflaterLevel;
+
+/* hasToken - whether token appears in the header line, ignoring case */
+static int hasToken(char *hdrLine, char *token) {
+	size_t len = strlen(token);
+
+	for(; *hdrLine; hdrLine++) {
+		if(!strncasecmp(hdrLine, token, len))
+			return 1;
+	}
+	return 0;
+}
+
+/* gzipAllows - whether the response header line hdrLine lets the body be
+ * stored compressed: not if it is coded already, only part of it, varies
+ * with the request, must not be transformed, or its type is media that
+ * is compressed by itself */
+int gzipAllows(char *hdrLine) {
+	if(!strncasecmp(hdrLine, "Content-Encoding:", 17))
+		return hasToken(hdrLine + 17, "identity");
+	if(!strncasecmp(hdrLine, "Content-Range:", 14) ||
+	   !strncasecmp(hdrLine, "Vary:", 5))
+		return 0;
+	if(!strncasecmp(hdrLine, "Cache-Control:", 14))
+		return !hasToken(hdrLine + 14, "no-transform");
+	if(!strncasecmp(hdrLine, "Content-Type:", 13)) {
+		hdrLine += 13;
+		if(hasToken(hdrLine, "svg"))
+			return 1;
+		return !hasToken(hdrLine, "image/") &&
+		       !hasToken(hdrLine, "audio/") &&
+		       !hasToken(hdrLine, "video/") &&
+		       !hasToken(hdrLine, "zip") && !hasToken(hdrLine, "compress");
+	}
+	return 1;
+}
+
+/* gzipETag - the ETag header line hdrLine of n bytes, as stored with a
+ * compressed body, into out of size bytes: a strong tag is made weak, W/
+ * before its value, as neither coding sent is the bytes it was given for.
+ * an If-Range then never matches it, If-None-Match still does. return the
+ * size of the line, -1 if it does not fit */
+ssize_t gzipETag(char *hdrLine, size_t n, char *out, size_t size) {
+	size_t val = 5;
+
+	while(val < n && (hdrLine[val] == ' ' || hdrLine[val] == '\t'))
+		val++;
+	if(n - val >= 2 && !strncmp(hdrLine + val, "W/", 2)) {
+		if(n > size)
+			return -1;
+		memcpy(out, hdrLine, n);
+		return n;
+	}
+	if(n + 2 > size)
+		return -1;
+	memcpy(out, hdrLine, val);
+	memcpy(out + val, "W/", 2);
+	memcpy(out + val + 2, hdrLine + val, n - val);
+	return n + 2;
+}
+
+/* byteSet - the number of distinct byte values in the first GZIP_SAMPLE
+ * of n bytes from offset off of the data in the chunks starting at c */
+static int byteSet(chunk *c, size_t off, size_t n) {
+	unsigned char seen[256];
+	unsigned char *p;
+	size_t part;
+	int i, set = 0;
+
+	memset(seen, 0, sizeof(seen));
+	if(n > GZIP_SAMPLE)
+		n = GZIP_SAMPLE;
+	for(; off >= CHUNK_SIZE; off -= CHUNK_SIZE)
+		c = c->next;
+	while(n > 0) {
+		part = CHUNK_SIZE - off < n ? CHUNK_SIZE - off : n;
+		p = (unsigned char *)c->data + off;
+		for(i = 0; i < part; i++)
+			seen[p[i]] = 1;
+		n -= part;
+		c = c->next;
+		off = 0;
+	}
+	for(i = 0; i < 256; i++)
+		set += seen[i];
+	return set;
+}
+
+/* deflateRun - run the deflate stream zs over all of its input with
+ * flush, appending what comes out to cl. return -1 if cl would grow to
+ * most bytes or there is no room in the cache, 0 otherwise */
+static int deflateRun(z_stream *zs, int flush, chunkList *cl, size_t most, \
+                                                          queue *cacheQueue) {
+	size_t room;
+	char *out;
+	int rc;
+
+	do {
+		if(cl->size >= most || (out = growCache(cl, &room, cacheQueue)) == NULL)
+			return -1;
+		zs->next_out = (Bytef *)out;
+		zs->avail_out = room;
+		if((rc = deflate(zs, flush)) == Z_STREAM_ERROR)
+			return -1;
+		cl->size += room - zs->avail_out;
+	} while(zs->avail_in > 0 ||
+	        (flush == Z_FINISH ? rc != Z_STREAM_END : zs->avail_out == 0));
+	return 0;
+}
+
+/* gzipChunks - compress n bytes from offset off of the data in the chunks
+ * starting at c with zlib level, appending them to cl as one gzip member.
+ * return -1 if it looks random, does not fit in the cache, cl would grow
+ * to most bytes or the probe saved too little, 0 otherwise. cl is the
+ * caller's to give back either way */
+int gzipChunks(chunk *c, size_t off, size_t n, chunkList *cl, size_t most, \
+                                             int level, queue *cacheQueue) {
+	z_stream *zs = deflater;
+	size_t start = cl->size, fed = 0, part;
+	int flush, probed = 0;
+
+	if(byteSet(c, off, n) > GZIP_BYTE_SET)
+		return -1;
+
+	/* the stream of this thread, made once and reset after */
+	if(zs == NULL) {
+		zs = (z_stream *)Calloc(1, sizeof(z_stream));
+		if(deflateInit2(zs, level, Z_DEFLATED, GZIP_WINDOW, 8,
+		                Z_DEFAULT_STRATEGY) != Z_OK) {
+			Free(zs);
+			return -1;
+		}
+		deflater = zs;
+		deflaterLevel = level;
+	}
+	else {
+		deflateReset(zs);
+		if(level != deflaterLevel) {
+			deflateParams(zs, level, Z_DEFAULT_STRATEGY);
+			deflaterLevel = level;
+		}
+	}
+
+	for(; off >= CHUNK_SIZE; off -= CHUNK_SIZE) //skip to the first one
+		c = c->next;
+	while(n > 0) {
+		part = CHUNK_SIZE - off < n ? CHUNK_SIZE - off : n;
+		zs->next_in = (Bytef *)c->data + off;
+		zs->avail_in = part;
+		fed += part;
+		n -= part;
+		c = c->next;
+		off = 0;
+
+		/* flushed once the probe is in, to see what it came to */
+		flush = (!probed && fed >= GZIP_PROBE) ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+		if(deflateRun(zs, flush, cl, most, cacheQueue) < 0)
+			return -1;
+		if(flush == Z_SYNC_FLUSH) {
+			probed = 1;
+			if(cl->size - start > fed - fed / GZIP_PROBE_GAIN)
+				return -1;
+		}
+	}
+	return deflateRun(zs, Z_FINISH, cl, most, cacheQueue);
+}
+
+/* gunzipChunks - inflate the gzip member of n bytes from offset off of the
+ * data in the chunks starting at c, plain bytes when inflated, and write
+ * the len of them from byte skip on to fd. inflating stops there, the 
+ * whole member is only checked when len reaches its end. return len, or
+ * -1 on write error or if the data does not inflate to plain bytes */
+ssize_t gunzipChunks(int fd, chunk *c, size_t off, size_t n, size_t plain, \
+                                                   size_t skip, size_t len) {
+	char buf[GZIP_OUT];
+	z_stream zs;
+	size_t part, pos = 0, have, from, to, end = skip + len;
+	int rc = Z_OK;
+
+	memset(&zs, 0, sizeof(zs));
+	if(end > plain || inflateInit2(&zs, GZIP_WINDOW) != Z_OK)
+		return -1;
+
+	for(; off >= CHUNK_SIZE; off -= CHUNK_SIZE)
+		c = c->next;
+	while(rc != Z_STREAM_END && (pos < end || end == plain)) {
+		if(zs.avail_in == 0) {
+			if(n == 0) //cut short
+				break;
+			part = CHUNK_SIZE - off < n ? CHUNK_SIZE - off : n;
+			zs.next_in = (Bytef *)c->data + off;
+			zs.avail_in = part;
+			n -= part;
+			c = c->next;
+			off = 0;
+		}
+		zs.next_out = (Bytef *)buf;
+		zs.avail_out = GZIP_OUT;
+		rc = inflate(&zs, Z_NO_FLUSH);
+		if(rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+			break;
+		have = GZIP_OUT - zs.avail_out;
+		if(pos + have > plain) {
+			rc = Z_DATA_ERROR;
+			break;
+		}
+
+		/* the part of this buffer inside the range */
+		from = skip > pos ? skip - pos : 0;
+		to = end < pos + have ? end - pos : have;
+		if(from < to && Rio_writen(fd, buf + from, to - from) != to - from) {
+			rc = Z_DATA_ERROR;
+			break;
+		}
+		pos += have;
+	}
+	inflateEnd(&zs);
+	if(end == plain)
+		return (rc == Z_STREAM_END && pos == plain) ? (ssize_t)len : -1;
+	return pos >= end ? (ssize_t)len : -1;
+}
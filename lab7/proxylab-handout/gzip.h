@@ -0,0 +1,41 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the gzip coding of cached responses. A response stored as the
+ * server sent it (identity) is compressed with zlib when it is committed,
+ * straight from its chunks of the cache slab into new ones, and kept that
+ * way only if it then takes fewer chunks, so the same cache holds more
+ * responses. Clients that accept gzip are sent the compressed body with
+ * sendfile like any hit, the others get it inflated on the fly, a buffer
+ * at a time, or only as far as the part a Range asks for. Headers that
+ * forbid changing the body, or tell it is coded already, keep a response
+ * as it is (gzipAllows). Its ETag is stored weak (gzipETag), the bytes
+ * sent are no longer the ones it names.
+ *
+ * ***************************************************************************/
+
+#ifndef __GZIP_H__
+#define __GZIP_H__
+
+#include "csapp.h"
+#include "cache.h"
+
+#define DEFAULT_GZIP_LEVEL 1 //zlib level, fastest, 0 stores as received
+#define GZIP_SAMPLE 1024 //bytes looked at before compressing
+#define GZIP_BYTE_SET 224 //distinct values in them of data taken for random
+#define GZIP_PROBE (2 * CHUNK_SIZE) //input compressed before giving up
+#define GZIP_PROBE_GAIN 8 //the probe must save 1/GZIP_PROBE_GAIN of it
+
+/* function prototypes for gzip.c */
+int gzipAllows(char *hdrLine);
+ssize_t gzipETag(char *hdrLine, size_t n, char *out, size_t size);
+
+int gzipChunks(chunk *c, size_t off, size_t n, chunkList *cl, size_t most, \
+                                            int level, queue *cacheQueue);
+
+ssize_t gunzipChunks(int fd, chunk *c, size_t off, size_t n, size_t plain, \
+                                                   size_t skip, size_t len);
+
+#endif /* __GZIP_H__ */
@@ -0,0 +1,136 @@
+/****************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * hitbench - microbenchmark of cache hits. Fills the cache of cache.c with
+ * objects small enough that all of them fit, then lets threads look up
+ * random ones of them (each lookup a hit, released at once) for a while,
+ * and reports the lookups per second for each way hits are promoted:
+ * only counted, promoted under the shard write lock, and buffered per
+ * thread and promoted in batches. It runs with 1, 2, 4 ... up to the
+ * given number of threads.
+ *
+ * usage: hitbench [-d msecs] [-n objects] [-t threads]
+ *
+ *****************************************************************************/
+
+#include "csapp.h"
+#include "cache.h"
+#include "policy.h"
+
+#define OBJ_SIZE 1024 //size of each object
+
+/* runner is struct for one benchmark thread. It has the cache, the seed
+ * of its random URLs and the lookups it has done */
+typedef struct runner {
+	queue *cache;
+	unsigned long seed;
+	long lookups;
+} runner;
+
+static char **urls; //the cached URLs
+static int nurls;
+static volatile int running; //threads look up while set
+
+/* lookupThread - look up random cached URLs until running is cleared */
+static void *lookupThread(void *vargp) {
+	runner *r = (runner *)vargp;
+	unsigned long x = r->seed;
+	object *obj;
+	long n = 0;
+
+	while(running) {
+		x ^= x << 13; //xorshift
+		x ^= x >> 7;
+		x ^= x << 17;
+		if((obj = searchCache(urls[x % nurls], r->cache)) != NULL)
+			releaseObj(obj);
+		n++;
+	}
+	r->lookups = n;
+	return NULL;
+}
+
+/* bench - nthreads look up in cache for msecs, return lookups per second */
+static double bench(queue *cache, int nthreads, int msecs) {
+	runner *runners = (runner *)Calloc(nthreads, sizeof(runner));
+	pthread_t *tids = (pthread_t *)Calloc(nthreads, sizeof(pthread_t));
+	long total = 0;
+	int i;
+
+	running = 1;
+	for(i = 0; i < nthreads; i++) {
+		runners[i].cache = cache;
+		runners[i].seed = 88172645463325252UL + i * 7919;
+		Pthread_create(&tids[i], NULL, lookupThread, &runners[i]);
+	}
+	usleep(msecs * 1000);
+	running = 0;
+	for(i = 0; i < nthreads; i++) {
+		Pthread_join(tids[i], NULL);
+		total += runners[i].lookups;
+	}
+	Free(runners);
+	Free(tids);
+	return total * 1000.0 / msecs;
+}
+
+static void usage(char *prog) {
+	fprintf(stderr, "usage: %s [-d msecs] [-n objects] [-t threads]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	char *names[] = { "count", "locked", "batched" };
+	int modes[] = { RECENCY_COUNT, RECENCY_LOCKED, RECENCY_BATCHED };
+	int maxThreads = sysconf(_SC_NPROCESSORS_ONLN), msecs = 1000;
+	int opt, i, m, t;
+	queue *cache;
+	chunkList cl;
+	object *obj;
+
+	nurls = 512;
+	while((opt = getopt(argc, argv, "d:n:t:")) != -1) {
+		switch(opt) {
+		case 'd': msecs = atoi(optarg); break;
+		case 'n': nurls = atoi(optarg); break;
+		case 't': maxThreads = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if(argc != optind || msecs < 1 || nurls < 1 || maxThreads < 1)
+		usage(argv[0]);
+
+	urls = (char **)Malloc(nurls * sizeof(char *));
+	for(i = 0; i < nurls; i++) {
+		urls[i] = (char *)Malloc(64);
+		sprintf(urls[i], "http://bench/obj/%d", i);
+	}
+
+	printf("%-8s %7s %14s\n", "recency", "threads", "lookups/s");
+	for(m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		if((cache = initCache(&lruPolicy, 0, DEFAULT_CACHE_SIZE,
+		                      DEFAULT_OBJECT_SIZE)) == NULL)
+			exit(1);
+		cache->recency = modes[m];
+		for(i = 0; i < nurls; i++) {
+			cl.head = cl.tail = NULL;
+			cl.size = 0;
+			if(fillCache(&cl, OBJ_SIZE, cache) < 0) {
+				cancelCache(&cl, cache);
+				continue;
+			}
+			obj = commitCache(&cl, urls[i], strlen(urls[i]) + 1, 0, 0, 0,
+			                  0, cache);
+			if(obj != NULL)
+				releaseObj(obj);
+			else
+				cancelCache(&cl, cache);
+		}
+		for(t = 1; t <= maxThreads; t *= 2)
+			printf("%-8s %7d %14.0f\n", names[m], t, bench(cache, t, msecs));
+	}
+	return 0;
+}
@@ -0,0 +1,320 @@
+/******************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the request parser, see http.h. Parsing runs in two stages over
+ * windows of SCAN_BLOCKS blocks of 32 bytes. The scanner first classifies
+ * every byte of the window at once into three bit masks per block (line
+ * feeds, colons and spaces), then the parser walks the set bits in order.
+ * Only the bits that matter in its state are looked at: spaces only on
+ * the request line, colons only before the first one of a header line,
+ * so a long header value costs one compare per 32 bytes and a bit scan.
+ *
+ * ***************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+#include "http.h"
+
+#define SCAN_BLOCKS 64 //32 byte blocks classified at a time
+
+/* states of the parser */
+#define PARSE_LINE 0 //request line
+#define PARSE_NAME 1 //header name, up to its colon
+#define PARSE_VALUE 2 //header value, up to the end of the line
+
+/* scanFn classifies the n bytes at p (at most SCAN_BLOCKS * 32) into a
+ * mask of each kind per block of 32, bit i for byte i of the block */
+typedef void (*scanFn)(const char *p, size_t n, uint32_t *lf, \
+                       uint32_t *colon, uint32_t *sp);
+
+/* scanScalar - classify one byte at a time, for CPUs without SIMD */
+static void scanScalar(const char *p, size_t n, uint32_t *lf, \
+                       uint32_t *colon, uint32_t *sp) {
+	size_t i, nb = (n + 31) / 32;
+	uint32_t bit;
+
+	memset(lf, 0, nb * sizeof(uint32_t));
+	memset(colon, 0, nb * sizeof(uint32_t));
+	memset(sp, 0, nb * sizeof(uint32_t));
+	for(i = 0; i < n; i++) {
+		bit = 1U << (i & 31);
+		if(p[i] == '\n')
+			lf[i / 32] |= bit;
+		else if(p[i] == ':')
+			colon[i / 32] |= bit;
+		else if(p[i] == ' ')
+			sp[i / 32] |= bit;
+	}
+}
+
+#ifdef __x86_64__
+/* MASK16 - bit i set where byte i of v is the byte repeated in c */
+#define MASK16(v, c) ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, c)))
+
+/* MASK32 - the same for 32 bytes */
+#define MASK32(v, c) ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, c)))
+
+/* scanSse2 - classify 16 bytes per compare, two halves per block. SSE2 is
+ * in every x86-64 CPU. the last partial block is copied to a padded one
+ * so nothing past n is read */
+static void scanSse2(const char *p, size_t n, uint32_t *lf, \
+                     uint32_t *colon, uint32_t *sp) {
+	const __m128i vlf = _mm_set1_epi8('\n'), vcolon = _mm_set1_epi8(':');
+	const __m128i vsp = _mm_set1_epi8(' ');
+	char pad[32];
+	const char *q;
+	__m128i lo, hi;
+	size_t b, nb = (n + 31) / 32;
+
+	for(b = 0; b < nb; b++) {
+		q = p + b * 32;
+		if(n - b * 32 < 32) {
+			memset(pad, 0, sizeof(pad));
+			memcpy(pad, q, n - b * 32);
+			q = pad;
+		}
+		lo = _mm_loadu_si128((const __m128i *)q);
+		hi = _mm_loadu_si128((const __m128i *)(q + 16));
+		lf[b] = MASK16(lo, vlf) | MASK16(hi, vlf) << 16;
+		colon[b] = MASK16(lo, vcolon) | MASK16(hi, vcolon) << 16;
+		sp[b] = MASK16(lo, vsp) | MASK16(hi, vsp) << 16;
+	}
+}
+
+/* scanAvx2 - classify a whole block per compare */
+__attribute__((target("avx2")))
+static void scanAvx2(const char *p, size_t n, uint32_t *lf, \
+                     uint32_t *colon, uint32_t *sp) {
+	const __m256i vlf = _mm256_set1_epi8('\n');
+	const __m256i vcolon = _mm256_set1_epi8(':');
+	const __m256i vsp = _mm256_set1_epi8(' ');
+	char pad[32];
+	const char *q;
+	__m256i v;
+	size_t b, nb = (n + 31) / 32;
+
+	for(b = 0; b < nb; b++) {
+		q = p + b * 32;
+		if(n - b * 32 < 32) {
+			memset(pad, 0, sizeof(pad));
+			memcpy(pad, q, n - b * 32);
+			q = pad;
+		}
+		v = _mm256_loadu_si256((const __m256i *)q);
+		lf[b] = MASK32(v, vlf);
+		colon[b] = MASK32(v, vcolon);
+		sp[b] = MASK32(v, vsp);
+	}
+}
+#endif
+
+/* scanner is struct for one way to classify. It has its name, the
+ * function and whether this CPU runs it */
+typedef struct scanner {
+	const char *name;
+	scanFn scan;
+	int ok;
+} scanner;
+
+static scanner scanners[] = {
+#ifdef __x86_64__
+	{ "avx2", scanAvx2, 0 }, //checked by httpInit
+	{ "sse2", scanSse2, 1 },
+#endif
+	{ "scalar", scanScalar, 1 },
+};
+#define NSCANNERS (sizeof(scanners) / sizeof(scanners[0]))
+
+#ifdef __x86_64__
+static scanner *current = &scanners[1]; //until httpInit knows the CPU
+#else
+static scanner *current = &scanners[0];
+#endif
+
+/* httpInit - pick the fastest scanner this CPU runs */
+void httpInit() {
+	size_t i;
+
+#ifdef __x86_64__
+	__builtin_cpu_init();
+	scanners[0].ok = __builtin_cpu_supports("avx2");
+#endif
+	for(i = 0; i < NSCANNERS && !scanners[i].ok; i++)
+		;
+	current = &scanners[i];
+}
+
+/* httpUseScanner - use the scanner called name, for benchmarks and tests.
+ * return -1 if there is none or this CPU does not run it, 0 otherwise */
+int httpUseScanner(const char *name) {
+	size_t i;
+
+	for(i = 0; i < NSCANNERS; i++) {
+		if(!strcmp(scanners[i].name, name) && scanners[i].ok) {
+			current = &scanners[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* httpScanner - name of the scanner in use */
+const char *httpScanner() {
+	return current->name;
+}
+
+/* isBlank - whether c is optional whitespace of a header */
+static inline int isBlank(char c) {
+	return c == ' ' || c == '\t';
+}
+
+/* httpParse - parse the request head at the start of the len bytes of buf
+ * into req, whose spans then point into buf. return the size of the head
+ * up to and including its empty line, 0 if it is not all there yet, -1 if
+ * it is malformed */
+int httpParse(const char *buf, size_t len, httpRequest *req) {
+	uint32_t lf[SCAN_BLOCKS], colon[SCAN_BLOCKS], sp[SCAN_BLOCKS];
+	uint32_t l, c, s, m, bit;
+	httpSpan *fields[3];
+	size_t start, base, n, b, at, mark, end;
+	int state = PARSE_LINE, field = 0;
+	httpHeader *h;
+
+	fields[0] = &req->method;
+	fields[1] = &req->target;
+	fields[2] = &req->version;
+	req->nhdrs = 0;
+
+	/* empty lines left over from the previous request */
+	for(start = 0; start < len && (buf[start] == '\r' || buf[start] == '\n');
+	    start++)
+		;
+	mark = start;
+
+	for(base = start; base < len; base += n) {
+		n = len - base < SCAN_BLOCKS * 32 ? len - base : SCAN_BLOCKS * 32;
+		current->scan(buf + base, n, lf, colon, sp);
+
+		for(b = 0; b < (n + 31) / 32; b++) {
+			l = lf[b];
+			c = colon[b];
+			s = sp[b];
+			while(1) {
+				/* the next position that matters in this state */
+				m = l | (state == PARSE_LINE ? s : 0) |
+				    (state == PARSE_NAME ? c : 0);
+				if(m == 0)
+					break;
+				bit = m & -m;
+				at = base + b * 32 + __builtin_ctz(m);
+				l &= ~(bit | (bit - 1));
+				c &= ~(bit | (bit - 1));
+				s &= ~(bit | (bit - 1));
+
+				/* a line ends here, without its CR */
+				end = at;
+				if(buf[at] == '\n' && end > mark && buf[end - 1] == '\r')
+					end--;
+
+				if(state == PARSE_LINE) {
+					/* method, target and version, extra words ignored */
+					if(end > mark && field < 3) {
+						fields[field]->p = buf + mark;
+						fields[field]->len = end - mark;
+						field++;
+					}
+					mark = at + 1;
+					if(buf[at] == '\n') {
+						if(field < 3)
+							return -1;
+						state = PARSE_NAME;
+					}
+				}
+				else if(state == PARSE_NAME && buf[at] == ':') {
+					/* no folded lines, no whitespace before the colon */
+					if(at == mark || isBlank(buf[mark]) ||
+					   isBlank(buf[at - 1]) || req->nhdrs == HTTP_MAX_HEADERS)
+						return -1;
+					h = &req->hdrs[req->nhdrs];
+					h->name.p = buf + mark;
+					h->name.len = at - mark;
+					mark = at + 1;
+					state = PARSE_VALUE;
+				}
+				else if(state == PARSE_NAME) {
+					if(end > mark) //a line without a colon
+						return -1;
+					return at + 1; //the empty line ends the head
+				}
+				else {
+					while(mark < end && isBlank(buf[mark]))
+						mark++;
+					while(end > mark && isBlank(buf[end - 1]))
+						end--;
+					h = &req->hdrs[req->nhdrs++];
+					h->value.p = buf + mark;
+					h->value.len = end - mark;
+					mark = at + 1;
+					state = PARSE_NAME;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+/* httpHasToken - whether token appears in s, ignoring case */
+int httpHasToken(httpSpan s, const char *token) {
+	size_t i, len = strlen(token);
+
+	for(i = 0; i + len <= s.len; i++) {
+		if(!strncasecmp(s.p + i, token, len))
+			return 1;
+	}
+	return 0;
+}
+
+/* httpSplitUrl - split url into host, port and path, skipping the scheme.
+ * port is empty if not given, path is "/" if not given */
+void httpSplitUrl(httpSpan url, httpSpan *host, httpSpan *port, \
+                                                       httpSpan *path) {
+	const char *p = url.p, *end = url.p + url.len, *q;
+
+	//skip possible "http://"
+	for(q = p; q + 3 <= end; q++) {
+		if(q[0] == ':' && q[1] == '/' && q[2] == '/') {
+			p = q + 3;
+			break;
+		}
+	}
+
+	//hostname before the first '/' or ':'
+	for(q = p; q < end && *q != '/' && *q != ':'; q++)
+		;
+	host->p = p;
+	host->len = q - p;
+
+	port->p = q;
+	port->len = 0;
+	if(q < end && *q == ':') {
+		for(port->p = ++q; q < end && *q != '/'; q++)
+			;
+		port->len = q - port->p;
+	}
+
+	if(q == end) { //nothing after host and port, path is "/"
+		path->p = "/";
+		path->len = 1;
+	}
+	else {
+		path->p = q;
+		path->len = end - q;
+	}
+}
@@ -0,0 +1,80 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the parser of client requests. It tokenizes the request line
+ * and headers in a single pass over the bytes where they were read, the
+ * rio buffer of the client, into a table of spans pointing into them, so
+ * nothing is copied or NUL terminated while parsing. The bytes are
+ * classified 32 at a time into bit masks of line feeds, colons and
+ * spaces with AVX2 (or SSE2, or a plain loop where neither exists), and
+ * the parser only visits the positions set in those masks, never each
+ * byte. Which classifier runs is picked at startup from the CPU.
+ *
+ * Header names are compared ignoring case. Lines may end with CRLF or a
+ * bare LF, empty lines before a request are skipped. Folded header lines,
+ * whitespace before a colon, headers without one and more than
+ * HTTP_MAX_HEADERS headers make a request malformed.
+ *
+ * ***************************************************************************/
+
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+#define HTTP_MAX_HEADERS 64 //headers of one request at most
+
+/* httpSpan is struct for a run of bytes in the parsed buffer. It has the
+ * first byte and the length, it is not NUL terminated */
+typedef struct httpSpan {
+	const char *p;
+	size_t len;
+} httpSpan;
+
+/* httpHeader is struct for one header. It has its name and its value
+ * without the whitespace around it */
+typedef struct httpHeader {
+	httpSpan name;
+	httpSpan value;
+} httpHeader;
+
+/* httpRequest is struct for a parsed request head. It has the method,
+ * target and version of the request line, and the headers in order */
+typedef struct httpRequest {
+	httpSpan method;
+	httpSpan target;
+	httpSpan version;
+	int nhdrs;
+	httpHeader hdrs[HTTP_MAX_HEADERS];
+} httpRequest;
+
+/* function prototypes for http.c */
+void httpInit();
+
+int httpUseScanner(const char *name);
+
+const char *httpScanner();
+
+int httpParse(const char *buf, size_t len, httpRequest *req);
+
+int httpHasToken(httpSpan s, const char *token);
+
+void httpSplitUrl(httpSpan url, httpSpan *host, httpSpan *port, \
+                                                       httpSpan *path);
+
+/* httpSpanIs - whether s is the header name name, ignoring case. inline
+ * so the length of a literal name is known and most names differ there */
+static inline int httpSpanIs(httpSpan s, const char *name) {
+	return s.len == strlen(name) && !strncasecmp(s.p, name, s.len);
+}
+
+/* httpSpanEq - whether s is exactly str */
+static inline int httpSpanEq(httpSpan s, const char *str) {
+	return s.len == strlen(str) && !memcmp(s.p, str, s.len);
+}
+
+#endif /* __HTTP_H__ */
@@ -0,0 +1,251 @@
+/****************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * httpfuzz - fuzzer of the request parser of http.c. Every input is parsed
+ * with each scanner this CPU runs. They must all give the same result,
+ * and every span of an accepted request must lie inside its head without
+ * a line feed in it. Built with sanitizers by the Makefile, so a read
+ * past the input aborts too.
+ *
+ * Without options it parses the given files (the corpus in fuzz/) and
+ * then as many mutants of them as -n asks for: bytes flipped, deleted or
+ * duplicated, CR, LF, colons, spaces and tabs inserted, cuts anywhere.
+ * Built with -DHTTP_LIBFUZZER it is a libFuzzer target instead.
+ *
+ * usage: httpfuzz [-n mutants] [-s seed] file...
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "http.h"
+
+static const char *scanners[] = { "avx2", "sse2", "scalar" };
+static long accepted, incomplete, malformed; //results of the inputs
+
+/* fail - report a broken invariant of the input of size bytes and abort */
+static void fail(const char *what, const char *data, size_t size) {
+	fprintf(stderr, "httpfuzz: %s on %zu byte input:\n", what, size);
+	fwrite(data, 1, size, stderr);
+	fprintf(stderr, "\n");
+	abort();
+}
+
+/* checkSpan - whether s lies inside the first head bytes of buf and has
+ * no line feed */
+static int checkSpan(httpSpan s, const char *buf, size_t head) {
+	return s.p >= buf && s.p + s.len <= buf + head &&
+	       memchr(s.p, '\n', s.len) == NULL;
+}
+
+/* sameSpan - whether a and b are the same span */
+static int sameSpan(httpSpan a, httpSpan b) {
+	return a.p == b.p && a.len == b.len;
+}
+
+/* sameRequest - whether two parses of the same buffer agree */
+static int sameRequest(httpRequest *a, httpRequest *b) {
+	int i;
+
+	if(!sameSpan(a->method, b->method) || !sameSpan(a->target, b->target) ||
+	   !sameSpan(a->version, b->version) || a->nhdrs != b->nhdrs)
+		return 0;
+	for(i = 0; i < a->nhdrs; i++) {
+		if(!sameSpan(a->hdrs[i].name, b->hdrs[i].name) ||
+		   !sameSpan(a->hdrs[i].value, b->hdrs[i].value))
+			return 0;
+	}
+	return 1;
+}
+
+/* checkInput - parse the input with every scanner and check the results */
+static void checkInput(const char *data, size_t size) {
+	char *buf = (char *)malloc(size ? size : 1); //exact size for ASan
+	httpRequest first, req;
+	httpSpan host, port, path;
+	int s, rc, rc0 = 0, seen = 0, i;
+
+	memcpy(buf, data, size);
+	for(s = 0; s < sizeof(scanners) / sizeof(scanners[0]); s++) {
+		if(httpUseScanner(scanners[s]) < 0)
+			continue;
+		rc = httpParse(buf, size, &req);
+		if(!seen) {
+			rc0 = rc;
+			first = req;
+			seen = 1;
+		}
+		else if(rc != rc0 || (rc > 0 && !sameRequest(&first, &req))) {
+			fail("scanners disagree", data, size);
+		}
+	}
+
+	if(rc0 > 0) {
+		accepted++;
+		if(rc0 > size)
+			fail("head larger than input", data, size);
+		if(first.method.len == 0 || first.target.len == 0 ||
+		   first.version.len == 0 || !checkSpan(first.method, buf, rc0) ||
+		   !checkSpan(first.target, buf, rc0) ||
+		   !checkSpan(first.version, buf, rc0))
+			fail("bad request line span", data, size);
+		for(i = 0; i < first.nhdrs; i++) {
+			if(first.hdrs[i].name.len == 0 ||
+			   memchr(first.hdrs[i].name.p, ':', first.hdrs[i].name.len) ||
+			   !checkSpan(first.hdrs[i].name, buf, rc0) ||
+			   !checkSpan(first.hdrs[i].value, buf, rc0))
+				fail("bad header span", data, size);
+		}
+		httpSplitUrl(first.target, &host, &port, &path);
+		if(!checkSpan(host, buf, rc0) || !checkSpan(port, buf, rc0) ||
+		   (!checkSpan(path, buf, rc0) && !httpSpanEq(path, "/")))
+			fail("bad url span", data, size);
+	}
+	else if(rc0 == 0) {
+		incomplete++;
+	}
+	else {
+		malformed++;
+	}
+	free(buf);
+}
+
+#ifdef HTTP_LIBFUZZER
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	static int ready;
+
+	if(!ready) {
+		httpInit();
+		ready = 1;
+	}
+	checkInput((const char *)data, size);
+	return 0;
+}
+#else
+
+/* seed is struct for one input of the corpus. It has its bytes and size */
+typedef struct seed {
+	char *data;
+	size_t size;
+} seed;
+
+/* readSeed - read the file into s, return -1 if it cannot be read */
+static int readSeed(const char *file, seed *s) {
+	FILE *fp = fopen(file, "rb");
+	long size;
+
+	if(fp == NULL || fseek(fp, 0, SEEK_END) < 0 || (size = ftell(fp)) < 0) {
+		if(fp != NULL)
+			fclose(fp);
+		return -1;
+	}
+	rewind(fp);
+	s->data = (char *)malloc(size ? size : 1);
+	s->size = fread(s->data, 1, size, fp);
+	fclose(fp);
+	return 0;
+}
+
+/* mutate - a mutant of s in out (room for twice its size plus 8 bytes),
+ * return its size */
+static size_t mutate(seed *s, char *out) {
+	static const char special[] = "\r\n: \t";
+	size_t n = s->size, pos, len;
+	int k, ops = 1 + rand() % 4;
+
+	memcpy(out, s->data, n);
+	for(k = 0; k < ops; k++) {
+		pos = n ? rand() % (n + 1) : 0;
+		switch(rand() % 6) {
+		case 0: //flip a byte
+			if(pos < n)
+				out[pos] ^= 1 << (rand() % 8);
+			break;
+		case 1: //insert a character the parser looks for
+			if(n < 2 * s->size + 8) {
+				memmove(out + pos + 1, out + pos, n - pos);
+				out[pos] = special[rand() % 5];
+				n++;
+			}
+			break;
+		case 2: //delete a byte
+			if(pos < n) {
+				memmove(out + pos, out + pos + 1, n - pos - 1);
+				n--;
+			}
+			break;
+		case 3: //cut it short
+			n = pos;
+			break;
+		case 4: //duplicate a run of it
+			len = n - pos < 16 ? n - pos : 16;
+			if(n + len <= 2 * s->size + 8) {
+				memmove(out + pos + len, out + pos, n - pos);
+				n += len;
+			}
+			break;
+		default: //a byte that is not ASCII
+			if(pos < n)
+				out[pos] = (char)(0x80 | rand());
+		}
+	}
+	return n;
+}
+
+static void usage(char *prog) {
+	fprintf(stderr, "usage: %s [-n mutants] [-s seed] file...\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	long mutants = 100000, i;
+	unsigned int rseed = 1;
+	seed *seeds;
+	char *buf;
+	size_t maxSize = 0;
+	int opt, nseeds = 0, j;
+
+	while((opt = getopt(argc, argv, "n:s:")) != -1) {
+		switch(opt) {
+		case 'n': mutants = atol(optarg); break;
+		case 's': rseed = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if(optind == argc || mutants < 0)
+		usage(argv[0]);
+
+	httpInit();
+	seeds = (seed *)malloc((argc - optind) * sizeof(seed));
+	for(j = optind; j < argc; j++) {
+		if(readSeed(argv[j], &seeds[nseeds]) < 0) {
+			fprintf(stderr, "cannot read %s\n", argv[j]);
+			exit(1);
+		}
+		checkInput(seeds[nseeds].data, seeds[nseeds].size);
+		if(seeds[nseeds].size > maxSize)
+			maxSize = seeds[nseeds].size;
+		nseeds++;
+	}
+
+	srand(rseed);
+	buf = (char *)malloc(2 * maxSize + 8);
+	for(i = 0; i < mutants; i++) {
+		seed *s = &seeds[rand() % nseeds];
+		checkInput(buf, mutate(s, buf));
+	}
+	printf("%ld inputs ok: %ld accepted, %ld incomplete, %ld malformed\n",
+	       nseeds + mutants, accepted, incomplete, malformed);
+	for(j = 0; j < nseeds; j++)
+		free(seeds[j].data);
+	free(seeds);
+	free(buf);
+	return 0;
+}
+#endif
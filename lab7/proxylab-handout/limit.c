@@ -0,0 +1,167 @@
+/******************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * These are the per-server limits, see limit.h. One mutex guards the 
+ * table, taken twice per request to a server, never while waiting. A 
+ * freed slot goes straight to the first waiter instead of back to the 
+ * server, so a request arriving meanwhile cannot overtake the line. The 
+ * waiter is woken through its eventfd after the mutex is released, and 
+ * lives on the stack of the waiting request, which cannot return before
+ * the wakeup.
+ *
+ * ***************************************************************************/
+
+#include "csapp.h"
+#include "pool.h"
+#include "limit.h"
+
+/* findLimit - look for the server host:port, adding it if create is set.
+ * return NULL if there is none or it cannot be added. called with the
+ * limiter locked */
+static serverLimit *findLimit(limiter *lm, char *host, char *port, \
+                                                         int create) {
+	unsigned long hash = hashOrigin(host, port);
+	serverLimit **bucket = &lm->buckets[hash & (LIMIT_BUCKETS - 1)];
+	serverLimit *curr;
+
+	for(curr = *bucket; curr != NULL; curr = curr->next) {
+		if(curr->hash == hash && !strcmp(curr->host, host) &&
+		   !strcmp(curr->port, port))
+			return curr;
+	}
+	if(!create)
+		return NULL;
+
+	curr = (serverLimit *)Calloc(1, sizeof(serverLimit));
+	if((curr->host = strdup(host)) == NULL ||
+	   (curr->port = strdup(port)) == NULL) {
+		Free(curr->host);
+		Free(curr);
+		return NULL;
+	}
+	curr->hash = hash;
+	curr->next = *bucket;
+	*bucket = curr;
+	return curr;
+}
+
+/* dropLimit - unlink and free server sl, which has no requests left.
+ * called with the limiter locked */
+static void dropLimit(limiter *lm, serverLimit *sl) {
+	serverLimit **prev = &lm->buckets[sl->hash & (LIMIT_BUCKETS - 1)];
+
+	while(*prev != sl)
+		prev = &(*prev)->next;
+	*prev = sl->next;
+	Free(sl->host);
+	Free(sl->port);
+	Free(sl);
+}
+
+/* initLimiter - initialize limits of maxActive requests at once and 
+ * maxWaiting in line per server, in the heap */
+limiter *initLimiter(int maxActive, int maxWaiting) {
+	limiter *init = (limiter *)Calloc(1, sizeof(limiter));
+
+	init->maxActive = maxActive;
+	init->maxWaiting = maxWaiting;
+	Sem_init(&init->mutex, 0, 1);
+	return init;
+}
+
+/* leaveLine - take waiter w out of the line of sl, if it is still in it.
+ * return 0 if it was, -1 if it was handed a slot already. called with the
+ * limiter locked */
+static int leaveLine(serverLimit *sl, limitWaiter *w) {
+	limitWaiter **prev = &sl->head, *last = NULL;
+
+	while(*prev != NULL && *prev != w) {
+		last = *prev;
+		prev = &(*prev)->next;
+	}
+	if(*prev == NULL)
+		return -1;
+	*prev = w->next;
+	if(sl->tail == w)
+		sl->tail = last;
+	sl->nwaiting--;
+	return 0;
+}
+
+/* limitAcquire - take a slot of host:port, waiting in line for one at most
+ * ms if they are all taken. return 0 if one was free, 1 if it was handed
+ * over after waiting, -1 if the line is full too or the server cannot be
+ * added and -2 if none came in time, no slot was taken then */
+int limitAcquire(limiter *lm, char *host, char *port, long ms) {
+	serverLimit *sl;
+	limitWaiter w;
+	int handed;
+
+	P(&lm->mutex);
+	if((sl = findLimit(lm, host, port, 1)) == NULL) {
+		V(&lm->mutex);
+		return -1;
+	}
+	if(sl->active < lm->maxActive) {
+		sl->active++;
+		V(&lm->mutex);
+		return 0;
+	}
+	if(sl->nwaiting >= lm->maxWaiting || (w.fd = open_wakeupfd()) < 0) {
+		V(&lm->mutex);
+		return -1;
+	}
+	w.next = NULL;
+	if(sl->tail != NULL)
+		sl->tail->next = &w;
+	else
+		sl->head = &w;
+	sl->tail = &w;
+	sl->nwaiting++;
+	V(&lm->mutex);
+
+	/* the slot is ours once woken. out of time, it may have been handed
+	 * over meanwhile, the wakeup is then coming */
+	if(wait_wakeup_for(w.fd, ms) < 0) {
+		P(&lm->mutex);
+		handed = (leaveLine(sl, &w) < 0);
+		V(&lm->mutex);
+		if(!handed) {
+			Close(w.fd);
+			return -2;
+		}
+		wait_wakeup(w.fd);
+	}
+	Close(w.fd);
+	return 1;
+}
+
+/* limitRelease - give back a slot of host:port, to the first request in
+ * its line if there is one */
+void limitRelease(limiter *lm, char *host, char *port) {
+	serverLimit *sl;
+	limitWaiter *w = NULL;
+	int fd = -1;
+
+	P(&lm->mutex);
+	if((sl = findLimit(lm, host, port, 0)) == NULL) {
+		V(&lm->mutex);
+		return;
+	}
+	if((w = sl->head) != NULL) {
+		if((sl->head = w->next) == NULL)
+			sl->tail = NULL;
+		sl->nwaiting--;
+		fd = w->fd;
+	}
+	else if(--sl->active == 0) {
+		dropLimit(lm, sl);
+	}
+	V(&lm->mutex);
+
+	if(fd >= 0)
+		send_wakeup(fd);
+}
@@ -0,0 +1,65 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * These are the per-server limits of the proxy, keyed by host and port
+ * like the pool of idle connections, but shared by every event loop and
+ * thread. A server gets at most maxActive requests at once: a request 
+ * takes a slot before its server connection and gives it back after the
+ * response, and a request finding every slot taken waits in line, first
+ * come first served, for one to be handed over, for a while. At most
+ * maxWaiting wait, more are turned away at once. A server that stops
+ * answering thus ties up maxActive requests and its own line, never the
+ * loops, threads or connections every other server needs, and its
+ * requests are bounded by the connect and response timeouts of the proxy.
+ *
+ * ***************************************************************************/
+
+#ifndef __LIMIT_H__
+#define __LIMIT_H__
+
+#include "csapp.h"
+
+#define LIMIT_BUCKETS 256 //hash buckets for servers, power of 2
+
+/* limitWaiter is struct for one request waiting for a slot of a server. It
+ * has the eventfd the request parks on and the next waiter in line */
+typedef struct limitWaiter {
+	int fd;
+	struct limitWaiter *next;
+} limitWaiter;
+
+/* serverLimit is struct for one server with requests on it. It has the
+ * host and port strings, hash of both, the slots taken, the line of 
+ * waiters with its length and the next server in the same bucket. It is
+ * freed once it has neither */
+typedef struct serverLimit {
+	char *host;
+	char *port;
+	unsigned long hash;
+	int active;
+	limitWaiter *head;
+	limitWaiter *tail;
+	int nwaiting;
+	struct serverLimit *next;
+} serverLimit;
+
+/* limiter is struct for the limits of every server. It has the hash 
+ * buckets of servers, the slots and waiters each server may have, and a
+ * mutex for them */
+typedef struct limiter {
+	serverLimit *buckets[LIMIT_BUCKETS];
+	int maxActive;
+	int maxWaiting;
+	sem_t mutex;
+} limiter;
+
+/* function prototypes for limit.c */
+limiter *initLimiter(int maxActive, int maxWaiting);
+
+int limitAcquire(limiter *lm, char *host, char *port, long ms);
+
+void limitRelease(limiter *lm, char *host, char *port);
+
+#endif /* __LIMIT_H__ */
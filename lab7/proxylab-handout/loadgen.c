@@ -0,0 +1,613 @@
+/****************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * loadgen - load generator for the proxy. Keeps conns concurrent client
+ * connections busy until requests responses were received. By default
+ * each request is a new connection sending "GET url" as HTTP/1.0; with -k
+ * the connections are kept alive, each sending its next HTTP/1.1 request
+ * as soon as the previous response is complete. -g asks for gzip coded
+ * responses with Accept-Encoding. Responses are delimited by 
+ * Content-Length, chunked encoding or the proxy closing. Connections
+ * are spread over threads, each driving its share with a non-blocking
+ * epoll loop, so thousands of clients do not need thousands of threads.
+ *
+ * A url of @file takes the URLs from file, one per line, requesting them
+ * in turn, or with -z alpha at random with Zipf(alpha) popularity, the
+ * first line the most popular. -m port reads the stats of the proxy on
+ * its admin port (proxy -M) before and after the run and reports the hit
+ * ratio of the requests in between.
+ *
+ * Reports requests per second, MB/s and latency percentiles from the start
+ * of each request (its connect, for a new connection) to the end of its
+ * response, as "name value" pairs for scripts like gate.sh.
+ *
+ * usage: loadgen [-gk] [-c conns] [-m port] [-n requests] [-s seed]
+ *                [-t threads] [-z alpha] <host> <port> <url>
+ *
+ *****************************************************************************/
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <math.h>
+#include "csapp.h"
+
+/* slot states */
+#define CONNECTING 0
+#define SENDING 1
+#define HEAD 2 //status line and headers
+#define BODY 3 //Content-Length bytes left
+#define CHUNK_SIZE 4 //chunk size line
+#define CHUNK_DATA 5 //chunk data and its CRLF left
+#define TRAILERS 6 //trailer lines up to the empty one
+#define UNTIL_EOF 7 //body delimited by the proxy closing
+
+#define STALL_SECS 10 //give up on connections idle for this long
+
+/* what feeding response bytes to a slot did */
+#define FEED_MORE 0 //response not complete yet
+#define FEED_DONE 1 //response complete
+#define FEED_ERROR -1 //not an HTTP response
+
+/* slot is struct for one client connection. It has the socket, the state,
+ * its request, how much of it is sent, when the request was started,
+ * the response head read so far, the body bytes still expected, whether
+ * the chunk size line is past its digits and a trailer line is at its
+ * start, whether the proxy closes the connection after the response and
+ * the epoll events it waits for */
+typedef struct slot {
+	int fd;
+	int state;
+	int req;
+	size_t sent;
+	struct timeval start;
+	char head[MAXBUF];
+	size_t headLen;
+	size_t left;
+	int sizeDone;
+	int lineStart;
+	int closing;
+	unsigned int events;
+} slot;
+
+/* worker is struct for one load thread. It has the epoll instance, the
+ * connections it drives and the state of its random numbers */
+typedef struct worker {
+	int epfd;
+	int nslots;
+	slot *slots;
+	unsigned short seed[3];
+} worker;
+
+static struct addrinfo *proxyAddr; //proxy address, resolved once
+static char **requests; //requests sent in turn
+static size_t *requestSizes;
+static int nrequests;
+static int keepAlive; //keep connections open between requests
+static int acceptGzip; //send Accept-Encoding: gzip
+static double *zipfCdf; //cumulative popularity of the requests, or NULL
+static long totalReqs; //requests to complete
+static long startedReqs; //requests started, shared by threads
+static long doneReqs, errReqs, badStatus, bytesRead, connects, stalled;
+static long *latencies; //latency of each completed request in us
+
+/* elapsedUs - microseconds since start */
+static long elapsedUs(struct timeval *start) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000000L +
+	       (now.tv_usec - start->tv_usec);
+}
+
+/* pickRequest - the request to send next: the i-th in turn, or one drawn
+ * from the Zipf popularity with -z */
+static int pickRequest(worker *w, long i) {
+	double u;
+	int lo, hi;
+
+	if(zipfCdf == NULL)
+		return i % nrequests;
+	u = erand48(w->seed) * zipfCdf[nrequests - 1];
+	for(lo = 0, hi = nrequests - 1; lo < hi; ) { //first cdf >= u
+		if(zipfCdf[(lo + hi) / 2] < u)
+			lo = (lo + hi) / 2 + 1;
+		else
+			hi = (lo + hi) / 2;
+	}
+	return lo;
+}
+
+/* claimRequest - claim the next request for slot s, return 0 if all
+ * requests were already claimed */
+static int claimRequest(worker *w, slot *s) {
+	long i = __sync_fetch_and_add(&startedReqs, 1);
+
+	if(i >= totalReqs)
+		return 0;
+	s->req = pickRequest(w, i);
+	s->sent = 0;
+	s->headLen = 0;
+	s->state = SENDING;
+	gettimeofday(&s->start, NULL);
+	return 1;
+}
+
+/* waitFor - make the connection of s wait for events */
+static void waitFor(worker *w, slot *s, unsigned int events) {
+	struct epoll_event ev;
+
+	if(s->events == events)
+		return;
+	ev.events = events;
+	ev.data.ptr = s;
+	epoll_ctl(w->epfd, EPOLL_CTL_MOD, s->fd, &ev);
+	s->events = events;
+}
+
+/* startSlot - claim the next request and start connecting for it,
+ * return 0 if all requests were already claimed */
+static int startSlot(worker *w, slot *s) {
+	struct epoll_event ev;
+
+	while(claimRequest(w, s)) {
+		s->fd = socket(proxyAddr->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if(s->fd < 0 || (connect(s->fd, proxyAddr->ai_addr,
+		                 proxyAddr->ai_addrlen) < 0 && errno != EINPROGRESS)) {
+			if(s->fd >= 0)
+				close(s->fd);
+			__sync_fetch_and_add(&errReqs, 1);
+			continue;
+		}
+		__sync_fetch_and_add(&connects, 1);
+		s->state = CONNECTING;
+		s->events = ev.events = EPOLLOUT;
+		ev.data.ptr = s;
+		epoll_ctl(w->epfd, EPOLL_CTL_ADD, s->fd, &ev);
+		return 1;
+	}
+	return 0;
+}
+
+/* sendSlot - write what is left of the request of s, then wait for the
+ * response. return 0 if the write failed, 1 otherwise */
+static int sendSlot(worker *w, slot *s) {
+	ssize_t n;
+
+	while(s->sent < requestSizes[s->req]) {
+		n = write(s->fd, requests[s->req] + s->sent,
+		          requestSizes[s->req] - s->sent);
+		if(n < 0 && errno == EAGAIN) { //the rest when there is room
+			waitFor(w, s, EPOLLOUT);
+			return 1;
+		}
+		if(n < 0)
+			return 0;
+		s->sent += n;
+	}
+	waitFor(w, s, EPOLLIN);
+	s->state = HEAD;
+	return 1;
+}
+
+/* endSlot - record the request and start the next, on the same
+ * connection if it is kept alive. return 0 once the slot has no more
+ * requests to run */
+static int endSlot(worker *w, slot *s, int ok) {
+	if(ok) {
+		long i = __sync_fetch_and_add(&doneReqs, 1);
+		latencies[i] = elapsedUs(&s->start);
+	}
+	else {
+		__sync_fetch_and_add(&errReqs, 1);
+	}
+
+	if(ok && keepAlive && !s->closing) {
+		if(!claimRequest(w, s)) {
+			close(s->fd);
+			return 0;
+		}
+		if(sendSlot(w, s))
+			return 1;
+		__sync_fetch_and_add(&errReqs, 1);
+	}
+	close(s->fd);
+	return startSlot(w, s);
+}
+
+/* headerIs - whether the header line at p is a name header */
+static int headerIs(char *p, const char *name) {
+	size_t len = strlen(name);
+	return !strncasecmp(p, name, len) && p[len] == ':';
+}
+
+/* hasValue - whether value appears in the header line at p, ignoring
+ * case */
+static int hasValue(char *p, const char *value) {
+	size_t len = strlen(value);
+
+	for(; *p && *p != '\n'; p++) {
+		if(!strncasecmp(p, value, len))
+			return 1;
+	}
+	return 0;
+}
+
+/* parseHead - the head of a response is complete in s->head, find out
+ * how its body is delimited. return FEED_ERROR if it is not a response */
+static int parseHead(slot *s) {
+	int minor, status, chunked = 0, keep = 0;
+	long length = -1;
+	char *p;
+
+	s->head[s->headLen] = '\0';
+	if(sscanf(s->head, "HTTP/1.%d %d", &minor, &status) != 2)
+		return FEED_ERROR;
+	if(status < 200 || status >= 400)
+		__sync_fetch_and_add(&badStatus, 1);
+
+	s->closing = 0;
+	for(p = strchr(s->head, '\n'); p != NULL; p = strchr(p, '\n')) {
+		p++;
+		if(headerIs(p, "Content-Length"))
+			length = strtol(p + 15, NULL, 10);
+		else if(headerIs(p, "Transfer-Encoding"))
+			chunked = hasValue(p, "chunked");
+		else if(headerIs(p, "Connection")) {
+			s->closing = hasValue(p, "close");
+			keep = hasValue(p, "keep-alive");
+		}
+	}
+	if(minor == 0 && !keep)
+		s->closing = 1;
+
+	if(status == 204 || status == 304 || (status >= 100 && status < 200)) {
+		s->left = 0;
+		s->state = BODY;
+	}
+	else if(chunked) {
+		s->left = 0;
+		s->sizeDone = 0;
+		s->state = CHUNK_SIZE;
+	}
+	else if(length >= 0) {
+		s->left = length;
+		s->state = BODY;
+	}
+	else {
+		s->closing = 1;
+		s->state = UNTIL_EOF;
+	}
+	return FEED_MORE;
+}
+
+/* feed - take n response bytes at p for slot s. return FEED_DONE once the
+ * response is complete, FEED_ERROR if it is not one, FEED_MORE otherwise */
+static int feed(slot *s, char *p, size_t n) {
+	size_t k, i;
+	int c;
+
+	while(1) {
+		switch(s->state) {
+		case HEAD:
+			/* gather the head, then go on with whatever came after it */
+			k = sizeof(s->head) - 1 - s->headLen;
+			if(k == 0)
+				return FEED_ERROR;
+			k = n < k ? n : k;
+			memcpy(s->head + s->headLen, p, k);
+			for(i = s->headLen > 3 ? s->headLen - 3 : 0;
+			    i + 4 <= s->headLen + k; i++) {
+				if(!memcmp(s->head + i, "\r\n\r\n", 4))
+					break;
+			}
+			if(i + 4 > s->headLen + k) {
+				s->headLen += k;
+				return FEED_MORE;
+			}
+			p += i + 4 - s->headLen;
+			n -= i + 4 - s->headLen;
+			s->headLen = i + 4;
+			if(parseHead(s) == FEED_ERROR)
+				return FEED_ERROR;
+			break;
+		case BODY:
+			k = n < s->left ? n : s->left;
+			s->left -= k;
+			if(s->left == 0)
+				return FEED_DONE;
+			return FEED_MORE;
+		case CHUNK_SIZE:
+			/* hex digits, then an extension ignored up to the LF */
+			for(; n > 0 && *p != '\n'; p++, n--) {
+				c = *p;
+				if(!s->sizeDone && isxdigit(c))
+					s->left = s->left * 16 +
+					          (isdigit(c) ? c - '0' : (c | 0x20) - 'a' + 10);
+				else
+					s->sizeDone = 1;
+			}
+			if(n == 0)
+				return FEED_MORE;
+			p++, n--;
+			s->state = s->left == 0 ? TRAILERS : CHUNK_DATA;
+			s->left += 2; //the CRLF after the data
+			s->lineStart = 1;
+			break;
+		case CHUNK_DATA:
+			k = n < s->left ? n : s->left;
+			p += k, n -= k;
+			if((s->left -= k) > 0)
+				return FEED_MORE;
+			s->left = 0;
+			s->sizeDone = 0;
+			s->state = CHUNK_SIZE;
+			break;
+		case TRAILERS:
+			/* lines up to an empty one, CRs ignored */
+			for(; n > 0; p++, n--) {
+				if(*p == '\n' && s->lineStart)
+					return FEED_DONE;
+				if(*p != '\r')
+					s->lineStart = (*p == '\n');
+			}
+			return FEED_MORE;
+		default: //UNTIL_EOF
+			return FEED_MORE;
+		}
+		if(n == 0 && s->state != BODY && s->state != TRAILERS)
+			return FEED_MORE;
+	}
+}
+
+/* handleSlot - advance one connection on an epoll event, return 0 once the
+ * slot has no more requests to run */
+static int handleSlot(worker *w, slot *s, unsigned int events) {
+	char buf[MAXBUF];
+	ssize_t n = 0;
+	int rc = FEED_MORE;
+
+	if(s->state < HEAD && (events & (EPOLLERR | EPOLLHUP))) {
+		close(s->fd);
+		__sync_fetch_and_add(&errReqs, 1);
+		return startSlot(w, s);
+	}
+
+	if(s->state == CONNECTING)
+		s->state = SENDING;
+	if(s->state == SENDING) {
+		if(!sendSlot(w, s))
+			return endSlot(w, s, 0);
+		return 1;
+	}
+
+	/* read what is there, the response ends in it or with EOF */
+	while(rc == FEED_MORE && (n = read(s->fd, buf, sizeof(buf))) > 0) {
+		__sync_fetch_and_add(&bytesRead, n);
+		rc = feed(s, buf, n);
+	}
+	if(rc == FEED_MORE && n < 0 && errno == EAGAIN)
+		return 1;
+	if(rc == FEED_MORE) //EOF, a response only ends there if it says so
+		return endSlot(w, s, n == 0 && s->state == UNTIL_EOF);
+	return endSlot(w, s, rc == FEED_DONE);
+}
+
+/* workerThread - drive the slots of one worker until all are finished.
+ * if none moved for STALL_SECS, the requests left are errors, a broken
+ * proxy fails the run instead of hanging it */
+static void *workerThread(void *vargp) {
+	worker *w = (worker *)vargp;
+	struct epoll_event evs[256];
+	int i, n, active = 0;
+
+	for(i = 0; i < w->nslots; i++)
+		active += startSlot(w, &w->slots[i]);
+
+	while(active > 0) {
+		if((n = epoll_wait(w->epfd, evs, 256, STALL_SECS * 1000)) == 0) {
+			__sync_fetch_and_add(&stalled, active);
+			__sync_fetch_and_add(&startedReqs, totalReqs); //start no more
+			break;
+		}
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			unix_error("epoll_wait error");
+			break;
+		}
+		for(i = 0; i < n; i++) {
+			if(!handleSlot(w, (slot *)evs[i].data.ptr, evs[i].events))
+				active--;
+		}
+	}
+	return NULL;
+}
+
+/* addRequest - add a request for url to those sent */
+static void addRequest(char *url) {
+	requests = (char **)Realloc(requests, (nrequests + 1) * sizeof(char *));
+	requestSizes = (size_t *)Realloc(requestSizes,
+	                                 (nrequests + 1) * sizeof(size_t));
+	requests[nrequests] = (char *)Malloc(MAXLINE);
+	requestSizes[nrequests] = snprintf(requests[nrequests], MAXLINE,
+	              "GET %s HTTP/1.%d\r\nUser-Agent: loadgen\r\n%s\r\n", url,
+	              keepAlive, acceptGzip ? "Accept-Encoding: gzip\r\n" : "");
+	nrequests++;
+}
+
+/* readUrls - add a request for every line of file */
+static void readUrls(char *file) {
+	FILE *fp = fopen(file, "r");
+	char line[MAXLINE];
+
+	if(fp == NULL)
+		unix_error("cannot open url file");
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if(line[0] != '\0')
+			addRequest(line);
+	}
+	fclose(fp);
+	if(nrequests == 0) {
+		fprintf(stderr, "no urls in %s\n", file);
+		exit(1);
+	}
+}
+
+/* makeZipf - give the requests Zipf(alpha) popularity in their order */
+static void makeZipf(double alpha) {
+	double sum = 0;
+	int i;
+
+	zipfCdf = (double *)Malloc(nrequests * sizeof(double));
+	for(i = 0; i < nrequests; i++) {
+		sum += 1.0 / pow(i + 1, alpha);
+		zipfCdf[i] = sum;
+	}
+}
+
+/* scrape - read the counters of the proxy's admin port into totals, by
+ * name: requests, cache_hits and coalesced. return -1 if it cannot */
+static int scrape(char *host, char *port, long *totals) {
+	static const char *names[] = { "requests ", "cache_hits ", "coalesced " };
+	char line[MAXLINE];
+	rio_t rio;
+	int fd, i;
+
+	if(!strcmp(host, "localhost")) //the admin port is on IPv4 loopback
+		host = "127.0.0.1";
+	if((fd = open_clientfd(host, port)) < 0)
+		return -1;
+	memset(totals, 0, 3 * sizeof(long));
+	Rio_writen(fd, "GET / HTTP/1.0\r\n\r\n", 18);
+	Rio_readinitb(&rio, fd);
+	while(Rio_readlineb(&rio, line, MAXLINE) > 0) {
+		for(i = 0; i < 3; i++) {
+			if(!strncmp(line, names[i], strlen(names[i])))
+				totals[i] = atol(line + strlen(names[i]));
+		}
+	}
+	Close(fd);
+	return 0;
+}
+
+/* cmpLong - qsort comparator for latencies */
+static int cmpLong(const void *a, const void *b) {
+	long x = *(const long *)a, y = *(const long *)b;
+	return (x > y) - (x < y);
+}
+
+/* percentile - p-th percentile of the sorted latencies */
+static long percentile(double p) {
+	long i = (long)(p / 100.0 * doneReqs);
+	if(i >= doneReqs)
+		i = doneReqs - 1;
+	return latencies[i];
+}
+
+static void usage(char *prog) {
+	fprintf(stderr, "usage: %s [-gk] [-c conns] [-m port] [-n requests] "
+	        "[-s seed] [-t threads] [-z alpha] <host> <port> <url>\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	int conns = 100, nthreads = 4, opt, i;
+	long seed = 1, before[3], after[3];
+	double alpha = 0, secs;
+	char *adminPort = NULL;
+	struct addrinfo hints;
+	struct timeval start;
+	struct rlimit rl;
+	pthread_t *tids;
+	worker *workers;
+
+	totalReqs = 10000;
+	while((opt = getopt(argc, argv, "c:gkm:n:s:t:z:")) != -1) {
+		switch(opt) {
+		case 'c': conns = atoi(optarg); break;
+		case 'g': acceptGzip = 1; break;
+		case 'k': keepAlive = 1; break;
+		case 'm': adminPort = optarg; break;
+		case 'n': totalReqs = atol(optarg); break;
+		case 's': seed = atol(optarg); break;
+		case 't': nthreads = atoi(optarg); break;
+		case 'z': alpha = atof(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if(argc - optind != 3 || conns < 1 || nthreads < 1 || totalReqs < 1 ||
+	   alpha < 0)
+		usage(argv[0]);
+	if(nthreads > conns)
+		nthreads = conns;
+
+	/* a socket per connection, thousands of them */
+	if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICSERV;
+	if((i = getaddrinfo(argv[optind], argv[optind+1], &hints, &proxyAddr))) {
+		gai_error(i, "getaddrinfo error");
+		exit(1);
+	}
+	if(argv[optind+2][0] == '@')
+		readUrls(argv[optind+2] + 1);
+	else
+		addRequest(argv[optind+2]);
+	if(alpha > 0)
+		makeZipf(alpha);
+	latencies = (long *)Calloc(totalReqs, sizeof(long));
+	if(adminPort != NULL && scrape(argv[optind], adminPort, before) < 0) {
+		fprintf(stderr, "cannot read stats on port %s\n", adminPort);
+		exit(1);
+	}
+
+	/* split the connections evenly across the threads */
+	workers = (worker *)Calloc(nthreads, sizeof(worker));
+	tids = (pthread_t *)Calloc(nthreads, sizeof(pthread_t));
+	gettimeofday(&start, NULL);
+	for(i = 0; i < nthreads; i++) {
+		workers[i].nslots = conns / nthreads + (i < conns % nthreads);
+		workers[i].slots = (slot *)Calloc(workers[i].nslots, sizeof(slot));
+		workers[i].epfd = epoll_create1(0);
+		workers[i].seed[0] = seed;
+		workers[i].seed[1] = seed >> 16;
+		workers[i].seed[2] = i;
+		Pthread_create(&tids[i], NULL, workerThread, &workers[i]);
+	}
+	for(i = 0; i < nthreads; i++)
+		Pthread_join(tids[i], NULL);
+	secs = elapsedUs(&start) / 1e6;
+
+	if(doneReqs == 0) {
+		printf("requests 0 errors %ld stalled %ld\n", errReqs, stalled);
+		exit(1);
+	}
+	qsort(latencies, doneReqs, sizeof(long), cmpLong);
+	printf("requests %ld errors %ld bad_status %ld stalled %ld conns %d "
+	       "connects %ld secs %.3f req/s %.1f MB/s %.2f\n", doneReqs, errReqs,
+	       badStatus, stalled, conns, connects, secs, doneReqs / secs,
+	       bytesRead / secs / 1e6);
+	printf("latency_us p50 %ld p90 %ld p99 %ld p999 %ld max %ld\n",
+	       percentile(50), percentile(90), percentile(99), percentile(99.9),
+	       latencies[doneReqs-1]);
+
+	/* hits of the requests of this run, coalesced ones count, they cost
+	 * the server nothing either */
+	if(adminPort != NULL && scrape(argv[optind], adminPort, after) == 0) {
+		after[0] -= before[0];
+		after[1] -= before[1];
+		after[2] -= before[2];
+		printf("proxy requests %ld hits %ld coalesced %ld hit_ratio %.4f\n",
+		       after[0], after[1], after[2], after[0] ?
+		       (double)(after[1] + after[2]) / after[0] : 0.0);
+	}
+	exit(stalled > 0);
+}
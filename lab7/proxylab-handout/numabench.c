@@ -0,0 +1,249 @@
+/****************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * numabench - benchmark of the NUMA placement of the cache. Threads like
+ * the event loops each store their own share of the objects, then look up
+ * random ones for a while and read their payloads as a hit is sent, most
+ * of them (-l percent) of their own share, as clients tend to stay with
+ * one loop, the rest of anyone's. It runs three ways: threads unpinned
+ * over a whole cache, pinned (-P) over a whole cache, and pinned over a
+ * cache split per node (-P -N), and reports the lookups per second, the
+ * hits stored on another node than the thread's (split only) and, from
+ * the perf counters of the node loads, the loads per lookup that went to
+ * memory and how many of them to another node's memory. Without the
+ * counters (a VM, perf_event_paranoid) those columns are n/a, on a single
+ * node machine all memory is local.
+ *
+ * usage: numabench [-d msecs] [-l percent] [-n objects] [-s size]
+ *                  [-t threads]
+ *
+ *****************************************************************************/
+
+#include "csapp.h"
+#include "cache.h"
+#include "policy.h"
+#include "topo.h"
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/* runner is struct for one benchmark thread. It has the cache, its index,
+ * whether it is pinned, the seed of its random URLs, and the lookups it
+ * has done and how many of them were remote hits */
+typedef struct runner {
+	queue *cache;
+	int id;
+	int pin;
+	unsigned long seed;
+	long lookups;
+	long remote;
+} runner;
+
+static char **urls; //the cached URLs, thread i stores every nthreads-th
+static int nurls;
+static int nthreads;
+static size_t objSize = 16384;
+static int locality = 90;
+static volatile int running; //threads look up while set
+
+/* storeThread - pin if asked and store the share of the objects of this
+ * thread, so their payloads are first touched on its node */
+static void *storeThread(void *vargp) {
+	runner *r = (runner *)vargp;
+	chunkList cl;
+	object *obj;
+	chunk *ch;
+	int i;
+
+	if(r->pin)
+		topoPin(r->id);
+	for(i = r->id; i < nurls; i += nthreads) {
+		cl.head = cl.tail = NULL;
+		cl.size = 0;
+		if(fillCache(&cl, objSize, r->cache) < 0) {
+			cancelCache(&cl, r->cache);
+			continue;
+		}
+		for(ch = cl.head; ch != NULL; ch = ch->next) //written like a response
+			memset(ch->data, i, CHUNK_SIZE);
+		obj = commitCache(&cl, urls[i], strlen(urls[i]) + 1, 0, 0, 0, 0,
+		                  r->cache);
+		if(obj != NULL)
+			releaseObj(obj);
+		else
+			cancelCache(&cl, r->cache);
+	}
+	return NULL;
+}
+
+/* lookupThread - look up random URLs, mostly of the own share, and read
+ * their payloads until running is cleared */
+static void *lookupThread(void *vargp) {
+	runner *r = (runner *)vargp;
+	char *buf = (char *)Malloc(objSize);
+	unsigned long x = r->seed;
+	int own = (nurls - r->id + nthreads - 1) / nthreads, node = 0, i;
+	object *obj;
+	long n = 0, remote = 0;
+
+	if(r->pin)
+		topoPin(r->id);
+	while(running) {
+		x ^= x << 13; //xorshift
+		x ^= x >> 7;
+		x ^= x << 17;
+		if(x % 100 < locality && own > 0)
+			i = r->id + (x / 100) % own * nthreads;
+		else
+			i = (x / 100) % nurls;
+		if((obj = searchCache(urls[i], r->cache)) != NULL) {
+			copyChunks(obj->chunks, 0, buf, obj->dsize);
+			if(r->cache->nnodes > 1)
+				node = topoNode() % r->cache->nnodes;
+			remote += obj->node != node;
+			releaseObj(obj);
+		}
+		n++;
+	}
+	r->lookups = n;
+	r->remote = remote;
+	Free(buf);
+	return NULL;
+}
+
+/* openCounter - count node cache events of result (access or miss) of
+ * this process and the threads it creates from now on, user space only.
+ * return the counter, -1 if there is none */
+static int openCounter(int result) {
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_NODE |
+	              (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* readCounter - the count of counter fd, closed after, -1 if none */
+static long readCounter(int fd) {
+	long count;
+
+	if(fd < 0)
+		return -1;
+	if(read(fd, &count, sizeof(count)) != sizeof(count))
+		count = -1;
+	close(fd);
+	return count;
+}
+
+/* runThreads - run body in nthreads threads over cache and wait for them,
+ * for msecs if it looks up. return the lookups and remote hits in total */
+static void runThreads(void *(*body)(void *), queue *cache, int pin, \
+                       int msecs, long *lookups, long *remote) {
+	runner *runners = (runner *)Calloc(nthreads, sizeof(runner));
+	pthread_t *tids = (pthread_t *)Calloc(nthreads, sizeof(pthread_t));
+	int i;
+
+	running = 1;
+	for(i = 0; i < nthreads; i++) {
+		runners[i].cache = cache;
+		runners[i].id = i;
+		runners[i].pin = pin;
+		runners[i].seed = 88172645463325252UL + i * 7919;
+		Pthread_create(&tids[i], NULL, body, &runners[i]);
+	}
+	if(msecs > 0) {
+		usleep(msecs * 1000);
+		running = 0;
+	}
+	*lookups = *remote = 0;
+	for(i = 0; i < nthreads; i++) {
+		Pthread_join(tids[i], NULL);
+		*lookups += runners[i].lookups;
+		*remote += runners[i].remote;
+	}
+	Free(runners);
+	Free(tids);
+}
+
+/* perLookup - print count per lookup, or n/a without the counter */
+static void perLookup(long count, long lookups) {
+	if(count < 0 || lookups == 0)
+		printf(" %14s", "n/a");
+	else
+		printf(" %14.3f", (double)count / lookups);
+}
+
+static void usage(char *prog) {
+	fprintf(stderr, "usage: %s [-d msecs] [-l percent] [-n objects] "
+	        "[-s size] [-t threads]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	char *names[] = { "shared", "pinned", "split" };
+	int pins[] = { 0, 1, 1 }, splits[] = { 0, 0, 1 };
+	int msecs = 1000, nnodes, opt, i, c, loads, misses;
+	long lookups, remote, nloads, nmisses;
+	queue *cache;
+
+	nnodes = topoInit();
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	nurls = 2048;
+	while((opt = getopt(argc, argv, "d:l:n:s:t:")) != -1) {
+		switch(opt) {
+		case 'd': msecs = atoi(optarg); break;
+		case 'l': locality = atoi(optarg); break;
+		case 'n': nurls = atoi(optarg); break;
+		case 's': objSize = atol(optarg); break;
+		case 't': nthreads = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if(argc != optind || msecs < 1 || nurls < 1 || nthreads < 1 ||
+	   objSize < 1 || locality < 0 || locality > 100)
+		usage(argv[0]);
+
+	urls = (char **)Malloc(nurls * sizeof(char *));
+	for(i = 0; i < nurls; i++) {
+		urls[i] = (char *)Malloc(64);
+		sprintf(urls[i], "http://bench/obj/%d", i);
+	}
+
+	printf("%d nodes, %d threads, %d objects of %lu bytes, %d%% of lookups"
+	       " of the own share\n", nnodes, nthreads, nurls,
+	       (unsigned long)objSize, locality);
+	printf("%-8s %14s %12s %14s %14s\n", "config", "lookups/s",
+	       "remote_hits", "node_loads/op", "node_misses/op");
+	for(c = 0; c < sizeof(names) / sizeof(names[0]); c++) {
+		/* room for every object, nothing is evicted */
+		cache = initCache(&lruPolicy, 0, 2 * nurls * chunkBytes(objSize),
+		                  objSize);
+		if(cache == NULL ||
+		   (splits[c] && splitCache(cache, nnodes) < 0))
+			exit(1);
+		runThreads(storeThread, cache, pins[c], 0, &lookups, &remote);
+
+		loads = openCounter(PERF_COUNT_HW_CACHE_RESULT_ACCESS);
+		misses = openCounter(PERF_COUNT_HW_CACHE_RESULT_MISS);
+		runThreads(lookupThread, cache, pins[c], msecs, &lookups, &remote);
+		nloads = readCounter(loads);
+		nmisses = readCounter(misses);
+
+		printf("%-8s %14.0f", names[c], lookups * 1000.0 / msecs);
+		if(splits[c] && lookups > 0)
+			printf(" %11.1f%%", 100.0 * remote / lookups);
+		else
+			printf(" %12s", "-");
+		perLookup(nloads, lookups);
+		perLookup(nmisses, lookups);
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,185 @@
+/****************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * parsebench - microbenchmark of request parsing. Parses a short curl
+ * request, a browser request and one with a 2 KB cookie over and over
+ * and reports the nanoseconds per request of the parser of http.c with
+ * each scanner this CPU runs, and of the line by line sscanf and strstr
+ * parsing the proxy did before, as the baseline. Both include what the
+ * proxy does with the result: matching the header names it handles and
+ * splitting the URL.
+ *
+ * usage: parsebench [-n requests]
+ *
+ *****************************************************************************/
+
+#include <time.h>
+#include "csapp.h"
+#include "http.h"
+
+static char *requests[3]; //the requests parsed, built by makeRequests
+static const char *names[] = { "curl", "browser", "cookie" };
+static volatile size_t sink; //results go here so nothing is optimized out
+
+/* makeRequests - build the requests */
+static void makeRequests() {
+	char cookie[2048 + 1];
+
+	requests[0] = strdup("GET http://localhost:8080/home.html HTTP/1.1\r\n"
+	    "Host: localhost:8080\r\n"
+	    "User-Agent: curl/7.88.1\r\n"
+	    "Accept: */*\r\n"
+	    "Proxy-Connection: Keep-Alive\r\n\r\n");
+	requests[1] = strdup("GET http://www.example.com/static/js/app.js?v=3 "
+	    "HTTP/1.1\r\n"
+	    "Host: www.example.com\r\n"
+	    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) "
+	    "Gecko/20100101 Firefox/115.0\r\n"
+	    "Accept: */*\r\n"
+	    "Accept-Language: en-US,en;q=0.5\r\n"
+	    "Accept-Encoding: gzip, deflate, br\r\n"
+	    "Referer: http://www.example.com/index.html\r\n"
+	    "Connection: keep-alive\r\n"
+	    "Sec-Fetch-Dest: script\r\n"
+	    "Sec-Fetch-Mode: no-cors\r\n"
+	    "Sec-Fetch-Site: same-origin\r\n"
+	    "If-None-Match: \"5f2b-17a3c\"\r\n"
+	    "Cache-Control: max-age=0\r\n\r\n");
+	memset(cookie, 'x', 2048);
+	cookie[2048] = '\0';
+	requests[2] = (char *)Malloc(strlen(requests[1]) + 2048 + 16);
+	sprintf(requests[2], "%.*sCookie: %s\r\n\r\n",
+	        (int)strlen(requests[1]) - 2, requests[1], cookie);
+}
+
+/* parseNew - parse req with http.c like serveRequest does */
+static void parseNew(char *req) {
+	httpRequest r;
+	httpSpan host, port, path;
+	size_t n = 0;
+	int i;
+
+	if(httpParse(req, strlen(req), &r) <= 0)
+		app_error("parse failed");
+	httpSplitUrl(r.target, &host, &port, &path);
+	for(i = 0; i < r.nhdrs; i++) {
+		if(httpSpanIs(r.hdrs[i].name, "host"))
+			n += 1;
+		else if(httpSpanIs(r.hdrs[i].name, "connection") ||
+		        httpSpanIs(r.hdrs[i].name, "proxy-connection"))
+			n += httpHasToken(r.hdrs[i].value, "close");
+		else if(!httpSpanIs(r.hdrs[i].name, "user-agent") &&
+		        !httpSpanIs(r.hdrs[i].name, "accept") &&
+		        !httpSpanIs(r.hdrs[i].name, "accept-encoding") &&
+		        !httpSpanIs(r.hdrs[i].name, "keep-alive"))
+			n += r.hdrs[i].value.len;
+	}
+	sink += n + host.len + path.len;
+}
+
+/* readLine - copy the line at *pp to line like Rio_readlineb, return its
+ * length */
+static size_t readLine(char **pp, char *line) {
+	char *p = *pp, *q = line;
+
+	while(*p && q < line + MAXLINE - 1) {
+		if((*q++ = *p++) == '\n')
+			break;
+	}
+	*q = '\0';
+	*pp = p;
+	return q - line;
+}
+
+/* parseOld - parse req the way the proxy did before http.c */
+static void parseOld(char *req) {
+	char line[MAXLINE], method[MAXLINE], url[MAXLINE], version[MAXLINE];
+	char hostname[MAXLINE], path[MAXLINE], more[MAXLINE];
+	char *p = req, *curr, *h;
+	size_t n = 0;
+
+	readLine(&p, line);
+	if(sscanf(line, "%s %s %s", method, url, version) != 3)
+		app_error("parse failed");
+
+	/* parReq */
+	curr = (curr = strstr(url, "://")) == NULL ? url : curr + 3;
+	for(h = hostname; *curr != '/' && *curr != ':' && *curr != '\0'; )
+		*h++ = *curr++;
+	*h = '\0';
+	strcpy(path, *curr ? curr : "/");
+
+	/* toServerhdr */
+	more[0] = '\0';
+	while(readLine(&p, line) > 0) {
+		if(!strcmp(line, "\r\n"))
+			break;
+		if(strstr(line, "Host:") != NULL)
+			n += 1;
+		else if(strstr(line, "User-Agent:") != NULL)
+			continue;
+		else if(strstr(line, "Accept:") != NULL)
+			continue;
+		else if(strstr(line, "Accept-Encoding:") != NULL)
+			continue;
+		else if(strstr(line, "Connection:") != NULL)
+			n += strstr(line, "close") != NULL;
+		else if(strstr(line, "Keep-Alive:") != NULL)
+			continue;
+		else
+			strcat(more, line);
+	}
+	sink += n + strlen(hostname) + strlen(path) + strlen(more);
+}
+
+/* bench - parse request r n times with parse, return ns per request */
+static double bench(void (*parse)(char *), char *r, long n) {
+	struct timespec t0, t1;
+	long i;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(i = 0; i < n; i++)
+		parse(r);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / n;
+}
+
+static void usage(char *prog) {
+	fprintf(stderr, "usage: %s [-n requests]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	const char *scanners[] = { "avx2", "sse2", "scalar" };
+	long n = 1000000;
+	int opt, i, s;
+
+	while((opt = getopt(argc, argv, "n:")) != -1) {
+		switch(opt) {
+		case 'n': n = atol(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if(argc != optind || n < 1)
+		usage(argv[0]);
+
+	httpInit();
+	makeRequests();
+	printf("%-8s %6s %-8s %10s\n", "request", "bytes", "parser", "ns/req");
+	for(i = 0; i < 3; i++) {
+		for(s = 0; s < 3; s++) {
+			if(httpUseScanner(scanners[s]) < 0)
+				continue;
+			bench(parseNew, requests[i], n / 10 + 1); //warm up
+			printf("%-8s %6zu %-8s %10.1f\n", names[i], strlen(requests[i]),
+			       scanners[s], bench(parseNew, requests[i], n));
+		}
+		bench(parseOld, requests[i], n / 10 + 1);
+		printf("%-8s %6zu %-8s %10.1f\n", names[i], strlen(requests[i]),
+		       "sscanf", bench(parseOld, requests[i], n));
+	}
+	return 0;
+}
@@ -0,0 +1,307 @@
+/******************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * These are the eviction policies and the TinyLFU sketch, see policy.h.
+ * The policies only ever run with the shard write locked. Hits found
+ * under the read lock are not applied at once, searchCache just counts
+ * them in obj->hits, and the policies that care credit them when the
+ * object comes up as a victim: an SLRU object with hits is promoted
+ * instead of evicted, a GDSF object gets its priority raised and sinks
+ * back into the heap.
+ *
+ * ***************************************************************************/
+
+#include "csapp.h"
+#include "policy.h"
+
+/* takeHits - the hits counted on obj since the last call */
+static inline unsigned int takeHits(object *obj) {
+	return __sync_lock_test_and_set(&obj->hits, 0);
+}
+
+/* listPush - put obj at the head of the list headp/tailp */
+static void listPush(object **headp, object **tailp, object *obj) {
+	obj->prev = NULL;
+	obj->next = *headp;
+	if(*headp != NULL)
+		(*headp)->prev = obj;
+	else
+		*tailp = obj;
+	*headp = obj;
+}
+
+/* listUnlink - take obj out of the list headp/tailp */
+static void listUnlink(object **headp, object **tailp, object *obj) {
+	if(obj->prev != NULL)
+		obj->prev->next = obj->next;
+	else
+		*headp = obj->next;
+	if(obj->next != NULL)
+		obj->next->prev = obj->prev;
+	else
+		*tailp = obj->prev;
+}
+
+/******************************
+ * lru
+ ******************************/
+
+static void lruInsert(shard *sh, object *obj) {
+	listPush(&sh->head, &sh->tail, obj);
+	sh->bytes += obj->dsize;
+}
+
+static void lruRemove(shard *sh, object *obj) {
+	listUnlink(&sh->head, &sh->tail, obj);
+	sh->bytes -= obj->dsize;
+}
+
+static void lruTouch(shard *sh, object *obj) {
+	if(obj != sh->head) {
+		listUnlink(&sh->head, &sh->tail, obj);
+		listPush(&sh->head, &sh->tail, obj);
+	}
+}
+
+static object *lruVictim(shard *sh) {
+	return sh->tail;
+}
+
+policyOps lruPolicy = { "lru", lruInsert, lruRemove, lruRemove, lruTouch,
+                        lruVictim };
+
+/******************************
+ * slru
+ ******************************/
+
+/* new objects are on probation (seg 0), the shard's queue */
+static void slruInsert(shard *sh, object *obj) {
+	obj->seg = 0;
+	listPush(&sh->head, &sh->tail, obj);
+	sh->bytes += obj->dsize;
+}
+
+static void slruRemove(shard *sh, object *obj) {
+	if(obj->seg) {
+		listUnlink(&sh->phead, &sh->ptail, obj);
+		sh->protBytes -= obj->dsize;
+	}
+	else {
+		listUnlink(&sh->head, &sh->tail, obj);
+	}
+	sh->bytes -= obj->dsize;
+}
+
+/* a hit protects the object, the protected LRU ones beyond the segment's
+ * share go back on probation as its most recent */
+static void slruTouch(shard *sh, object *obj) {
+	object *old;
+
+	if(obj->seg) {
+		listUnlink(&sh->phead, &sh->ptail, obj);
+		listPush(&sh->phead, &sh->ptail, obj);
+		return;
+	}
+
+	listUnlink(&sh->head, &sh->tail, obj);
+	listPush(&sh->phead, &sh->ptail, obj);
+	obj->seg = 1;
+	sh->protBytes += obj->dsize;
+
+	while(sh->protBytes > sh->bytes / 100 * SLRU_PROTECTED &&
+	      (old = sh->ptail) != obj) {
+		listUnlink(&sh->phead, &sh->ptail, old);
+		sh->protBytes -= old->dsize;
+		old->seg = 0;
+		listPush(&sh->head, &sh->tail, old);
+	}
+}
+
+/* probation goes first. a victim that was hit meanwhile is touched now
+ * and the next one considered, each hit count is taken only once */
+static object *slruVictim(shard *sh) {
+	object *obj;
+
+	while((obj = sh->tail ? sh->tail : sh->ptail) != NULL) {
+		if(takeHits(obj) == 0)
+			return obj;
+		slruTouch(sh, obj);
+	}
+	return NULL;
+}
+
+policyOps slruPolicy = { "slru", slruInsert, slruRemove, slruRemove,
+                         slruTouch, slruVictim };
+
+/******************************
+ * gdsf
+ ******************************/
+
+/* gdsfPrio - priority of obj, each hit worth one over its size */
+static inline double gdsfPrio(shard *sh, object *obj) {
+	return sh->inflation + (double)obj->freq / (obj->dsize ? obj->dsize : 1);
+}
+
+/* heapSet - put obj at index i of the heap */
+static inline void heapSet(shard *sh, size_t i, object *obj) {
+	sh->heap[i] = obj;
+	obj->hidx = i;
+}
+
+/* heapUp, heapDown - restore the min heap order of the object at i */
+static void heapUp(shard *sh, size_t i) {
+	object *obj = sh->heap[i];
+
+	while(i > 0 && sh->heap[(i - 1) / 2]->prio > obj->prio) {
+		heapSet(sh, i, sh->heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	heapSet(sh, i, obj);
+}
+
+static void heapDown(shard *sh, size_t i) {
+	object *obj = sh->heap[i];
+	size_t child;
+
+	while((child = 2 * i + 1) < sh->heapLen) {
+		if(child + 1 < sh->heapLen &&
+		   sh->heap[child + 1]->prio < sh->heap[child]->prio)
+			child++;
+		if(sh->heap[child]->prio >= obj->prio)
+			break;
+		heapSet(sh, i, sh->heap[child]);
+		i = child;
+	}
+	heapSet(sh, i, obj);
+}
+
+static void gdsfInsert(shard *sh, object *obj) {
+	if(sh->heapLen == sh->heapCap) { //grow the heap by doubling
+		sh->heapCap = sh->heapCap ? sh->heapCap * 2 : 16;
+		sh->heap = (object **)Realloc(sh->heap,
+		                              sh->heapCap * sizeof(object *));
+	}
+	obj->freq = 1;
+	obj->prio = gdsfPrio(sh, obj);
+	heapSet(sh, sh->heapLen++, obj);
+	heapUp(sh, obj->hidx);
+	sh->bytes += obj->dsize;
+}
+
+static void gdsfRemove(shard *sh, object *obj) {
+	size_t i = obj->hidx;
+	object *last = sh->heap[--sh->heapLen];
+
+	if(last != obj) { //move the last one into the hole
+		heapSet(sh, i, last);
+		heapDown(sh, i);
+		heapUp(sh, last->hidx);
+	}
+	sh->bytes -= obj->dsize;
+}
+
+/* the evicted priority inflates everyone inserted or hit later */
+static void gdsfEvict(shard *sh, object *obj) {
+	sh->inflation = obj->prio;
+	gdsfRemove(sh, obj);
+}
+
+static void gdsfTouch(shard *sh, object *obj) {
+	obj->freq++;
+	obj->prio = gdsfPrio(sh, obj);
+	heapDown(sh, obj->hidx);
+}
+
+/* the lowest priority goes, after crediting its hits meanwhile */
+static object *gdsfVictim(shard *sh) {
+	object *obj;
+	unsigned int hits;
+
+	while(sh->heapLen > 0) {
+		obj = sh->heap[0];
+		if((hits = takeHits(obj)) == 0)
+			return obj;
+		obj->freq += hits;
+		obj->prio = gdsfPrio(sh, obj);
+		heapDown(sh, 0);
+	}
+	return NULL;
+}
+
+policyOps gdsfPolicy = { "gdsf", gdsfInsert, gdsfRemove, gdsfEvict,
+                         gdsfTouch, gdsfVictim };
+
+/* findPolicy - the policy called name, NULL if there is none */
+policyOps *findPolicy(char *name) {
+	policyOps *all[] = { &lruPolicy, &slruPolicy, &gdsfPolicy };
+	size_t i;
+
+	for(i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+		if(!strcmp(all[i]->name, name))
+			return all[i];
+	}
+	return NULL;
+}
+
+/******************************
+ * TinyLFU sketch
+ ******************************/
+
+/* sketchIndex - counter of hash in row, double hashing of a remixed hash
+ * since its low bits already pick the shard */
+static inline size_t sketchIndex(unsigned long hash, int row) {
+	unsigned long h = hash * 0x9E3779B97F4A7C15UL;
+	unsigned long h2 = (h >> 32) | 1;
+
+	return ((h >> 16) + row * h2) & (SKETCH_WIDTH - 1);
+}
+
+/* initSketch - initialize an empty sketch in the heap */
+sketch *initSketch() {
+	return (sketch *)Calloc(1, sizeof(sketch));
+}
+
+/* sketchAdd - count one lookup of hash. only the counters at the minimum
+ * are raised (conservative update), which keeps collisions from inflating
+ * the others. every SKETCH_PERIOD lookups all counters are halved, racing
+ * lookups may lose a count then, which a sketch can afford */
+void sketchAdd(sketch *sk, unsigned long hash) {
+	unsigned char *c[SKETCH_DEPTH], v, min = SKETCH_MAX;
+	int row;
+	size_t i;
+
+	for(row = 0; row < SKETCH_DEPTH; row++) {
+		c[row] = &sk->counts[row][sketchIndex(hash, row)];
+		if(*c[row] < min)
+			min = *c[row];
+	}
+	if(min < SKETCH_MAX) {
+		for(row = 0; row < SKETCH_DEPTH; row++) {
+			if((v = *c[row]) == min)
+				__sync_bool_compare_and_swap(c[row], v, v + 1);
+		}
+	}
+
+	if(__sync_add_and_fetch(&sk->samples, 1) % SKETCH_PERIOD == 0) {
+		for(row = 0; row < SKETCH_DEPTH; row++) {
+			for(i = 0; i < SKETCH_WIDTH; i++)
+				sk->counts[row][i] >>= 1;
+		}
+	}
+}
+
+/* sketchEstimate - how often hash was looked up lately, the minimum of
+ * its counters */
+unsigned int sketchEstimate(sketch *sk, unsigned long hash) {
+	unsigned int min = SKETCH_MAX, v;
+	int row;
+
+	for(row = 0; row < SKETCH_DEPTH; row++) {
+		if((v = sk->counts[row][sketchIndex(hash, row)]) < min)
+			min = v;
+	}
+	return min;
+}
@@ -0,0 +1,58 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * These are the eviction policies of the cache and its admission filter.
+ *
+ * lru   the queue of each shard, a hit brings the object to the head and
+ *       the tail is evicted.
+ * slru  segmented LRU: new objects enter a probation segment, a hit moves
+ *       them to a protected segment of at most SLRU_PROTECTED percent of
+ *       the shard, whose LRU objects fall back to probation. probation is
+ *       evicted first, so objects asked for once cannot flush the others.
+ * gdsf  Greedy Dual Size Frequency: priority is the inflation value L
+ *       plus hits / size, the lowest priority is evicted and becomes L.
+ *       small popular objects stay, large rarely hit ones go first.
+ *
+ * With TinyLFU admission every lookup is counted in a count-min sketch of
+ * SKETCH_DEPTH rows of small saturating counters, halved every
+ * SKETCH_PERIOD lookups so old popularity fades. When the cache is full a
+ * new object is only cached if the sketch has seen it more often than the
+ * victim it would replace, so one hit wonders stay out.
+ *
+ * ***************************************************************************/
+
+#ifndef __POLICY_H__
+#define __POLICY_H__
+
+#include "csapp.h"
+#include "cache.h"
+
+#define SLRU_PROTECTED 80 //percent of a shard the protected segment can take
+#define SKETCH_DEPTH 4 //rows of the sketch
+#define SKETCH_WIDTH 8192 //counters per row, power of 2
+#define SKETCH_MAX 15 //counters saturate here, like 4 bit counters
+#define SKETCH_PERIOD (10 * SKETCH_WIDTH) //lookups between halvings
+
+/* sketch is struct for the TinyLFU count-min sketch. It has the counters
+ * and the number of lookups counted */
+typedef struct sketch {
+	unsigned char counts[SKETCH_DEPTH][SKETCH_WIDTH];
+	unsigned long samples;
+} sketch;
+
+extern policyOps lruPolicy;
+extern policyOps slruPolicy;
+extern policyOps gdsfPolicy;
+
+/* function prototypes for policy.c */
+policyOps *findPolicy(char *name);
+
+sketch *initSketch();
+
+void sketchAdd(sketch *sk, unsigned long hash);
+
+unsigned int sketchEstimate(sketch *sk, unsigned long hash);
+
+#endif /* __POLICY_H__ */
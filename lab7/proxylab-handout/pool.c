@@ -0,0 +1,192 @@
+/******************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the pool of idle keep-alive server connections, see pool.h.
+ * Servers are found through a chained hash table of host and port. The
+ * most recently used connection is handed out first, since it is the one
+ * least likely to have been closed by the server meanwhile. A connection
+ * is checked with a non-blocking peek before it is handed out: an idle
+ * server connection must have nothing to read, EOF means the server has
+ * closed it. The proxy still retries once on a fresh connection if a
+ * reused one dies before the response starts.
+ *
+ * ***************************************************************************/
+
+#include "csapp.h"
+#include "pool.h"
+
+/* hashOrigin - 64 bit FNV-1a hash of host and port */
+unsigned long hashOrigin(char *host, char *port) {
+	unsigned long hash = 14695981039346656037UL;
+
+	while(*host) {
+		hash ^= (unsigned char)*host++;
+		hash *= 1099511628211UL;
+	}
+	hash ^= ':';
+	hash *= 1099511628211UL;
+	while(*port) {
+		hash ^= (unsigned char)*port++;
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+/* findOrigin - look for the server host:port, adding it if create is set.
+ * return NULL if there is none or it cannot be added. called with the
+ * pool locked */
+static origin *findOrigin(pool *pl, char *host, char *port, int create) {
+	unsigned long hash = hashOrigin(host, port);
+	origin **bucket = &pl->buckets[hash & (POOL_BUCKETS - 1)];
+	origin *curr;
+
+	for(curr = *bucket; curr != NULL; curr = curr->next) {
+		if(curr->hash == hash && !strcmp(curr->host, host) &&
+		   !strcmp(curr->port, port))
+			return curr;
+	}
+	if(!create)
+		return NULL;
+
+	curr = (origin *)Calloc(1, sizeof(origin));
+	if((curr->host = strdup(host)) == NULL ||
+	   (curr->port = strdup(port)) == NULL) {
+		Free(curr->host);
+		Free(curr);
+		return NULL;
+	}
+	curr->hash = hash;
+	curr->nidle = 0;
+	curr->next = *bucket;
+	*bucket = curr;
+	return curr;
+}
+
+/* isAlive - an idle connection is usable if there is nothing to read on
+ * it yet, neither data nor EOF */
+static int isAlive(int fd) {
+	char c;
+	return recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 &&
+	       (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/* initPool - initialize an empty pool in the heap */
+pool *initPool() {
+	pool *init = (pool *)Calloc(1, sizeof(pool));
+
+	Sem_init(&init->mutex, 0, 1);
+	return init;
+}
+
+/* poolGet - take the most recent idle connection to host:port that is
+ * still usable, closing the stale ones on the way. return -1 if none */
+int poolGet(pool *pl, char *host, char *port) {
+	origin *org;
+	time_t now = time(NULL), since;
+	int fd;
+
+	while(1) {
+		P(&pl->mutex);
+		org = findOrigin(pl, host, port, 0);
+		if(org == NULL || org->nidle == 0) {
+			V(&pl->mutex);
+			return -1;
+		}
+		org->nidle--;
+		pl->nidle--;
+		fd = org->idlefds[org->nidle];
+		since = org->idleSince[org->nidle];
+		/* the most recent one is too old, so are all the others */
+		if(now - since > POOL_IDLE_SECS) {
+			pl->nidle -= org->nidle;
+			while(org->nidle > 0) {
+				org->nidle--;
+				Close(org->idlefds[org->nidle]);
+			}
+		}
+		V(&pl->mutex);
+
+		if(now - since <= POOL_IDLE_SECS && isAlive(fd))
+			return fd;
+		Close(fd);
+	}
+}
+
+/* poolPut - keep fd as an idle connection to host:port, closing the
+ * oldest idle one if the server already has POOL_MAX_IDLE or the pool has
+ * POOL_MAX_TOTAL. fd itself is closed if the pool is full and the server
+ * has none to give up, or if the server cannot be added */
+void poolPut(pool *pl, char *host, char *port, int fd) {
+	origin *org;
+	int oldest = -1;
+
+	P(&pl->mutex);
+	org = findOrigin(pl, host, port, 0);
+	if(pl->nidle == POOL_MAX_TOTAL && (org == NULL || org->nidle == 0)) {
+		V(&pl->mutex);
+		Close(fd);
+		return;
+	}
+	if(org == NULL && (org = findOrigin(pl, host, port, 1)) == NULL) {
+		V(&pl->mutex);
+		Close(fd);
+		return;
+	}
+	if(org->nidle == POOL_MAX_IDLE || pl->nidle == POOL_MAX_TOTAL) {
+		oldest = org->idlefds[0];
+		memmove(org->idlefds, org->idlefds + 1,
+		        (org->nidle - 1) * sizeof(int));
+		memmove(org->idleSince, org->idleSince + 1,
+		        (org->nidle - 1) * sizeof(time_t));
+		org->nidle--;
+		pl->nidle--;
+	}
+	org->idlefds[org->nidle] = fd;
+	org->idleSince[org->nidle] = time(NULL);
+	org->nidle++;
+	pl->nidle++;
+	V(&pl->mutex);
+
+	if(oldest >= 0)
+		Close(oldest);
+}
+
+/* poolSweep - close the connections idle for more than POOL_IDLE_SECS,
+ * the oldest of each server first, and forget the servers left with none.
+ * return how many were closed */
+int poolSweep(pool *pl) {
+	origin **pp, *org;
+	time_t now = time(NULL);
+	int i, old, closed = 0;
+
+	P(&pl->mutex);
+	for(i = 0; i < POOL_BUCKETS; i++) {
+		for(pp = &pl->buckets[i]; (org = *pp) != NULL; ) {
+			for(old = 0; old < org->nidle &&
+			    now - org->idleSince[old] > POOL_IDLE_SECS; old++)
+				Close(org->idlefds[old]);
+			if(old > 0) {
+				memmove(org->idlefds, org->idlefds + old,
+				        (org->nidle - old) * sizeof(int));
+				memmove(org->idleSince, org->idleSince + old,
+				        (org->nidle - old) * sizeof(time_t));
+				org->nidle -= old;
+				pl->nidle -= old;
+				closed += old;
+			}
+			if(org->nidle > 0) {
+				pp = &org->next;
+				continue;
+			}
+			*pp = org->next;
+			Free(org->host);
+			Free(org->port);
+			Free(org);
+		}
+	}
+	V(&pl->mutex);
+	return closed;
+}
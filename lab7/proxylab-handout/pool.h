@@ -0,0 +1,60 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is a pool of idle keep-alive connections to servers, keyed by host
+ * and port. After a response has been relayed completely on a connection
+ * the server keeps open, the proxy puts it back here, and the next request
+ * to the same server takes it instead of resolving the name and doing a
+ * TCP handshake again. Each server keeps at most POOL_MAX_IDLE connections,
+ * the whole pool POOL_MAX_TOTAL. Connections idle for more than
+ * POOL_IDLE_SECS are closed by poolSweep, which the owner of the pool runs
+ * every POOL_SWEEP_SECS, and servers left without any are forgotten.
+ *
+ * ***************************************************************************/
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include "csapp.h"
+
+#define POOL_BUCKETS 256 //hash buckets for servers, power of 2
+#define POOL_MAX_IDLE 8 //idle connections kept per server
+#define POOL_MAX_TOTAL 256 //idle connections kept in the whole pool
+#define POOL_IDLE_SECS 30 //idle connections older than this are closed
+#define POOL_SWEEP_SECS 5 //time between sweeps of the idle connections
+
+/* origin is struct for one server in the pool. It has the host and port
+ * strings, hash of both, the idle connections with the time each was put
+ * back (most recent last) and the next server in the same bucket */
+typedef struct origin {
+	char *host;
+	char *port;
+	unsigned long hash;
+	int nidle;
+	int idlefds[POOL_MAX_IDLE];
+	time_t idleSince[POOL_MAX_IDLE];
+	struct origin *next;
+} origin;
+
+/* pool is struct for the whole pool. It has the hash buckets of servers,
+ * the idle connections of all of them and a mutex for both */
+typedef struct pool {
+	origin *buckets[POOL_BUCKETS];
+	int nidle;
+	sem_t mutex;
+} pool;
+
+/* function prototypes for pool.c */
+unsigned long hashOrigin(char *host, char *port);
+
+pool *initPool();
+
+int poolGet(pool *pl, char *host, char *port);
+
+void poolPut(pool *pl, char *host, char *port, int fd);
+
+int poolSweep(pool *pl);
+
+#endif /* __POOL_H__ */
@@ -7,13 +7,133 @@
  * This simple proxy provides connection between clients and servers.
  * It has mutiple threads and can concurrently handle requests from 
  * different clients and forward to different servers, and forward response
- * of servers back to clients. All the threads share the same 1 MB LRU cache. 
- * Contents from server can be stored in cache if its size does exceed 
- * 1 KB. URL of each request is used to mark individual web contents If exceeds
- * 1 MB cache size, the least recently used contents will be replaced. Writing 
+ * of servers back to clients. All the threads share the same 1 MB LRU cache
+ * (-S sets its size). Contents from server can be stored in cache if its
+ * size does not exceed 100 KB (-O sets it, up to the cache size). URL of
+ * each request is used to mark individual web contents. If exceeds the
+ * cache size, the least recently used contents will be replaced. Writing 
  * in cache will only be accessed by one thread, while reading in cache can be 
- * concurrent. 
+ * concurrent. Objects are kept in fixed size chunks of the cache slab, so
+ * a large one needs no contiguous memory.
+ *
+ * Concurrency:
+ * By default clients are served by event loops (event.c), one per core
+ * or as many as given with -t. Each loop has its own SO_REUSEPORT 
+ * listener and runs every client as a cooperative task, so thousands of
+ * connections cost neither a thread nor an 8 MB stack each. -T serves
+ * them from threads instead: a fixed pool of -w workers (WORKER_STACK 
+ * stacks) taking clients from a bounded lock-free ring (ring.c) that the
+ * main thread accepts into, and stops accepting while it is full. -w 0
+ * restores the original thread per connection. All run serveClient.
+ *
+ * Server connections are kept alive: requests go out as HTTP/1.1 (or 
+ * HTTP/1.0 with Connection: keep-alive for HTTP/1.0 clients), responses
+ * are delimited by Content-Length or chunked encoding, and a connection
+ * the server keeps open is put in a pool (pool.c) for the next request to
+ * the same host and port, saving the lookup and handshake. Event loops 
+ * each have their own pool, since their sockets belong to their epoll.
+ *
+ * Client connections are persistent too: serveClient answers requests on
+ * the same connection and rio buffer until the client asks to close, an
+ * HTTP/1.0 client does not ask for keep-alive, or a response can only be 
+ * delimited by closing. Pipelined requests simply wait in the rio buffer
+ * and are answered in order. Cached responses are stored without the 
+ * Connection header, which is added for each client when sent.
+ *
+ * Concurrent misses on the same URL are coalesced (flight.c): the first
+ * one fetches, the others stream its response out of the cache slab as it
+ * arrives, or wait for it to be cached when its length is not known, so a
+ * burst of clients for a new URL costs the server a single request. If
+ * the first client goes away meanwhile, the fetch goes on for the others.
+ *
+ * Server names are resolved through a cache (dns.c) whose lookups run on
+ * resolver threads, so a slow DNS server parks one request instead of a
+ * thread or a whole event loop. -R resolves every connection with a 
+ * blocking getaddrinfo as before.
+ *
+ * The cache evicts by LRU, or by the policy given with -E: slru keeps 
+ * objects hit more than once in a protected segment, gdsf favours small
+ * popular objects (policy.c). -A adds TinyLFU admission, so a full cache
+ * only takes objects asked for more often than what they would evict.
+ * cachesim replays a trace against each of them to compare hit ratios.
+ *
+ * -D dir adds a disk tier (disk.c): evicted objects are appended to log
+ * segments in dir and read back on a miss, and a restart rebuilds its 
+ * index from the segments. SIGTERM or SIGINT then write the whole cache to
+ * it before exiting, so the next start is warm.
+ *
+ * Responses that grow past the largest object size are never cached, so once a 
+ * response gets there the rest of it is relayed with splice() through a 
+ * pipe, never entering user space. -C keeps copying them through a buffer.
  * 
+ * Cached responses expire (fresh.c): only responses of a cacheable status
+ * whose headers allow it are stored, each fresh for the lifetime its 
+ * Cache-Control, Expires or Last-Modified gives it, -F seconds if they
+ * tell nothing. A stale object with an ETag or Last-Modified is 
+ * revalidated with If-None-Match or If-Modified-Since, and a 304 makes it
+ * fresh again and answers the client from the cache. Clients asking for 
+ * no-cache revalidate, no-store and Authorization keep it out of the cache.
+ *
+ * Requests are parsed in place in the rio buffer of the client (http.c):
+ * one pass classifies the bytes with SIMD compares and records the 
+ * request line and headers as spans, header names are matched ignoring
+ * case, and only the URL and host are copied out as strings. The request
+ * forwarded to the server is a list of pieces pointing at those bytes and
+ * at the proxy's own headers, sent with one writev.
+ *
+ * Every thread counts requests, hits, misses, bytes and errors and times
+ * the phases of each request into latency histograms of its own (stats.c),
+ * with no lock or shared line on the request path. -M port serves the
+ * totals, percentiles and the cache, flight, disk and resolver counters
+ * as text on that port of the loopback address, SIGUSR1 prints them.
+ *
+ * One slow server cannot hold everyone up (limit.c): each server gets at
+ * most -L requests at once, the rest wait in a line of their own, first
+ * come first served, and are answered 503 when that is full too, 504 if
+ * no slot comes free within the response timeout. Connects
+ * time out after -K seconds and silent responses after -W, answered 504,
+ * through the event loops' timer wheel (or socket timeouts in thread
+ * mode), so a server that accepts and never answers frees its slots.
+ *
+ * CONNECT opens a tunnel to the host and port asked for, TLS most often:
+ * the proxy connects, answers 200 and then relays bytes both ways without
+ * looking at them (tunnel.c), spliced through pipes so they never enter
+ * user space, until both sides close or it is silent for TUNNEL_IDLE_SECS.
+ * Tunnels take no slot of their server, they last as long as the client
+ * wants, but their connects time out, and they are counted in the stats.
+ *
+ * Responses sent uncoded are cached gzip compressed (gzip.c) when that 
+ * saves chunks of the cache, at zlib level 1 or the one given with -Z (0 
+ * stores them as received). Clients whose Accept-Encoding takes gzip get
+ * the compressed body as stored, the others get it inflated while it is
+ * sent, both with Vary: Accept-Encoding. The leader of a flight and its 
+ * streaming followers relay the response as it comes, only later hits 
+ * see the coding.
+ *
+ * A Range request for one run of bytes of a cached 200 of known length is
+ * answered 206 from the cache (sendRange): the stored headers with its 
+ * Content-Range, then just those bytes, with sendfile from the slab, or
+ * inflated up to the end of the range if stored compressed. If-Range 
+ * must name its strong ETag or Last-Modified, else, like for a list of 
+ * ranges, the whole object is sent. A follower of a flight streaming a
+ * 200 is sliced the same way from the shared chunks, waiting only for the
+ * bytes it asked for (streamRange). A miss passes Range to the server, 
+ * and its 206 is relayed but never cached as if it were the whole body.
+ *
+ * SIGHUP reloads the proxy without dropping a connection (reload.c): the
+ * binary is started again with the same arguments and handed the very 
+ * listening sockets, the admin one and an image of the cache over a unix
+ * socket. Once it serves them the old process stops accepting, closes its
+ * clients as their responses end, and exits when none is left or after 
+ * -G seconds. -H leaves the cache behind, the new process starts cold.
+ * Both must run the same concurrency mode, listeners are per event loop.
+ *
+ * On NUMA machines -P pins the event loops (or workers) to a CPU each,
+ * and -N splits the cache per node (topo.c): a slab of each node's memory
+ * and a group of the shards, a response stored on the node of the thread
+ * that received it and looked up there first. Hits from another node 
+ * still work, they are counted as remote_hits.
+ *
  * Robustness and error handling:
  * Made the following changes in csapp.c:
  *   -for all styles error functions: removed exit(0) for application in 
@@ -24,319 +144,2060 @@
  *   -rio_read & rio_readn: retry on ECONNRESET and EINTR errors
  *   -rio_writen: retry on EPIPE and EINTR errors
  * All the error handlings are processed in proxy.c, either exit in main() or
- * thread_exit in one of the threads
+ * return from serveClient after closing the connection
  * 
  *****************************************************************************/
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <netinet/tcp.h>
 #include "csapp.h"
 #include "cache.h"
-
-/* Recommended max cache and object sizes */
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
+#include "policy.h"
+#include "event.h"
+#include "pool.h"
+#include "dns.h"
+#include "flight.h"
+#include "ring.h"
+#include "disk.h"
+#include "http.h"
+#include "fresh.h"
+#include "stats.h"
+#include "limit.h"
+#include "tunnel.h"
+#include "gzip.h"
+#include "reload.h"
+#include "topo.h"
 
 /* You won't lose style points for including these long lines in your code */
 static const char *user_agent_hdr = "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
 static const char *accept_hdr = "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n";
 static const char *accept_encoding_hdr = "Accept-Encoding: gzip, deflate\r\n";
-static const char *connection_hdr = "Connection: close\r\n";
-static const char *proxy_connection_hdr = "Proxy-Connection: close\r\n";
+static const char *connection_hdr = "Connection: keep-alive\r\n";
+static const char *client_close_hdr = "Connection: close\r\n";
+static const char *client_keep_hdr = "Connection: keep-alive\r\n";
+
+/* Idle keep-alive clients of thread mode are closed after this long, 
+ * event loops cost nothing while waiting */
+#define CLIENT_IDLE_SECS 30
+
+/* Tunnels silent both ways for this long are closed */
+#define TUNNEL_IDLE_SECS 300
+
+/* Thread mode workers, and clients accepted but not yet taken by one */
+#define DEFAULT_WORKERS 128
+#define WORKER_STACK (512 * 1024)
+#define RING_SIZE 1024
+
+/* Requests at once per server, waiting in line for one of them per slot,
+ * and timeouts of connects and of each wait for a response, in ms */
+#define DEFAULT_SERVER_SLOTS 32
+#define LINE_PER_SLOT 32
+#define DEFAULT_CONNECT_MS 5000
+#define DEFAULT_RESPONSE_MS 30000
 
 /* Global cache pointer */
 queue *cacheQueue;
 
+/* Responses being fetched, for misses on the same URL to follow */
+static flightTable *flights;
+
+/* Relay responses too big to cache with splice instead of copying */
+static int spliceRelay = 1;
+
+/* Idle server connections, one pool per event loop, or one shared pool
+ * for thread per connection mode */
+static pool *sharedPool;
+static __thread pool *loopPool;
+
+/* Resolver cache of server names, NULL with -R */
+static resolver *dnsCache;
+
+/* Lifetime of responses whose headers do not tell */
+static long freshDefault = DEFAULT_FRESH_SECS;
+
+/* zlib level of cached responses, 0 to store them as received */
+static int gzipLevel = DEFAULT_GZIP_LEVEL;
+
+/* Slots and lines of the servers, NULL with -L 0, and server timeouts */
+static limiter *limits;
+static long connectTimeout = DEFAULT_CONNECT_MS;
+static long responseTimeout = DEFAULT_RESPONSE_MS;
+
+/* Hot reload: the arguments to start again with, how long the old process
+ * may drain, in ms, and whether the cache is handed over. once draining 
+ * every response closes its client, and the old process exits when no 
+ * client is left. the thread mode listener (-1 for event loops) and the 
+ * wakeup telling its acceptor to stop */
+static char **progArgv;
+static long drainTimeout = DEFAULT_DRAIN_SECS * 1000L;
+static int handover = 1;
+static int draining;
+static int activeClients;
+static int threadListenfd = -1;
+static int acceptWake = -1;
+
+/* Whether the threads serving clients are pinned to a CPU each (-P), and
+ * how many have been */
+static int pinThreads;
+static int pinned;
+
+/* what the client request allows of the cache, see cacheDirectives */
+#define REQ_NO_CACHE 1 //revalidate even a fresh object
+#define REQ_NO_STORE 2 //do not store the response
+
+/* results of relaying a response, see serverToClient. nothing was sent
+ * to the client for the first three, it is told why */
+#define RELAY_BUSY -5 //no slot of the server and no room in its line
+#define RELAY_UNREACHED -4 //no connection to the server
+#define RELAY_TIMEOUT -3 //no connection or response in time
+#define RELAY_EMPTY -2 //server closed before any response byte
+#define RELAY_ERROR -1 //read or write error, or response cut short
+#define RELAY_CLOSE 0 //complete, server connection cannot be reused
+#define RELAY_KEEP 1 //complete, server connection can be reused
+
+/* how the end of a response body is found */
+#define FRAME_CLOSE 0 //server closes the connection
+#define FRAME_LENGTH 1 //Content-Length bytes
+#define FRAME_CHUNKED 2 //chunked transfer encoding
+
+/* byteRange is struct for the single byte range a client asks for, see
+ * clientRange. It has whether there is one, its first and last byte (last
+ * -1 up to the end), or for a suffix range first -1 and the count of last
+ * bytes in last, and the If-Range validator (len 0 if none). a list of 
+ * ranges is not answered from the cache, the whole object is sent */
+typedef struct byteRange {
+	int set;
+	long first;
+	long last;
+	httpSpan ifRange;
+} byteRange;
+
+/* relay is struct for one response being relayed from server to client.
+ * It has the server's rio buffer, the client, the output waiting to be
+ * written to the client, the chunks of the cache slab the response is
+ * received into with its size so far, whether it can still be cached, the
+ * size of its headers, what its headers tell about its body and the
+ * server connection, whether the client connection stays open, the
+ * flight it leads (NULL if none), whether the chunks are shared and
+ * whether the client went away while they were, the stale object being
+ * revalidated (NULL if none) and whether the response is a 304 for it,
+ * what the headers tell about caching it, until when it is fresh, whether
+ * they let it be stored compressed and the client takes gzip, the range
+ * it asks for and when the request went out (statsNow) */
+typedef struct relay {
+	rio_t *rp;
+	int clientfd;
+	char outBuf[MAXBUF];
+	size_t outLen;
+	chunkList body;
+	int caching;
+	size_t hdrSize;
+	int status;
+	int framing;
+	size_t contentLength;
+	int serverKeep;
+	int clientKeep;
+	flight *fl;
+	int shared;
+	int clientGone;
+	object *stale;
+	int notModified;
+	freshInfo fresh;
+	time_t expires;
+	int compressible;
+	int gzipOk;
+	byteRange *range;
+	long sent;
+} relay;
+
+/* pieces of a request to a server at most: request line, Host, default
+ * headers, each passed header and its CRLF, the empty line */
+#define REQ_IOV (2 * HTTP_MAX_HEADERS + 16)
+
+/* upstream is struct for the request forwarded to a server, as pieces
+ * pointing into the client's rio buffer where the bytes are the client's
+ * and at constant strings where they are the proxy's. It has the pieces,
+ * how many there are and their total size */
+typedef struct upstream {
+	struct iovec iov[REQ_IOV];
+	int n;
+	size_t size;
+} upstream;
+
 /* function prototypes */
 void *thread(void *clientfdp);
-inline static void serverToClient(rio_t *toServerrp, char *url, int clientfd, \
-																int serverfd);
-inline static void packToServer(char *headers, char *path, char *toServerReq);
-void parReq(char *url, char *hostname, char *portp, char *path);
-inline static void toServerhdr(char *hostname, rio_t *reqrp, char *headers, \
-												int serverfd, int clientfd);
+static void *worker(void *vargp);
+static void serveThreaded(int clientfd);
+void serveClient(int clientfd);
+static int serveRequest(rio_t *reqrp, int clientfd, long *start);
+static int serveTunnel(rio_t *reqrp, int clientfd, char *hostname, \
+                       char *port);
+static int sendCached(int clientfd, object *obj, int gzipOk, \
+                      byteRange *range, int keep);
+static int sendRange(int clientfd, object *obj, byteRange *range, int keep);
+static ssize_t rangeHead(int clientfd, char *hdrs, size_t size, int gzipped, \
+                   byteRange *range, int keep, size_t *first, size_t *count);
+static ssize_t streamRange(flight *f, int clientfd, byteRange *range, \
+                                   int keep, size_t *sent, size_t *end);
+static int sendHeaders(int clientfd, chunk *c, size_t hsize, int keep, \
+                                                             char *tail);
+static int sendError(int clientfd, int rc, int keep);
+static int followFlight(flight *f, int clientfd, int http11, int gzipOk, \
+                        byteRange *range, int clientKeep, int *keep);
+inline static int serverToClient(rio_t *toServerrp, char *url, int clientfd, \
+    int *clientKeep, flight *fl, object *stale, int store, int gzipOk, \
+                                                          byteRange *range);
+static int relayHeaders(relay *r);
+static size_t relayCompress(relay *r, chunkList *zl, size_t *hdrSize);
+static int relayNotModified(relay *r);
+static int relayBody(relay *r, size_t n);
+static int relayChunked(relay *r);
+static int relayWrite(relay *r, char *buf, size_t n, int toCache);
+static int relayFlush(relay *r);
+static int relayClient(relay *r, char *buf, size_t n);
+static void relayShare(relay *r);
+static void relayUncache(relay *r);
+static pool *serverPool();
+static void sweepLoopPool();
+static void *sweepThread(void *vargp);
+static void *statsThread(void *vargp);
+static void reload(sigset_t *set);
+static int acceptClient(int listenfd);
+static void printStats(FILE *fp);
+static int hasValue(char *hdrLine, char *value);
+inline static void packToServer(upstream *up, httpSpan path, int http11);
+inline static void toServerhdr(httpSpan host, httpRequest *req, \
+                          upstream *up, int *clientKeep, char *validators);
+static int cacheDirectives(httpRequest *req);
+static int acceptsGzip(httpRequest *req);
+static void clientRange(httpRequest *req, byteRange *range);
+static int ifRangeMatches(char *hdrs, httpSpan v);
+static size_t storedHeaders(object *obj, char *buf);
+static void addHeader(upstream *up, httpHeader *h);
+static void addPiece(upstream *up, const char *p, size_t len);
+static int sendUpstream(int serverfd, upstream *up);
+static int readRequest(rio_t *rp, httpRequest *req, long *start);
+static int spanCopy(char *dst, size_t size, httpSpan s, char *dflt);
+static size_t parseSize(char *arg);
+static long parseSecs(char *arg);
+static int timedOut(int err);
+static void usage(char *prog);
+
 int main(int argc, char **argv)
 {
 	Signal(SIGPIPE, SIG_IGN); //handle SIGPIPE
-	int listenfd, *clientfdp;
+	int listenfd, clientfd, *clientfdp, opt;
+	int threadMode = 0; //thread per connection instead of event loops
+	int nloops = sysconf(_SC_NPROCESSORS_ONLN); //event loop threads
 	char *portp;
-	struct sockaddr_in clientaddr;
-	socklen_t clientlen = sizeof(struct sockaddr_in);
 	pthread_t tid;
+	int useResolver = 1; //cache names and resolve them off the loops
+	int nworkers = DEFAULT_WORKERS; //thread mode workers, 0 for per client
+	pthread_attr_t attr;
+	ring *clients;
+	static sigset_t statsSig;
+	policyOps *policy = &lruPolicy; //cache eviction policy
+	int admit = 0; //TinyLFU admission
+	char *diskDir = NULL; //directory of the disk tier
+	size_t cacheSize = DEFAULT_CACHE_SIZE; //memory of the cache
+	size_t objectSize = DEFAULT_OBJECT_SIZE; //largest object cached
+	char *adminPort = NULL; //loopback port serving the stats
+	int slots = DEFAULT_SERVER_SLOTS; //requests at once per server
+	int inherited[RELOAD_MAX_FDS], ninherited; //listeners handed over
+	int adminfd, imagefd; //admin socket and cache image handed over
+	int split = 0; //the cache split per NUMA node
 
-	//if arg count is not 2, report error
-	if(argc != 2) {
-		fprintf(stderr, "usage: %s <port>\n", argv[0]);
+	progArgv = argv;
+	while((opt = getopt(argc, argv, "ACD:E:F:G:HK:L:M:NO:PRS:Tt:W:w:Z:")) 
+	                                                                != -1) {
+		switch(opt) {
+		case 'A':
+			admit = 1;
+			break;
+		case 'C':
+			spliceRelay = 0;
+			break;
+		case 'D':
+			diskDir = optarg;
+			break;
+		case 'E':
+			if((policy = findPolicy(optarg)) == NULL)
+				usage(argv[0]);
+			break;
+		case 'F':
+			freshDefault = atol(optarg);
+			break;
+		case 'G':
+			drainTimeout = parseSecs(optarg);
+			break;
+		case 'H':
+			handover = 0;
+			break;
+		case 'K':
+			connectTimeout = parseSecs(optarg);
+			break;
+		case 'L':
+			slots = atoi(optarg);
+			break;
+		case 'M':
+			adminPort = optarg;
+			break;
+		case 'N':
+			split = 1;
+			break;
+		case 'O':
+			objectSize = parseSize(optarg);
+			break;
+		case 'P':
+			pinThreads = 1;
+			break;
+		case 'R':
+			useResolver = 0;
+			break;
+		case 'S':
+			cacheSize = parseSize(optarg);
+			break;
+		case 'T':
+			threadMode = 1;
+			break;
+		case 't':
+			nloops = atoi(optarg);
+			break;
+		case 'W':
+			responseTimeout = parseSecs(optarg);
+			break;
+		case 'w':
+			nworkers = atoi(optarg);
+			break;
+		case 'Z':
+			gzipLevel = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	//if port is not the only argument left, report error
+	if(argc - optind != 1 || nloops < 1 || nworkers < 0 || cacheSize == 0 ||
+	   objectSize == 0 || freshDefault < 0 || slots < 0 || 
+	   connectTimeout <= 0 || responseTimeout <= 0 || gzipLevel < 0 ||
+	   gzipLevel > 9 || drainTimeout <= 0) {
+		usage(argv[0]);
+	}
+
+	portp = argv[optind];
+
+	/* a proxy reloading started this one, take over its sockets. if 
+	 * anything fails from here on it keeps serving them itself */
+	if((ninherited = reloadInherit(inherited, RELOAD_MAX_FDS, &adminfd,
+	                               &imagefd)) < 0) {
+		fprintf(stderr, "reload: nothing handed over\n");
 		exit(0);
 	}
 
-	portp = argv[1];
+	//initialize cache here
+	if((cacheQueue = initCache(policy, admit, cacheSize, objectSize)) == NULL) {
+		exit(0);
+	}
+	if(split && splitCache(cacheQueue, topoInit()) < 0) {
+		fprintf(stderr, "cannot split the cache per node\n");
+		exit(0);
+	}
+	sharedPool = initPool();
+	flights = initFlights();
+	/* a thread waiting in line is a worker less for other servers, a
+	 * task costs nothing, so threads get a short line */
+	if(slots > 0)
+		limits = initLimiter(slots, threadMode ? slots : 
+		                            slots * LINE_PER_SLOT);
 
-	if((listenfd = Open_listenfd(portp)) < 0) { //listen to input port
+	/* SIGUSR1 and SIGHUP are taken by statsThread only, block them before
+	 * any thread is created so they all inherit the mask. so are SIGTERM
+	 * and SIGINT with a disk tier, the cache is saved before exiting */
+	sigemptyset(&statsSig);
+	sigaddset(&statsSig, SIGUSR1);
+	sigaddset(&statsSig, SIGHUP);
+	if(diskDir != NULL) {
+		sigaddset(&statsSig, SIGTERM);
+		sigaddset(&statsSig, SIGINT);
+	}
+	pthread_sigmask(SIG_BLOCK, &statsSig, NULL);
+	if(diskDir != NULL && (cacheQueue->disk = openDisk(diskDir)) == NULL)
+		exit(0);
+	if(imagefd >= 0) {
+		fprintf(stderr, "reload: %ld objects cached from the image\n",
+		        loadCache(cacheQueue, imagefd));
+		close(imagefd);
+	}
+	Pthread_create(&tid, NULL, statsThread, &statsSig);
+	if(adminPort == NULL && adminfd >= 0)
+		close(adminfd);
+	if(adminPort != NULL && statsServe(adminPort, adminfd, printStats) < 0) {
+		fprintf(stderr, "cannot serve stats on port %s\n", adminPort);
 		exit(0);
 	}
 
-	cacheQueue = initCache(); //initialize cache here
+	httpInit(); //request parser for this CPU
+	if(useResolver) {
+		dnsCache = initResolver(DNS_THREADS);
+		dnsInstall(dnsCache);
+	}
+
+	/* event loops, one listener per loop, the old process can drain once
+	 * they are all open */
+	if(!threadMode) {
+		if(evListen(portp, nloops, inherited, ninherited) < 0)
+			exit(0);
+		reloadReady();
+		evSweep(sweepLoopPool, POOL_SWEEP_SECS * 1000L);
+		evStart(serveClient, pinThreads);
+	}
+
+	//listen to input port, or the one handed over
+	if(ninherited > 0) {
+		listenfd = inherited[0];
+		while(--ninherited > 0)
+			close(inherited[ninherited]);
+	}
+	else if((listenfd = Open_listenfd(portp)) < 0) {
+		exit(0);
+	}
+
+	/* accepted after a poll, which the wakeup interrupts to drain: the
+	 * socket is non-blocking, another process may take a client first */
+	fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+	threadListenfd = listenfd;
+	acceptWake = Open_wakeupfd();
+	if(nworkers > 0 && (clients = initRing(RING_SIZE)) == NULL)
+		exit(0);
+	Pthread_create(&tid, NULL, sweepThread, NULL);
+	reloadReady();
+
+	/* prethreaded workers fed by the ring, pushing blocks while it is
+	 * full so clients wait in the listen backlog */
+	if(nworkers > 0) {
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, WORKER_STACK);
+		while(nworkers-- > 0)
+			Pthread_create(&tid, &attr, worker, clients);
+		while((clientfd = acceptClient(listenfd)) >= 0)
+			ringPush(clients, clientfd);
+	}
 
 	//connect to client and handle request in a newly created thread
-	while(1) { 
+	while((clientfd = acceptClient(listenfd)) >= 0) { 
 		//use calloc to prevent race condition for client
 		clientfdp = (int *)Calloc(1, sizeof(int)); 
-		*clientfdp = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-		/* if accept error, free this file descriptor and continue */
-		if(*clientfdp < 0) { 
-			Free(clientfdp);
+		*clientfdp = clientfd;
+		Pthread_create(&tid, NULL, thread, clientfdp);
+	}
+
+	/* draining, statsThread exits once the clients are done */
+	close(listenfd);
+	while(1)
+		pause();
+}
+
+/* acceptClient - accept the next client on listenfd in thread mode and
+ * count it as active, see reload. return -1 once the proxy drains */
+static int acceptClient(int listenfd) {
+	struct pollfd pfds[2] = { { listenfd, POLLIN, 0 },
+	                          { acceptWake, POLLIN, 0 } };
+	int clientfd;
+
+	while(1) {
+		if(poll(pfds, 2, -1) < 0)
 			continue;
+		if(pfds[1].revents)
+			return -1;
+		if((clientfd = accept(listenfd, NULL, NULL)) >= 0) {
+			__sync_add_and_fetch(&activeClients, 1);
+			return clientfd;
 		}
-		Pthread_create(&tid, NULL, thread, clientfdp);
 	}
 }
 
-void *thread(void *clientfdp) {
-	char req[MAXLINE];
-	char method[MAXLINE], hostname[MAXLINE], port[MAXLINE], path[MAXLINE];
-	char headers[MAXLINE], url[MAXLINE], end[MAXLINE];
+/* parseSize - a size in bytes, or in KB or MB with a k or m suffix. 
+ * return 0 if it is not one */
+static size_t parseSize(char *arg) {
+	char *end;
+	unsigned long n = strtoul(arg, &end, 10);
+
+	if(end == arg)
+		return 0;
+	if(*end == 'k' || *end == 'K')
+		n <<= 10, end++;
+	else if(*end == 'm' || *end == 'M')
+		n <<= 20, end++;
+	return *end == '\0' ? n : 0;
+}
 
-	strcpy(port, "80"); //default port number
+/* parseSecs - seconds, possibly fractional, in ms. return 0 if it is not
+ * a positive number of them */
+static long parseSecs(char *arg) {
+	char *end;
+	double secs = strtod(arg, &end);
 
-	rio_t reqRead;
-	
+	if(end == arg || *end != '\0' || secs <= 0)
+		return 0;
+	return secs * 1000 < 1 ? 1 : (long)(secs * 1000);
+}
+
+/* usage - print command line usage and exit */
+static void usage(char *prog) {
+	fprintf(stderr, "usage: %s [-ACHNPRT] [-D dir] [-E policy] [-F secs] "
+	        "[-G secs] [-K secs] [-L slots] [-M port] [-O size] [-S size] "
+	        "[-t nloops] [-W secs] [-w nworkers] [-Z level] <port>\n", prog);
+	fprintf(stderr, "  -A         TinyLFU admission to the cache\n");
+	fprintf(stderr, "  -C         copy large responses instead of splice\n");
+	fprintf(stderr, "  -D dir     disk tier of the cache in dir\n");
+	fprintf(stderr, "  -E policy  cache eviction, lru, slru or gdsf\n");
+	fprintf(stderr, "  -F secs    lifetime of responses without one (300)\n");
+	fprintf(stderr, "  -G secs    drain deadline of a reload (30)\n");
+	fprintf(stderr, "  -H         no cache handover on reload\n");
+	fprintf(stderr, "  -K secs    server connect timeout (5)\n");
+	fprintf(stderr, "  -L slots   requests at once per server, 0 for any "
+	        "(32)\n");
+	fprintf(stderr, "  -M port    serve stats on port of 127.0.0.1\n");
+	fprintf(stderr, "  -N         split the cache per NUMA node\n");
+	fprintf(stderr, "  -O size    largest object cached (100k)\n");
+	fprintf(stderr, "  -P         pin loops and workers to a CPU each\n");
+	fprintf(stderr, "  -R         no resolver cache, getaddrinfo each time\n");
+	fprintf(stderr, "  -S size    cache size (1m)\n");
+	fprintf(stderr, "  -T         one thread per connection\n");
+	fprintf(stderr, "  -t nloops  number of event loop threads\n");
+	fprintf(stderr, "  -W secs    server response timeout, per read (30)\n");
+	fprintf(stderr, "  -w n       thread mode workers, 0 for one per client\n");
+	fprintf(stderr, "  -Z level   gzip level of cached responses, 0 for "
+	        "none (1)\n");
+	exit(0);
+}
+
+/* thread - thread per connection mode, serve the client and exit */
+void *thread(void *clientfdp) {
 	//store the input client file discriptor
 	int clientfd = *((int *)clientfdp);
 
 	Pthread_detach(pthread_self()); //detach it self
 	
 	Free(clientfdp); //free the previous allocated pointer
-	
-	/* the first line of client request will hold info on 
-	 * method, url and http version */
+
+	if(pinThreads)
+		topoPin(__sync_fetch_and_add(&pinned, 1));
+
+	serveThreaded(clientfd);
+	return NULL;
+}
+
+/* worker - prethreaded worker, serve the clients of the ring one by one */
+static void *worker(void *vargp) {
+	ring *clients = (ring *)vargp;
+
+	Pthread_detach(pthread_self());
+	if(pinThreads)
+		topoPin(__sync_fetch_and_add(&pinned, 1));
+	while(1)
+		serveThreaded(ringPop(clients));
+	return NULL;
+}
+
+/* serveThreaded - serve a client from a thread of its own for the time */
+static void serveThreaded(int clientfd) {
+	struct timeval idle = { CLIENT_IDLE_SECS, 0 };
+
+	/* do not hold a thread forever for a silent keep-alive client */
+	setsockopt(clientfd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+	serveClient(clientfd);
+}
+
+/* serveClient - answer the requests of a client one after the other on the
+ * same connection and rio buffer, until it is not kept alive. clientfd is 
+ * closed on return. each request read is timed from its complete head to
+ * its answer, however it ends */
+void serveClient(int clientfd) {
+	rio_t reqRead;
+	int nodelay = 1, keep = 1;
+	long start;
+
+	if(io_hooks != NULL) //event loop, thread mode counts it when accepted
+		__sync_add_and_fetch(&activeClients, 1);
+
+	/* responses are written in few large pieces, never wait for acks */
+	setsockopt(clientfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(int));
+
 	Rio_readinitb(&reqRead, clientfd);
-	/* if readlineb error, exit the thread */
-	if(Rio_readlineb(&reqRead, req, MAXLINE) < 0) {
-		Close(clientfd);
-		return NULL;
+	while(keep) {
+		start = 0;
+		keep = serveRequest(&reqRead, clientfd, &start);
+		if(start != 0)
+			statsTime(PHASE_COMPLETE, statsNow() - start);
 	}
-	
-	sscanf(req, "%s %s %s", method, url, end); //end will be ignored
-	
+	Close(clientfd);
+	__sync_sub_and_fetch(&activeClients, 1);
+}
+
+/* serveRequest - read one request from the client, answer it from the cache
+ * or forward it to the server and relay the response back. start is set to
+ * when its head was complete (statsNow) if one was read. return 1 if the
+ * client connection stays open for the next request, 0 otherwise */
+static int serveRequest(rio_t *reqrp, int clientfd, long *start) {
+	char hostname[MAXLINE], port[MAXLINE], url[MAXLINE];
+	char validators[MAXLINE]; //conditional headers revalidating stale
+	int http11, clientKeep, keep, headSize, reqCache, gzipOk;
+	httpRequest req;
+	byteRange range;
+	httpSpan host, portSpan, pathSpan;
+	upstream up;
+	object *dataFromCache, *stale = NULL;
+	long t;
+
+	/* the request line and headers are parsed in place in the rio buffer,
+	 * holding method, url and http version and the headers. if read 
+	 * error, the client is done or it is not a request, close the client */
+	if((headSize = readRequest(reqrp, &req, start)) <= 0) {
+		return 0;
+	}
+	statsAdd(STAT_REQUESTS, 1);
+	http11 = httpSpanEq(req.version, "HTTP/1.1");
+
 	//parse url strings to get hostname, port and path
-	parReq(url, hostname, port, path);
+	httpSplitUrl(req.target, &host, &portSpan, &pathSpan);
+	if(spanCopy(url, MAXLINE, req.target, "") < 0 ||
+	   spanCopy(hostname, MAXLINE, host, "") < 0 ||
+	   spanCopy(port, MAXLINE, portSpan, "80") < 0) { //default port number
+		return 0;
+	}
+
+	/* a tunnel, the client connection is its own from now on. not timed
+	 * as a request, it lasts as long as the client wants */
+	if(httpSpanEq(req.method, "CONNECT")) {
+		reqrp->rio_bufptr += headSize;
+		reqrp->rio_cnt -= headSize;
+		*start = 0;
+		if(portSpan.len == 0)
+			strcpy(port, "443");
+		return serveTunnel(reqrp, clientfd, hostname, port);
+	}
 
 	//method is not GET, simply return
-	if(strcmp(method, "GET")) {
-		Close(clientfd);
-		return NULL;
+	if(!httpSpanEq(req.method, "GET")) {
+		return 0;
 	}
-	
-	/* if found the path in cache, write the data to client and return */
-	object *dataFromCache;
+	t = statsNow();
+	statsTime(PHASE_PARSE, t - *start);
+
+	/* look for the path in cache. the object stays pinned until released,
+	 * even if evicted meanwhile. a chunked response is no use to an 
+	 * HTTP/1.0 client, fetch it. a stale one, or any if the client says
+	 * no-cache, is revalidated if it has validators, fetched again if not */
+	reqCache = cacheDirectives(&req);
+	gzipOk = acceptsGzip(&req);
+	clientRange(&req, &range);
 	if((dataFromCache = searchCache(url, cacheQueue)) != NULL) {
-		Rio_writen(clientfd, dataFromCache->data, dataFromCache->dsize);
-		Close(clientfd);
-		return NULL;
-	} 
+		if(dataFromCache->framing == FRAME_CHUNKED && !http11) {
+			releaseObj(dataFromCache);
+			dataFromCache = NULL;
+		}
+		else if(!(reqCache & REQ_NO_CACHE) && 
+		        objFresh(dataFromCache, time(NULL))) {
+			//fresh, answered below
+		}
+		else {
+			char hdrs[MAXBUF];
+
+			statsAdd(STAT_STALE, 1);
+			storedHeaders(dataFromCache, hdrs);
+			if(freshValidators(hdrs, validators, MAXLINE) > 0) {
+				statsAdd(STAT_REVALIDATED, 1);
+				stale = dataFromCache;
+			}
+			else {
+				releaseObj(dataFromCache);
+			}
+			dataFromCache = NULL;
+		}
+	}
+	statsTime(PHASE_LOOKUP, statsNow() - t);
+
+	/* prepare the request package to be sent to server, pieces pointing
+	 * into the rio buffer, conditional if revalidating. then the request
+	 * is consumed even for a cache hit, the next request starts after it.
+	 * its bytes stay where they are until the next request is read */
+	clientKeep = http11;
+	packToServer(&up, pathSpan, http11);
+	toServerhdr(host, &req, &up, &clientKeep, stale ? validators : NULL);
+	if(__atomic_load_n(&draining, __ATOMIC_RELAXED)) //reloaded, see reload
+		clientKeep = 0;
+	reqrp->rio_bufptr += headSize;
+	reqrp->rio_cnt -= headSize;
+	
+	/* found fresh in cache, write the data to client and return */
+	if(dataFromCache != NULL) {
+		statsAdd(STAT_HITS, 1);
+		if(cacheQueue->nnodes > 1 && dataFromCache->node != topoNode())
+			statsAdd(STAT_REMOTE_HITS, 1);
+		keep = clientKeep && dataFromCache->framing != FRAME_CLOSE;
+		if(sendCached(clientfd, dataFromCache, gzipOk, &range, keep) < 0) {
+			statsAdd(STAT_ERRORS, 1);
+			keep = 0;
+		}
+		releaseObj(dataFromCache);
+		return keep;
+	}
+
+	/* the same url is being fetched already, follow that fetch. if its 
+	 * response is not shared after all, fetch it alone */
+	int leader, rc;
+	flight *fl = flightStart(flights, url, &leader);
+	if(!leader) {
+		rc = followFlight(fl, clientfd, http11, gzipOk, &range, clientKeep,
+		                  &keep);
+		flightRelease(flights, fl);
+		if(rc != 0) {
+			statsAdd(rc > 0 ? STAT_COALESCED : STAT_ERRORS, 1);
+			if(stale != NULL)
+				releaseObj(stale);
+			return rc > 0 && keep;
+		}
+		fl = NULL;
+	}
 
 	/* get server fd, write the request package from client to server */
-	int serverfd;
+	int serverfd = -1, reused, queued = 0;
 	rio_t toServerRead;
-	char toServerReq[MAXLINE];
-	size_t reqSize;
 
-	/* on error, close clientfd and return this thread */
-	if((serverfd = Open_clientfd(hostname, port)) < 0) {
-		Close(clientfd);
-		return NULL;
+	/* a slot of the server first, waiting in line behind the requests
+	 * before this one if they are all taken, as long as for a response */
+	statsAdd(STAT_MISSES, 1);
+	if(limits != NULL) {
+		t = statsNow();
+		queued = limitAcquire(limits, hostname, port, responseTimeout);
+		if(queued > 0 || queued == -2) {
+			statsAdd(STAT_QUEUED, 1);
+			statsTime(PHASE_QUEUE, statsNow() - t);
+		}
+	}
+
+	/* take an idle connection to the server if there is one. the server
+	 * may still have closed it, then nothing comes back and the request
+	 * is sent once more on a new connection. the connect and each wait 
+	 * for the response are bounded by their timeouts */
+	rc = queued == -2 ? RELAY_TIMEOUT : RELAY_BUSY;
+	if(queued >= 0)
+		serverfd = poolGet(serverPool(), hostname, port);
+	while(queued >= 0) {
+		reused = (serverfd >= 0);
+		if(reused) {
+			statsAdd(STAT_REUSED, 1);
+		}
+		else { //on error, tell the client
+			t = statsNow();
+			set_io_timeout(connectTimeout);
+			serverfd = open_clientfd(hostname, port);
+			statsTime(PHASE_CONNECT, statsNow() - t);
+			if(serverfd < 0) {
+				rc = timedOut(errno) ? RELAY_TIMEOUT : RELAY_UNREACHED;
+				break;
+			}
+			statsAdd(STAT_CONNECTS, 1);
+			if(io_hooks == NULL) { //thread mode, a timeout per socket
+				struct timeval tv = { responseTimeout / 1000,
+				                      responseTimeout % 1000 * 1000 };
+				setsockopt(serverfd, SOL_SOCKET, SO_RCVTIMEO, &tv,
+				           sizeof(tv));
+				setsockopt(serverfd, SOL_SOCKET, SO_SNDTIMEO, &tv,
+				           sizeof(tv));
+			}
+		}
+		set_io_timeout(responseTimeout);
+
+		/* write the request package to server and return the server's 
+		 * reponse to client */
+		Rio_readinitb(&toServerRead, serverfd);
+		keep = clientKeep;
+		if(sendUpstream(serverfd, &up) < 0)
+			rc = RELAY_EMPTY;
+		else
+			rc = serverToClient(&toServerRead, url, clientfd, &keep, fl,
+			                    stale, !(reqCache & REQ_NO_STORE), gzipOk,
+			                    &range);
+
+		if(rc != RELAY_EMPTY || !reused)
+			break;
+		Close(serverfd); //stale pooled connection, retry on a new one
+		serverfd = -1;
 	}
+	set_io_timeout(0);
 
-	/* prepare for request package to be sent to server, store all the
-	 * info into arrray toServerReq */
-	toServerhdr(hostname, &reqRead, headers, serverfd, clientfd);
-	packToServer(headers, path, toServerReq);
-	reqSize = strlen(toServerReq);
+	/* the followers fetch alone if the response never got shared */
+	if(fl != NULL) {
+		flightFail(flights, fl);
+		flightRelease(flights, fl);
+	}
+	if(stale != NULL)
+		releaseObj(stale);
+	if(rc < 0)
+		statsAdd(STAT_ERRORS, 1);
+	if(rc == RELAY_TIMEOUT)
+		statsAdd(STAT_TIMEOUTS, 1);
 
-	/* write the request package to server */
-	Rio_readinitb(&toServerRead, serverfd);
-	/* if writen error, exit the thread */
-	if(Rio_writen(serverfd, toServerReq, reqSize) != reqSize) {
+	/* keep the server connection for the next request if it is clean */
+	if(rc == RELAY_KEEP)
+		poolPut(serverPool(), hostname, port, serverfd);
+	else if(serverfd >= 0)
 		Close(serverfd);
-		Close(clientfd);
-		return NULL;
+	if(queued >= 0 && limits != NULL)
+		limitRelease(limits, hostname, port);
+
+	/* nothing was sent, answer for the server */
+	if(rc == RELAY_BUSY || rc == RELAY_UNREACHED || rc == RELAY_TIMEOUT) {
+		if(rc == RELAY_BUSY)
+			statsAdd(STAT_REJECTED, 1);
+		return sendError(clientfd, rc, clientKeep) == 0 && clientKeep;
 	}
-	
-	/* return the server's reponse to client */
-	serverToClient(&toServerRead, url, clientfd, serverfd);
+	return rc >= 0 && keep;
+}
+
+/* sendError - answer the client with an empty 503, 502 or 504 response
+ * for the request the server could not take, be reached for or answer in
+ * time (rc), telling whether the connection stays open. return -1 on
+ * write error */
+static int sendError(int clientfd, int rc, int keep) {
+	char buf[MAXLINE];
+	int n;
 
+	n = snprintf(buf, MAXLINE, "HTTP/1.1 %s\r\nContent-Length: 0\r\n%s\r\n",
+	             rc == RELAY_BUSY ? "503 Service Unavailable" :
+	             rc == RELAY_UNREACHED ? "502 Bad Gateway" : 
+	             "504 Gateway Timeout",
+	             keep ? client_keep_hdr : client_close_hdr);
+	return Rio_writen(clientfd, buf, n) == n ? 0 : -1;
+}
+
+/* timedOut - whether err is from a wait or blocking connect or read that
+ * ran out of time, see set_io_timeout */
+static int timedOut(int err) {
+	return err == ETIMEDOUT || err == EAGAIN || err == EWOULDBLOCK ||
+	       err == EINPROGRESS;
+}
+
+/* serveTunnel - answer a CONNECT to hostname:port: connect to it, tell the
+ * client the tunnel is established and relay bytes both ways until both
+ * are done, starting with those reqrp holds after the request. a failed
+ * connect is answered 502 or 504. return 0, the client is closed after */
+static int serveTunnel(rio_t *reqrp, int clientfd, char *hostname, \
+                       char *port) {
+	static const char *established = 
+		"HTTP/1.1 200 Connection Established\r\n\r\n";
+	int serverfd, rc;
+	size_t up, down;
+	long t;
+
+	t = statsNow();
+	set_io_timeout(connectTimeout);
+	serverfd = open_clientfd(hostname, port);
+	statsTime(PHASE_CONNECT, statsNow() - t);
+	set_io_timeout(0);
+	if(serverfd < 0) {
+		rc = timedOut(errno) ? RELAY_TIMEOUT : RELAY_UNREACHED;
+		statsAdd(STAT_ERRORS, 1);
+		if(rc == RELAY_TIMEOUT)
+			statsAdd(STAT_TIMEOUTS, 1);
+		sendError(clientfd, rc, 0);
+		return 0;
+	}
+	statsAdd(STAT_CONNECTS, 1);
+	statsAdd(STAT_TUNNELS, 1);
+
+	if(Rio_writen(clientfd, (char *)established, strlen(established)) ==
+	   strlen(established)) {
+		set_io_timeout(TUNNEL_IDLE_SECS * 1000L);
+		tunnelRelay(reqrp, serverfd, &up, &down);
+		set_io_timeout(0);
+		statsAdd(STAT_TUNNEL_BYTES, up + down);
+	}
 	Close(serverfd);
-	Close(clientfd);
-	
+	return 0;
+}
+
+/* sendCached - send a held cache object to the client with the Connection
+ * header telling whether it stays open. a compressed one goes as stored
+ * if gzipOk, the client takes gzip, and inflated otherwise, either with
+ * the Content-Length of what is sent. only the part asked for goes if 
+ * range (NULL if none) is set and it can be sliced (sendRange). return 
+ * -1 on write error */
+static int sendCached(int clientfd, object *obj, int gzipOk, \
+                      byteRange *range, int keep) {
+	char tail[MAXLINE];
+	size_t zsize;
+	ssize_t rc;
+	long t;
+
+	if(range != NULL && range->set &&
+	   (rc = sendRange(clientfd, obj, range, keep)) <= 0)
+		return rc;
+
+	/* no headers to add to, this was not an HTTP/1.x response */
+	if(obj->hsize == 0) {
+		statsAdd(STAT_CACHE_BYTES, obj->dsize);
+		return sendObj(clientfd, obj, 0, obj->dsize) == obj->dsize ? 0 : -1;
+	}
+
+	/* the headers end at hsize, where the empty line is, the rest goes
+	 * with sendfile */
+	if(obj->plainSize == 0) {
+		statsAdd(STAT_CACHE_BYTES, obj->dsize);
+		if(sendHeaders(clientfd, obj->chunks, obj->hsize, keep, NULL) < 0)
+			return -1;
+		if(sendObj(clientfd, obj, obj->hsize, obj->dsize - obj->hsize) != 
+		                                            obj->dsize - obj->hsize)
+			return -1;
+		return 0;
+	}
+
+	/* compressed, the empty line and the gzip member follow the headers */
+	zsize = obj->dsize - obj->hsize - 2;
+	if(gzipOk) {
+		statsAdd(STAT_GZIP_SENT, 1);
+		statsAdd(STAT_CACHE_BYTES, obj->dsize);
+		snprintf(tail, MAXLINE, "Content-Encoding: gzip\r\n"
+		         "Content-Length: %zu\r\nVary: Accept-Encoding\r\n\r\n",
+		         zsize);
+		if(sendHeaders(clientfd, obj->chunks, obj->hsize, keep, tail) < 0)
+			return -1;
+		return sendObj(clientfd, obj, obj->hsize + 2, zsize) == zsize ?
+		       0 : -1;
+	}
+	statsAdd(STAT_GUNZIPPED, 1);
+	statsAdd(STAT_CACHE_BYTES, obj->hsize + obj->plainSize);
+	snprintf(tail, MAXLINE, "Content-Length: %zu\r\n"
+	         "Vary: Accept-Encoding\r\n\r\n", obj->plainSize);
+	if(sendHeaders(clientfd, obj->chunks, obj->hsize, keep, tail) < 0)
+		return -1;
+	t = statsNow();
+	rc = gunzipChunks(clientfd, obj->chunks, obj->hsize + 2, zsize,
+	                  obj->plainSize, 0, obj->plainSize);
+	statsTime(PHASE_GUNZIP, statsNow() - t);
+	return rc < 0 ? -1 : 0;
+}
+
+/* sendRange - answer a Range request from a held cache object with the
+ * head of rangeHead and the bytes asked for, with sendfile straight from
+ * the slab. a compressed one is inflated as far as the end of the range.
+ * only a 200 of known length is sliced. return 1 if the whole object is
+ * to be sent instead, -1 on write error, 0 otherwise */
+static int sendRange(int clientfd, object *obj, byteRange *range, int keep) {
+	char hdrs[MAXBUF];
+	size_t size, body, first, count;
+	ssize_t rc;
+	char c;
+	long t;
+
+	if(obj->hsize == 0 || obj->hsize >= MAXBUF ||
+	   obj->framing != FRAME_LENGTH)
+		return 1;
+	storedHeaders(obj, hdrs);
+
+	/* where the body starts, after the empty line, and its size as sent */
+	if(obj->plainSize > 0) {
+		body = obj->hsize + 2;
+		size = obj->plainSize;
+	}
+	else {
+		copyChunks(obj->chunks, obj->hsize, &c, 1);
+		body = obj->hsize + (c == '\r' ? 2 : 1);
+		size = obj->dsize - body;
+	}
+	if((rc = rangeHead(clientfd, hdrs, size, obj->plainSize > 0, range, 
+	                   keep, &first, &count)) <= 0)
+		return rc < 0 ? -1 : 1;
+
+	statsAdd(STAT_CACHE_BYTES, rc + count);
+	if(count == 0)
+		return 0;
+	if(obj->plainSize == 0)
+		return sendObj(clientfd, obj, body + first, count) == count ? 0 : -1;
+	t = statsNow();
+	rc = gunzipChunks(clientfd, obj->chunks, body, obj->dsize - body,
+	                  obj->plainSize, first, count);
+	statsTime(PHASE_GUNZIP, statsNow() - t);
+	return rc < 0 ? -1 : 0;
+}
+
+/* rangeHead - start the answer to range of a response with the headers
+ * hdrs, a string, and a body of size bytes, compressed in the cache if
+ * gzipped is set: 206 with the headers but the ones about the whole body
+ * and the Content-Range and Content-Length of the bytes asked for, or 416
+ * if they start past its end. *first and *count are set to the bytes of
+ * the body to send after it, none for a 416. only a 200 is sliced, and 
+ * only if the If-Range validator, if any, is its own. return the size of
+ * the head sent, 0 if the whole response is to be sent instead, -1 on 
+ * write error */
+static ssize_t rangeHead(int clientfd, char *hdrs, size_t size, int gzipped, \
+                   byteRange *range, int keep, size_t *first, size_t *count) {
+	char buf[MAXBUF + MAXLINE], *line, *next;
+	const char *connhdr = keep ? client_keep_hdr : client_close_hdr;
+	size_t last, n;
+	int status;
+
+	if(sscanf(hdrs, "HTTP/%*d.%*d %d", &status) != 1 || status != 200 ||
+	   !ifRangeMatches(hdrs, range->ifRange) || size == 0)
+		return 0;
+	statsAdd(STAT_RANGES, 1);
+
+	/* the bytes asked for, cut at the end of the body */
+	if(range->first < 0) {
+		*first = (size_t)range->last < size ? size - range->last : 0;
+		last = size - 1;
+	}
+	else {
+		*first = range->first;
+		last = (range->last < 0 || (size_t)range->last >= size) ? 
+		       size - 1 : (size_t)range->last;
+	}
+	if(*first >= size) { //past the end, or a suffix of none
+		*count = 0;
+		n = snprintf(buf, MAXLINE, "HTTP/1.1 416 Range Not Satisfiable\r\n"
+		             "Content-Range: bytes */%zu\r\nContent-Length: 0\r\n"
+		             "%s\r\n", size, connhdr);
+		return Rio_writen(clientfd, buf, n) == n ? n : -1;
+	}
+	*count = last - *first + 1;
+
+	/* the status line with its version, then the stored headers but the
+	 * ones about the whole body */
+	line = strchr(hdrs, ' ');
+	n = line - hdrs;
+	memcpy(buf, hdrs, n);
+	n += sprintf(buf + n, " 206 Partial Content\r\n");
+	for(line = hdrs + strcspn(hdrs, "\n"); *line; line = next) {
+		line++;
+		next = line + strcspn(line, "\n");
+		if(!strncasecmp(line, "Content-Length:", 15) ||
+		   !strncasecmp(line, "Content-Range:", 14) || line == next)
+			continue;
+		memcpy(buf + n, line, next - line + (*next == '\n'));
+		n += next - line + (*next == '\n');
+	}
+	n += snprintf(buf + n, MAXLINE, "Content-Range: bytes %zu-%zu/%zu\r\n"
+	              "Content-Length: %zu\r\n%s%s\r\n", *first, last, size,
+	              *count, gzipped ? "Vary: Accept-Encoding\r\n" : "", connhdr);
+	return Rio_writen(clientfd, buf, n) == n ? n : -1;
+}
+
+/* sendHeaders - send the hsize bytes of response headers at the start of
+ * the chunks from c, the Connection header telling whether the client
+ * connection stays open and then tail (if not NULL), in one write if they
+ * fit in a buffer. return -1 on write error */
+static int sendHeaders(int clientfd, chunk *c, size_t hsize, int keep, \
+                                                             char *tail) {
+	char buf[MAXBUF];
+	const char *connhdr = keep ? client_keep_hdr : client_close_hdr;
+	size_t connSize = strlen(connhdr), tailSize = tail ? strlen(tail) : 0;
+
+	if(hsize + connSize + tailSize <= MAXBUF) {
+		copyChunks(c, 0, buf, hsize);
+		memcpy(buf + hsize, connhdr, connSize);
+		memcpy(buf + hsize + connSize, tail, tailSize);
+		if(Rio_writen(clientfd, buf, hsize + connSize + tailSize) != 
+		                                 hsize + connSize + tailSize)
+			return -1;
+	}
+	else if(sendChunks(clientfd, chunkSlab(cacheQueue, c), c, 0, hsize) != 
+	                                                              hsize ||
+	        Rio_writen(clientfd, (char *)connhdr, connSize) != connSize ||
+	        Rio_writen(clientfd, tail, tailSize) != tailSize) {
+		return -1;
+	}
+	return 0;
+}
+
+/* followFlight - answer the request with the response the leader of f is
+ * fetching: send it once cached, or stream it from the shared reservation
+ * as the leader receives it. return 1 if answered, 0 if the response was
+ * not shared and must be fetched alone, -1 if the client connection has
+ * to be closed. gzipOk tells whether the client takes gzip and range what
+ * part of the response it asks for, keep whether its connection stays
+ * open */
+static int followFlight(flight *f, int clientfd, int http11, int gzipOk, \
+                        byteRange *range, int clientKeep, int *keep) {
+	int wakefd, state, rc = 0;
+	size_t have, sent, end, n;
+	ssize_t head;
+
+	if((wakefd = Open_wakeupfd()) < 0)
+		return 0;
+
+	have = flightWait(flights, f, 0, &state, wakefd);
+	if(state == FLIGHT_DONE) {
+		/* like a cache hit, the flight holds the object */
+		if(f->obj->framing != FRAME_CHUNKED || http11) {
+			*keep = clientKeep && f->obj->framing != FRAME_CLOSE;
+			rc = sendCached(clientfd, f->obj, gzipOk, range, *keep) < 0 ?
+			     -1 : 1;
+		}
+	}
+	else if(state == FLIGHT_STREAM) {
+		/* known length, the headers with our Connection header first,
+		 * then the rest up to total as it arrives. for a range, its head
+		 * and only its bytes of the body, up to end */
+		*keep = clientKeep;
+		rc = 1;
+		sent = f->hdrSize;
+		end = f->total;
+		if(range->set && (head = streamRange(f, clientfd, range, *keep,
+		                                     &sent, &end)) != 0) {
+			if(head < 0)
+				rc = -1;
+		}
+		else if(sendHeaders(clientfd, f->chunks.head, f->hdrSize, *keep,
+		                    NULL) < 0) {
+			rc = -1;
+		}
+		while(rc > 0 && sent < end) {
+			if(have > sent) {
+				n = (have < end ? have : end) - sent;
+				if(sendChunks(clientfd, chunkSlab(cacheQueue, f->chunks.head),
+				              f->chunks.head, sent, n) != n)
+					rc = -1;
+				sent += n;
+				continue;
+			}
+			have = flightWait(flights, f, sent, &state, wakefd);
+			if(state == FLIGHT_FAILED && have <= sent) //cut short
+				rc = -1;
+		}
+	}
+	Close(wakefd);
+	return rc;
+}
+
+/* streamRange - answer range from the response the leader of f streams:
+ * send the head of rangeHead, and set *sent and *end to where the bytes
+ * asked for start and end in the shared chunks. return what rangeHead
+ * does, 0 if the whole response is to be sent */
+static ssize_t streamRange(flight *f, int clientfd, byteRange *range, \
+                                   int keep, size_t *sent, size_t *end) {
+	char hdrs[MAXBUF];
+	size_t body, first, count;
+	ssize_t rc;
+	char c;
+
+	if(f->hdrSize >= MAXBUF)
+		return 0;
+	copyChunks(f->chunks.head, 0, hdrs, f->hdrSize);
+	hdrs[f->hdrSize] = '\0';
+	copyChunks(f->chunks.head, f->hdrSize, &c, 1);
+	body = f->hdrSize + (c == '\r' ? 2 : 1);
+	if((rc = rangeHead(clientfd, hdrs, f->total - body, 0, range, keep,
+	                   &first, &count)) > 0) {
+		*sent = body + first;
+		*end = body + first + count;
+	}
+	return rc;
+}
+
+/* serverPool - pool of idle server connections for the calling thread */
+static pool *serverPool() {
+	if(io_hooks == NULL) //not an event loop
+		return sharedPool;
+	if(loopPool == NULL)
+		loopPool = initPool();
+	return loopPool;
+}
+
+/* sweepLoopPool - close the expired idle server connections of the
+ * calling event loop, run by the loop itself every POOL_SWEEP_SECS */
+static void sweepLoopPool() {
+	if(loopPool != NULL)
+		poolSweep(loopPool);
+}
+
+/* sweepThread - close the expired idle server connections of the pool of
+ * thread mode every POOL_SWEEP_SECS, never returns */
+static void *sweepThread(void *vargp) {
+	Pthread_detach(pthread_self());
+	while(1) {
+		sleep(POOL_SWEEP_SECS);
+		poolSweep(sharedPool);
+	}
 	return NULL;
 }
 
+/* statsThread - print the stats to stderr on every SIGUSR1, reload on
+ * SIGHUP, save the cache to disk and exit on SIGTERM or SIGINT */
+static void *statsThread(void *vargp) {
+	sigset_t *set = (sigset_t *)vargp;
+	int sig;
+
+	Pthread_detach(pthread_self());
+	while(1) {
+		if(sigwait(set, &sig) != 0)
+			continue;
+		if(sig == SIGHUP) {
+			reload(set);
+			continue;
+		}
+		if(sig != SIGUSR1) {
+			fprintf(stderr, "saving cache to disk\n");
+			spillCache(cacheQueue);
+			exit(0);
+		}
+		statsPrint(stderr);
+		printStats(stderr);
+	}
+	return NULL;
+}
 
-/* go through each line of data sent back from server, write it to client
- * store in dataToCache if size does not exceeds MAX_OBJECT_SIZE */
-inline static void serverToClient(rio_t *toServerrp, char *url, int clientfd, \
-																int serverfd) {
+/* reload - start the proxy again and hand it the listening sockets, the
+ * admin socket and an image of the cache (not with -H), see reload.c. 
+ * the disk tier stops writing first, its log is the new process's then.
+ * once the new one serves, stop accepting and drain: responses close their
+ * clients, idle ones are closed, and exit when none is left or after the
+ * drain timeout (-G), at once on SIGTERM or SIGINT. if the new process 
+ * fails, serve on */
+static void reload(sigset_t *set) {
+	struct timespec tick = { 0, DRAIN_POLL_MS * 1000000L };
+	int fds[RELOAD_MAX_FDS], nfds, imagefd = -1, sig;
+	long nobjs = 0, deadline;
+	pid_t pid;
 
-	char clientLine[MAXLINE]; //data read from each line
-	char dataToCache[MAX_OBJECT_SIZE]; //all the data to be cached
-	char *tempPtr = dataToCache; //temp pointer tracks the end of cached data
-	size_t dataSize = 0; //total data size
-	size_t cycleSize; //size of content read from each cycle
-	size_t urlSize = strlen(url)+1; //string size of path
+	if(threadListenfd >= 0) {
+		fds[0] = threadListenfd;
+		nfds = 1;
+	}
+	else {
+		nfds = evListeners(fds, RELOAD_MAX_FDS);
+	}
+	if(cacheQueue->disk != NULL) {
+		diskPause(cacheQueue->disk, 1);
+		diskSync(cacheQueue->disk);
+	}
+	if(handover && (imagefd = reloadImage(cacheQueue, &nobjs)) < 0)
+		fprintf(stderr, "reload: no cache image, starting cold\n");
+	pid = reloadSpawn(progArgv, fds, nfds, statsListener(), imagefd);
+	if(imagefd >= 0)
+		close(imagefd);
+	if(pid < 0) {
+		if(cacheQueue->disk != NULL)
+			diskPause(cacheQueue->disk, 0);
+		fprintf(stderr, "reload failed, still serving\n");
+		return;
+	}
+	fprintf(stderr, "reload: pid %d took over %d listeners and %ld cached "
+	        "objects, draining\n", (int)pid, nfds, nobjs);
 
-	/* read MAXLINE each cycle and write it back to client, store to the
-	 * buffer dataToCache if size does not  */
-	while((cycleSize = Rio_readnb(toServerrp, clientLine, MAXLINE)) > 0) {
-		/* if writen error, exit the thread */
-		if(Rio_writen(clientfd, clientLine, cycleSize) != cycleSize) {
-			Close(serverfd);
-			Close(clientfd);
-			Pthread_exit(NULL);
+	__atomic_store_n(&draining, 1, __ATOMIC_RELAXED);
+	statsStop();
+	if(threadListenfd >= 0)
+		send_wakeup(acceptWake);
+	else
+		evDrain();
+	deadline = statsNow() + drainTimeout * 1000000L;
+	while(__atomic_load_n(&activeClients, __ATOMIC_RELAXED) > 0 &&
+	      statsNow() < deadline) {
+		sig = sigtimedwait(set, NULL, &tick);
+		if(sig == SIGTERM || sig == SIGINT)
+			break;
+		if(sig == SIGUSR1) {
+			statsPrint(stderr);
+			printStats(stderr);
 		}
-		dataSize = dataSize + cycleSize;
-		/* if size is fine, append to dataToCache */
-		if(dataSize <= MAX_OBJECT_SIZE) {
-			memcpy(tempPtr, clientLine, cycleSize);
-			tempPtr = tempPtr + cycleSize;
-		} 
 	}
+	fprintf(stderr, "reload: drained, %d clients left\n",
+	        __atomic_load_n(&activeClients, __ATOMIC_RELAXED));
+	exit(0);
+}
 
-	if(cycleSize < 0) { //if readnb error, exit the thread
-		Close(serverfd);
-		Close(clientfd);
-		Pthread_exit(NULL);
+/* printStats - print the counters of the cache, flights, disk tier and
+ * resolver, one "name value" line each, after those of stats.c */
+static void printStats(FILE *fp) {
+	flightStats fs;
+	diskStats ds;
+	dnsStats st;
+
+	fprintf(fp, "cache_bytes %lu\ncache_max_bytes %lu\ncache_evictions %lu\n"
+	        "cache_plain_bytes %lu\n",
+	        (unsigned long)__atomic_load_n(&cacheQueue->cacheSize, 
+	                                       __ATOMIC_RELAXED),
+	        (unsigned long)cacheQueue->maxSize, cacheEvictions(cacheQueue),
+	        (unsigned long)__atomic_load_n(&cacheQueue->plainBytes,
+	                                       __ATOMIC_RELAXED));
+	fprintf(fp, "slab_lost_chunks %lu\n", cacheLostChunks(cacheQueue));
+	flightGetStats(flights, &fs);
+	fprintf(fp, "flight_leaders %lu\nflight_followers %lu\n"
+	        "flight_fallbacks %lu\n", fs.leaders, fs.followers, fs.fallbacks);
+	if(cacheQueue->disk != NULL) {
+		diskGetStats(cacheQueue->disk, &ds);
+		fprintf(fp, "disk_hits %lu\ndisk_misses %lu\ndisk_corrupt %lu\n"
+		        "disk_spills %lu\ndisk_skipped %lu\ndisk_dropped %lu\n"
+		        "disk_parked %lu\ndisk_objects %lu\ndisk_bytes %lu\n"
+		        "disk_segments %lu\n",
+		        ds.hits, ds.misses, ds.corrupt, ds.spills, ds.skipped,
+		        ds.dropped, ds.parked, ds.objects, ds.bytes, ds.segments);
 	}
-	
-	/*if does not exceeds MAX_OBJECT_SIZE, push in cache */
-	if(dataSize <= MAX_OBJECT_SIZE) {
-		pushCache(dataToCache, dataSize, url, urlSize, cacheQueue);
-	} 
+	if(dnsCache == NULL)
+		return;
+	dnsGetStats(dnsCache, &st);
+	fprintf(fp, "dns_lookups %lu\ndns_hits %lu\ndns_stale %lu\n"
+	        "dns_misses %lu\ndns_joined %lu\ndns_resolves %lu\n"
+	        "dns_failures %lu\ndns_resolve_avg_us %.1f\n"
+	        "dns_resolve_max_us %.1f\n", st.lookups, st.hits, st.staleHits,
+	        st.misses, st.joined, st.resolves, st.failures, st.resolves ?
+	        st.resolveNsTotal / 1000.0 / st.resolves : 0.0,
+	        st.resolveNsMax / 1000.0);
 }
 
+/* serverToClient - relay the response of the server to the client. while
+ * the size does not exceed the largest object size the data is read
+ * straight into chunks of the cache slab and written to client from
+ * there, then cached. return RELAY_KEEP if the response was complete and
+ * the server connection can take another request, RELAY_CLOSE if complete
+ * otherwise, RELAY_ERROR on read or write error, RELAY_EMPTY if the server
+ * sent nothing at all and RELAY_TIMEOUT if nothing within the response
+ * timeout. clientKeep tells whether the client wants to keep the
+ * connection, and is cleared if the response does not allow it. if fl is
+ * not NULL the response is shared with its followers if it can be cached.
+ * stale is the cached object the request revalidates (NULL if none), on
+ * a 304 it is sent instead. nothing is cached unless store is set. gzipOk
+ * tells whether the client takes gzip and range what part it asks for,
+ * for a 304 answered from the cached object */
+inline static int serverToClient(rio_t *toServerrp, char *url, int clientfd, \
+    int *clientKeep, flight *fl, object *stale, int store, int gzipOk, \
+                                                          byteRange *range) {
+
+	relay r;
+	object *obj;
+	chunkList zipped, *stored;
+	int rc;
+	size_t urlSize = strlen(url)+1; //string size of path
+	size_t hdrSize, plain;
+
+	r.rp = toServerrp;
+	r.clientfd = clientfd;
+	r.outLen = 0;
+	r.body.head = r.body.tail = NULL;
+	r.body.size = 0;
+	r.caching = store;
+	r.hdrSize = 0;
+	r.clientKeep = *clientKeep;
+	r.fl = fl;
+	r.shared = 0;
+	r.clientGone = 0;
+	r.stale = stale;
+	r.notModified = 0;
+	r.compressible = 1;
+	r.gzipOk = gzipOk;
+	r.range = range;
+	r.sent = statsNow();
+	freshInit(&r.fresh);
 
-/* packToServer - put together "GET path" and all headers */
-inline static void packToServer(char *headers, char *path, char *toServerReq) {
-	char pathBuf[MAXLINE];
-	sprintf(pathBuf, "GET %s HTTP/1.0\r\n", path);
-	sprintf(toServerReq, "%s%s\r\n", pathBuf, headers);
+	/* headers first, then the body as they delimit it. our copy is still
+	 * good, send it */
+	if((rc = relayHeaders(&r)) == 0 && r.notModified) {
+		rc = relayNotModified(&r);
+		*clientKeep = r.clientKeep;
+		if(rc < 0)
+			return rc;
+		if(r.serverKeep && toServerrp->rio_cnt == 0)
+			return RELAY_KEEP;
+		return RELAY_CLOSE;
+	}
+	if(rc == 0) {
+		relayShare(&r);
+		if(r.framing == FRAME_CHUNKED)
+			rc = relayChunked(&r);
+		else if(r.framing == FRAME_LENGTH)
+			rc = relayBody(&r, r.contentLength);
+		else
+			rc = relayBody(&r, SIZE_MAX);
+	}
+	if(rc == 0)
+		rc = relayFlush(&r);
+	*clientKeep = r.clientKeep;
+
+	if(rc < 0) { //if read or write error, do not cache partial data
+		if(r.caching)
+			relayUncache(&r);
+		return rc;
+	}
+	
+	/*if does not exceeds the largest object, push in cache, compressed
+	 * if that saves room. the followers get the object, the flight holds
+	 * it for them, with the chunks received as they may still stream 
+	 * them. not admitted, they fall back to fetching it themselves */
+	if(r.caching) {
+		stored = &r.body;
+		hdrSize = r.hdrSize;
+		if((plain = relayCompress(&r, &zipped, &hdrSize)) > 0)
+			stored = &zipped;
+		obj = commitCache(stored, url, urlSize, hdrSize, r.framing, plain, \
+		                  r.expires, cacheQueue);
+		if(obj == NULL) {
+			if(plain > 0)
+				cancelCache(&zipped, cacheQueue);
+			relayUncache(&r);
+		}
+		else {
+			if(plain > 0 && !r.shared)
+				cancelCache(&r.body, cacheQueue);
+			if(r.shared)
+				flightDone(flights, r.fl, obj);
+			else
+				releaseObj(obj);
+		}
+	} 
+
+	/* reusable only if delimited, kept open and nothing unasked was sent */
+	if(r.framing != FRAME_CLOSE && r.serverKeep && toServerrp->rio_cnt == 0)
+		return RELAY_KEEP;
+	return RELAY_CLOSE;
 }
 
-/* toServerhdr - go through inputs of client, look for existence of each header
- * if existing, replace the original default header. look for other
- * headers, put them together */
-inline static void toServerhdr(char *hostname, rio_t *reqrp, char *headers, \
-								int serverfd, int clientfd) 				{
-	char hosthdr[MAXLINE]; //host header string
+/* relayHeaders - relay the status line and headers of the response. the
+ * hop-by-hop Connection, Keep-Alive and Proxy-Connection headers are for
+ * the proxy only, the client is told whether its connection stays open,
+ * which needs a delimited body. fill in the status, framing, size of the 
+ * headers, whether the server keeps the connection open and what the 
+ * headers tell about caching and compressing, and stop caching if they do
+ * not allow it. 
+ * a 304 to a revalidation is only read, the client gets our copy.
+ * return RELAY_EMPTY if nothing came, RELAY_TIMEOUT if nothing came in 
+ * time, RELAY_ERROR on error, 0 otherwise */
+static int relayHeaders(relay *r) {
 	char hdrLine[MAXLINE]; //string read in one line
+	int major, minor, chunked = 0, closing = 0, keepAlive = 0;
+	long length = -1;
+	time_t now;
 	ssize_t rc;
-	/* buffers store the rest of headers */
-	char userhdr[MAXLINE];
-	char accepthdr[MAXLINE];
-	char acceptEncodinghdr[MAXLINE];
-	char connectionhdr[MAXLINE];
-	char proxyConnectionhdr[MAXLINE];
-	char morehdrs[MAXLINE];
-	
-	/* copy default headers to buffers */
-	sprintf(hosthdr, "Host: %s\r\n", hostname);
-	strcpy(userhdr, user_agent_hdr);
-	strcpy(accepthdr, accept_hdr);
-	strcpy(acceptEncodinghdr, accept_encoding_hdr);
-	strcpy(connectionhdr, connection_hdr);
-	strcpy(proxyConnectionhdr, proxy_connection_hdr);
-	
-	/* read through each line from client, if found corresponding head
-	 * replace the original header to the specified one */
-	while((rc = Rio_readlineb(reqrp, hdrLine, MAXLINE)) > 0) {
-
-		/* if cannot find header termination, just break */
-		if(!strcmp(hdrLine, "\r\n")) break; 
-		/* if Host header specified, use the specified one */
-		if(strstr(hdrLine, "Host:") != NULL) {
-			strcpy(hosthdr, hdrLine);
-		}
-		/* do nothing to the other specified headers, use default */
-		else if(strstr(hdrLine, "User-Agent:") != NULL) {
+	const char *connhdr;
+
+	/* errno tells a timeout from a closed connection */
+	if((rc = rio_readlineb(r->rp, hdrLine, MAXLINE)) < 0 && timedOut(errno))
+		return RELAY_TIMEOUT;
+	if(rc <= 0)
+		return RELAY_EMPTY;
+	statsTime(PHASE_FIRST_BYTE, statsNow() - r->sent);
+
+	/* not an HTTP/1.x status line, relay whatever comes until EOF. it
+	 * says nothing about caching it */
+	r->framing = FRAME_CLOSE;
+	r->serverKeep = 0;
+	if(sscanf(hdrLine, "HTTP/%d.%d %d", &major, &minor, &r->status) != 3) {
+		r->clientKeep = 0;
+		if(r->caching)
+			relayUncache(r);
+		return relayWrite(r, hdrLine, rc, 1) < 0 ? RELAY_ERROR : 0;
+	}
+	r->notModified = (r->stale != NULL && r->status == 304);
+	if(relayWrite(r, hdrLine, rc, 1) < 0)
+		return RELAY_ERROR;
+
+	while((rc = Rio_readlineb(r->rp, hdrLine, MAXLINE)) > 0) {
+		if(!strcmp(hdrLine, "\r\n") || !strcmp(hdrLine, "\n"))
+			break;
+		if(!strncasecmp(hdrLine, "Connection:", 11)) {
+			closing = (hasValue(hdrLine, "close"));
+			keepAlive = (hasValue(hdrLine, "keep-alive"));
 			continue;
 		}
-		else if(strstr(hdrLine, "Accept:") != NULL) {
+		if(!strncasecmp(hdrLine, "Keep-Alive:", 11) ||
+		   !strncasecmp(hdrLine, "Proxy-Connection:", 17))
 			continue;
-		}
-		else if(strstr(hdrLine, "Accept-Encoding:") != NULL) {
+		if(!strncasecmp(hdrLine, "Content-Length:", 15))
+			length = strtol(hdrLine + 15, NULL, 10);
+		else if(!strncasecmp(hdrLine, "Transfer-Encoding:", 18))
+			chunked = (hasValue(hdrLine, "chunked"));
+		else
+			freshHeader(&r->fresh, hdrLine);
+		if(!gzipAllows(hdrLine))
+			r->compressible = 0;
+		if(relayWrite(r, hdrLine, rc, 1) < 0)
+			return RELAY_ERROR;
+	}
+	if(rc <= 0) //headers cut short
+		return RELAY_ERROR;
+
+	if((r->status >= 100 && r->status < 200) || r->status == 204 || 
+	   r->status == 304) { //never a body
+		r->framing = FRAME_LENGTH;
+		r->contentLength = 0;
+	}
+	else if(chunked) {
+		r->framing = FRAME_CHUNKED;
+	}
+	else if(length >= 0) {
+		r->framing = FRAME_LENGTH;
+		r->contentLength = length;
+	}
+	r->serverKeep = !closing && (minor >= 1 || keepAlive);
+	now = time(NULL);
+	r->expires = freshUntil(&r->fresh, now, freshDefault);
+	if(r->caching && !r->notModified &&
+	   !freshStorable(&r->fresh, r->status, r->expires, now)) {
+		statsAdd(STAT_UNSTORABLE, 1);
+		relayUncache(r);
+	}
+
+	/* our own Connection header is for this client only, not cached. the
+	 * cached headers end where the empty line starts */
+	if(r->framing == FRAME_CLOSE)
+		r->clientKeep = 0;
+	r->hdrSize = r->body.size;
+	connhdr = r->clientKeep ? client_keep_hdr : client_close_hdr;
+	if(relayWrite(r, (char *)connhdr, strlen(connhdr), 0) < 0 ||
+	   relayWrite(r, hdrLine, rc, 1) < 0)
+		return RELAY_ERROR;
+	return 0;
+}
+
+/* hasValue - whether value appears in the header line, ignoring case */
+static int hasValue(char *hdrLine, char *value) {
+	size_t len = strlen(value);
+
+	for(; *hdrLine; hdrLine++) {
+		if(!strncasecmp(hdrLine, value, len))
+			return 1;
+	}
+	return 0;
+}
+
+/* relayWrite - queue n bytes of buf for the client, and copy them to the 
+ * cache chunks if toCache is set and the response still fits in them.
+ * header and chunk lines are gathered in outBuf so they go out in a few 
+ * writes, not one small segment each. return -1 on write error, 0 
+ * otherwise. nothing of a 304 to a revalidation goes anywhere */
+static int relayWrite(relay *r, char *buf, size_t n, int toCache) {
+	if(r->notModified)
+		return 0;
+	if(r->outLen + n > MAXBUF && relayFlush(r) < 0)
+		return -1;
+	if(n > MAXBUF) {
+		if(relayClient(r, buf, n) < 0)
+			return -1;
+	}
+	else {
+		memcpy(r->outBuf + r->outLen, buf, n);
+		r->outLen += n;
+	}
+	if(!toCache || !r->caching)
+		return 0;
+	if(appendCache(&r->body, buf, n, cacheQueue) < 0) //will not be cached
+		relayUncache(r);
+	return 0;
+}
+
+/* relayNotModified - the server says the stale object is still good:
+ * make it fresh for as long as the 304, over its stored headers, says,
+ * hand it to the followers and send it to the client like a hit. return
+ * RELAY_ERROR on write error, 0 otherwise */
+static int relayNotModified(relay *r) {
+	char hdrs[MAXBUF];
+	freshInfo stored;
+	object *obj = r->stale;
+
+	statsAdd(STAT_NOT_MODIFIED, 1);
+	freshInit(&stored);
+	storedHeaders(obj, hdrs);
+	freshHeaders(&stored, hdrs);
+	freshUpdate(&stored, &r->fresh);
+	refreshObj(obj, freshUntil(&stored, time(NULL), freshDefault));
+
+	if(r->fl != NULL)
+		flightDone(flights, r->fl, retainObj(obj));
+	r->clientKeep = r->clientKeep && obj->framing != FRAME_CLOSE;
+	return sendCached(r->clientfd, obj, r->gzipOk, r->range, 
+	                  r->clientKeep) < 0 ? 
+	       RELAY_ERROR : 0;
+}
+
+/* relayCompress - the complete response in r->body is to be cached: 
+ * compress it into zl if the headers allow it and it then takes fewer 
+ * chunks. zl has the headers but Content-Length, which sendCached gives
+ * for the coding it sends, and with a weak ETag, *hdrSize is set to their
+ * size, then a CRLF empty line and the gzip member. return the size of
+ * the body before compression, 0 if it is to be stored as received */
+static size_t relayCompress(relay *r, chunkList *zl, size_t *hdrSize) {
+	char hdrs[MAXBUF], etag[MAXLINE], *line, *next;
+	size_t bodyOff = r->body.size - r->contentLength, zhdrSize;
+	ssize_t etagSize;
+	long t;
+
+	/* a body within one chunk saves nothing */
+	if(gzipLevel == 0 || !r->compressible || r->status != 200 ||
+	   r->framing != FRAME_LENGTH || r->hdrSize >= MAXBUF ||
+	   r->contentLength == 0 || chunkBytes(r->body.size) <= CHUNK_SIZE)
+		return 0;
+	t = statsNow();
+	zl->head = zl->tail = NULL;
+	zl->size = 0;
+
+	copyChunks(r->body.head, 0, hdrs, r->hdrSize);
+	hdrs[r->hdrSize] = '\0';
+	for(line = hdrs; *line != '\0'; line = next) {
+		next = strchr(line, '\n');
+		next = next != NULL ? next + 1 : line + strlen(line);
+		if(!strncasecmp(line, "Content-Length:", 15))
 			continue;
+		if(!strncasecmp(line, "ETag:", 5)) {
+			etagSize = gzipETag(line, next - line, etag, MAXLINE);
+			if(etagSize < 0 ||
+			   appendCache(zl, etag, etagSize, cacheQueue) < 0)
+				break;
 		}
-		else if(strstr(hdrLine, "Connection:") != NULL) {
-			continue;
+		else if(appendCache(zl, line, next - line, cacheQueue) < 0) {
+			break;
 		}
-		else if(strstr(hdrLine, "Proxy-Connection:") != NULL) {
-			continue;
+	}
+	zhdrSize = zl->size;
+	if(*line != '\0' || appendCache(zl, "\r\n", 2, cacheQueue) < 0 ||
+	   gzipChunks(r->body.head, bodyOff, r->contentLength, zl,
+	              chunkBytes(r->body.size) - CHUNK_SIZE, gzipLevel,
+	              cacheQueue) < 0 ||
+	   chunkBytes(zl->size) >= chunkBytes(r->body.size)) {
+		statsTime(PHASE_GZIP, statsNow() - t);
+		statsAdd(STAT_GZIP_SKIPPED, 1);
+		cancelCache(zl, cacheQueue);
+		return 0;
+	}
+	statsTime(PHASE_GZIP, statsNow() - t);
+	statsAdd(STAT_GZIP_STORED, 1);
+	*hdrSize = zhdrSize;
+	statsAdd(STAT_GZIP_SAVED, chunkBytes(r->body.size) - chunkBytes(zl->size));
+	return r->contentLength;
+}
+
+/* relayShare - the headers are in, share the response with the followers
+ * of the flight if it can be cached: streamed while it arrives if its 
+ * whole size is known, complete otherwise */
+static void relayShare(relay *r) {
+	size_t total = 0;
+
+	if(r->fl == NULL)
+		return;
+	if(r->framing == FRAME_LENGTH)
+		total = r->body.size + r->contentLength;
+	if(!r->caching || total > cacheQueue->maxObject) {
+		flightFail(flights, r->fl);
+		return;
+	}
+	flightShare(flights, r->fl, &r->body, r->hdrSize, total, cacheQueue);
+	r->shared = 1;
+}
+
+/* relayUncache - the response will not be cached. the chunks are given
+ * back, by the flight once its followers are done if shared, so it gets
+ * those taken since the last progress too */
+static void relayUncache(relay *r) {
+	if(r->shared) {
+		flightProgress(flights, r->fl, &r->body);
+		flightFail(flights, r->fl);
+	}
+	else {
+		cancelCache(&r->body, cacheQueue);
+	}
+	r->caching = 0;
+}
+
+/* relayFlush - write what relayWrite queued to the client. return -1 on 
+ * write error, 0 otherwise */
+static int relayFlush(relay *r) {
+	size_t n = r->outLen;
+
+	r->outLen = 0;
+	return n > 0 ? relayClient(r, r->outBuf, n) : 0;
+}
+
+/* relayClient - write n bytes of buf to the client. if it goes away while
+ * the response is shared, the rest is still received and cached for the
+ * followers, only not written: one client closing early does not cut
+ * short every response coalesced with its own. return -1 on write error
+ * or once the client is gone and nothing is cached anymore, 0 otherwise */
+static int relayClient(relay *r, char *buf, size_t n) {
+	if(!r->clientGone) {
+		if(Rio_writen(r->clientfd, buf, n) == n) {
+			statsAdd(STAT_RELAYED, n);
+			return 0;
 		}
-		/* Anything other than those headers, strcat them */
-		else {
-			strcat(morehdrs, hdrLine);
+		if(!r->shared)
+			return -1;
+		statsAdd(STAT_ERRORS, 1);
+		r->clientGone = 1;
+		r->clientKeep = 0;
+	}
+	return r->caching ? 0 : -1;
+}
+
+/* relayBody - relay n bytes of body from server to client, or everything
+ * until EOF if n is SIZE_MAX. the data is read straight into the cache
+ * chunks while it fits, once it does not the rest is spliced (or 
+ * copied through a buffer with -C or for a short rest). return 
+ * RELAY_ERROR on error or if the body ends early, 0 otherwise */
+static int relayBody(relay *r, size_t n) {
+	char clientLine[MAXLINE]; //data read from each line once too big
+	char *readPtr; //where the data of this cycle is read to
+	size_t room, want; //space left in the last chunk, size to read
+	ssize_t cycleSize; //size of content read from each cycle
+
+	if(relayFlush(r) < 0) //the headers or chunk line go first
+		return RELAY_ERROR;
+
+	/* read MAXLINE each cycle and write it back to client, reading into 
+	 * the chunks while the response fits in the cache */
+	while(n > 0) {
+		/* not cacheable anymore, splice the rest from server to client */
+		if(!r->caching && spliceRelay && n >= RIO_SPLICESIZE) {
+			cycleSize = Rio_splice(r->rp, r->clientfd, n);
+			if(cycleSize < 0 || (n != SIZE_MAX && cycleSize != n))
+				return RELAY_ERROR;
+			statsAdd(STAT_RELAYED, cycleSize);
+			return 0;
 		}
+
+		room = 0;
+		readPtr = r->caching ? growCache(&r->body, &room, cacheQueue) : NULL;
+		if(readPtr == NULL)
+			readPtr = clientLine;
+		want = (room && room < MAXLINE) ? room : MAXLINE;
+		if(want > n)
+			want = n;
+		if((cycleSize = Rio_readnb(r->rp, readPtr, want)) <= 0)
+			return (cycleSize == 0 && n == SIZE_MAX) ? 0 : RELAY_ERROR;
+
+		/* more data than the largest object, it will not be cached */
+		if(readPtr == clientLine && r->caching)
+			relayUncache(r);
+		/* if writen error, give up on this response unless shared */
+		if(relayClient(r, readPtr, cycleSize) < 0)
+			return RELAY_ERROR;
+		if(readPtr != clientLine) {
+			r->body.size += cycleSize;
+			if(r->shared) //followers stream it from the chunks
+				flightProgress(flights, r->fl, &r->body);
+		}
+		if(n != SIZE_MAX)
+			n -= cycleSize;
 	}
-	
-	if(rc < 0) { //if readlineb error, exit this thread
-		Close(serverfd);
-		Close(clientfd);
-		Pthread_exit(NULL);
+	return 0;
+}
+
+/* relayChunked - relay a chunked body: each chunk size line and chunk, the
+ * last empty chunk and the trailers up to the final empty line. return
+ * RELAY_ERROR on error or if the body ends early, 0 otherwise */
+static int relayChunked(relay *r) {
+	char line[MAXLINE];
+	size_t size;
+	ssize_t rc;
+
+	while(1) {
+		if((rc = Rio_readlineb(r->rp, line, MAXLINE)) <= 0 ||
+		   relayWrite(r, line, rc, 1) < 0)
+			return RELAY_ERROR;
+		if((size = strtoul(line, NULL, 16)) == 0) //last chunk
+			break;
+		if(relayBody(r, size + 2) < 0) //chunk data and its CRLF
+			return RELAY_ERROR;
 	}
-	
-	//connect all headers together
-	sprintf(headers, "%s%s%s%s%s%s%s", hosthdr, userhdr, accepthdr,\
-	        acceptEncodinghdr, connectionhdr, proxyConnectionhdr, morehdrs);
+
+	do { //trailers until the empty line
+		if((rc = Rio_readlineb(r->rp, line, MAXLINE)) <= 0 ||
+		   relayWrite(r, line, rc, 1) < 0)
+			return RELAY_ERROR;
+	} while(strcmp(line, "\r\n") && strcmp(line, "\n"));
+	return relayFlush(r);
 }
 
 
-/* parReq - for given url, parse the hostname, port number and path, if no path
- * specified, just add "/" to make sure it is not "\0", if no port number
- * specified, just use default well know port number 80 */
-void parReq(char *url, char *hostname, char *portp, char *path) {
-	char *curr;
-	char ports[MAXLINE];
-	
-	//skip possible "http://"
-	if((curr = strstr(url, "://")) == NULL) {
-		curr = url;
+/* packToServer - start the request package with "GET path", as HTTP/1.1
+ * if the client speaks it, so the response framing is one it understands */
+inline static void packToServer(upstream *up, httpSpan path, int http11) {
+	up->n = 0;
+	up->size = 0;
+	addPiece(up, "GET ", 4);
+	addPiece(up, path.p, path.len);
+	addPiece(up, http11 ? " HTTP/1.1\r\n" : " HTTP/1.0\r\n", 11);
+}
+
+/* toServerhdr - go through the headers of the client request and add them
+ * to the request package. the client's Host header replaces the default 
+ * one, User-Agent, Accept and Accept-Encoding are always the default ones,
+ * the hop-by-hop ones are the proxy's own, the others are passed on after
+ * them as the client sent them. clientKeep comes in as whether the client
+ * connection persists by default and is updated from its Connection or 
+ * Proxy-Connection header. validators are the conditional headers of a
+ * revalidation, which replace those of the client, NULL if none */
+inline static void toServerhdr(httpSpan host, httpRequest *req, \
+                          upstream *up, int *clientKeep, char *validators) {
+	httpHeader *h, *hostHdr = NULL;
+	char pass[HTTP_MAX_HEADERS]; //passed on as they are
+	int i;
+
+	for(i = 0; i < req->nhdrs; i++) {
+		h = &req->hdrs[i];
+		pass[i] = 0;
+		if(httpSpanIs(h->name, "host")) {
+			hostHdr = h;
+		}
+		/* Connection and Proxy-Connection, only the client's own wish */
+		else if(httpSpanIs(h->name, "connection") ||
+		        httpSpanIs(h->name, "proxy-connection")) {
+			if(httpHasToken(h->value, "close"))
+				*clientKeep = 0;
+			else if(httpHasToken(h->value, "keep-alive"))
+				*clientKeep = 1;
+		}
+		/* the client's condition is no use for revalidating our copy */
+		else if(httpSpanIs(h->name, "if-none-match") ||
+		        httpSpanIs(h->name, "if-modified-since")) {
+			pass[i] = (validators == NULL);
+		}
+		/* the defaults are used, and the keep-alive with the server is 
+		 * the proxy's */
+		else if(!httpSpanIs(h->name, "user-agent") &&
+		        !httpSpanIs(h->name, "accept") &&
+		        !httpSpanIs(h->name, "accept-encoding") &&
+		        !httpSpanIs(h->name, "keep-alive")) {
+			pass[i] = 1;
+		}
+	}
+
+	/* Host first, then the default headers and the rest */
+	if(hostHdr == NULL) {
+		addPiece(up, "Host: ", 6);
+		addPiece(up, host.p, host.len);
+		addPiece(up, "\r\n", 2);
 	}
 	else {
-		curr += 3;
+		addHeader(up, hostHdr);
 	}
-	
-	//hostname before the first '/' or ':'
-	while(*curr != '/' && *curr != ':' && *curr != '\0') {
-		*hostname = *curr;
-		hostname++;
-		curr++;
+	addPiece(up, user_agent_hdr, strlen(user_agent_hdr));
+	addPiece(up, accept_hdr, strlen(accept_hdr));
+	addPiece(up, accept_encoding_hdr, strlen(accept_encoding_hdr));
+	addPiece(up, connection_hdr, strlen(connection_hdr));
+	for(i = 0; i < req->nhdrs; i++) {
+		if(pass[i])
+			addHeader(up, &req->hdrs[i]);
+	}
+	if(validators != NULL)
+		addPiece(up, validators, strlen(validators));
+	addPiece(up, "\r\n", 2);
+}
+
+/* cacheDirectives - what the client request allows of the cache: 
+ * REQ_NO_CACHE for Cache-Control no-cache or max-age=0 or Pragma no-cache,
+ * REQ_NO_STORE for Cache-Control no-store or any Authorization, whose
+ * response is for that client only */
+static int cacheDirectives(httpRequest *req) {
+	httpHeader *h;
+	int i, flags = 0;
+
+	for(i = 0; i < req->nhdrs; i++) {
+		h = &req->hdrs[i];
+		if(httpSpanIs(h->name, "cache-control")) {
+			if(httpHasToken(h->value, "no-cache") ||
+			   httpHasToken(h->value, "max-age=0"))
+				flags |= REQ_NO_CACHE;
+			if(httpHasToken(h->value, "no-store"))
+				flags |= REQ_NO_STORE;
+		}
+		else if(httpSpanIs(h->name, "pragma") &&
+		        httpHasToken(h->value, "no-cache")) {
+			flags |= REQ_NO_CACHE;
+		}
+		else if(httpSpanIs(h->name, "authorization")) {
+			flags |= REQ_NO_STORE;
+		}
 	}
-	*hostname = '\0'; //terminate hostname string
+	return flags;
+}
 
-	if(*curr ==  '\0') { //if terminated after hostname, path is "/"
-		strcpy(path, "/");
-		return;
+/* acceptsGzip - whether the client takes gzip coded responses: its 
+ * Accept-Encoding names gzip, or *, with a weight other than q=0 */
+static int acceptsGzip(httpRequest *req) {
+	httpHeader *h;
+	const char *p, *tok, *end, *next;
+	char q[8];
+	size_t n;
+	int i;
+
+	for(i = 0; i < req->nhdrs; i++) {
+		h = &req->hdrs[i];
+		if(!httpSpanIs(h->name, "accept-encoding"))
+			continue;
+		/* each coding up to a comma, its name first */
+		end = h->value.p + h->value.len;
+		for(p = h->value.p; p < end; p = next + 1) {
+			for(next = p; next < end && *next != ','; next++)
+				;
+			while(p < next && (*p == ' ' || *p == '\t'))
+				p++;
+			for(tok = p; p < next && *p != ';' && *p != ' ' && *p != '\t';
+			    p++)
+				;
+			if(!(p - tok == 4 && !strncasecmp(tok, "gzip", 4)) &&
+			   !(p - tok == 1 && *tok == '*'))
+				continue;
+			for(; p + 2 <= next; p++) {
+				if((*p == 'q' || *p == 'Q') && p[1] == '=') {
+					n = next - p - 2 < sizeof(q) ? next - p - 2 :
+					                               sizeof(q) - 1;
+					memcpy(q, p + 2, n);
+					q[n] = '\0';
+					return strtod(q, NULL) > 0;
+				}
+			}
+			return 1;
+		}
 	}
+	return 0;
+}
 
-	if(*curr == ':') { //if find ':', set the port number
-		curr++;
-		char *temp = ports;
-		while(*curr != '/' && *curr !=  '\0') {
-			*temp = *curr;
-			temp++;
-			curr++;
+/* clientRange - the single byte range the client asks for with Range, 
+ * bytes=first-last, first- or -suffix, and its If-Range. one that is not
+ * valid, or a list of them, is not set: the whole response is sent */
+static void clientRange(httpRequest *req, byteRange *range) {
+	httpHeader *h;
+	char spec[MAXLINE], *p, *end;
+	int i;
+
+	memset(range, 0, sizeof(byteRange));
+	for(i = 0; i < req->nhdrs; i++) {
+		h = &req->hdrs[i];
+		if(httpSpanIs(h->name, "if-range")) {
+			range->ifRange = h->value;
+			continue;
+		}
+		if(!httpSpanIs(h->name, "range") ||
+		   spanCopy(spec, MAXLINE, h->value, "") < 0 ||
+		   strncasecmp(spec, "bytes=", 6) || strchr(spec, ',') != NULL)
+			continue;
+
+		/* first, up to the dash, then last, either may be missing */
+		p = spec + 6;
+		range->first = range->last = -1;
+		if(isdigit((unsigned char)*p)) {
+			range->first = strtol(p, &end, 10);
+			p = end;
 		}
-		*temp = '\0'; //terminate port string
-		strcpy(portp, ports);
-		if(*curr ==  '\0') { //if terminated after port, path is "/"
-			strcpy(path, "/");
-			return;
+		if(*p++ != '-')
+			continue;
+		if(isdigit((unsigned char)*p)) {
+			range->last = strtol(p, &end, 10);
+			p = end;
 		}
+		range->set = *p == '\0' && (range->first >= 0 || range->last >= 0) &&
+		             (range->last < 0 || range->first <= range->last);
 	}
-	else {	//no ':', use default 80
-		strcpy(portp, "80");
+}
+
+/* ifRangeMatches - whether the If-Range validator v (len 0 if none) is 
+ * the one of the stored response headers hdrs: its ETag, strong, or its
+ * Last-Modified date, exactly */
+static int ifRangeMatches(char *hdrs, httpSpan v) {
+	const char *name = (v.len > 0 && v.p[0] == '"') ? "etag:" : 
+	                                                   "last-modified:";
+	size_t n, len = strlen(name);
+	char *line;
+
+	if(v.len == 0)
+		return 1;
+	for(line = hdrs; *line; line += strcspn(line, "\n")) {
+		if(*line == '\n')
+			line++;
+		if(strncasecmp(line, name, len))
+			continue;
+		for(line += len; *line == ' ' || *line == '\t'; line++)
+			;
+		for(n = strcspn(line, "\r\n"); n > 0 && (line[n - 1] == ' ' ||
+		                                        line[n - 1] == '\t'); n--)
+			;
+		return n == v.len && !memcmp(line, v.p, n);
 	}
+	return 0;
+}
 
-	sprintf(path, "%s", curr); //put the rest string as path
+/* storedHeaders - copy the stored response headers of a held object to
+ * buf of MAXBUF bytes as a string, as many as fit. return their size */
+static size_t storedHeaders(object *obj, char *buf) {
+	size_t n = obj->hsize < MAXBUF ? obj->hsize : MAXBUF - 1;
+
+	copyChunks(obj->chunks, 0, buf, n);
+	buf[n] = '\0';
+	return n;
+}
+
+/* addHeader - add the line of header h as the client sent it, with its
+ * CRLF if it ended so, to the request package */
+static void addHeader(upstream *up, httpHeader *h) {
+	const char *end = h->value.p + h->value.len;
+
+	/* the line goes on with its line feed at least, a CR is followed by one */
+	if(end[0] == '\r' && end[1] == '\n') {
+		addPiece(up, h->name.p, end + 2 - h->name.p);
+	}
+	else {
+		addPiece(up, h->name.p, end - h->name.p);
+		addPiece(up, "\r\n", 2);
+	}
+}
+
+/* addPiece - add the len bytes at p to the request package. bytes right
+ * after the last piece, like a run of passed header lines, extend it */
+static void addPiece(upstream *up, const char *p, size_t len) {
+	struct iovec *last = up->n > 0 ? &up->iov[up->n - 1] : NULL;
+
+	if(last != NULL && (char *)last->iov_base + last->iov_len == p)
+		last->iov_len += len;
+	else {
+		up->iov[up->n].iov_base = (void *)p;
+		up->iov[up->n++].iov_len = len;
+	}
+	up->size += len;
+}
+
+/* sendUpstream - write the request package to the server with one writev,
+ * on a copy of the pieces so it can be sent again on a new connection.
+ * return -1 on write error, 0 otherwise */
+static int sendUpstream(int serverfd, upstream *up) {
+	struct iovec iov[REQ_IOV];
+
+	memcpy(iov, up->iov, up->n * sizeof(struct iovec));
+	return Rio_writev(serverfd, iov, up->n) == up->size ? 0 : -1;
+}
+
+/* readRequest - read from the client until its request line and headers
+ * are all in the rio buffer, and parse them there into req. start is set
+ * to when the last of the head was there. return the size of the head, 0
+ * if the client is done, sent something that is not a request or one with
+ * a head larger than the buffer */
+static int readRequest(rio_t *rp, httpRequest *req, long *start) {
+	long t = statsNow();
+	int n;
+
+	while((n = httpParse(rp->rio_bufptr, rp->rio_cnt, req)) == 0) {
+		if(Rio_fillb(rp) <= 0)
+			return 0;
+		t = statsNow();
+	}
+	if(n < 0)
+		return 0;
+	*start = t;
+	return n;
+}
+
+/* spanCopy - copy s to the string dst of size bytes, or dflt if s is 
+ * empty. return -1 if it does not fit, 0 otherwise */
+static int spanCopy(char *dst, size_t size, httpSpan s, char *dflt) {
+	if(s.len == 0) {
+		strcpy(dst, dflt);
+		return 0;
+	}
+	if(s.len >= size)
+		return -1;
+	memcpy(dst, s.p, s.len);
+	dst[s.len] = '\0';
+	return 0;
 }
@@ -0,0 +1,211 @@
+/******************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the hot reload of the proxy, see reload.h. The new process is
+ * forked and exec'd with only the channel, a unix socketpair, as its
+ * descriptor 3 and RELOAD_ENV telling so: everything else the old one has
+ * open, client and server connections above all, is closed in the child
+ * first, or the connections the old process closes would stay open. The
+ * sockets follow in one SCM_RIGHTS message, and the new process writes a
+ * byte back once it serves them.
+ *
+ * The child of a threaded process may only make async-signal-safe calls
+ * until it execs, so its environment is built before the fork.
+ *
+ * ***************************************************************************/
+
+#include "csapp.h"
+#include "reload.h"
+#include <sys/syscall.h>
+
+/* memfd_create is only declared with _GNU_SOURCE, which clashes with the
+ * gai_error in csapp.h, and so is environ */
+int memfd_create(const char *name, unsigned int flags);
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 1U
+#endif
+extern char **environ;
+
+static int channel = -1; //to the old process, in the new one
+
+/* closeFrom - close every descriptor from fd on, in the child before it
+ * execs. close_range does it at once where the kernel has it */
+static void closeFrom(int fd) {
+	long most = sysconf(_SC_OPEN_MAX);
+
+#ifdef SYS_close_range
+	if(syscall(SYS_close_range, fd, ~0U, 0) == 0)
+		return;
+#endif
+	for(; fd < most; fd++)
+		close(fd);
+}
+
+/* reloadImage - write an image of the cache to a new memfd, to hand it
+ * over, setting *nobjs to the objects in it. it takes as much memory
+ * again as the cache, until the new process has loaded it. return the
+ * memfd, read from the start, or -1 on error */
+int reloadImage(queue *cacheQueue, long *nobjs) {
+	int fd;
+
+	if((fd = memfd_create("proxy-image", MFD_CLOEXEC)) < 0)
+		return -1;
+	if((*nobjs = saveCache(cacheQueue, fd)) < 0 ||
+	   lseek(fd, 0, SEEK_SET) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* reloadSpawn - start the proxy again with argv and hand it the nlisten
+ * listening sockets in fds, the admin socket adminfd and the cache image
+ * imagefd (-1 if none), then wait until it serves them. return its pid,
+ * or -1 if it could not start or was not ready in RELOAD_READY_SECS */
+pid_t reloadSpawn(char **argv, int *fds, int nlisten, int adminfd, \
+                                                        int imagefd) {
+	char ctl[CMSG_SPACE((RELOAD_MAX_FDS + 2) * sizeof(int))];
+	char **envp, *exe, ready;
+	int sv[2], all[RELOAD_MAX_FDS + 2], n, i;
+	struct pollfd pfd;
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct iovec iov;
+	reloadMsg m;
+	sigset_t none;
+	pid_t pid;
+
+	if(nlisten > RELOAD_MAX_FDS ||
+	   socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		return -1;
+
+	/* the environment and the binary are settled before the fork. a bare
+	 * name was found on the PATH, run the file of this process then */
+	for(n = 0; environ[n] != NULL; n++)
+		;
+	envp = (char **)Malloc((n + 2) * sizeof(char *));
+	for(i = 0, n = 0; environ[i] != NULL; i++) {
+		if(strncmp(environ[i], RELOAD_ENV "=", strlen(RELOAD_ENV) + 1))
+			envp[n++] = environ[i];
+	}
+	envp[n++] = RELOAD_ENV "=3";
+	envp[n] = NULL;
+	exe = strchr(argv[0], '/') != NULL ? argv[0] : "/proc/self/exe";
+	sigemptyset(&none);
+
+	if((pid = fork()) < 0) {
+		close(sv[0]);
+		close(sv[1]);
+		Free(envp);
+		return -1;
+	}
+	if(pid == 0) {
+		/* only the channel goes along, and no signal stays blocked */
+		if(sv[1] != 3 && dup2(sv[1], 3) < 0)
+			_exit(127);
+		closeFrom(4);
+		sigprocmask(SIG_SETMASK, &none, NULL);
+		execve(exe, argv, envp);
+		_exit(127);
+	}
+	close(sv[1]);
+	Free(envp);
+
+	/* the sockets in one message, what they are in its data */
+	m.nlisten = nlisten;
+	m.admin = adminfd >= 0;
+	m.image = imagefd >= 0;
+	memcpy(all, fds, nlisten * sizeof(int));
+	n = nlisten;
+	if(m.admin)
+		all[n++] = adminfd;
+	if(m.image)
+		all[n++] = imagefd;
+	memset(&msg, 0, sizeof(msg));
+	memset(ctl, 0, sizeof(ctl));
+	iov.iov_base = &m;
+	iov.iov_len = sizeof(m);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl;
+	msg.msg_controllen = CMSG_SPACE(n * sizeof(int));
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(n * sizeof(int));
+	memcpy(CMSG_DATA(cm), all, n * sizeof(int));
+
+	/* ready is one byte back, a new process that died closes instead */
+	pfd.fd = sv[0];
+	pfd.events = POLLIN;
+	if(sendmsg(sv[0], &msg, 0) != sizeof(m) ||
+	   poll(&pfd, 1, RELOAD_READY_SECS * 1000) <= 0 ||
+	   read(sv[0], &ready, 1) != 1) {
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		close(sv[0]);
+		return -1;
+	}
+	close(sv[0]);
+	return pid;
+}
+
+/* reloadInherit - in a proxy started by reloadSpawn, take the sockets
+ * handed over: up to most listening sockets into fds, the admin socket
+ * into *adminfd and the cache image into *imagefd, -1 for those not
+ * handed over. return how many listening sockets there are, 0 if this is
+ * not a reload, -1 on error */
+int reloadInherit(int *fds, int most, int *adminfd, int *imagefd) {
+	char ctl[CMSG_SPACE((RELOAD_MAX_FDS + 2) * sizeof(int))];
+	int all[RELOAD_MAX_FDS + 2], n;
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct iovec iov;
+	reloadMsg m;
+	char *env;
+
+	*adminfd = *imagefd = -1;
+	if((env = getenv(RELOAD_ENV)) == NULL)
+		return 0;
+	channel = atoi(env);
+	unsetenv(RELOAD_ENV);
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &m;
+	iov.iov_len = sizeof(m);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl;
+	msg.msg_controllen = sizeof(ctl);
+	if(recvmsg(channel, &msg, 0) != sizeof(m) ||
+	   (cm = CMSG_FIRSTHDR(&msg)) == NULL || cm->cmsg_type != SCM_RIGHTS)
+		return -1;
+	n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	memcpy(all, CMSG_DATA(cm), n * sizeof(int));
+	if(m.nlisten < 0 || m.nlisten > most ||
+	   n != m.nlisten + m.admin + m.image)
+		return -1;
+
+	memcpy(fds, all, m.nlisten * sizeof(int));
+	if(m.admin)
+		*adminfd = all[m.nlisten];
+	if(m.image)
+		*imagefd = all[m.nlisten + m.admin];
+	return m.nlisten;
+}
+
+/* reloadReady - tell the old process this one serves the sockets now, it
+ * may drain. nothing if this is not a reload */
+void reloadReady() {
+	char ready = 1;
+
+	if(channel < 0)
+		return;
+	if(write(channel, &ready, 1) != 1)
+		fprintf(stderr, "reload: old process gone\n");
+	close(channel);
+	channel = -1;
+}
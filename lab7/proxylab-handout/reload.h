@@ -0,0 +1,50 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the hot reload of the proxy. On SIGHUP the running proxy starts
+ * its binary again, as it is on disk now, with the same arguments, and
+ * hands the new process its listening sockets, the one of the admin port
+ * and an image of its cache in a memfd, over a unix socket with
+ * SCM_RIGHTS. The new process serves the very same sockets, so no
+ * connection waiting to be accepted is lost or refused, loads the image
+ * into its own cache and then tells the old one it is ready. Only then
+ * does the old process stop accepting and drain (see reload in proxy.c).
+ * If the new one fails, or is not ready within RELOAD_READY_SECS, it is
+ * killed and the old one serves on as if nothing happened.
+ *
+ * ***************************************************************************/
+
+#ifndef __RELOAD_H__
+#define __RELOAD_H__
+
+#include "csapp.h"
+#include "cache.h"
+
+#define RELOAD_ENV "PROXY_RELOAD_FD" //the channel, in the new process
+#define RELOAD_MAX_FDS 64 //listening sockets handed over at most
+#define RELOAD_READY_SECS 10 //the new process has this long to be ready
+#define DEFAULT_DRAIN_SECS 30 //the old one this long to finish its clients
+#define DRAIN_POLL_MS 50 //how often the old one looks if it is done
+
+/* reloadMsg is struct for what is sent along with the sockets handed over.
+ * It has how many listening sockets there are, and whether the admin
+ * socket and the cache image follow them, in that order */
+typedef struct reloadMsg {
+	int nlisten;
+	int admin;
+	int image;
+} reloadMsg;
+
+/* function prototypes for reload.c */
+int reloadImage(queue *cacheQueue, long *nobjs);
+
+pid_t reloadSpawn(char **argv, int *fds, int nlisten, int adminfd, \
+                                                        int imagefd);
+
+int reloadInherit(int *fds, int most, int *adminfd, int *imagefd);
+
+void reloadReady();
+
+#endif /* __RELOAD_H__ */
@@ -0,0 +1,111 @@
+/******************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the ring of client file descriptors, see ring.h. A cell at
+ * position pos is free for the producer of pos when its sequence is pos,
+ * and full for the consumer of pos when its sequence is pos + 1. The
+ * consumer sets it to pos + size, freeing it for the next lap.
+ *
+ * ***************************************************************************/
+
+#include <sched.h>
+#include "csapp.h"
+#include "ring.h"
+
+/* initRing - initialize an empty ring of at least size cells in the heap.
+ * return NULL on error */
+ring *initRing(size_t size) {
+	ring *init;
+	unsigned long n = 1, i;
+
+	while(n < size)
+		n <<= 1;
+
+	if(posix_memalign((void **)&init, 64, sizeof(ring)) != 0) {
+		unix_error("posix_memalign error");
+		return NULL;
+	}
+	memset(init, 0, sizeof(ring));
+	init->cells = (cell *)Calloc(n, sizeof(cell));
+	init->mask = n - 1;
+	for(i = 0; i < n; i++)
+		init->cells[i].seq = i;
+	Sem_init(&init->slots, 0, n);
+	Sem_init(&init->items, 0, 0);
+	return init;
+}
+
+/* ringTryPush - put fd in the next free cell, return -1 if the ring is
+ * full (or its next cell still being emptied), 0 otherwise */
+int ringTryPush(ring *rg, int fd) {
+	unsigned long pos = __atomic_load_n(&rg->enqPos, __ATOMIC_RELAXED);
+	cell *c;
+	long diff;
+
+	while(1) {
+		c = &rg->cells[pos & rg->mask];
+		diff = (long)__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - (long)pos;
+		if(diff == 0) { //free for this lap, claim it
+			if(__sync_bool_compare_and_swap(&rg->enqPos, pos, pos + 1))
+				break;
+		}
+		else if(diff < 0) { //not emptied since the last lap
+			return -1;
+		}
+		pos = __atomic_load_n(&rg->enqPos, __ATOMIC_RELAXED);
+	}
+
+	c->fd = fd;
+	__atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* ringTryPop - take the fd of the next full cell into *fd, return -1 if
+ * the ring is empty (or its next cell still being filled), 0 otherwise */
+int ringTryPop(ring *rg, int *fd) {
+	unsigned long pos = __atomic_load_n(&rg->deqPos, __ATOMIC_RELAXED);
+	cell *c;
+	long diff;
+
+	while(1) {
+		c = &rg->cells[pos & rg->mask];
+		diff = (long)__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) -
+		       (long)(pos + 1);
+		if(diff == 0) { //full for this lap, claim it
+			if(__sync_bool_compare_and_swap(&rg->deqPos, pos, pos + 1))
+				break;
+		}
+		else if(diff < 0) { //not filled yet
+			return -1;
+		}
+		pos = __atomic_load_n(&rg->deqPos, __ATOMIC_RELAXED);
+	}
+
+	*fd = c->fd;
+	__atomic_store_n(&c->seq, pos + rg->mask + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* ringPush - put fd in the ring, sleeping while it is full */
+void ringPush(ring *rg, int fd) {
+	P(&rg->slots);
+	/* a free cell exists, but the one at our position may still be in
+	 * the middle of being emptied */
+	while(ringTryPush(rg, fd) < 0)
+		sched_yield();
+	V(&rg->items);
+}
+
+/* ringPop - take an fd out of the ring, sleeping while it is empty */
+int ringPop(ring *rg) {
+	int fd;
+
+	P(&rg->items);
+	while(ringTryPop(rg, &fd) < 0)
+		sched_yield();
+	V(&rg->slots);
+	return fd;
+}
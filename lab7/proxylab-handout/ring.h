@@ -0,0 +1,53 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is a bounded multi-producer multi-consumer ring of client file
+ * descriptors, feeding the prethreaded workers of thread mode. It is the
+ * sbuf of the textbook without its mutex: every cell carries a sequence
+ * number telling whose turn it is, and producers and consumers claim
+ * positions with a compare and swap, so neither ever waits for a lock
+ * held by another thread. The slots and items semaphores only put threads
+ * to sleep when the ring is full or empty. A full ring blocks the
+ * acceptor, which leaves new clients waiting in the listen backlog.
+ *
+ * ***************************************************************************/
+
+#ifndef __RING_H__
+#define __RING_H__
+
+#include "csapp.h"
+
+/* cell is struct for one position of the ring. It has the sequence number
+ * of the position, telling whether it is free or full for the current lap,
+ * and the file descriptor */
+typedef struct cell {
+	unsigned long seq;
+	int fd;
+} cell;
+
+/* ring is struct for the whole ring. It has the cells, the mask of the
+ * size (a power of 2), the next positions to fill and to empty on their
+ * own cache lines, and the counting semaphores of free and full cells */
+typedef struct ring {
+	cell *cells;
+	unsigned long mask;
+	unsigned long enqPos __attribute__((aligned(64)));
+	unsigned long deqPos __attribute__((aligned(64)));
+	sem_t slots __attribute__((aligned(64)));
+	sem_t items;
+} ring;
+
+/* function prototypes for ring.c */
+ring *initRing(size_t size);
+
+int ringTryPush(ring *rg, int fd);
+
+int ringTryPop(ring *rg, int *fd);
+
+void ringPush(ring *rg, int fd);
+
+int ringPop(ring *rg);
+
+#endif /* __RING_H__ */
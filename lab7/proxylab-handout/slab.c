@@ -0,0 +1,150 @@
+/******************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the memfd backed slab for cache payloads, see slab.h. Chunks
+ * are taken and given back a list at a time under one mutex, whole
+ * objects are freed with a single lock.
+ *
+ * A chunk sent with sendfile is not copied: the socket buffers keep
+ * referring to its page until the client has read it, on loopback until
+ * the client's receive queue is drained. Writing a new response into a
+ * freed chunk would change data already "sent". So freed chunks are
+ * punched out of the memfd first: pages still referred to by a socket
+ * stay with it, and the chunk gets a fresh zeroed page when next written.
+ * Where the kernel cannot punch holes in a memfd, hits are copied out of
+ * the mapping instead of sent with sendfile (sendChunks), so no socket
+ * ever refers to a chunk. A punch failing later on leaves the chunks it
+ * was for off the free stack for good, sockets may still be sending them.
+ *
+ * ***************************************************************************/
+
+#include "csapp.h"
+#include "slab.h"
+
+/* memfd_create is only declared with _GNU_SOURCE, which clashes with the
+ * gai_error in csapp.h */
+int memfd_create(const char *name, unsigned int flags);
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 1U
+#endif
+
+/* so is fallocate */
+int fallocate(int fd, int mode, off_t offset, off_t len);
+#ifndef FALLOC_FL_KEEP_SIZE
+#define FALLOC_FL_KEEP_SIZE 0x01
+#endif
+#ifndef FALLOC_FL_PUNCH_HOLE
+#define FALLOC_FL_PUNCH_HOLE 0x02
+#endif
+
+/* whether the failed punch was reported, once for all slabs */
+static int punchReported;
+
+/* punchFailed - report a punch that failed, the first time only */
+static void punchFailed() {
+	if(__sync_lock_test_and_set(&punchReported, 1) == 0)
+		fprintf(stderr, "slab: cannot punch holes in the memfd (%s), "
+		        "cache hits are copied instead of sent with sendfile\n",
+		        strerror(errno));
+}
+
+/* initSlab - create a memfd of size bytes rounded up to whole chunks,
+ * map it shared and put all of its chunks on the free stack in address
+ * order. return NULL on error */
+slab *initSlab(size_t size) {
+	slab *sl = (slab *)Calloc(1, sizeof(slab));
+	size_t i, n = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+	sl->size = n * CHUNK_SIZE;
+	if((sl->fd = memfd_create("proxy-cache", MFD_CLOEXEC)) < 0) {
+		unix_error("memfd_create error");
+		Free(sl);
+		return NULL;
+	}
+	if(ftruncate(sl->fd, sl->size) < 0) {
+		unix_error("ftruncate error");
+		close(sl->fd);
+		Free(sl);
+		return NULL;
+	}
+	sl->base = mmap(NULL, sl->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                sl->fd, 0);
+	if(sl->base == MAP_FAILED) {
+		unix_error("mmap error");
+		close(sl->fd);
+		Free(sl);
+		return NULL;
+	}
+
+	/* the slab is all free, punching it out tells whether freeing can */
+	sl->punch = fallocate(sl->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+	                      0, sl->size) == 0;
+	if(!sl->punch)
+		punchFailed();
+
+	sl->chunks = (chunk *)Calloc(n, sizeof(chunk));
+	for(i = 0; i < n; i++) {
+		sl->chunks[i].data = sl->base + i * CHUNK_SIZE;
+		sl->chunks[i].next = (i + 1 < n) ? &sl->chunks[i + 1] : NULL;
+	}
+	sl->freeList = sl->chunks;
+	sl->nfree = n;
+	Sem_init(&sl->mutex, 0, 1);
+	return sl;
+}
+
+/* slabAlloc - take a chunk off the free stack, NULL if the slab is full */
+chunk *slabAlloc(slab *sl) {
+	chunk *c;
+
+	P(&sl->mutex);
+	if((c = sl->freeList) != NULL) {
+		sl->freeList = c->next;
+		sl->nfree--;
+	}
+	V(&sl->mutex);
+	if(c != NULL)
+		c->next = NULL;
+	return c;
+}
+
+/* slabFree - give back the list of chunks starting at head, their pages
+ * punched out one run of adjacent chunks at a time. if a punch fails,
+ * none of them is given back and hits stop using sendfile */
+void slabFree(slab *sl, chunk *head) {
+	chunk *tail, *first = head;
+	size_t n = 1;
+	int punch = slabPunches(sl), lost = 0;
+
+	if(head == NULL)
+		return;
+	for(tail = head; ; tail = tail->next) {
+		/* punch out the run of chunks ending here */
+		if(punch && (tail->next == NULL ||
+		             tail->next->data != tail->data + CHUNK_SIZE)) {
+			if(fallocate(sl->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			             slabOffset(sl, first),
+			             tail->data + CHUNK_SIZE - first->data) < 0)
+				lost = 1;
+			first = tail->next;
+		}
+		if(tail->next == NULL)
+			break;
+		n++;
+	}
+	if(lost) {
+		punchFailed();
+		__atomic_store_n(&sl->punch, 0, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&sl->nlost, n, __ATOMIC_RELAXED);
+		return;
+	}
+
+	P(&sl->mutex);
+	tail->next = sl->freeList;
+	sl->freeList = head;
+	sl->nfree += n;
+	V(&sl->mutex);
+}
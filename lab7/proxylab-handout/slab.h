@@ -0,0 +1,72 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the slab holding the payloads of the cache. It is one memfd
+ * mapped into the proxy, so a cached object is both memory the proxy can
+ * read from the server into and a range of a file descriptor the kernel
+ * can sendfile to a client without copying it through user space. The
+ * slab is cut into chunks of one fixed size, and an object is a linked
+ * list of them: any object size fits without a contiguous range, so the
+ * slab cannot fragment, and the memory an object takes is exactly its
+ * chunks. Free chunks are kept on a stack, their pages punched out of the
+ * memfd, since sendfile may still be sending them, or sendfile is not
+ * used if that cannot be done (slab.c).
+ *
+ * ***************************************************************************/
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include "csapp.h"
+
+#define CHUNK_SIZE 4096 //bytes per chunk, one page
+
+/* chunk is struct for one chunk of the slab. It has its data in the
+ * mapping and the next chunk of the same object (or of the free stack) */
+typedef struct chunk {
+	char *data;
+	struct chunk *next;
+} chunk;
+
+/* slab is struct for the whole slab. It has the memfd, its mapping, its
+ * size, whether freed chunks are punched out of the memfd, the chunks, the
+ * free stack with its length, how many chunks were never given back
+ * because punching them failed and a mutex for the stack */
+typedef struct slab {
+	int fd;
+	char *base;
+	size_t size;
+	int punch;
+	chunk *chunks;
+	chunk *freeList;
+	size_t nfree;
+	size_t nlost;
+	sem_t mutex;
+} slab;
+
+/* function prototypes for slab.c */
+slab *initSlab(size_t size);
+
+chunk *slabAlloc(slab *sl);
+
+void slabFree(slab *sl, chunk *head);
+
+/* slabOffset - offset of the data of chunk c in the memfd */
+static inline size_t slabOffset(slab *sl, chunk *c) {
+	return c->data - sl->base;
+}
+
+/* slabPunches - whether chunks of sl may be sent with sendfile, which
+ * they may as long as freeing them punches them out of the memfd */
+static inline int slabPunches(slab *sl) {
+	return __atomic_load_n(&sl->punch, __ATOMIC_RELAXED);
+}
+
+/* slabOwns - whether chunk c is one of the slab sl */
+static inline int slabOwns(slab *sl, chunk *c) {
+	return c >= sl->chunks && c < sl->chunks + sl->size / CHUNK_SIZE;
+}
+
+#endif /* __SLAB_H__ */
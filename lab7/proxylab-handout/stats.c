@@ -0,0 +1,287 @@
+/******************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * These are the counters and latency histograms, see stats.h. Blocks are
+ * allocated once per thread and linked in a list under a mutex, taken
+ * only when a thread first counts and on a scrape. A thread exiting, in
+ * thread per connection mode, leaves its block to the next new thread
+ * through a pthread key destructor, so the list is as long as the most
+ * threads ever alive at once.
+ *
+ * The admin port is served by a thread of its own, bound to the loopback
+ * address only: any request on it gets the totals as plain text, one
+ * "name value" line each, then the connection is closed. Its socket is
+ * non-blocking and polled every ADMIN_POLL_MS, so on a hot reload the 
+ * thread can be told to stop and leave it to the new process.
+ *
+ * ***************************************************************************/
+
+#include "csapp.h"
+#include "stats.h"
+
+__thread statsBlock *statsMine; //block of the calling thread
+
+static statsBlock *blocks; //every block ever allocated
+static sem_t blocksMutex; //protects the list and owned flags
+static pthread_key_t blockKey; //gives the block back on thread exit
+static pthread_once_t blockOnce = PTHREAD_ONCE_INIT;
+static int adminfd = -1; //listening socket of the admin port
+static int adminStop; //set by statsStop
+
+static const char *statsNames[STATS_COUNTERS] = {
+	"requests", "cache_hits", "cache_misses", "coalesced", "bytes_relayed",
+	"bytes_from_cache", "upstream_connects", "upstream_reused", "errors",
+	"stale_hits", "revalidations", "not_modified", "unstorable",
+	"origin_queued", "origin_rejected", "upstream_timeouts", "tunnels",
+	"bytes_tunneled", "gzip_stored", "gzip_saved_bytes", "gzip_skipped",
+	"gzip_sent", "gunzipped", "range_hits", "remote_hits"
+};
+
+static const char *phaseNames[STATS_PHASES] = {
+	"parse", "lookup", "connect", "first_byte", "complete", "queue", "gzip",
+	"gunzip"
+};
+
+/* scrape is struct for the arguments of the admin thread. It has the
+ * listening socket and the function printing the proxy's own lines */
+typedef struct scrape {
+	int listenfd;
+	statsExtra extra;
+} scrape;
+
+/* releaseBlock - pthread key destructor, the thread is gone, its block
+ * is free for the next one */
+static void releaseBlock(void *vblock) {
+	statsBlock *b = (statsBlock *)vblock;
+
+	P(&blocksMutex);
+	b->owned = 0;
+	V(&blocksMutex);
+}
+
+/* initBlocks - create the mutex and key once */
+static void initBlocks() {
+	Sem_init(&blocksMutex, 0, 1);
+	pthread_key_create(&blockKey, releaseBlock);
+}
+
+/* statsAttach - give the calling thread a block, one a gone thread left
+ * or a new one, and return it */
+statsBlock *statsAttach() {
+	statsBlock *b;
+
+	Pthread_once(&blockOnce, initBlocks);
+	P(&blocksMutex);
+	for(b = blocks; b != NULL && b->owned; b = b->next)
+		;
+	if(b == NULL) {
+		if(posix_memalign((void **)&b, 64, sizeof(statsBlock)) != 0)
+			unix_error("posix_memalign error");
+		memset(b, 0, sizeof(statsBlock));
+		b->next = blocks;
+		blocks = b;
+	}
+	b->owned = 1;
+	V(&blocksMutex);
+
+	pthread_setspecific(blockKey, b);
+	statsMine = b;
+	return b;
+}
+
+/* bucketOf - the histogram bucket of v nanoseconds */
+static inline int bucketOf(unsigned long v) {
+	int e;
+
+	if(v < STATS_SUB)
+		return v;
+	e = 63 - __builtin_clzl(v);
+	if(e >= STATS_MAX_EXP)
+		return STATS_BUCKETS - 1;
+	return (e - STATS_SUB_BITS + 1) * STATS_SUB +
+	       (int)(v >> (e - STATS_SUB_BITS)) - STATS_SUB;
+}
+
+/* bucketMid - the middle of the values of bucket i */
+static double bucketMid(int i) {
+	int e;
+
+	if(i < STATS_SUB)
+		return i;
+	e = i / STATS_SUB + STATS_SUB_BITS - 1;
+	return (double)((unsigned long)(STATS_SUB + i % STATS_SUB) <<
+	                (e - STATS_SUB_BITS)) +
+	       (double)(1UL << (e - STATS_SUB_BITS)) / 2;
+}
+
+/* statsTime - record ns nanoseconds of phase for the calling thread */
+void statsTime(int phase, long ns) {
+	statsBlock *b = statsMine ? statsMine : statsAttach();
+	statsHist *h = &b->hists[phase];
+	unsigned long v = ns > 0 ? ns : 0;
+	int i = bucketOf(v);
+
+	__atomic_store_n(&h->buckets[i], h->buckets[i] + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->sum, h->sum + v, __ATOMIC_RELAXED);
+	if(v > h->max)
+		__atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+}
+
+/* statsTotals - sum the counters of every thread into totals */
+void statsTotals(unsigned long *totals) {
+	statsBlock *b;
+	int c;
+
+	Pthread_once(&blockOnce, initBlocks);
+	memset(totals, 0, STATS_COUNTERS * sizeof(unsigned long));
+	P(&blocksMutex);
+	for(b = blocks; b != NULL; b = b->next) {
+		for(c = 0; c < STATS_COUNTERS; c++)
+			totals[c] += __atomic_load_n(&b->counters[c], __ATOMIC_RELAXED);
+	}
+	V(&blocksMutex);
+}
+
+/* percentile - the value below which a fraction q of the values of h are,
+ * to within its bucket */
+static double percentile(statsHist *h, double q) {
+	unsigned long want = (unsigned long)(q * h->count + 0.5), seen = 0;
+	int i;
+
+	if(want == 0)
+		want = 1;
+	for(i = 0; i < STATS_BUCKETS; i++) {
+		if((seen += h->buckets[i]) >= want)
+			break;
+	}
+	return bucketMid(i) < h->max ? bucketMid(i) : h->max;
+}
+
+/* statsPrint - print the totals of every counter and, for every phase,
+ * the count, mean, percentiles and largest latency in microseconds */
+void statsPrint(FILE *fp) {
+	static const double qs[] = { 0.5, 0.9, 0.99, 0.999 };
+	static const char *qNames[] = { "p50", "p90", "p99", "p999" };
+	unsigned long totals[STATS_COUNTERS];
+	statsHist *sum = (statsHist *)Calloc(STATS_PHASES, sizeof(statsHist));
+	statsBlock *b;
+	statsHist *h;
+	int c, p, i;
+
+	statsTotals(totals);
+	for(c = 0; c < STATS_COUNTERS; c++)
+		fprintf(fp, "%s %lu\n", statsNames[c], totals[c]);
+
+	P(&blocksMutex);
+	for(b = blocks; b != NULL; b = b->next) {
+		for(p = 0; p < STATS_PHASES; p++) {
+			h = &b->hists[p];
+			for(i = 0; i < STATS_BUCKETS; i++)
+				sum[p].buckets[i] += __atomic_load_n(&h->buckets[i],
+				                                     __ATOMIC_RELAXED);
+			sum[p].count += __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+			sum[p].sum += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+			if(h->max > sum[p].max)
+				sum[p].max = h->max;
+		}
+	}
+	V(&blocksMutex);
+
+	for(p = 0; p < STATS_PHASES; p++) {
+		h = &sum[p];
+		fprintf(fp, "latency_%s_count %lu\n", phaseNames[p], h->count);
+		if(h->count == 0)
+			continue;
+		fprintf(fp, "latency_%s_mean_us %.1f\n", phaseNames[p],
+		        (double)h->sum / h->count / 1000);
+		for(i = 0; i < 4; i++)
+			fprintf(fp, "latency_%s_%s_us %.1f\n", phaseNames[p], qNames[i],
+			        percentile(h, qs[i]) / 1000);
+		fprintf(fp, "latency_%s_max_us %.1f\n", phaseNames[p],
+		        (double)h->max / 1000);
+	}
+	Free(sum);
+}
+
+/* adminThread - answer every connection to the admin port with the
+ * totals, until statsStop. what the client sent is read first and 
+ * ignored */
+static void *adminThread(void *vargp) {
+	scrape *sc = (scrape *)vargp;
+	struct pollfd pfd = { sc->listenfd, POLLIN, 0 };
+	char buf[MAXLINE];
+	int connfd;
+	FILE *fp;
+
+	Pthread_detach(pthread_self());
+	while(!__atomic_load_n(&adminStop, __ATOMIC_RELAXED)) {
+		if(poll(&pfd, 1, ADMIN_POLL_MS) <= 0 ||
+		   (connfd = accept(sc->listenfd, NULL, NULL)) < 0)
+			continue;
+		if(read(connfd, buf, sizeof(buf)) < 0 ||
+		   (fp = fdopen(connfd, "w")) == NULL) {
+			Close(connfd);
+			continue;
+		}
+		fprintf(fp, "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n"
+		        "Connection: close\r\n\r\n");
+		statsPrint(fp);
+		if(sc->extra != NULL)
+			sc->extra(fp);
+		fclose(fp);
+	}
+	close(sc->listenfd);
+	Free(sc);
+	return NULL;
+}
+
+/* statsServe - serve the totals on port of the loopback address, with
+ * the lines of extra after them, on fd if it is not -1, the admin socket
+ * handed over by the process this one replaces. return -1 if it cannot 
+ * listen there */
+int statsServe(char *port, int fd, statsExtra extra) {
+	struct sockaddr_in addr;
+	scrape *sc;
+	pthread_t tid;
+	int one = 1;
+
+	if(fd >= 0)
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	else {
+		if((fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0)
+			return -1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(atoi(port));
+		if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		   listen(fd, LISTENQ) < 0) {
+			close(fd);
+			return -1;
+		}
+	}
+
+	sc = (scrape *)Malloc(sizeof(scrape));
+	sc->listenfd = fd;
+	sc->extra = extra;
+	adminfd = fd;
+	Pthread_create(&tid, NULL, adminThread, sc);
+	return 0;
+}
+
+/* statsListener - the listening socket of the admin port, to hand it
+ * over, -1 if it is not served */
+int statsListener() {
+	return adminfd;
+}
+
+/* statsStop - stop serving the admin port, its thread closes the socket
+ * within ADMIN_POLL_MS */
+void statsStop() {
+	__atomic_store_n(&adminStop, 1, __ATOMIC_RELAXED);
+}
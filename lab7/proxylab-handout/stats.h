@@ -0,0 +1,127 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * These are the counters and latency histograms of the proxy. Every
+ * thread counts into a block of its own, cache line aligned, with plain
+ * stores: no lock, no atomic read-modify-write and no line shared with
+ * another thread on the request path. Event loop tasks never leave their
+ * thread, so the blocks stay single writer. The blocks are only summed
+ * when someone asks, on a scrape of the admin port or SIGUSR1.
+ *
+ * Latencies go into HDR style histograms of nanoseconds: a bucket for
+ * each power of two, cut into STATS_SUB linear sub-buckets, so any value
+ * is known to within 1/STATS_SUB of itself, from 1 ns to 2^STATS_MAX_EXP
+ * ns (about 36 minutes), in a few KB.
+ *
+ * ***************************************************************************/
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "csapp.h"
+#include <time.h>
+
+#define STATS_SUB_BITS 4 //sub-buckets of a power of two, as bits
+#define STATS_SUB (1 << STATS_SUB_BITS)
+#define STATS_MAX_EXP 41 //larger values go into the last bucket
+#define STATS_BUCKETS ((STATS_MAX_EXP - STATS_SUB_BITS + 1) * STATS_SUB)
+#define ADMIN_POLL_MS 100 //the admin thread looks for statsStop this often
+
+/* counters, see statsNames in stats.c */
+#define STAT_REQUESTS 0 //requests parsed
+#define STAT_HITS 1 //answered fresh from the cache
+#define STAT_MISSES 2 //fetched from the server
+#define STAT_COALESCED 3 //answered by following another fetch
+#define STAT_RELAYED 4 //bytes of server responses relayed
+#define STAT_CACHE_BYTES 5 //bytes sent from the cache
+#define STAT_CONNECTS 6 //new server connections
+#define STAT_REUSED 7 //pooled server connections used
+#define STAT_ERRORS 8 //requests ended by an error
+#define STAT_STALE 9 //hits found stale
+#define STAT_REVALIDATED 10 //conditional requests sent for them
+#define STAT_NOT_MODIFIED 11 //304s refreshing a stale object
+#define STAT_UNSTORABLE 12 //responses the headers kept out of the cache
+#define STAT_QUEUED 13 //requests that waited for a slot of their server
+#define STAT_REJECTED 14 //requests turned away, the line was full too
+#define STAT_TIMEOUTS 15 //connects or responses past their timeout
+#define STAT_TUNNELS 16 //CONNECT tunnels established
+#define STAT_TUNNEL_BYTES 17 //bytes relayed through them, both ways
+#define STAT_GZIP_STORED 18 //responses cached compressed
+#define STAT_GZIP_SAVED 19 //cache bytes that saved them, in whole chunks
+#define STAT_GZIP_SKIPPED 20 //responses compressing saved too little of
+#define STAT_GZIP_SENT 21 //compressed hits sent as stored
+#define STAT_GUNZIPPED 22 //compressed hits inflated for the client
+#define STAT_RANGES 23 //Range requests answered from the cache, 206 or 416
+#define STAT_REMOTE_HITS 24 //hits stored on another node than the thread's
+#define STATS_COUNTERS 25
+
+/* phases of a request with a latency histogram each */
+#define PHASE_PARSE 0 //request head complete to parsed and checked
+#define PHASE_LOOKUP 1 //cache lookup
+#define PHASE_CONNECT 2 //new server connection, lookup and handshake
+#define PHASE_FIRST_BYTE 3 //request sent to first byte of the response
+#define PHASE_COMPLETE 4 //request head complete to response sent
+#define PHASE_QUEUE 5 //waiting in line for a slot of the server
+#define PHASE_GZIP 6 //compressing a response to cache it
+#define PHASE_GUNZIP 7 //inflating a compressed hit while sending it
+#define STATS_PHASES 8
+
+/* statsHist is struct for one latency histogram. It has the count, sum
+ * and largest of its values and the count of each bucket */
+typedef struct statsHist {
+	unsigned long count;
+	unsigned long sum;
+	unsigned long max;
+	unsigned long buckets[STATS_BUCKETS];
+} statsHist;
+
+/* statsBlock is struct for the counters and histograms of one thread. It
+ * has them, whether a thread owns it and the next block. A block whose
+ * thread exited is taken over by the next new thread, keeping its counts */
+typedef struct statsBlock {
+	unsigned long counters[STATS_COUNTERS];
+	statsHist hists[STATS_PHASES];
+	int owned;
+	struct statsBlock *next;
+} __attribute__((aligned(64))) statsBlock;
+
+/* statsExtra prints more lines for a scrape, the cache, flights and the
+ * resolver the proxy owns */
+typedef void (*statsExtra)(FILE *fp);
+
+extern __thread statsBlock *statsMine;
+
+/* function prototypes for stats.c */
+statsBlock *statsAttach();
+
+void statsTime(int phase, long ns);
+
+void statsTotals(unsigned long *totals);
+
+void statsPrint(FILE *fp);
+
+int statsServe(char *port, int fd, statsExtra extra);
+
+int statsListener();
+
+void statsStop();
+
+/* statsAdd - add n to counter c of the calling thread. only this thread
+ * writes it, the relaxed store is there for the scraper reading it */
+static inline void statsAdd(int c, unsigned long n) {
+	statsBlock *b = statsMine ? statsMine : statsAttach();
+
+	__atomic_store_n(&b->counters[c], b->counters[c] + n, __ATOMIC_RELAXED);
+}
+
+/* statsNow - nanoseconds of CLOCK_MONOTONIC, for timing phases */
+static inline long statsNow() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+#endif /* __STATS_H__ */
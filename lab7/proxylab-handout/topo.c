@@ -0,0 +1,134 @@
+/******************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the CPU and NUMA topology of the machine, see topo.h. It is read
+ * once: the CPUs the proxy may run on from its affinity mask, and the node
+ * of each from the cpulist of every node in sysfs. Affinity, getcpu and
+ * mbind are called through syscall, their wrappers and cpu_set_t need
+ * _GNU_SOURCE, which clashes with the gai_error in csapp.h, and mbind
+ * would need libnuma.
+ *
+ * ***************************************************************************/
+
+#include "csapp.h"
+#include "topo.h"
+#include <sys/syscall.h>
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#define MASK_BITS (8 * sizeof(unsigned long))
+#define NODE_DIR "/sys/devices/system/node"
+
+static pthread_once_t topoOnce = PTHREAD_ONCE_INIT;
+static int cpus[TOPO_MAX_CPUS]; //ids of the CPUs the proxy may run on
+static int ncpus;
+static unsigned char cpuNode[TOPO_MAX_CPUS]; //node of each CPU id
+static int nnodes = 1;
+static __thread int pinnedNode = -1; //node of the calling thread if pinned
+
+/* readCpuList - mark the CPUs of a sysfs cpulist like "0-3,8" as being on
+ * node */
+static void readCpuList(char *list, int node) {
+	long first, last;
+	char *end;
+
+	while(*list != '\0' && *list != '\n') {
+		first = last = strtol(list, &end, 10);
+		if(end == list)
+			return;
+		if(*end == '-')
+			last = strtol(end + 1, &end, 10);
+		for(; first <= last && first < TOPO_MAX_CPUS; first++) {
+			if(first >= 0)
+				cpuNode[first] = node;
+		}
+		list = *end == ',' ? end + 1 : end;
+	}
+}
+
+/* readTopo - read the allowed CPUs and their nodes, once. the nodes
+ * counted are those up to the highest one with an allowed CPU */
+static void readTopo() {
+	unsigned long mask[TOPO_MAX_CPUS / MASK_BITS];
+	char path[MAXLINE], list[MAXLINE];
+	int cpu, node;
+	FILE *fp;
+
+	memset(mask, 0, sizeof(mask));
+	if(syscall(SYS_sched_getaffinity, 0, sizeof(mask), mask) < 0)
+		mask[0] = 1;
+	for(cpu = 0; cpu < TOPO_MAX_CPUS; cpu++) {
+		if(mask[cpu / MASK_BITS] & (1UL << (cpu % MASK_BITS)))
+			cpus[ncpus++] = cpu;
+	}
+
+	for(node = 0; node < TOPO_MAX_NODES; node++) {
+		sprintf(path, NODE_DIR "/node%d/cpulist", node);
+		if((fp = fopen(path, "r")) == NULL)
+			continue;
+		if(fgets(list, sizeof(list), fp) != NULL)
+			readCpuList(list, node);
+		fclose(fp);
+	}
+	for(cpu = 0; cpu < ncpus; cpu++) {
+		if(cpuNode[cpus[cpu]] >= nnodes)
+			nnodes = cpuNode[cpus[cpu]] + 1;
+	}
+}
+
+/* topoInit - read the topology if not done yet, return the number of
+ * nodes */
+int topoInit() {
+	pthread_once(&topoOnce, readTopo);
+	return nnodes;
+}
+
+/* topoNodes - the number of nodes, 1 before topoInit */
+int topoNodes() {
+	return nnodes;
+}
+
+/* topoPin - pin the calling thread to the i-th CPU it may run on, in
+ * turn if there are fewer. return its node, or -1 if it stays unpinned */
+int topoPin(int i) {
+	unsigned long mask[TOPO_MAX_CPUS / MASK_BITS];
+	int cpu;
+
+	topoInit();
+	cpu = cpus[i % ncpus];
+	memset(mask, 0, sizeof(mask));
+	mask[cpu / MASK_BITS] = 1UL << (cpu % MASK_BITS);
+	if(syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) < 0)
+		return -1;
+	pinnedNode = cpuNode[cpu];
+	return pinnedNode;
+}
+
+/* topoNode - the node the calling thread runs on: the one it is pinned
+ * to, else where it runs right now, which may change */
+int topoNode() {
+	unsigned int cpu, node;
+
+	if(pinnedNode >= 0)
+		return pinnedNode;
+	if(nnodes == 1 || syscall(SYS_getcpu, &cpu, &node, NULL) < 0 ||
+	   node >= nnodes)
+		return 0;
+	return node;
+}
+
+/* topoBind - have the pages of len bytes at addr come from node when they
+ * are first touched, or another node if it has no memory left. a shared
+ * mapping keeps that for its file. return -1 on error */
+int topoBind(void *addr, size_t len, int node) {
+	unsigned long nodes = 1UL << node;
+
+	if(nnodes == 1)
+		return 0;
+	return syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &nodes,
+	               MASK_BITS + 1, 0) < 0 ? -1 : 0;
+}
@@ -0,0 +1,35 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the CPU and NUMA topology of the machine, as far as the proxy
+ * cares about it: which CPUs it may run on, and which memory node each of
+ * them is on (from /sys/devices/system/node). Event loops and workers can
+ * be pinned to one CPU each (-P), in turn, so a thread stays next to the
+ * memory it touched first, and the cache can be split per node (-N): a
+ * slab and a group of shards each, see cache.c. A machine without NUMA
+ * is one node.
+ *
+ * ***************************************************************************/
+
+#ifndef __TOPO_H__
+#define __TOPO_H__
+
+#include "csapp.h"
+
+#define TOPO_MAX_CPUS 1024 //CPUs known at most
+#define TOPO_MAX_NODES 8 //memory nodes known at most, the rest are node 0
+
+/* function prototypes for topo.c */
+int topoInit();
+
+int topoNodes();
+
+int topoPin(int i);
+
+int topoNode();
+
+int topoBind(void *addr, size_t len, int node);
+
+#endif /* __TOPO_H__ */
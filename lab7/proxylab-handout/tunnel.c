@@ -0,0 +1,132 @@
+/******************************************************************************
+ *
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the relay of CONNECT tunnels, see tunnel.h. Both sockets are 
+ * non-blocking for the time of the tunnel, in thread mode too. Each turn
+ * pumps both directions until they would block, then waits for what each
+ * blocked on: its source readable or its destination writable. A pipe is
+ * always drained before it is filled again, so only the sockets can block.
+ * A source reaching EOF shuts down the sending side of its destination,
+ * the other direction goes on until it closes too. The I/O timeout of the
+ * caller bounds how long a tunnel may stay silent.
+ *
+ * ***************************************************************************/
+
+#include "csapp.h"
+#include "tunnel.h"
+
+/* splice and pipe2 are only declared with _GNU_SOURCE, which clashes with
+ * the gai_error in csapp.h */
+ssize_t splice(int fdin, loff_t *offin, int fdout, loff_t *offout,
+               size_t len, unsigned int flags);
+int pipe2(int pipefd[2], int flags);
+#ifndef SPLICE_F_MOVE
+#define SPLICE_F_MOVE 1
+#define SPLICE_F_NONBLOCK 2
+#endif
+
+/* setNonblock - make fd non-blocking */
+static void setNonblock(int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+
+	if(flags >= 0 && !(flags & O_NONBLOCK))
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* pump - move the bytes of direction d until it would block, then add
+ * what it waits for to the events of its sockets, fromEvents and toEvents.
+ * return -1 on error */
+static int pump(tunnelDir *d, int *fromEvents, int *toEvents) {
+	ssize_t n;
+
+	while(!d->done) {
+		if(d->inPipe > 0) {
+			n = splice(d->pipefd[0], NULL, d->to, NULL, d->inPipe,
+			           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if(n > 0) {
+				d->inPipe -= n;
+				d->moved += n;
+				continue;
+			}
+			if(n < 0 && errno == EAGAIN) {
+				*toEvents |= POLLOUT;
+				return 0;
+			}
+			if(n < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+		n = splice(d->from, NULL, d->pipefd[1], NULL, TUNNEL_CHUNK,
+		           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if(n > 0) {
+			d->inPipe = n;
+			continue;
+		}
+		if(n == 0) { //the source is done sending, so is the destination
+			shutdown(d->to, SHUT_WR);
+			d->done = 1;
+			return 0;
+		}
+		if(errno == EAGAIN) {
+			*fromEvents |= POLLIN;
+			return 0;
+		}
+		if(errno != EINTR)
+			return -1;
+	}
+	return 0;
+}
+
+/* tunnelRelay - relay bytes both ways between the client of clientrp and
+ * serverfd until both have closed their sending side, bytes the client 
+ * sent after its request first. up and down are set to the bytes moved to
+ * the server and to the client. return 0 if both closed, -1 on error or
+ * when silent for longer than the I/O timeout */
+int tunnelRelay(rio_t *clientrp, int serverfd, size_t *up, size_t *down) {
+	int clientfd = clientrp->rio_fd, clientEvents, serverEvents, rc = 0;
+	tunnelDir toServer = { clientfd, serverfd, { -1, -1 }, 0, 0, 0 };
+	tunnelDir toClient = { serverfd, clientfd, { -1, -1 }, 0, 0, 0 };
+
+	*up = *down = 0;
+	if(clientrp->rio_cnt > 0) {
+		if(rio_writen(serverfd, clientrp->rio_bufptr, clientrp->rio_cnt) !=
+		   clientrp->rio_cnt)
+			return -1;
+		toServer.moved = clientrp->rio_cnt;
+		clientrp->rio_bufptr += clientrp->rio_cnt;
+		clientrp->rio_cnt = 0;
+	}
+	if(pipe2(toServer.pipefd, O_CLOEXEC) < 0)
+		return -1;
+	if(pipe2(toClient.pipefd, O_CLOEXEC) < 0) {
+		close(toServer.pipefd[0]);
+		close(toServer.pipefd[1]);
+		return -1;
+	}
+	if(io_hooks == NULL) { //thread mode, waits are in wait_either only
+		setNonblock(clientfd);
+		setNonblock(serverfd);
+	}
+
+	while(!toServer.done || !toClient.done) {
+		clientEvents = serverEvents = 0;
+		if(pump(&toServer, &clientEvents, &serverEvents) < 0 ||
+		   pump(&toClient, &serverEvents, &clientEvents) < 0 ||
+		   ((clientEvents || serverEvents) && 
+		    wait_either(clientfd, clientEvents, serverfd, serverEvents) < 0)) {
+			rc = -1;
+			break;
+		}
+	}
+
+	close(toServer.pipefd[0]);
+	close(toServer.pipefd[1]);
+	close(toClient.pipefd[0]);
+	close(toClient.pipefd[1]);
+	*up = toServer.moved;
+	*down = toClient.moved;
+	return rc;
+}
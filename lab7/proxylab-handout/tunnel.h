@@ -0,0 +1,37 @@
+/******************************************************************************
+ * Proxy lab
+ * Min Xu
+ * andrewID: minxu
+ *
+ * This is the relay of CONNECT tunnels: once the proxy has connected to the
+ * server a client asked for, bytes are moved both ways between the two
+ * sockets, unseen, until both have closed their sending side. Each 
+ * direction goes through a pipe of its own with splice, so the bytes never
+ * enter user space, and a single task (or thread) drives both, waiting on
+ * whichever socket it needs next with wait_either.
+ *
+ * ***************************************************************************/
+
+#ifndef __TUNNEL_H__
+#define __TUNNEL_H__
+
+#include "csapp.h"
+
+#define TUNNEL_CHUNK 65536 //bytes per splice, default pipe size
+
+/* tunnelDir is struct for one direction of a tunnel. It has the socket the
+ * bytes come from and the one they go to, the pipe between them with the
+ * bytes in it, whether the source has closed and the bytes moved so far */
+typedef struct tunnelDir {
+	int from;
+	int to;
+	int pipefd[2];
+	size_t inPipe;
+	int done;
+	size_t moved;
+} tunnelDir;
+
+/* function prototypes for tunnel.c */
+int tunnelRelay(rio_t *clientrp, int serverfd, size_t *up, size_t *down);
+
+#endif /* __TUNNEL_H__ */